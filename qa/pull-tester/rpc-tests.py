@@ -120,6 +120,10 @@ testScripts = [
     'mempool_reorg.py',
     'mempool_limit.py',
     'httpbasics.py',
+    'rpcbatch.py',
+    'binrpc.py',
+    'httpeventloops.py',
+    'rest_range.py',
     'multi_rpc.py',
     'zapwallettxes.py',
     'proxy_test.py',
@@ -169,6 +173,7 @@ testScriptsExt = [
     'maxuploadtarget.py',
     'replace-by-fee.py',
     'p2p-feefilter.py',
+    'p2p-connstress.py',
     'pruning.py', # leave pruning last as it takes a REALLY long time
 ]
 
@@ -0,0 +1,132 @@
+#!/usr/bin/env python3
+# Copyright (c) 2016 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Test the binary RPC interface at /bin: blocks, transactions, UTXOs and
+# mempool entries in one batch, errors, and the time to pull every block
+# compared with getblock over JSON-RPC.
+#
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import *
+
+import http.client
+import struct
+import time
+import urllib.parse
+
+# P2SH(OP_TRUE), spendable with scriptSig 020151
+ADDRESS = "2ND8PB9RrfCaAcjfjP1Y6nAgFd9zWHYX4DN"
+NUM_BLOCKS = 110
+
+BINRPC_BLOCK = 1
+BINRPC_TX = 2
+BINRPC_UTXO = 3
+BINRPC_MEMPOOL_ENTRY = 4
+
+BINRPC_OK = 0
+BINRPC_NOT_FOUND = 1
+BINRPC_INVALID = 2
+
+def frame(payload):
+    return struct.pack("<I", len(payload)) + payload
+
+def hash_request(request_type, hash_hex):
+    return frame(bytes([request_type]) + hex_str_to_bytes(hash_hex)[::-1])
+
+def utxo_request(txid, n):
+    return frame(bytes([BINRPC_UTXO]) + hex_str_to_bytes(txid)[::-1] + struct.pack("<I", n))
+
+def parse_reply(data):
+    replies = []
+    pos = 0
+    while pos < len(data):
+        length = struct.unpack("<I", data[pos:pos + 4])[0]
+        payload = data[pos + 4:pos + 4 + length]
+        assert_equal(len(payload), length)
+        replies.append((payload[0], payload[1:]))
+        pos += 4 + length
+    return replies
+
+class BinaryRPCTest(BitcoinTestFramework):
+    def __init__(self):
+        super().__init__()
+        self.setup_clean_chain = True
+        self.num_nodes = 1
+
+    def setup_network(self, split=False):
+        self.nodes = start_nodes(self.num_nodes, self.options.tmpdir, [["-rpcbinary"]])
+        self.is_network_split = False
+
+    def post(self, body, method='POST', auth=True):
+        url = urllib.parse.urlparse(self.nodes[0].url)
+        headers = {}
+        if auth:
+            headers["Authorization"] = "Basic " + str_to_b64str(url.username + ':' + url.password)
+        conn = http.client.HTTPConnection(url.hostname, url.port)
+        conn.request(method, '/bin', body, headers)
+        response = conn.getresponse()
+        data = response.read()
+        conn.close()
+        return response.status, data
+
+    def run_test(self):
+        node = self.nodes[0]
+        hashes = node.generatetoaddress(NUM_BLOCKS, ADDRESS)
+
+        # Spend the first coinbase into the mempool
+        coinbase = node.getblock(hashes[0])["tx"][0]
+        rawtx = node.createrawtransaction([{"txid": coinbase, "vout": 0}], {ADDRESS: 49.999})
+        rawtx = rawtx[:82] + "020151" + rawtx[84:]
+        txid = node.sendrawtransaction(rawtx)
+
+        # Errors
+        assert_equal(self.post(b'', auth=False)[0], 401)
+        assert_equal(self.post(None, method='GET')[0], 405)
+        assert_equal(self.post(b'\x01\x00\x00\x00')[0], 400)
+        assert_equal(self.post(b''), (200, b''))
+
+        coinbase2 = node.getblock(hashes[1])["tx"][0]
+        body = hash_request(BINRPC_BLOCK, hashes[5])
+        body += hash_request(BINRPC_TX, coinbase2)
+        body += utxo_request(coinbase2, 0)
+        body += utxo_request(coinbase, 0)
+        body += hash_request(BINRPC_MEMPOOL_ENTRY, txid)
+        body += hash_request(BINRPC_TX, txid)
+        body += hash_request(BINRPC_BLOCK, "00" * 32)
+        body += frame(b'\x63')
+        status, data = self.post(body)
+        assert_equal(status, 200)
+        replies = parse_reply(data)
+        assert_equal(len(replies), 8)
+
+        assert_equal(replies[0], (BINRPC_OK, hex_str_to_bytes(node.getblock(hashes[5], False))))
+        assert_equal(replies[1], (BINRPC_OK, hex_str_to_bytes(node.getrawtransaction(coinbase2)) + hex_str_to_bytes(hashes[1])[::-1]))
+        # tx version, height, value
+        assert_equal(replies[2][0], BINRPC_OK)
+        assert_equal(struct.unpack("<IIq", replies[2][1][:16]), (1, 2, 50 * 100000000))
+        # spent in the mempool
+        assert_equal(replies[3], (BINRPC_NOT_FOUND, b''))
+        assert_equal(replies[4][0], BINRPC_OK)
+        tx = hex_str_to_bytes(rawtx)
+        assert_equal(replies[4][1][:len(tx)], tx)
+        assert_equal(struct.unpack("<qq", replies[4][1][len(tx):len(tx) + 16]), (100000, 100000))
+        assert_equal(replies[5], (BINRPC_OK, tx + b'\x00' * 32))
+        assert_equal(replies[6], (BINRPC_NOT_FOUND, b''))
+        assert_equal(replies[7], (BINRPC_INVALID, b''))
+
+        # Pull every block both ways
+        start = time.time()
+        raw = [node.getblock(h, False) for h in hashes]
+        elapsed_json = time.time() - start
+        start = time.time()
+        status, data = self.post(b''.join(hash_request(BINRPC_BLOCK, h) for h in hashes))
+        elapsed_bin = time.time() - start
+        assert_equal(status, 200)
+        assert_equal(parse_reply(data), [(BINRPC_OK, hex_str_to_bytes(r)) for r in raw])
+        print("%d blocks: %.1f ms over JSON-RPC, %.1f ms in one binary batch" % (len(hashes), elapsed_json * 1000, elapsed_bin * 1000))
+
+if __name__ == '__main__':
+    BinaryRPCTest().main()
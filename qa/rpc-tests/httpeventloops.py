@@ -0,0 +1,63 @@
+#!/usr/bin/env python3
+# Copyright (c) 2016 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Test the HTTP server with several event loops sharing the RPC port:
+# many keep-alive connections get their replies, and the node shuts down.
+#
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import *
+
+import http.client
+import urllib.parse
+
+# P2SH(OP_TRUE)
+ADDRESS = "2ND8PB9RrfCaAcjfjP1Y6nAgFd9zWHYX4DN"
+NUM_CONNECTIONS = 16
+NUM_ROUNDS = 5
+
+class HTTPEventLoopsTest(BitcoinTestFramework):
+    def __init__(self):
+        super().__init__()
+        self.setup_clean_chain = True
+        self.num_nodes = 1
+
+    def setup_network(self, split=False):
+        self.nodes = start_nodes(self.num_nodes, self.options.tmpdir, [["-rpceventloops=4", "-rest"]])
+        self.is_network_split = False
+
+    def run_test(self):
+        node = self.nodes[0]
+        node.generatetoaddress(3, ADDRESS)
+        besthash = node.getbestblockhash().encode()
+
+        url = urllib.parse.urlparse(node.url)
+        headers = {"Authorization": "Basic " + str_to_b64str(url.username + ':' + url.password)}
+        conns = [http.client.HTTPConnection(url.hostname, url.port) for i in range(NUM_CONNECTIONS)]
+        for conn in conns:
+            conn.connect()
+
+        # Interleave the requests so that every loop has connections waiting
+        for i in range(NUM_ROUNDS):
+            for conn in conns:
+                conn.request('POST', '/', '{"method": "getbestblockhash"}', headers)
+            for conn in conns:
+                out = conn.getresponse().read()
+                assert(b'"error":null' in out)
+                assert(besthash in out)
+                assert(conn.sock != None)
+
+        # REST replies on the same connections
+        for conn in conns:
+            conn.request('GET', '/rest/headers/3/%s.bin' % node.getblockhash(1))
+        for conn in conns:
+            response = conn.getresponse()
+            assert_equal(response.status, 200)
+            assert_equal(len(response.read()), 3 * 80)
+            conn.close()
+
+if __name__ == '__main__':
+    HTTPEventLoopsTest().main()
@@ -0,0 +1,139 @@
+#!/usr/bin/env python3
+# Copyright (c) 2016 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+from test_framework.mininode import *
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import *
+import resource
+import select
+import socket
+import struct
+import time
+
+'''
+Connection stress test for the socket handler.
+
+Opens thousands of loopback connections to a single node, completes the
+version handshake on all of them, then pings every peer and waits for all
+pongs. Reports wall-clock time and the CPU time the node spent, so that the
+select() and -socketepoll backends can be compared:
+
+    p2p-connstress.py --connections=3000
+    p2p-connstress.py --connections=900 --select
+
+The select() backend cannot serve more than FD_SETSIZE (usually 1024) sockets.
+'''
+
+MAGIC = b"\xfa\xbf\xb5\xda" # regtest
+PEER_VERSION = 70016 # HARDFORK_PROTO_VERSION
+
+def frame(message):
+    payload = message.serialize()
+    return (MAGIC + message.command + b"\x00" * (12 - len(message.command)) +
+            struct.pack("<I", len(payload)) + hash256(payload)[:4] + payload)
+
+class StressPeer(object):
+    def __init__(self, port):
+        self.sock = socket.create_connection(("127.0.0.1", port))
+        self.sock.setblocking(False)
+        self.recvbuf = b""
+        self.commands = set()
+        version = msg_version()
+        version.nVersion = PEER_VERSION
+        self.sendbuf = frame(version) + frame(msg_verack())
+
+    def flush(self):
+        if self.sendbuf:
+            try:
+                n = self.sock.send(self.sendbuf)
+                self.sendbuf = self.sendbuf[n:]
+            except BlockingIOError:
+                pass
+
+    def on_readable(self):
+        data = self.sock.recv(65536)
+        if not data:
+            raise AssertionError("peer disconnected by node")
+        self.recvbuf += data
+        while len(self.recvbuf) >= 24:
+            length = struct.unpack("<I", self.recvbuf[16:20])[0]
+            if len(self.recvbuf) < 24 + length:
+                break
+            self.commands.add(self.recvbuf[4:16].rstrip(b"\x00"))
+            self.recvbuf = self.recvbuf[24 + length:]
+
+class ConnStressTest(BitcoinTestFramework):
+
+    def add_options(self, parser):
+        parser.add_option("--connections", dest="connections", default=2000, type="int",
+                          help="number of loopback connections to open")
+        parser.add_option("--select", dest="use_select", default=False, action="store_true",
+                          help="use the select() socket handler instead of -socketepoll")
+
+    def __init__(self):
+        super().__init__()
+        self.setup_clean_chain = True
+        self.num_nodes = 1
+
+    def setup_network(self):
+        n = self.options.connections
+        soft, hard = resource.getrlimit(resource.RLIMIT_NOFILE)
+        wanted = n + 100
+        if soft < wanted:
+            resource.setrlimit(resource.RLIMIT_NOFILE, (min(wanted, hard), hard))
+        args = ["-maxconnections=%d" % (n + 50), "-socketepoll=%d" % (not self.options.use_select)]
+        self.nodes = [start_node(0, self.options.tmpdir, args)]
+
+    def node_cpu_seconds(self):
+        with open("/proc/%d/stat" % bitcoind_processes[0].pid) as f:
+            fields = f.read().rsplit(")", 1)[1].split()
+        return (int(fields[11]) + int(fields[12])) / os.sysconf("SC_CLK_TCK")
+
+    def pump(self, peers, done, timeout):
+        poller = select.poll()
+        byfd = {}
+        for peer in peers:
+            poller.register(peer.sock, select.POLLIN)
+            byfd[peer.sock.fileno()] = peer
+        deadline = time.time() + timeout
+        while not all(done(p) for p in peers):
+            assert time.time() < deadline, "timed out waiting for %d peers" % sum(1 for p in peers if not done(p))
+            for peer in peers:
+                peer.flush()
+            for fd, _ in poller.poll(100):
+                byfd[fd].on_readable()
+
+    def run_test(self):
+        n = self.options.connections
+        print("Opening %d connections (%s)" % (n, "select" if self.options.use_select else "epoll"))
+        cpu_start = self.node_cpu_seconds()
+        start = time.time()
+        peers = []
+        for i in range(n):
+            peers.append(StressPeer(p2p_port(0)))
+            # Don't overrun the listen backlog
+            if i % 100 == 99:
+                self.pump(peers, lambda p: b"verack" in p.commands, 60)
+        self.pump(peers, lambda p: b"verack" in p.commands, 60)
+        handshake = time.time() - start
+
+        assert wait_until(lambda: self.nodes[0].getconnectioncount() == n, timeout=60)
+        assert_equal(self.nodes[0].getconnectioncount(), n)
+
+        start = time.time()
+        for peer in peers:
+            peer.sendbuf += frame(msg_ping(nonce=1))
+        self.pump(peers, lambda p: b"pong" in p.commands, 60)
+        roundtrip = time.time() - start
+        cpu = self.node_cpu_seconds() - cpu_start
+
+        print("Handshakes: %.2fs, ping round: %.2fs, node CPU: %.2fs" % (handshake, roundtrip, cpu))
+
+        for peer in peers:
+            peer.sock.close()
+        assert wait_until(lambda: self.nodes[0].getconnectioncount() == 0, timeout=60)
+
+if __name__ == '__main__':
+    ConnStressTest().main()
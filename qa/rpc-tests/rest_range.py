@@ -0,0 +1,85 @@
+#!/usr/bin/env python3
+# Copyright (c) 2016 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Test the streamed REST range endpoints /rest/blockrange and
+# /rest/headerrange, and compare pulling the chain through them with
+# one getblock call per block.
+#
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import *
+
+import http.client
+import time
+import urllib.parse
+
+# P2SH(OP_TRUE)
+ADDRESS = "2ND8PB9RrfCaAcjfjP1Y6nAgFd9zWHYX4DN"
+NUM_BLOCKS = 300
+
+class RESTRangeTest(BitcoinTestFramework):
+    def __init__(self):
+        super().__init__()
+        self.setup_clean_chain = True
+        self.num_nodes = 1
+
+    def setup_network(self, split=False):
+        # One worker, so a stuck range request would block the ones after it
+        self.nodes = start_nodes(self.num_nodes, self.options.tmpdir, [["-rest", "-rpcthreads=1"]])
+        self.is_network_split = False
+
+    def get(self, path):
+        url = urllib.parse.urlparse(self.nodes[0].url)
+        conn = http.client.HTTPConnection(url.hostname, url.port)
+        conn.request('GET', path)
+        response = conn.getresponse()
+        data = response.read()
+        conn.close()
+        return response.status, data
+
+    def run_test(self):
+        node = self.nodes[0]
+        hashes = [node.getblockhash(0)] + node.generatetoaddress(NUM_BLOCKS, ADDRESS)
+        blocks = [hex_str_to_bytes(node.getblock(h, False)) for h in hashes]
+        headers = [hex_str_to_bytes(node.getblockheader(h, False)) for h in hashes]
+
+        # Whole chain, a middle part and a range past the tip
+        assert_equal(self.get('/rest/blockrange/0/%d.bin' % len(hashes)), (200, b''.join(blocks)))
+        assert_equal(self.get('/rest/blockrange/10/5.bin'), (200, b''.join(blocks[10:15])))
+        assert_equal(self.get('/rest/blockrange/250/1000000.bin'), (200, b''.join(blocks[250:])))
+        assert_equal(self.get('/rest/headerrange/0/%d.bin' % len(hashes)), (200, b''.join(headers)))
+        assert_equal(self.get('/rest/headerrange/299/2.bin'), (200, b''.join(headers[299:])))
+
+        # Errors
+        assert_equal(self.get('/rest/blockrange/%d/1.bin' % len(hashes))[0], 404)
+        assert_equal(self.get('/rest/headerrange/%d/1.bin' % len(hashes))[0], 404)
+        assert_equal(self.get('/rest/blockrange/0/1.json')[0], 404)
+        assert_equal(self.get('/rest/blockrange/0/0.bin')[0], 400)
+        assert_equal(self.get('/rest/blockrange/-1/1.bin')[0], 400)
+        assert_equal(self.get('/rest/headerrange/x/1.bin')[0], 400)
+        assert_equal(self.get('/rest/headerrange/1.bin')[0], 400)
+
+        # A client that goes away in the middle of a reply frees the worker
+        url = urllib.parse.urlparse(node.url)
+        conn = http.client.HTTPConnection(url.hostname, url.port)
+        conn.request('GET', '/rest/blockrange/0/%d.bin' % len(hashes))
+        conn.getresponse().read(100)
+        conn.close()
+        assert_equal(self.get('/rest/headerrange/0/1.bin'), (200, headers[0]))
+
+        # Pull every block both ways
+        start = time.time()
+        for h in hashes:
+            node.getblock(h, False)
+        elapsed_rpc = time.time() - start
+        start = time.time()
+        status, data = self.get('/rest/blockrange/0/%d.bin' % len(hashes))
+        elapsed_rest = time.time() - start
+        assert_equal(len(data), sum(len(b) for b in blocks))
+        print("%d blocks: %.1f ms over JSON-RPC, %.1f ms in one range request" % (len(hashes), elapsed_rpc * 1000, elapsed_rest * 1000))
+
+if __name__ == '__main__':
+    RESTRangeTest().main()
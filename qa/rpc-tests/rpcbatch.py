@@ -0,0 +1,94 @@
+#!/usr/bin/env python3
+# Copyright (c) 2016 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Test JSON-RPC batches: results come back in request order, calls that may
+# change state are not reordered around read-only ones, and time batches of
+# getblock calls at several -rpcbatchparallelism settings.
+#
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import *
+
+import http.client
+import json
+import time
+import urllib.parse
+
+ADDRESS = "mipcBbFg9gMiCh81Kj8tqqdgoZub1ZJRfn"
+NUM_BLOCKS = 200
+BENCH_ROUNDS = 5
+
+class RPCBatchTest(BitcoinTestFramework):
+    def __init__(self):
+        super().__init__()
+        self.setup_clean_chain = True
+        self.num_nodes = 1
+
+    def setup_network(self, split=False):
+        self.nodes = start_nodes(self.num_nodes, self.options.tmpdir, [["-rpcthreads=8", "-rpcworkqueue=64"]])
+        self.is_network_split = False
+
+    def batch(self, calls):
+        url = urllib.parse.urlparse(self.nodes[0].url)
+        authpair = url.username + ':' + url.password
+        headers = {"Authorization": "Basic " + str_to_b64str(authpair)}
+        body = json.dumps([{"method": method, "params": params, "id": i} for i, (method, params) in enumerate(calls)])
+        conn = http.client.HTTPConnection(url.hostname, url.port)
+        conn.request('POST', '/', body, headers)
+        response = conn.getresponse()
+        assert_equal(response.status, 200)
+        replies = json.loads(response.read().decode('utf-8'))
+        conn.close()
+        assert_equal([reply["id"] for reply in replies], list(range(len(calls))))
+        return replies
+
+    def run_test(self):
+        node = self.nodes[0]
+        hashes = node.generatetoaddress(NUM_BLOCKS, ADDRESS)
+
+        # Results of a run of read-only calls come back in order
+        replies = self.batch([("getblockhash", [h]) for h in range(1, NUM_BLOCKS + 1)])
+        assert_equal([reply["result"] for reply in replies], hashes)
+
+        # Calls that change state split the batch and see the calls before them
+        replies = self.batch([
+            ("getblockcount", []),
+            ("getblockhash", [NUM_BLOCKS]),
+            ("generatetoaddress", [1, ADDRESS]),
+            ("getblockcount", []),
+            ("getbestblockhash", []),
+            ("nosuchmethod", []),
+            ("getblockhash", [NUM_BLOCKS + 10]),
+            ("getblockcount", []),
+        ])
+        assert_equal(replies[0]["result"], NUM_BLOCKS)
+        assert_equal(replies[1]["result"], hashes[-1])
+        assert_equal(replies[3]["result"], NUM_BLOCKS + 1)
+        assert_equal(replies[4]["result"], replies[2]["result"][0])
+        assert_equal(replies[5]["error"]["code"], -32601)
+        assert_equal(replies[6]["error"]["code"], -8)
+        assert_equal(replies[7]["result"], NUM_BLOCKS + 1)
+
+        # Time batches of verbose getblock calls
+        calls = [("getblock", [h]) for h in hashes]
+        expected = None
+        for parallelism in [1, 2, 4, 8]:
+            stop_nodes(self.nodes)
+            wait_bitcoinds()
+            self.nodes = start_nodes(self.num_nodes, self.options.tmpdir,
+                [["-rpcthreads=8", "-rpcworkqueue=64", "-rpcbatchparallelism=%d" % parallelism]])
+            start = time.time()
+            for i in range(BENCH_ROUNDS):
+                replies = self.batch(calls)
+            elapsed = time.time() - start
+            print("-rpcbatchparallelism=%d: %.1f ms per batch of %d getblock" % (parallelism, elapsed * 1000 / BENCH_ROUNDS, len(calls)))
+            results = [reply["result"] for reply in replies]
+            if expected is None:
+                expected = results
+            assert_equal(results, expected)
+
+if __name__ == '__main__':
+    RPCBatchTest().main()
@@ -0,0 +1,70 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "arith_uint256.h"
+#include "blockencodings.h"
+#include "txmempool.h"
+
+/* Number of transactions in the mempool */
+static const unsigned int MEMPOOL_TXS = 100000;
+
+/* Number of transactions in the block, including the coinbase */
+static const unsigned int BLOCK_TXS = 4000;
+
+// A MEMPOOL_TXS transaction mempool and a block of BLOCK_TXS - 1 of them
+static void CreateMempoolAndBlock(CTxMemPool& pool, CBlock& block)
+{
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vout.resize(1);
+    block.vtx.push_back(coinbase);
+    block.nVersion = 4;
+    block.nBits = 0x207fffff;
+    for (unsigned int i = 0; i < MEMPOOL_TXS; i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout.hash = ArithToUint256(arith_uint256(i + 1));
+        tx.vin[0].prevout.n = 0;
+        tx.vout.resize(1);
+        tx.vout[0].nValue = i;
+        pool.addUnchecked(tx.GetHash(), CTxMemPoolEntry(tx, 1000, 0, 0, 1, true, 0, false, 4, LockPoints()));
+        if (i % (MEMPOOL_TXS / (BLOCK_TXS - 1)) == 0 && block.vtx.size() < BLOCK_TXS)
+            block.vtx.push_back(tx);
+    }
+    assert(block.vtx.size() == BLOCK_TXS);
+}
+
+// Reconstruct a block announced under a new short id key every time
+static void CompactBlockReconstruct(benchmark::State& state)
+{
+    CTxMemPool pool(CFeeRate(1000));
+    CBlock block;
+    CreateMempoolAndBlock(pool, block);
+    std::vector<CExtraTransaction> extra_txn;
+    while (state.KeepRunning()) {
+        CBlockHeaderAndShortTxIDs cmpctblock(block, true);
+        PartiallyDownloadedBlock partialBlock(&pool);
+        ReadStatus status = partialBlock.InitData(cmpctblock, extra_txn);
+        assert(status == READ_STATUS_OK && partialBlock.IsTxAvailable(BLOCK_TXS - 1));
+    }
+}
+
+// Reconstruct a block announced under the same short id key every time
+static void CompactBlockReconstructSameKey(benchmark::State& state)
+{
+    CTxMemPool pool(CFeeRate(1000));
+    CBlock block;
+    CreateMempoolAndBlock(pool, block);
+    std::vector<CExtraTransaction> extra_txn;
+    CBlockHeaderAndShortTxIDs cmpctblock(block, true);
+    while (state.KeepRunning()) {
+        PartiallyDownloadedBlock partialBlock(&pool);
+        ReadStatus status = partialBlock.InitData(cmpctblock, extra_txn);
+        assert(status == READ_STATUS_OK && partialBlock.IsTxAvailable(BLOCK_TXS - 1));
+    }
+}
+
+BENCHMARK(CompactBlockReconstruct);
+BENCHMARK(CompactBlockReconstructSameKey);
@@ -0,0 +1,212 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// Load generator for the HTTP server: keeps a number of keep-alive
+// connections busy with the same JSON-RPC call or REST request for a while,
+// then reports requests per second and the latency distribution.
+
+#include "chainparamsbase.h"
+#include "rpc/protocol.h"
+#include "util.h"
+#include "utilstrencodings.h"
+#include "utiltime.h"
+
+#include <algorithm>
+#include <stdio.h>
+#include <vector>
+
+#include <boost/thread.hpp>
+
+#include <event2/buffer.h>
+#include <event2/event.h>
+#include <event2/http.h>
+#include <event2/keyvalq_struct.h>
+
+static const char DEFAULT_LOAD_HOST[] = "127.0.0.1";
+static const int DEFAULT_LOAD_CONNECTIONS = 16;
+static const int DEFAULT_LOAD_THREADS = 1;
+static const int DEFAULT_LOAD_SECONDS = 10;
+static const char DEFAULT_LOAD_METHOD[] = "getblockcount";
+
+static std::string HelpMessageLoad()
+{
+    std::string strUsage;
+    strUsage += HelpMessageGroup("Options:");
+    strUsage += HelpMessageOpt("-?", "This help message");
+    AppendParamsHelpMessages(strUsage);
+    strUsage += HelpMessageOpt("-datadir=<dir>", "Data directory to read the auth cookie from, without -rpcpassword");
+    strUsage += HelpMessageOpt("-rpcconnect=<ip>", strprintf("Server to load (default: %s)", DEFAULT_LOAD_HOST));
+    strUsage += HelpMessageOpt("-rpcport=<port>", "Server port (default: the network's RPC port)");
+    strUsage += HelpMessageOpt("-rpcuser=<user>", "Username for JSON-RPC connections");
+    strUsage += HelpMessageOpt("-rpcpassword=<pw>", "Password for JSON-RPC connections");
+    strUsage += HelpMessageOpt("-connections=<n>", strprintf("Number of keep-alive connections, each with one request in flight (default: %d)", DEFAULT_LOAD_CONNECTIONS));
+    strUsage += HelpMessageOpt("-threads=<n>", strprintf("Number of client threads to spread the connections over (default: %d)", DEFAULT_LOAD_THREADS));
+    strUsage += HelpMessageOpt("-seconds=<n>", strprintf("Duration of the run (default: %d)", DEFAULT_LOAD_SECONDS));
+    strUsage += HelpMessageOpt("-method=<name>", strprintf("JSON-RPC method to call (default: %s)", DEFAULT_LOAD_METHOD));
+    strUsage += HelpMessageOpt("-params=<json>", "JSON array of parameters for the method (default: [])");
+    strUsage += HelpMessageOpt("-rest=<path>", "GET this REST path (e.g. /rest/chaininfo.json) instead of calling a method");
+    return strUsage;
+}
+
+struct LoadThread;
+
+/** A connection and the start time of its request in flight */
+struct LoadConnection
+{
+    LoadThread* thread;
+    struct evhttp_connection* evcon;
+    int64_t nStartMicros;
+};
+
+/** Connections served by one event loop, and their results */
+struct LoadThread
+{
+    struct event_base* base;
+    std::vector<LoadConnection> vConnections;
+    int nActive;
+    std::vector<int64_t> vLatencyMicros;
+    int nErrors;
+};
+
+static std::string strHost;
+static int nPort;
+static std::string strAuthHeader;
+static std::string strRESTPath;
+static std::string strRequestBody;
+static int64_t nDeadlineMicros;
+
+static void SendRequest(LoadConnection& conn);
+
+static void http_request_done(struct evhttp_request* req, void* ctx)
+{
+    LoadConnection& conn = *(LoadConnection*)ctx;
+    LoadThread& thread = *conn.thread;
+    int64_t nNow = GetTimeMicros();
+    if (req && evhttp_request_get_response_code(req) == HTTP_OK)
+        thread.vLatencyMicros.push_back(nNow - conn.nStartMicros);
+    else
+        thread.nErrors++;
+
+    if (nNow < nDeadlineMicros)
+        SendRequest(conn);
+    else if (--thread.nActive == 0)
+        event_base_loopexit(thread.base, NULL);
+}
+
+static void SendRequest(LoadConnection& conn)
+{
+    struct evhttp_request* req = evhttp_request_new(http_request_done, &conn);
+    assert(req);
+    struct evkeyvalq* headers = evhttp_request_get_output_headers(req);
+    evhttp_add_header(headers, "Host", strHost.c_str());
+    evhttp_add_header(headers, "Authorization", strAuthHeader.c_str());
+    conn.nStartMicros = GetTimeMicros();
+    int r;
+    if (strRESTPath.empty()) {
+        evbuffer_add(evhttp_request_get_output_buffer(req), strRequestBody.data(), strRequestBody.size());
+        r = evhttp_make_request(conn.evcon, req, EVHTTP_REQ_POST, "/");
+    } else {
+        r = evhttp_make_request(conn.evcon, req, EVHTTP_REQ_GET, strRESTPath.c_str());
+    }
+    if (r != 0) {
+        // The request was freed; count it and take the connection out
+        conn.thread->nErrors++;
+        if (--conn.thread->nActive == 0)
+            event_base_loopexit(conn.thread->base, NULL);
+    }
+}
+
+static void RunLoadThread(LoadThread* thread)
+{
+    for (size_t i = 0; i < thread->vConnections.size(); i++)
+        SendRequest(thread->vConnections[i]);
+    event_base_dispatch(thread->base);
+}
+
+static double Percentile(const std::vector<int64_t>& vSorted, double q)
+{
+    if (vSorted.empty())
+        return 0;
+    size_t n = std::min(vSorted.size() - 1, (size_t)(q * vSorted.size()));
+    return vSorted[n] / 1000.0;
+}
+
+int main(int argc, char* argv[])
+{
+    SetupEnvironment();
+    ParseParameters(argc, argv);
+    if (mapArgs.count("-?") || mapArgs.count("-h") || mapArgs.count("-help")) {
+        fprintf(stdout, "Usage: bench_httpload [options]\n\n%s", HelpMessageLoad().c_str());
+        return 0;
+    }
+    try {
+        SelectBaseParams(ChainNameFromCommandLine());
+    } catch (const std::exception& e) {
+        fprintf(stderr, "Error: %s\n", e.what());
+        return 1;
+    }
+
+    strHost = GetArg("-rpcconnect", DEFAULT_LOAD_HOST);
+    nPort = GetArg("-rpcport", BaseParams().RPCPort());
+    std::string strUserPass;
+    if (mapArgs["-rpcpassword"] == "") {
+        if (!GetAuthCookie(&strUserPass)) {
+            fprintf(stderr, "Error: no -rpcpassword given and no auth cookie found in the data directory\n");
+            return 1;
+        }
+    } else {
+        strUserPass = mapArgs["-rpcuser"] + ":" + mapArgs["-rpcpassword"];
+    }
+    strAuthHeader = "Basic " + EncodeBase64(strUserPass);
+    strRESTPath = GetArg("-rest", "");
+    strRequestBody = strprintf("{\"method\":\"%s\",\"params\":%s,\"id\":1}",
+                               GetArg("-method", DEFAULT_LOAD_METHOD), GetArg("-params", "[]"));
+
+    int nThreads = std::max(1, (int)GetArg("-threads", DEFAULT_LOAD_THREADS));
+    int nConnections = std::max(1, (int)GetArg("-connections", DEFAULT_LOAD_CONNECTIONS));
+    int nSeconds = std::max(1, (int)GetArg("-seconds", DEFAULT_LOAD_SECONDS));
+
+    std::vector<LoadThread> vThreads(nThreads);
+    for (int i = 0; i < nThreads; i++) {
+        LoadThread& thread = vThreads[i];
+        thread.base = event_base_new();
+        assert(thread.base);
+        thread.nErrors = 0;
+        thread.vConnections.resize(nConnections / nThreads + (i < nConnections % nThreads ? 1 : 0));
+        thread.nActive = thread.vConnections.size();
+        for (size_t j = 0; j < thread.vConnections.size(); j++) {
+            LoadConnection& conn = thread.vConnections[j];
+            conn.thread = &thread;
+            conn.evcon = evhttp_connection_base_new(thread.base, NULL, strHost.c_str(), nPort);
+            assert(conn.evcon);
+        }
+    }
+
+    int64_t nStart = GetTimeMicros();
+    nDeadlineMicros = nStart + nSeconds * 1000000LL;
+    boost::thread_group threadGroup;
+    for (int i = 0; i < nThreads; i++)
+        threadGroup.create_thread(boost::bind(&RunLoadThread, &vThreads[i]));
+    threadGroup.join_all();
+    double dElapsed = (GetTimeMicros() - nStart) / 1000000.0;
+
+    std::vector<int64_t> vLatency;
+    int nErrors = 0;
+    for (int i = 0; i < nThreads; i++) {
+        LoadThread& thread = vThreads[i];
+        vLatency.insert(vLatency.end(), thread.vLatencyMicros.begin(), thread.vLatencyMicros.end());
+        nErrors += thread.nErrors;
+        for (size_t j = 0; j < thread.vConnections.size(); j++)
+            evhttp_connection_free(thread.vConnections[j].evcon);
+        event_base_free(thread.base);
+    }
+    std::sort(vLatency.begin(), vLatency.end());
+
+    fprintf(stdout, "%u requests, %d errors in %.2f s over %d connections: %.0f requests/s\n",
+            (unsigned int)vLatency.size(), nErrors, dElapsed, nConnections, vLatency.size() / dElapsed);
+    fprintf(stdout, "latency ms: p50 %.3f, p90 %.3f, p99 %.3f, p99.9 %.3f, max %.3f\n",
+            Percentile(vLatency, 0.5), Percentile(vLatency, 0.9), Percentile(vLatency, 0.99),
+            Percentile(vLatency, 0.999), Percentile(vLatency, 1.0));
+    return nErrors ? 1 : 0;
+}
@@ -0,0 +1,76 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "chain.h"
+#include "chainparams.h"
+#include "primitives/block.h"
+#include "rpc/jsonwriter.h"
+#include "script/script.h"
+
+#include <boost/bind.hpp>
+
+#include <univalue.h>
+
+extern UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false);
+extern void blockToJSON(CJSONStreamWriter& writer, const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false);
+
+/* Number of transactions in the block, making it roughly 1 MB */
+static const unsigned int BLOCK_TXS = 4000;
+
+static void CreateBlock(CBlock& block)
+{
+    for (unsigned int i = 0; i < BLOCK_TXS; i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout.n = i;
+        tx.vin[0].scriptSig = CScript() << std::vector<unsigned char>(100, i);
+        tx.vout.resize(2);
+        tx.vout[0].scriptPubKey = CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, i) << OP_EQUALVERIFY << OP_CHECKSIG;
+        tx.vout[1].scriptPubKey = CScript() << OP_HASH160 << std::vector<unsigned char>(20, i) << OP_EQUAL;
+        block.vtx.push_back(tx);
+    }
+}
+
+static uint64_t nSinkBytes = 0;
+
+static void CountChunk(const std::string& strChunk)
+{
+    nSinkBytes += strChunk.size();
+}
+
+// A verbose block dump as REST /block/ sent it: the whole tree, then the whole text
+static void BlockToJSONTree(benchmark::State& state)
+{
+    SelectParams(CBaseChainParams::MAIN);
+    CBlock block;
+    CreateBlock(block);
+    CBlockIndex index(block);
+    uint256 hash = block.GetHash();
+    index.phashBlock = &hash;
+    while (state.KeepRunning()) {
+        std::string strJSON = blockToJSON(block, &index, true).write() + "\n";
+        CountChunk(strJSON);
+    }
+}
+
+// The same dump written in chunks as it is produced
+static void BlockToJSONStream(benchmark::State& state)
+{
+    SelectParams(CBaseChainParams::MAIN);
+    CBlock block;
+    CreateBlock(block);
+    CBlockIndex index(block);
+    uint256 hash = block.GetHash();
+    index.phashBlock = &hash;
+    while (state.KeepRunning()) {
+        CJSONStreamWriter writer(boost::bind(CountChunk, _1));
+        blockToJSON(writer, block, &index, true);
+        writer.Raw("\n");
+        writer.Flush();
+    }
+}
+
+BENCHMARK(BlockToJSONTree);
+BENCHMARK(BlockToJSONStream);
@@ -0,0 +1,137 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "chainparams.h"
+#include "net.h"
+#include "primitives/block.h"
+#include "protocol.h"
+#include "version.h"
+
+#ifndef WIN32
+#include <sys/socket.h>
+
+/* Number of peers a block is relayed to */
+static const int RELAY_PEERS = 8;
+
+/* Number of transactions in the block, making it roughly 1 MB */
+static const unsigned int BLOCK_TXS = 4000;
+
+struct RelayPeers
+{
+    std::vector<CNode*> vNodes;
+    std::vector<SOCKET> vRemote;
+
+    RelayPeers()
+    {
+        for (int i = 0; i < RELAY_PEERS; i++) {
+            int fds[2];
+            assert(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+            vNodes.push_back(new CNode(fds[0], CAddress(CService("127.0.0.1", 8333 + i), NODE_NONE), "", true));
+            vRemote.push_back(fds[1]);
+        }
+    }
+
+    ~RelayPeers()
+    {
+        BOOST_FOREACH(CNode* pnode, vNodes)
+            delete pnode;
+        BOOST_FOREACH(SOCKET hSocket, vRemote)
+            CloseSocket(hSocket);
+    }
+
+    // Throw away everything queued and delivered so each round starts empty
+    void Reset()
+    {
+        for (size_t i = 0; i < vNodes.size(); i++) {
+            {
+                LOCK(vNodes[i]->cs_vSend);
+                vNodes[i]->vSendMsg.clear();
+                vNodes[i]->nSendSize = 0;
+                vNodes[i]->nSendOffset = 0;
+            }
+            char buf[0x10000];
+            while (recv(vRemote[i], buf, sizeof(buf), MSG_DONTWAIT) > 0);
+        }
+    }
+};
+
+static void CreateBlock(CBlock& block)
+{
+    for (unsigned int i = 0; i < BLOCK_TXS; i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout.n = i;
+        tx.vin[0].scriptSig = CScript() << std::vector<unsigned char>(100, i);
+        tx.vout.resize(2);
+        tx.vout[0].scriptPubKey = CScript() << std::vector<unsigned char>(25, i);
+        tx.vout[1].scriptPubKey = CScript() << std::vector<unsigned char>(25, i);
+        block.vtx.push_back(tx);
+    }
+}
+
+// Relay a block the old way: serialized and checksummed once per peer
+static void RelayBlockPerPeer(benchmark::State& state)
+{
+    SelectParams(CBaseChainParams::MAIN);
+    CBlock block;
+    CreateBlock(block);
+    RelayPeers peers;
+    while (state.KeepRunning()) {
+        BOOST_FOREACH(CNode* pnode, peers.vNodes)
+            pnode->PushMessage(NetMsgType::BLOCK, block);
+        peers.Reset();
+    }
+}
+
+// Relay a block as one shared message queued to every peer
+static void RelayBlockShared(benchmark::State& state)
+{
+    SelectParams(CBaseChainParams::MAIN);
+    CBlock block;
+    CreateBlock(block);
+    RelayPeers peers;
+    while (state.KeepRunning()) {
+        CSendBuffer msg = CNode::MakeSharedMessage(PROTOCOL_VERSION, 0, NetMsgType::BLOCK, block);
+        BOOST_FOREACH(CNode* pnode, peers.vNodes)
+            pnode->PushSharedMessage(NetMsgType::BLOCK, msg);
+        peers.Reset();
+    }
+}
+
+// Parse a stream of transaction messages and one block, as read off a socket,
+// and hand the processed messages back as ProcessMessages does
+static void ReceiveMessages(benchmark::State& state)
+{
+    SelectParams(CBaseChainParams::MAIN);
+    CBlock block;
+    CreateBlock(block);
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    BOOST_FOREACH(const CTransaction& tx, block.vtx) {
+        CSendBuffer msg = CNode::MakeSharedMessage(PROTOCOL_VERSION, 0, NetMsgType::TX, tx);
+        stream.write(&(*msg)[0], msg->size());
+    }
+    CSendBuffer msg = CNode::MakeSharedMessage(PROTOCOL_VERSION, 0, NetMsgType::BLOCK, block);
+    stream.write(&(*msg)[0], msg->size());
+
+    CNode node(INVALID_SOCKET, CAddress(CService("127.0.0.1", 8333), NODE_NONE), "", true);
+    LOCK(node.cs_vRecvMsg);
+    while (state.KeepRunning()) {
+        for (size_t nPos = 0; nPos < stream.size(); nPos += 0x10000) {
+            unsigned int nBytes = std::min<size_t>(0x10000, stream.size() - nPos);
+            assert(node.ReceiveMsgBytes(&stream[nPos], nBytes));
+            // Process everything complete so far, like the message handler
+            std::deque<CNetMessage>::iterator it = node.vRecvMsg.begin();
+            while (it != node.vRecvMsg.end() && it->complete())
+                ++it;
+            node.ReleaseRecvMessages(it);
+        }
+        assert(node.vRecvMsg.empty());
+    }
+}
+
+BENCHMARK(RelayBlockPerPeer);
+BENCHMARK(RelayBlockShared);
+BENCHMARK(ReceiveMessages);
+#endif
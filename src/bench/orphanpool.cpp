@@ -0,0 +1,60 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "main.h"
+#include "orphanpool.h"
+#include "random.h"
+
+/* Orphans received per iteration, from this many peers */
+static const int CHURN_ORPHANS = 1000;
+static const int CHURN_PEERS = 8;
+
+// Orphans arriving from several peers into a full pool: each one is added,
+// expired entries are swept, the pool is trimmed back to its limits, a
+// parent arrives for some, and now and then a peer disconnects.
+static void OrphanPoolChurn(benchmark::State& state)
+{
+    std::vector<std::shared_ptr<const CTransaction> > vParents, vOrphans;
+    for (int i = 0; i < CHURN_ORPHANS; i++) {
+        CMutableTransaction parent;
+        parent.vin.resize(1);
+        parent.vin[0].prevout = COutPoint(GetRandHash(), 0);
+        parent.vout.resize(2);
+        vParents.push_back(std::make_shared<const CTransaction>(parent));
+
+        CMutableTransaction tx;
+        tx.vin.resize(2);
+        tx.vin[0].prevout = COutPoint(parent.GetHash(), i % 2);
+        tx.vin[1].prevout = COutPoint(GetRandHash(), 0);
+        tx.vin[0].scriptSig = CScript() << std::vector<unsigned char>(72, i) << std::vector<unsigned char>(33, i);
+        tx.vin[1].scriptSig = tx.vin[0].scriptSig;
+        tx.vout.resize(2);
+        tx.vout[0].scriptPubKey = CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, i) << OP_EQUALVERIFY << OP_CHECKSIG;
+        tx.vout[1].scriptPubKey = tx.vout[0].scriptPubKey;
+        vOrphans.push_back(std::make_shared<const CTransaction>(tx));
+    }
+
+    COrphanPool pool;
+    int64_t nTime = 0;
+    while (state.KeepRunning()) {
+        std::set<uint256> setWork;
+        for (int i = 0; i < CHURN_ORPHANS; i++) {
+            nTime++;
+            pool.Add(vOrphans[i], i % CHURN_PEERS, nTime + CHURN_ORPHANS / 2);
+            pool.Expire(nTime);
+            pool.LimitSize(DEFAULT_MAX_ORPHAN_TRANSACTIONS, DEFAULT_MAX_ORPHAN_POOL_SIZE * 1000000);
+            if (i % 4 == 0) {
+                pool.AddChildrenToWorkSet(*vParents[i], setWork);
+                BOOST_FOREACH(const uint256& hash, setWork)
+                    pool.Erase(hash);
+                setWork.clear();
+            }
+            if (i % 100 == 0)
+                pool.EraseForPeer(i / 100 % CHURN_PEERS);
+        }
+    }
+}
+
+BENCHMARK(OrphanPoolChurn);
@@ -0,0 +1,57 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "policy/fees.h"
+#include "txmempool.h"
+
+/* Number of transactions per block */
+static const unsigned int BLOCK_TXS = 10000;
+
+/* Height the first transactions entered the mempool at */
+static const unsigned int BASE_HEIGHT = 1000;
+
+// BLOCK_TXS fee-paying transactions with feerates spread over the fee
+// buckets, which entered the mempool over the last MAX_BLOCK_CONFIRMS blocks
+static void CreateEntries(std::vector<CTxMemPoolEntry>& entries)
+{
+    for (unsigned int i = 0; i < BLOCK_TXS; i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout.n = i;
+        tx.vout.resize(1);
+        tx.vout[0].nValue = 0;
+        CAmount nFee = 250 + (i * 7919) % 100000;
+        entries.push_back(CTxMemPoolEntry(tx, nFee, 0, 0, BASE_HEIGHT + i % MAX_BLOCK_CONFIRMS,
+                                          true, 0, false, 4, LockPoints()));
+    }
+}
+
+// Transactions entering and leaving the mempool
+static void PolicyEstimatorProcessTransaction(benchmark::State& state)
+{
+    CBlockPolicyEstimator estimator(CFeeRate(1000));
+    std::vector<CTxMemPoolEntry> entries;
+    CreateEntries(entries);
+    while (state.KeepRunning()) {
+        for (unsigned int i = 0; i < entries.size(); i++)
+            estimator.processTransaction(entries[i], true);
+        for (unsigned int i = 0; i < entries.size(); i++)
+            estimator.removeTx(entries[i].GetTx().GetHash());
+    }
+}
+
+// A block confirming all of the transactions
+static void PolicyEstimatorProcessBlock(benchmark::State& state)
+{
+    std::vector<CTxMemPoolEntry> entries;
+    CreateEntries(entries);
+    while (state.KeepRunning()) {
+        CBlockPolicyEstimator estimator(CFeeRate(1000));
+        estimator.processBlock(BASE_HEIGHT + MAX_BLOCK_CONFIRMS, entries, true);
+    }
+}
+
+BENCHMARK(PolicyEstimatorProcessTransaction);
+BENCHMARK(PolicyEstimatorProcessBlock);
@@ -0,0 +1,117 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "chain.h"
+#include "chainparams.h"
+#include "primitives/block.h"
+#include "random.h"
+#include "script/script.h"
+#include "streams.h"
+#include "utilstrencodings.h"
+#include "version.h"
+
+#include <univalue.h>
+
+extern UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false);
+
+/* Number of transactions in the block, making it roughly 1 MB */
+static const unsigned int BLOCK_TXS = 4000;
+
+static void CreateBlock(CBlock& block, unsigned int nTxs)
+{
+    block.nBits = 0x1d00ffff;
+    for (unsigned int i = 0; i < nTxs; i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout.n = i;
+        tx.vin[0].scriptSig = CScript() << std::vector<unsigned char>(100, i);
+        tx.vout.resize(2);
+        tx.vout[0].scriptPubKey = CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, i) << OP_EQUALVERIFY << OP_CHECKSIG;
+        tx.vout[1].scriptPubKey = CScript() << OP_HASH160 << std::vector<unsigned char>(20, i) << OP_EQUAL;
+        block.vtx.push_back(tx);
+    }
+}
+
+// Build the verbose description of a full block, as getblock and REST do
+static void JSONBuildBlock(benchmark::State& state)
+{
+    SelectParams(CBaseChainParams::MAIN);
+    CBlock block;
+    CreateBlock(block, BLOCK_TXS);
+    CBlockIndex index(block);
+    uint256 hash = block.GetHash();
+    index.phashBlock = &hash;
+    while (state.KeepRunning()) {
+        UniValue objBlock = blockToJSON(block, &index, true);
+        assert(objBlock["tx"].size() == BLOCK_TXS);
+    }
+}
+
+// Serialize the verbose description of a full block
+static void JSONWriteBlock(benchmark::State& state)
+{
+    SelectParams(CBaseChainParams::MAIN);
+    CBlock block;
+    CreateBlock(block, BLOCK_TXS);
+    CBlockIndex index(block);
+    uint256 hash = block.GetHash();
+    index.phashBlock = &hash;
+    UniValue objBlock = blockToJSON(block, &index, true);
+    while (state.KeepRunning()) {
+        std::string strJSON = objBlock.write();
+        assert(strJSON.size() > 1000000);
+    }
+}
+
+// Parse a 1 MB request carrying one long string: submitblock of a hex block
+static void JSONParseHexRequest(benchmark::State& state)
+{
+    CBlock block;
+    CreateBlock(block, BLOCK_TXS / 2);
+    CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
+    ssBlock << block;
+    std::string strRequest = "{\"method\":\"submitblock\",\"params\":[\"" + HexStr(ssBlock.begin(), ssBlock.end()) + "\"],\"id\":1}";
+    while (state.KeepRunning()) {
+        UniValue valRequest;
+        assert(valRequest.read(strRequest));
+    }
+}
+
+// Parse 1 MB of nested objects: the verbose description of a block
+static void JSONParseBlock(benchmark::State& state)
+{
+    SelectParams(CBaseChainParams::MAIN);
+    CBlock block;
+    CreateBlock(block, BLOCK_TXS / 5);
+    CBlockIndex index(block);
+    uint256 hash = block.GetHash();
+    index.phashBlock = &hash;
+    std::string strJSON = blockToJSON(block, &index, true).write();
+    while (state.KeepRunning()) {
+        UniValue objBlock;
+        assert(objBlock.read(strJSON));
+    }
+}
+
+// Look members up in an object with many keys, like a verbose mempool dump
+static void JSONFindKey(benchmark::State& state)
+{
+    UniValue obj(UniValue::VOBJ);
+    std::vector<std::string> vKeys;
+    for (int i = 0; i < 10000; i++) {
+        vKeys.push_back(GetRandHash().ToString());
+        obj.push_back(Pair(vKeys.back(), i));
+    }
+    while (state.KeepRunning()) {
+        for (int i = 0; i < 10000; i += 100)
+            assert(find_value(obj, vKeys[i]).get_int() == i);
+    }
+}
+
+BENCHMARK(JSONBuildBlock);
+BENCHMARK(JSONWriteBlock);
+BENCHMARK(JSONParseHexRequest);
+BENCHMARK(JSONParseBlock);
+BENCHMARK(JSONFindKey);
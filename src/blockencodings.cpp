@@ -3,6 +3,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "blockencodings.h"
+#include "bloom.h"
 #include "consensus/consensus.h"
 #include "consensus/validation.h"
 #include "chainparams.h"
@@ -13,19 +14,83 @@
 #include "main.h"
 #include "util.h"
 
+#include <list>
 #include <unordered_map>
 
 #define MIN_TRANSACTION_BASE_SIZE (::GetSerializeSize(CTransaction(), SER_NETWORK, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS))
 
-CBlockHeaderAndShortTxIDs::CBlockHeaderAndShortTxIDs(const CBlock& block, bool fUseWTXID) :
+namespace {
+
+/**
+ * Short ids of a prefix of a mempool's transaction hash log under one
+ * SipHash key, so that matching the same key again (the same compact block
+ * reconstructed twice) only hashes what was added to the log since.
+ */
+struct ShortIdCacheEntry
+{
+    const CTxMemPool* pool;
+    uint64_t k0, k1, nEpoch;
+    std::vector<uint64_t> shortids;
+};
+
+/** Number of SipHash keys short ids are kept for */
+const size_t MAX_SHORTID_CACHE_KEYS = 4;
+
+CCriticalSection cs_shortIdCache;
+std::list<ShortIdCacheEntry> listShortIdCache; //!< Most recently used first
+
+/** Remove and return the cached short ids for a key, or an empty entry for it */
+ShortIdCacheEntry TakeShortIdCache(const CTxMemPool* pool, uint64_t k0, uint64_t k1, uint64_t nEpoch)
+{
+    ShortIdCacheEntry ret;
+    LOCK(cs_shortIdCache);
+    for (std::list<ShortIdCacheEntry>::iterator it = listShortIdCache.begin(); it != listShortIdCache.end(); it++) {
+        if (it->pool == pool && it->k0 == k0 && it->k1 == k1) {
+            if (it->nEpoch == nEpoch)
+                ret = std::move(*it);
+            listShortIdCache.erase(it);
+            break;
+        }
+    }
+    ret.pool = pool;
+    ret.k0 = k0;
+    ret.k1 = k1;
+    ret.nEpoch = nEpoch;
+    return ret;
+}
+
+void ReturnShortIdCache(ShortIdCacheEntry&& entry)
+{
+    LOCK(cs_shortIdCache);
+    listShortIdCache.push_front(std::move(entry));
+    while (listShortIdCache.size() > MAX_SHORTID_CACHE_KEYS)
+        listShortIdCache.pop_back();
+}
+
+} // anon namespace
+
+CBlockHeaderAndShortTxIDs::CBlockHeaderAndShortTxIDs(const CBlock& block, bool fUseWTXID, const CRollingBloomFilter* pfilterKnown) :
         nonce(GetRand(std::numeric_limits<uint64_t>::max())),
-        shorttxids(block.vtx.size() - 1), prefilledtxn(1), header(block) {
+        header(block) {
     FillShortTxIDSelector();
-    //TODO: Use our mempool prior to block acceptance to predictively fill more than just the coinbase
-    prefilledtxn[0] = {0, block.vtx[0]};
+    // Besides the coinbase, prefill the transactions the peer has neither
+    // announced to us nor been sent an inv for, as it probably lacks them
+    prefilledtxn.push_back({0, block.vtx[0]});
+    shorttxids.reserve(block.vtx.size() - 1);
+    size_t nPrefilledSize = 0;
+    size_t nLastPrefilled = 0;
     for (size_t i = 1; i < block.vtx.size(); i++) {
         const CTransaction& tx = block.vtx[i];
-        shorttxids[i - 1] = GetShortID(fUseWTXID ? tx.GetWitnessHash() : tx.GetHash());
+        if (pfilterKnown && !pfilterKnown->contains(tx.GetHash())) {
+            size_t nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
+            if (nPrefilledSize + nTxSize <= MAX_CMPCTBLOCK_PREFILL_SIZE) {
+                nPrefilledSize += nTxSize;
+                prefilledtxn.push_back({(uint16_t)(i - nLastPrefilled - 1), tx});
+                nLastPrefilled = i;
+                continue;
+            }
+        }
+        shorttxids.push_back(GetShortID(fUseWTXID ? tx.GetWitnessHash() : tx.GetHash()));
     }
 }
 
@@ -47,7 +112,18 @@ uint64_t CBlockHeaderAndShortTxIDs::GetShortID(const uint256& txhash) const {
 
 
 
-ReadStatus PartiallyDownloadedBlock::InitData(const CBlockHeaderAndShortTxIDs& cmpctblock) {
+const char* GetExtraTxnSourceName(ExtraTxnSource source)
+{
+    switch (source) {
+    case EXTRA_TXN_ORPHAN: return "orphan";
+    case EXTRA_TXN_REPLACED: return "replaced";
+    case EXTRA_TXN_EVICTED: return "evicted";
+    case EXTRA_TXN_SOURCE_COUNT: break;
+    }
+    return "unknown";
+}
+
+ReadStatus PartiallyDownloadedBlock::InitData(const CBlockHeaderAndShortTxIDs& cmpctblock, const std::vector<CExtraTransaction>& extra_txn) {
     if (cmpctblock.header.IsNull() || (cmpctblock.shorttxids.empty() && cmpctblock.prefilledtxn.empty()))
         return READ_STATUS_INVALID;
     if (cmpctblock.shorttxids.size() + cmpctblock.prefilledtxn.size() > MAX_BLOCK_BASE_SIZE / MIN_TRANSACTION_BASE_SIZE)
@@ -104,21 +180,29 @@ ReadStatus PartiallyDownloadedBlock::InitData(const CBlockHeaderAndShortTxIDs& c
         return READ_STATUS_FAILED; // Short ID collision
 
     std::vector<bool> have_txn(txn_available.size());
-    LOCK(pool->cs);
-    const std::vector<std::pair<uint256, CTxMemPool::txiter> >& vTxHashes = pool->vTxHashes;
-    for (size_t i = 0; i < vTxHashes.size(); i++) {
-        uint64_t shortid = cmpctblock.GetShortID(vTxHashes[i].first);
-        std::unordered_map<uint64_t, uint16_t>::iterator idit = shorttxids.find(shortid);
+    // Match against a snapshot of the mempool's transaction hash log, which
+    // leaves the mempool unlocked, reusing any short ids already computed
+    // under this key
+    std::shared_ptr<const TxHashesSnapshot> snapshot = pool->GetTxHashesSnapshot();
+    ShortIdCacheEntry cache = TakeShortIdCache(pool, cmpctblock.shorttxidk0, cmpctblock.shorttxidk1, snapshot->nEpoch);
+    for (size_t i = 0; i < snapshot->nSize; i++) {
+        const TxHashesLogEntry& entry = (*snapshot)[i];
+        if (i == cache.shortids.size())
+            cache.shortids.push_back(cmpctblock.GetShortID(entry.wtxid));
+        std::unordered_map<uint64_t, uint16_t>::iterator idit = shorttxids.find(cache.shortids[i]);
         if (idit != shorttxids.end()) {
             if (!have_txn[idit->second]) {
-                txn_available[idit->second] = vTxHashes[i].second->GetSharedTx();
+                txn_available[idit->second] = entry.tx;
                 have_txn[idit->second]  = true;
                 mempool_count++;
             } else {
                 // If we find two mempool txn that match the short id, just request it.
                 // This should be rare enough that the extra bandwidth doesn't matter,
-                // but eating a round-trip due to FillBlock failure would be annoying
-                if (txn_available[idit->second]) {
+                // but eating a round-trip due to FillBlock failure would be annoying.
+                // The log holds a transaction twice if it left the mempool and came
+                // back, which is not a collision.
+                if (txn_available[idit->second] && txn_available[idit->second] != entry.tx &&
+                        txn_available[idit->second]->GetWitnessHash() != entry.wtxid) {
                     txn_available[idit->second].reset();
                     mempool_count--;
                 }
@@ -130,6 +214,36 @@ ReadStatus PartiallyDownloadedBlock::InitData(const CBlockHeaderAndShortTxIDs& c
         if (mempool_count == shorttxids.size())
             break;
     }
+    ReturnShortIdCache(std::move(cache));
+
+    // Then the transactions we hold outside the mempool. Slots they fill are
+    // remembered by source; a slot matched twice is left for the request.
+    std::vector<int> extra_source(txn_available.size(), -1);
+    for (size_t i = 0; i < extra_txn.size() && mempool_count < shorttxids.size(); i++) {
+        uint64_t shortid = cmpctblock.GetShortID(extra_txn[i].wtxid);
+        std::unordered_map<uint64_t, uint16_t>::iterator idit = shorttxids.find(shortid);
+        if (idit == shorttxids.end())
+            continue;
+        if (!have_txn[idit->second]) {
+            txn_available[idit->second] = extra_txn[i].tx;
+            have_txn[idit->second] = true;
+            extra_source[idit->second] = extra_txn[i].source;
+            mempool_count++;
+        } else if (txn_available[idit->second] &&
+                   txn_available[idit->second]->GetWitnessHash() != extra_txn[i].wtxid) {
+            // The same transaction in the mempool and in extra_txn is not a
+            // collision; two different ones matching the short id are
+            txn_available[idit->second].reset();
+            extra_source[idit->second] = -1;
+            mempool_count--;
+        }
+    }
+    for (size_t i = 0; i < extra_source.size(); i++) {
+        if (extra_source[i] >= 0) {
+            extra_source_count[extra_source[i]]++;
+            extra_count++;
+        }
+    }
 
     LogPrint("cmpctblock", "Initialized PartiallyDownloadedBlock for block %s using a cmpctblock of size %lu\n", cmpctblock.header.GetHash().ToString(), cmpctblock.GetSerializeSize(SER_NETWORK, PROTOCOL_VERSION));
 
@@ -170,7 +284,8 @@ ReadStatus PartiallyDownloadedBlock::FillBlock(CBlock& block, const std::vector<
         return READ_STATUS_CHECKBLOCK_FAILED;
     }
 
-    LogPrint("cmpctblock", "Successfully reconstructed block %s with %lu txn prefilled, %lu txn from mempool and %lu txn requested\n", header.GetHash().ToString(), prefilled_count, mempool_count, vtx_missing.size());
+    LogPrint("cmpctblock", "Successfully reconstructed block %s with %lu txn prefilled, %lu txn from mempool (incl %lu from extra pool: %lu orphan, %lu replaced, %lu evicted) and %lu txn requested\n", header.GetHash().ToString(),
+             prefilled_count, mempool_count, extra_count, extra_source_count[EXTRA_TXN_ORPHAN], extra_source_count[EXTRA_TXN_REPLACED], extra_source_count[EXTRA_TXN_EVICTED], vtx_missing.size());
     if (vtx_missing.size() < 5) {
         for(const CTransaction& tx : vtx_missing)
             LogPrint("cmpctblock", "Reconstructed block %s required tx %s\n", header.GetHash().ToString(), tx.GetHash().ToString());
@@ -9,8 +9,45 @@
 
 #include <memory>
 
+class CRollingBloomFilter;
 class CTxMemPool;
 
+/** Maximum total size of the transactions besides the coinbase prefilled in a compact block */
+static const size_t MAX_CMPCTBLOCK_PREFILL_SIZE = 10000;
+
+/** Where a transaction kept around for compact block reconstruction came from */
+enum ExtraTxnSource
+{
+    EXTRA_TXN_ORPHAN,   //!< Orphan transaction (missing inputs)
+    EXTRA_TXN_REPLACED, //!< Replaced in the mempool by a conflicting transaction
+    EXTRA_TXN_EVICTED,  //!< Evicted from the mempool when trimming it to size
+    EXTRA_TXN_SOURCE_COUNT
+};
+
+/** Return a short name for an ExtraTxnSource */
+const char* GetExtraTxnSourceName(ExtraTxnSource source);
+
+/** A transaction that is not in the mempool but may still show up in blocks */
+struct CExtraTransaction
+{
+    uint256 wtxid;
+    std::shared_ptr<const CTransaction> tx;
+    ExtraTxnSource source;
+
+    CExtraTransaction() : source(EXTRA_TXN_ORPHAN) {}
+    CExtraTransaction(const std::shared_ptr<const CTransaction>& txIn, ExtraTxnSource sourceIn) :
+        wtxid(txIn->GetWitnessHash()), tx(txIn), source(sourceIn) {}
+};
+
+/** Counters for the transactions kept around for compact block reconstruction */
+struct CExtraTxnStats
+{
+    size_t nCount;                             //!< Transactions currently held
+    size_t nMax;                               //!< Maximum number held
+    uint64_t nAdded[EXTRA_TXN_SOURCE_COUNT];   //!< Transactions added, by source
+    uint64_t nHits[EXTRA_TXN_SOURCE_COUNT];    //!< Block transactions found, by source
+};
+
 // Dumb helper to handle CTransaction compression at serialize-time
 struct TransactionCompressor {
 private:
@@ -148,7 +185,11 @@ public:
     // Dummy for deserialization
     CBlockHeaderAndShortTxIDs() {}
 
-    CBlockHeaderAndShortTxIDs(const CBlock& block, bool fUseWTXID);
+    /**
+     * If pfilterKnown is set, the transactions not in it are prefilled, up
+     * to MAX_CMPCTBLOCK_PREFILL_SIZE, as the peer is unlikely to have them.
+     */
+    CBlockHeaderAndShortTxIDs(const CBlock& block, bool fUseWTXID, const CRollingBloomFilter* pfilterKnown = NULL);
 
     uint64_t GetShortID(const uint256& txhash) const;
 
@@ -194,14 +235,22 @@ public:
 class PartiallyDownloadedBlock {
 protected:
     std::vector<std::shared_ptr<const CTransaction> > txn_available;
-    size_t prefilled_count = 0, mempool_count = 0;
+    size_t prefilled_count = 0, mempool_count = 0, extra_count = 0;
+    size_t extra_source_count[EXTRA_TXN_SOURCE_COUNT] = {};
     CTxMemPool* pool;
 public:
     CBlockHeader header;
     PartiallyDownloadedBlock(CTxMemPool* poolIn) : pool(poolIn) {}
 
-    ReadStatus InitData(const CBlockHeaderAndShortTxIDs& cmpctblock);
+    /**
+     * Fill in what we can from the prefilled transactions, the mempool and
+     * extra_txn, transactions we hold outside the mempool (orphans, recently
+     * replaced or evicted ones) which would otherwise have to be requested.
+     */
+    ReadStatus InitData(const CBlockHeaderAndShortTxIDs& cmpctblock, const std::vector<CExtraTransaction>& extra_txn);
     bool IsTxAvailable(size_t index) const;
+    /** Number of transactions InitData took from extra_txn with the given source */
+    size_t GetExtraCount(ExtraTxnSource source) const { return extra_source_count[source]; }
     ReadStatus FillBlock(CBlock& block, const std::vector<CTransaction>& vtx_missing) const;
 };
 
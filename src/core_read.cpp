@@ -90,15 +90,32 @@ CScript ParseScript(const std::string& s)
     return result;
 }
 
-bool DecodeHexTx(CTransaction& tx, const std::string& strHexTx, bool fTryNoWitness)
+/**
+ * Decode the hex string str straight into ss, checking it like IsHex does.
+ * This saves the intermediate vector of ParseHex, and the copy of it the
+ * stream would make, for transactions and blocks of megabytes.
+ */
+static bool DecodeHexStream(const std::string& str, CDataStream& ss)
 {
-    if (!IsHex(strHexTx))
+    if (str.empty() || str.size() % 2 != 0)
         return false;
+    ss.resize(str.size() / 2);
+    for (size_t i = 0; i < ss.size(); i++) {
+        signed char hi = HexDigit(str[2 * i]);
+        signed char lo = HexDigit(str[2 * i + 1]);
+        if (hi < 0 || lo < 0)
+            return false;
+        ss[i] = (hi << 4) | lo;
+    }
+    return true;
+}
 
-    vector<unsigned char> txData(ParseHex(strHexTx));
-
+bool DecodeHexTx(CTransaction& tx, const std::string& strHexTx, bool fTryNoWitness)
+{
     if (fTryNoWitness) {
-        CDataStream ssData(txData, SER_NETWORK, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS);
+        CDataStream ssData(SER_NETWORK, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS);
+        if (!DecodeHexStream(strHexTx, ssData))
+            return false;
         try {
             ssData >> tx;
             if (ssData.eof()) {
@@ -110,7 +127,10 @@ bool DecodeHexTx(CTransaction& tx, const std::string& strHexTx, bool fTryNoWitne
         }
     }
 
-    CDataStream ssData(txData, SER_NETWORK, PROTOCOL_VERSION);
+    // Decoded again rather than kept around, as the first attempt usually succeeds
+    CDataStream ssData(SER_NETWORK, PROTOCOL_VERSION);
+    if (!DecodeHexStream(strHexTx, ssData))
+        return false;
     try {
         ssData >> tx;
     }
@@ -123,11 +143,9 @@ bool DecodeHexTx(CTransaction& tx, const std::string& strHexTx, bool fTryNoWitne
 
 bool DecodeHexBlk(CBlock& block, const std::string& strHexBlk)
 {
-    if (!IsHex(strHexBlk))
+    CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
+    if (!DecodeHexStream(strHexBlk, ssBlock))
         return false;
-
-    std::vector<unsigned char> blockData(ParseHex(strHexBlk));
-    CDataStream ssBlock(blockData, SER_NETWORK, PROTOCOL_VERSION);
     try {
         ssBlock >> block;
     }
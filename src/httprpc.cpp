@@ -7,6 +7,8 @@
 #include "base58.h"
 #include "chainparams.h"
 #include "httpserver.h"
+#include "rpc/binary.h"
+#include "rpc/jsonwriter.h"
 #include "rpc/protocol.h"
 #include "rpc/server.h"
 #include "random.h"
@@ -14,6 +16,7 @@
 #include "util.h"
 #include "utilstrencodings.h"
 #include "ui_interface.h"
+#include "version.h"
 #include "crypto/hmac_sha256.h"
 #include <stdio.h>
 #include "utilstrencodings.h"
@@ -144,14 +147,49 @@ static bool RPCAuthorized(const std::string& strAuth)
     return multiUserAuthorized(strUserPass);
 }
 
-static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
+static void JSONRPCWriteChunk(HTTPRequest* req, const std::string& strChunk)
 {
-    // JSONRPC handles only POST
-    if (req->GetRequestMethod() != HTTPRequest::POST) {
-        req->WriteReply(HTTP_BAD_METHOD, "JSONRPC server handles only POST requests");
-        return false;
+    if (!req->ReplyStarted())
+        req->WriteHeader("Content-Type", "application/json");
+    req->WriteReplyChunk(strChunk);
+}
+
+/**
+ * Execute a singleton request through the streaming version of its method,
+ * sending the reply in chunks as it is produced. Returns false, having sent
+ * nothing, if the method has no streaming version for these params.
+ */
+static bool JSONRPCExecStream(HTTPRequest* req, const JSONRequest& jreq)
+{
+    CJSONStreamWriter writer(boost::bind(JSONRPCWriteChunk, req, _1));
+    try {
+        // Same members as JSONRPCReplyObj
+        writer.BeginObject();
+        writer.Key("result");
+        if (!tableRPC.executeStream(jreq.strMethod, jreq.params, writer))
+            return false;
+        writer.Key("error");
+        writer.Value(NullUniValue);
+        writer.Key("id");
+        writer.Value(jreq.id);
+        writer.EndObject();
+        writer.Raw("\n");
+        writer.Flush();
+    } catch (...) {
+        if (!req->ReplyStarted())
+            throw;
+        // Too late for an error reply, so end the body short of valid JSON
+        LogPrintf("%s: %s failed after sending %u bytes\n", __func__, jreq.strMethod, writer.GetBytesWritten());
+        req->EndReply();
+        return true;
     }
-    // Check authorization
+    req->EndReply();
+    return true;
+}
+
+/** Check the credentials of a request, replying to it if they are missing or wrong */
+static bool CheckAuthorization(HTTPRequest* req)
+{
     std::pair<bool, std::string> authHeader = req->GetHeader("authorization");
     if (!authHeader.first) {
         req->WriteHeader("WWW-Authenticate", WWW_AUTH_HEADER_DATA);
@@ -171,6 +209,18 @@ static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
         req->WriteReply(HTTP_UNAUTHORIZED);
         return false;
     }
+    return true;
+}
+
+static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
+{
+    // JSONRPC handles only POST
+    if (req->GetRequestMethod() != HTTPRequest::POST) {
+        req->WriteReply(HTTP_BAD_METHOD, "JSONRPC server handles only POST requests");
+        return false;
+    }
+    if (!CheckAuthorization(req))
+        return false;
 
     JSONRequest jreq;
     try {
@@ -184,6 +234,9 @@ static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
         if (valRequest.isObject()) {
             jreq.parse(valRequest);
 
+            if (JSONRPCExecStream(req, jreq))
+                return true;
+
             UniValue result = tableRPC.execute(jreq.strMethod, jreq.params);
 
             // Send reply
@@ -207,6 +260,45 @@ static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
     return true;
 }
 
+static bool HTTPReq_BinaryRPC(HTTPRequest* req, const std::string &)
+{
+    if (req->GetRequestMethod() != HTTPRequest::POST) {
+        req->WriteReply(HTTP_BAD_METHOD, "Binary RPC server handles only POST requests");
+        return false;
+    }
+    if (!CheckAuthorization(req))
+        return false;
+    std::string strStatus;
+    if (RPCIsInWarmup(&strStatus)) {
+        req->WriteReply(HTTP_SERVICE_UNAVAILABLE, "Service temporarily unavailable: " + strStatus);
+        return false;
+    }
+
+    std::vector<std::string> vRequests;
+    if (!ParseBinaryRPCRequests(req->ReadBody(), vRequests)) {
+        req->WriteReply(HTTP_BAD_REQUEST, "Truncated binary RPC request");
+        return false;
+    }
+
+    // Replies to large batches go out in chunks as they are produced
+    req->WriteHeader("Content-Type", "application/octet-stream");
+    CDataStream reply(SER_NETWORK, PROTOCOL_VERSION);
+    BOOST_FOREACH(const std::string& strRequest, vRequests) {
+        ExecBinaryRPCRequest(strRequest, reply);
+        if (reply.size() >= BINRPC_CHUNK_SIZE) {
+            req->WriteReplyChunk(reply.str());
+            reply.clear();
+        }
+    }
+    if (!req->ReplyStarted()) {
+        req->WriteReply(HTTP_OK, reply.str());
+        return true;
+    }
+    req->WriteReplyChunk(reply.str());
+    req->EndReply();
+    return true;
+}
+
 static bool InitRPCAuthentication()
 {
     if (mapArgs["-rpcpassword"] == "")
@@ -232,10 +324,13 @@ bool StartHTTPRPC()
         return false;
 
     RegisterHTTPHandler("/", true, HTTPReq_JSONRPC);
+    if (GetBoolArg("-rpcbinary", DEFAULT_BINARY_RPC_ENABLE))
+        RegisterHTTPHandler("/bin", true, HTTPReq_BinaryRPC);
 
     assert(EventBase());
     httpRPCTimerInterface = new HTTPRPCTimerInterface(EventBase());
     RPCSetTimerInterface(httpRPCTimerInterface);
+    RPCSetBatchWorkQueue(&HTTPQueueWork);
     return true;
 }
 
@@ -248,6 +343,7 @@ void StopHTTPRPC()
 {
     LogPrint("rpc", "Stopping HTTP RPC server\n");
     UnregisterHTTPHandler("/", true);
+    UnregisterHTTPHandler("/bin", true);
     if (httpRPCTimerInterface) {
         RPCUnsetTimerInterface(httpRPCTimerInterface);
         delete httpRPCTimerInterface;
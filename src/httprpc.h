@@ -10,6 +10,9 @@
 
 class HTTPRequest;
 
+/** Whether the binary RPC interface at /bin is enabled by default */
+static const bool DEFAULT_BINARY_RPC_ENABLE = false;
+
 /** Start HTTP RPC subsystem.
  * Precondition; HTTP and RPC has been started.
  */
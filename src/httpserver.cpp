@@ -60,6 +60,22 @@ private:
     HTTPRequestHandler func;
 };
 
+/** Work item for a function queued with HTTPQueueWork */
+class HTTPTaskItem : public HTTPClosure
+{
+public:
+    HTTPTaskItem(const boost::function<void()>& func): func(func)
+    {
+    }
+    void operator()()
+    {
+        func();
+    }
+
+private:
+    boost::function<void()> func;
+};
+
 /** Simple work queue for distributing work over multiple threads.
  * Work items are simply callable objects.
  */
@@ -74,6 +90,8 @@ private:
     bool running;
     size_t maxDepth;
     int numThreads;
+    //! Worker threads waiting for an item; nobody needs a wakeup if zero
+    int numWaiting;
 
     /** RAII object to keep track of number of running worker threads */
     class ThreadCounter
@@ -96,7 +114,8 @@ private:
 public:
     WorkQueue(size_t maxDepth) : running(true),
                                  maxDepth(maxDepth),
-                                 numThreads(0)
+                                 numThreads(0),
+                                 numWaiting(0)
     {
     }
     /** Precondition: worker threads have all stopped
@@ -105,17 +124,33 @@ public:
     ~WorkQueue()
     {
     }
-    /** Enqueue a work item */
-    bool Enqueue(WorkItem* item)
+    /** Enqueue a work item if the queue holds fewer than limit items */
+    bool EnqueueLimit(WorkItem* item, size_t limit)
     {
-        boost::unique_lock<boost::mutex> lock(cs);
-        if (queue.size() >= maxDepth) {
-            return false;
+        bool wake;
+        {
+            boost::unique_lock<boost::mutex> lock(cs);
+            if (queue.size() >= limit) {
+                return false;
+            }
+            queue.emplace_back(std::unique_ptr<WorkItem>(item));
+            wake = numWaiting > 0;
         }
-        queue.emplace_back(std::unique_ptr<WorkItem>(item));
-        cond.notify_one();
+        // Notify after unlocking, so the woken worker does not block on cs
+        if (wake)
+            cond.notify_one();
         return true;
     }
+    /** Enqueue a work item */
+    bool Enqueue(WorkItem* item)
+    {
+        return EnqueueLimit(item, maxDepth);
+    }
+    /** Enqueue a work item if the queue is at most half full */
+    bool EnqueueSpare(WorkItem* item)
+    {
+        return EnqueueLimit(item, maxDepth / 2);
+    }
     /** Thread function */
     void Run()
     {
@@ -124,8 +159,11 @@ public:
             std::unique_ptr<WorkItem> i;
             {
                 boost::unique_lock<boost::mutex> lock(cs);
-                while (running && queue.empty())
+                while (running && queue.empty()) {
+                    numWaiting++;
                     cond.wait(lock);
+                    numWaiting--;
+                }
                 if (!running)
                     break;
                 i = std::move(queue.front());
@@ -169,20 +207,110 @@ struct HTTPPathHandler
     HTTPRequestHandler handler;
 };
 
+/** An event loop thread with its own evhttp server and listening sockets.
+ * Worker threads hand replies back through a queue that one persistent event
+ * drains, so a burst of replies costs a single wakeup of the loop and no
+ * event allocations, and they are sent in the order they were posted.
+ */
+class HTTPEventLoop
+{
+public:
+    struct event_base* base;
+    struct evhttp* http;
+    std::vector<evhttp_bound_socket*> boundSockets;
+    boost::thread thread;
+
+    HTTPEventLoop() : base(0), http(0), evPending(0) {}
+    ~HTTPEventLoop()
+    {
+        if (evPending)
+            event_free(evPending);
+        if (http)
+            evhttp_free(http);
+        if (base)
+            event_base_free(base);
+    }
+
+    /** Create the event base and evhttp server; false on failure */
+    bool Init();
+
+    /** Run func on the loop thread, after everything posted before it */
+    void Post(const boost::function<void()>& func)
+    {
+        bool wake;
+        {
+            boost::lock_guard<boost::mutex> lock(cs);
+            wake = vPending.empty();
+            vPending.push_back(func);
+        }
+        // A non-empty queue already has the event activated
+        if (wake)
+            event_active(evPending, 0, 0);
+    }
+
+private:
+    boost::mutex cs;
+    std::vector<boost::function<void()> > vPending;
+    struct event* evPending;
+
+    static void pending_cb(evutil_socket_t, short, void* data)
+    {
+        HTTPEventLoop* self = (HTTPEventLoop*)data;
+        std::vector<boost::function<void()> > vRun;
+        {
+            boost::lock_guard<boost::mutex> lock(self->cs);
+            vRun.swap(self->vPending);
+        }
+        for (size_t i = 0; i < vRun.size(); i++)
+            vRun[i]();
+    }
+};
+
+/** How much of a chunked reply was sent, shared between the worker writing
+ * it and the event loop sending it.
+ */
+class HTTPReplyProgress
+{
+public:
+    boost::mutex cs;
+    boost::condition_variable cond;
+    //! Bytes handed to libevent; only used by the event loop
+    uint64_t nHanded;
+    //! Bytes written to the connection
+    uint64_t nSent;
+    //! The connection was closed
+    bool fClosed;
+
+    HTTPReplyProgress() : nHanded(0), nSent(0), fClosed(false) {}
+
+    void Sent(uint64_t n)
+    {
+        boost::lock_guard<boost::mutex> lock(cs);
+        nSent = n;
+        cond.notify_all();
+    }
+    void Closed()
+    {
+        boost::lock_guard<boost::mutex> lock(cs);
+        fClosed = true;
+        cond.notify_all();
+    }
+};
+
 /** HTTP module state */
 
-//! libevent event loop
-static struct event_base* eventBase = 0;
-//! HTTP server
-struct evhttp* eventHTTP = 0;
+//! libevent event loops, each with its own evhttp server
+static std::vector<HTTPEventLoop*> eventLoops;
 //! List of subnets to allow RPC connections from
 static std::vector<CSubNet> rpc_allow_subnets;
 //! Work queue for handling longer requests off the event loop thread
 static WorkQueue<HTTPClosure>* workQueue = 0;
 //! Handlers for (sub)paths
 std::vector<HTTPPathHandler> pathHandlers;
-//! Bound listening sockets
-std::vector<evhttp_bound_socket *> boundSockets;
+//! Set by InterruptHTTPServer, so that streamed replies stop waiting for their clients
+static std::atomic<bool> fHTTPInterrupted(false);
+//! Seconds a streamed reply waits for a client that does not read
+static int64_t nHTTPServerTimeout = DEFAULT_HTTP_SERVER_TIMEOUT;
 
 /** Check if a network address is allowed to access the HTTP server */
 static bool ClientAllowed(const CNetAddr& netaddr)
@@ -245,7 +373,7 @@ static std::string RequestMethodString(HTTPRequest::RequestMethod m)
 /** HTTP request callback */
 static void http_request_cb(struct evhttp_request* req, void* arg)
 {
-    std::unique_ptr<HTTPRequest> hreq(new HTTPRequest(req));
+    std::unique_ptr<HTTPRequest> hreq(new HTTPRequest(req, (HTTPEventLoop*)arg));
 
     LogPrint("http", "Received a %s request for %s from %s\n",
              RequestMethodString(hreq->GetRequestMethod()), hreq->GetURI(), hreq->GetPeer().ToString());
@@ -301,18 +429,80 @@ static void http_reject_request_cb(struct evhttp_request* req, void*)
     evhttp_send_error(req, HTTP_SERVUNAVAIL, NULL);
 }
 
+bool HTTPEventLoop::Init()
+{
+    base = event_base_new();
+    if (!base) {
+        LogPrintf("Couldn't create an event_base: exiting\n");
+        return false;
+    }
+
+    /* Create a new evhttp object to handle requests. */
+    http = evhttp_new(base);
+    if (!http) {
+        LogPrintf("couldn't create evhttp. Exiting.\n");
+        return false;
+    }
+
+    evhttp_set_timeout(http, nHTTPServerTimeout);
+    evhttp_set_max_headers_size(http, MAX_HEADERS_SIZE);
+    evhttp_set_max_body_size(http, MAX_SIZE);
+    evhttp_set_gencb(http, http_request_cb, this);
+
+    evPending = event_new(base, -1, 0, pending_cb, this);
+    assert(evPending);
+    return true;
+}
+
 /** Event dispatcher thread */
-static void ThreadHTTP(struct event_base* base, struct evhttp* http)
+static void ThreadHTTP(HTTPEventLoop* loop)
 {
     RenameThread("bitcoin-http");
     LogPrint("http", "Entering http event loop\n");
-    event_base_dispatch(base);
+    event_base_dispatch(loop->base);
     // Event loop will be interrupted by InterruptHTTPServer()
     LogPrint("http", "Exited http event loop\n");
 }
 
-/** Bind HTTP server to specified addresses */
-static bool HTTPBindAddresses(struct evhttp* http)
+#ifdef SO_REUSEPORT
+/** Bind a listening socket that the other event loops bind to the same
+ * address as well; the kernel spreads incoming connections over them.
+ */
+static evhttp_bound_socket* HTTPBindReusePort(struct evhttp* http, const std::string& host, uint16_t port)
+{
+    struct evutil_addrinfo hints;
+    struct evutil_addrinfo* ai = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = EVUTIL_AI_PASSIVE;
+    if (evutil_getaddrinfo(host.empty() ? NULL : host.c_str(), strprintf("%u", port).c_str(), &hints, &ai) != 0 || !ai)
+        return NULL;
+
+    int on = 1;
+    evutil_socket_t fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    // Keep "::" from taking the IPv4 port as well, as every loop binds "0.0.0.0" next to it
+    bool fListening = fd >= 0 &&
+        evutil_make_socket_nonblocking(fd) == 0 &&
+        evutil_make_socket_closeonexec(fd) == 0 &&
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (const char*)&on, sizeof(on)) == 0 &&
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, (const char*)&on, sizeof(on)) == 0 &&
+        (ai->ai_family != AF_INET6 || setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, (const char*)&on, sizeof(on)) == 0) &&
+        bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 &&
+        listen(fd, 128) == 0;
+    evutil_freeaddrinfo(ai);
+
+    evhttp_bound_socket* bind_handle = NULL;
+    if (fListening)
+        bind_handle = evhttp_accept_socket_with_handle(http, fd); // takes ownership of fd
+    if (!bind_handle && fd >= 0)
+        evutil_closesocket(fd);
+    return bind_handle;
+}
+#endif
+
+/** Bind the HTTP servers of all event loops to specified addresses */
+static bool HTTPBindAddresses()
 {
     int defaultPort = GetArg("-rpcport", BaseParams().RPCPort());
     std::vector<std::pair<std::string, uint16_t> > endpoints;
@@ -338,16 +528,26 @@ static bool HTTPBindAddresses(struct evhttp* http)
     }
 
     // Bind addresses
+    bool fBound = false;
     for (std::vector<std::pair<std::string, uint16_t> >::iterator i = endpoints.begin(); i != endpoints.end(); ++i) {
         LogPrint("http", "Binding RPC on address %s port %i\n", i->first, i->second);
-        evhttp_bound_socket *bind_handle = evhttp_bind_socket_with_handle(http, i->first.empty() ? NULL : i->first.c_str(), i->second);
-        if (bind_handle) {
-            boundSockets.push_back(bind_handle);
-        } else {
-            LogPrintf("Binding RPC on address %s port %i failed.\n", i->first, i->second);
+        BOOST_FOREACH (HTTPEventLoop* loop, eventLoops) {
+            evhttp_bound_socket *bind_handle;
+#ifdef SO_REUSEPORT
+            if (eventLoops.size() > 1)
+                bind_handle = HTTPBindReusePort(loop->http, i->first, i->second);
+            else
+#endif
+                bind_handle = evhttp_bind_socket_with_handle(loop->http, i->first.empty() ? NULL : i->first.c_str(), i->second);
+            if (!bind_handle) {
+                LogPrintf("Binding RPC on address %s port %i failed.\n", i->first, i->second);
+                break;
+            }
+            loop->boundSockets.push_back(bind_handle);
+            fBound = true;
         }
     }
-    return !boundSockets.empty();
+    return fBound;
 }
 
 /** Simple wrapper to set thread name and run work queue */
@@ -372,11 +572,10 @@ static void libevent_log_cb(int severity, const char *msg)
 
 bool InitHTTPServer()
 {
-    struct evhttp* http = 0;
-    struct event_base* base = 0;
-
     if (!InitHTTPAllowList())
         return false;
+    fHTTPInterrupted = false;
+    nHTTPServerTimeout = GetArg("-rpcservertimeout", DEFAULT_HTTP_SERVER_TIMEOUT);
 
     if (GetBoolArg("-rpcssl", false)) {
         uiInterface.ThreadSafeMessageBox(
@@ -401,29 +600,24 @@ bool InitHTTPServer()
     evthread_use_pthreads();
 #endif
 
-    base = event_base_new(); // XXX RAII
-    if (!base) {
-        LogPrintf("Couldn't create an event_base: exiting\n");
-        return false;
+    int nEventLoops = std::max((long)GetArg("-rpceventloops", DEFAULT_HTTP_EVENT_LOOPS), 1L);
+#ifndef SO_REUSEPORT
+    if (nEventLoops > 1) {
+        LogPrintf("HTTP: -rpceventloops needs SO_REUSEPORT, which this platform lacks; using one event loop\n");
+        nEventLoops = 1;
     }
-
-    /* Create a new evhttp object to handle requests. */
-    http = evhttp_new(base); // XXX RAII
-    if (!http) {
-        LogPrintf("couldn't create evhttp. Exiting.\n");
-        event_base_free(base);
-        return false;
+#endif
+    for (int i = 0; i < nEventLoops; i++) {
+        eventLoops.push_back(new HTTPEventLoop());
+        if (!eventLoops.back()->Init()) {
+            StopHTTPServer();
+            return false;
+        }
     }
 
-    evhttp_set_timeout(http, GetArg("-rpcservertimeout", DEFAULT_HTTP_SERVER_TIMEOUT));
-    evhttp_set_max_headers_size(http, MAX_HEADERS_SIZE);
-    evhttp_set_max_body_size(http, MAX_SIZE);
-    evhttp_set_gencb(http, http_request_cb, NULL);
-
-    if (!HTTPBindAddresses(http)) {
+    if (!HTTPBindAddresses()) {
         LogPrintf("Unable to bind any endpoint for RPC server\n");
-        evhttp_free(http);
-        event_base_free(base);
+        StopHTTPServer();
         return false;
     }
 
@@ -432,19 +626,16 @@ bool InitHTTPServer()
     LogPrintf("HTTP: creating work queue of depth %d\n", workQueueDepth);
 
     workQueue = new WorkQueue<HTTPClosure>(workQueueDepth);
-    eventBase = base;
-    eventHTTP = http;
     return true;
 }
 
-boost::thread threadHTTP;
-
 bool StartHTTPServer()
 {
     LogPrint("http", "Starting HTTP server\n");
     int rpcThreads = std::max((long)GetArg("-rpcthreads", DEFAULT_HTTP_THREADS), 1L);
-    LogPrintf("HTTP: starting %d worker threads\n", rpcThreads);
-    threadHTTP = boost::thread(boost::bind(&ThreadHTTP, eventBase, eventHTTP));
+    LogPrintf("HTTP: starting %u event loops and %d worker threads\n", eventLoops.size(), rpcThreads);
+    BOOST_FOREACH (HTTPEventLoop* loop, eventLoops)
+        loop->thread = boost::thread(boost::bind(&ThreadHTTP, loop));
 
     for (int i = 0; i < rpcThreads; i++)
         boost::thread(boost::bind(&HTTPWorkQueueRun, workQueue));
@@ -454,13 +645,15 @@ bool StartHTTPServer()
 void InterruptHTTPServer()
 {
     LogPrint("http", "Interrupting HTTP server\n");
-    if (eventHTTP) {
+    fHTTPInterrupted = true;
+    BOOST_FOREACH (HTTPEventLoop* loop, eventLoops) {
         // Unlisten sockets
-        BOOST_FOREACH (evhttp_bound_socket *socket, boundSockets) {
-            evhttp_del_accept_socket(eventHTTP, socket);
+        BOOST_FOREACH (evhttp_bound_socket *socket, loop->boundSockets) {
+            evhttp_del_accept_socket(loop->http, socket);
         }
+        loop->boundSockets.clear();
         // Reject requests on current connections
-        evhttp_set_gencb(eventHTTP, http_reject_request_cb, NULL);
+        evhttp_set_gencb(loop->http, http_reject_request_cb, NULL);
     }
     if (workQueue)
         workQueue->Interrupt();
@@ -473,8 +666,11 @@ void StopHTTPServer()
         LogPrint("http", "Waiting for HTTP worker threads to exit\n");
         workQueue->WaitExit();
         delete workQueue;
+        workQueue = 0;
     }
-    if (eventBase) {
+    BOOST_FOREACH (HTTPEventLoop* loop, eventLoops) {
+        if (loop->thread.get_id() == boost::thread::id())
+            continue; // never started
         LogPrint("http", "Waiting for HTTP event thread to exit\n");
         // Give event loop a few seconds to exit (to send back last RPC responses), then break it
         // Before this was solved with event_base_loopexit, but that didn't work as expected in
@@ -483,29 +679,35 @@ void StopHTTPServer()
         // could be used again (if desirable).
         // (see discussion in https://github.com/bitcoin/bitcoin/pull/6990)
 #if BOOST_VERSION >= 105000
-        if (!threadHTTP.try_join_for(boost::chrono::milliseconds(2000))) {
+        if (!loop->thread.try_join_for(boost::chrono::milliseconds(2000))) {
 #else
-        if (!threadHTTP.timed_join(boost::posix_time::milliseconds(2000))) {
+        if (!loop->thread.timed_join(boost::posix_time::milliseconds(2000))) {
 #endif
             LogPrintf("HTTP event loop did not exit within allotted time, sending loopbreak\n");
-            event_base_loopbreak(eventBase);
-            threadHTTP.join();
+            event_base_loopbreak(loop->base);
+            loop->thread.join();
         }
     }
-    if (eventHTTP) {
-        evhttp_free(eventHTTP);
-        eventHTTP = 0;
-    }
-    if (eventBase) {
-        event_base_free(eventBase);
-        eventBase = 0;
-    }
+    BOOST_FOREACH (HTTPEventLoop* loop, eventLoops)
+        delete loop;
+    eventLoops.clear();
     LogPrint("http", "Stopped HTTP server\n");
 }
 
 struct event_base* EventBase()
 {
-    return eventBase;
+    return eventLoops.empty() ? 0 : eventLoops[0]->base;
+}
+
+bool HTTPQueueWork(const boost::function<void()>& func)
+{
+    if (!workQueue)
+        return false;
+    std::unique_ptr<HTTPTaskItem> item(new HTTPTaskItem(func));
+    if (!workQueue->EnqueueSpare(item.get()))
+        return false;
+    item.release(); /* queue took ownership */
+    return true;
 }
 
 static void httpevent_callback_fn(evutil_socket_t, short, void* data)
@@ -534,13 +736,20 @@ void HTTPEvent::trigger(struct timeval* tv)
     else
         evtimer_add(ev, tv); // trigger after timeval passed
 }
-HTTPRequest::HTTPRequest(struct evhttp_request* req) : req(req),
-                                                       replySent(false)
+HTTPRequest::HTTPRequest(struct evhttp_request* req, HTTPEventLoop* loop) : req(req),
+                                                                            loop(loop),
+                                                                            replySent(false),
+                                                                            replyStarted(false),
+                                                                            nChunkBytes(0)
 {
 }
 HTTPRequest::~HTTPRequest()
 {
-    if (!replySent) {
+    if (replyStarted && !replySent) {
+        // A streamed reply that was cut short; the client sees the truncated body
+        LogPrintf("%s: Unfinished reply\n", __func__);
+        EndReply();
+    } else if (!replySent) {
         // Keep track of whether reply was sent to avoid request leaks
         LogPrintf("%s: Unhandled request\n", __func__);
         WriteReply(HTTP_INTERNAL, "Unhandled request");
@@ -565,17 +774,16 @@ std::string HTTPRequest::ReadBody()
     if (!buf)
         return "";
     size_t size = evbuffer_get_length(buf);
-    /** Trivial implementation: if this is ever a performance bottleneck,
-     * internal copying can be avoided in multi-segment buffers by using
-     * evbuffer_peek and an awkward loop. Though in that case, it'd be even
-     * better to not copy into an intermediate string but use a stream
-     * abstraction to consume the evbuffer on the fly in the parsing algorithm.
-     */
-    const char* data = (const char*)evbuffer_pullup(buf, size);
-    if (!data) // returns NULL in case of empty buffer
+    if (size == 0)
+        return "";
+    // Large bodies arrive spread over many buffer segments. Copy them out in
+    // one pass, instead of having evbuffer_pullup join them into a new
+    // segment first.
+    std::string rv(size, '\0');
+    int nRead = evbuffer_remove(buf, &rv[0], size);
+    if (nRead < 0)
         return "";
-    std::string rv(data, size);
-    evbuffer_drain(buf, size);
+    rv.resize(nRead);
     return rv;
 }
 
@@ -593,14 +801,109 @@ void HTTPRequest::WriteHeader(const std::string& hdr, const std::string& value)
  */
 void HTTPRequest::WriteReply(int nStatus, const std::string& strReply)
 {
-    assert(!replySent && req);
+    assert(!replySent && !replyStarted && req);
     // Send event to main http thread to send reply message
     struct evbuffer* evb = evhttp_request_get_output_buffer(req);
     assert(evb);
     evbuffer_add(evb, strReply.data(), strReply.size());
-    HTTPEvent* ev = new HTTPEvent(eventBase, true,
-        boost::bind(evhttp_send_reply, req, nStatus, (const char*)NULL, (struct evbuffer *)NULL));
-    ev->trigger(0);
+    loop->Post(boost::bind(evhttp_send_reply, req, nStatus, (const char*)NULL, (struct evbuffer *)NULL));
+    replySent = true;
+    req = 0; // transferred back to main thread
+}
+
+static void http_reply_sent_cb(struct evhttp_connection*, void* arg)
+{
+    // Called once everything handed to the connection was written
+    HTTPReplyProgress* progress = (HTTPReplyProgress*)arg;
+    progress->Sent(progress->nHanded);
+}
+
+static void http_reply_closed_cb(struct evhttp_connection*, void* arg)
+{
+    ((HTTPReplyProgress*)arg)->Closed();
+}
+
+static void http_send_reply_start(struct evhttp_request* req, std::shared_ptr<HTTPReplyProgress> progress)
+{
+    evhttp_send_reply_start(req, HTTP_OK, NULL);
+    // The progress outlives the callbacks: http_send_reply_end unsets them
+    struct evhttp_connection* evcon = evhttp_request_get_connection(req);
+    if (evcon)
+        evhttp_connection_set_closecb(evcon, http_reply_closed_cb, progress.get());
+    else
+        progress->Closed();
+}
+
+static void http_send_reply_chunk(struct evhttp_request* req, struct evbuffer* evb, std::shared_ptr<HTTPReplyProgress> progress)
+{
+    progress->nHanded += evbuffer_get_length(evb);
+    if (!evhttp_request_get_connection(req)) {
+        progress->Closed();
+    } else {
+#if LIBEVENT_VERSION_NUMBER >= 0x02010100
+        evhttp_send_reply_chunk_with_cb(req, evb, http_reply_sent_cb, progress.get());
+#else
+        // Without a callback for written data only the handoff is paced
+        evhttp_send_reply_chunk(req, evb);
+        progress->Sent(progress->nHanded);
+#endif
+    }
+    evbuffer_free(evb);
+}
+
+static void http_send_reply_end(struct evhttp_request* req, std::shared_ptr<HTTPReplyProgress> progress)
+{
+    struct evhttp_connection* evcon = evhttp_request_get_connection(req);
+    if (evcon)
+        evhttp_connection_set_closecb(evcon, NULL, NULL);
+    // Replaces the callback of the last chunk
+    evhttp_send_reply_end(req);
+}
+
+void HTTPRequest::WriteReplyChunk(const std::string& strChunk)
+{
+    assert(!replySent && req);
+    // Posted functions run in order, so the start and the chunks reach the
+    // connection in order
+    if (!replyStarted) {
+        progress.reset(new HTTPReplyProgress());
+        loop->Post(boost::bind(http_send_reply_start, req, progress));
+        replyStarted = true;
+    }
+    if (strChunk.empty())
+        return; // an empty chunk would end the reply
+    struct evbuffer* evb = evbuffer_new();
+    assert(evb);
+    evbuffer_add(evb, strChunk.data(), strChunk.size());
+    nChunkBytes += strChunk.size();
+    loop->Post(boost::bind(http_send_reply_chunk, req, evb, progress));
+}
+
+bool HTTPRequest::WaitReplyPending(size_t nMaxPending)
+{
+    assert(replyStarted && !replySent);
+    boost::unique_lock<boost::mutex> lock(progress->cs);
+    uint64_t nLastSent = progress->nSent;
+    int64_t nLastProgress = GetTimeMillis();
+    while (!progress->fClosed && nChunkBytes - progress->nSent > nMaxPending) {
+        if (fHTTPInterrupted)
+            return false;
+        progress->cond.timed_wait(lock, boost::posix_time::milliseconds(100));
+        if (progress->nSent != nLastSent) {
+            nLastSent = progress->nSent;
+            nLastProgress = GetTimeMillis();
+        } else if (GetTimeMillis() - nLastProgress > nHTTPServerTimeout * 1000) {
+            LogPrint("http", "Client of %s stopped reading\n", GetURI());
+            return false;
+        }
+    }
+    return !progress->fClosed;
+}
+
+void HTTPRequest::EndReply()
+{
+    assert(replyStarted && !replySent && req);
+    loop->Post(boost::bind(http_send_reply_end, req, progress));
     replySent = true;
     req = 0; // transferred back to main thread
 }
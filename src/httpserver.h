@@ -5,6 +5,7 @@
 #ifndef BITCOIN_HTTPSERVER_H
 #define BITCOIN_HTTPSERVER_H
 
+#include <memory>
 #include <string>
 #include <stdint.h>
 #include <boost/thread.hpp>
@@ -14,10 +15,14 @@
 static const int DEFAULT_HTTP_THREADS=4;
 static const int DEFAULT_HTTP_WORKQUEUE=16;
 static const int DEFAULT_HTTP_SERVER_TIMEOUT=30;
+/** Number of event loop threads accepting and parsing HTTP connections */
+static const int DEFAULT_HTTP_EVENT_LOOPS=1;
 
 struct evhttp_request;
 struct event_base;
 class CService;
+class HTTPEventLoop;
+class HTTPReplyProgress;
 class HTTPRequest;
 
 /** Initialize HTTP server.
@@ -49,6 +54,12 @@ void UnregisterHTTPHandler(const std::string &prefix, bool exactMatch);
  */
 struct event_base* EventBase();
 
+/** Run func on one of the HTTP worker threads.
+ * It is only queued while the work queue is at most half full, so extra work
+ * never crowds out incoming requests; returns false if it was not queued.
+ */
+bool HTTPQueueWork(const boost::function<void()>& func);
+
 /** In-flight HTTP request.
  * Thin C++ wrapper around evhttp_request.
  */
@@ -56,10 +67,17 @@ class HTTPRequest
 {
 private:
     struct evhttp_request* req;
+    //! Event loop of the connection, which sends the reply
+    HTTPEventLoop* loop;
     bool replySent;
+    bool replyStarted;
+    //! How much of a chunked reply reached the client, shared with the event loop
+    std::shared_ptr<HTTPReplyProgress> progress;
+    //! Bytes of chunks written
+    uint64_t nChunkBytes;
 
 public:
-    HTTPRequest(struct evhttp_request* req);
+    HTTPRequest(struct evhttp_request* req, HTTPEventLoop* loop);
     ~HTTPRequest();
 
     enum RequestMethod {
@@ -112,6 +130,33 @@ public:
      * main thread, do not call any other HTTPRequest methods after calling this.
      */
     void WriteReply(int nStatus, const std::string& strReply = "");
+
+    /**
+     * Send part of a HTTP_OK reply using chunked transfer encoding. The first
+     * call sends the headers; the chunks go out in the order they were written.
+     *
+     * @note Call EndReply once the last chunk was written. WriteReply cannot be
+     * used after this.
+     */
+    void WriteReplyChunk(const std::string& strChunk);
+
+    /** Whether WriteReplyChunk was called */
+    bool ReplyStarted() const { return replyStarted; }
+
+    /**
+     * Wait until at most nMaxPending bytes of the chunks written so far are
+     * still on their way to the client, so that a long reply is produced at
+     * the pace the client reads it. Returns false if the client went away,
+     * read nothing for -rpcservertimeout seconds, or the server is shutting
+     * down; finish the reply with EndReply then.
+     */
+    bool WaitReplyPending(size_t nMaxPending);
+
+    /**
+     * Finish a reply that was started with WriteReplyChunk. Like WriteReply,
+     * this gives the request back to the main thread.
+     */
+    void EndReply();
 };
 
 /** Event handler closure.
@@ -199,8 +199,11 @@ void Shutdown()
     StopNode();
     StopTorControl();
     UnregisterNodeSignals(GetNodeSignals());
+    SetProfiledLock(NULL);
 
-    if (fFeeEstimatesInitialized)
+    // Every block has already been journaled to the fee estimates file, so
+    // it only has to be written out if the journal could not be kept open
+    if (fFeeEstimatesInitialized && !mempool.StopFeeEstimatesJournal())
     {
         boost::filesystem::path est_path = GetDataDir() / FEE_ESTIMATES_FILENAME;
         CAutoFile est_fileout(fopen(est_path.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
@@ -208,8 +211,8 @@ void Shutdown()
             mempool.WriteFeeEstimates(est_fileout);
         else
             LogPrintf("%s: Failed to write fee estimates to %s\n", __func__, est_path.string());
-        fFeeEstimatesInitialized = false;
     }
+    fFeeEstimatesInitialized = false;
 
     {
         LOCK(cs_main);
@@ -323,6 +326,8 @@ std::string HelpMessage(HelpMessageMode mode)
         strUsage += HelpMessageOpt("-feefilter", strprintf("Tell other nodes to filter invs to us by our mempool min fee (default: %u)", DEFAULT_FEEFILTER));
     strUsage += HelpMessageOpt("-loadblock=<file>", _("Imports blocks from external blk000??.dat file on startup"));
     strUsage += HelpMessageOpt("-maxorphantx=<n>", strprintf(_("Keep at most <n> unconnectable transactions in memory (default: %u)"), DEFAULT_MAX_ORPHAN_TRANSACTIONS));
+    strUsage += HelpMessageOpt("-maxorphanpoolsize=<n>", strprintf(_("Keep unconnectable transactions below <n> megabytes of memory (default: %u)"), DEFAULT_MAX_ORPHAN_POOL_SIZE));
+    strUsage += HelpMessageOpt("-blockreconstructionextratxn=<n>", strprintf(_("Extra transactions to keep in memory for compact block reconstructions (default: %u)"), DEFAULT_BLOCK_RECONSTRUCTION_EXTRA_TXN));
     strUsage += HelpMessageOpt("-maxmempool=<n>", strprintf(_("Keep the transaction memory pool below <n> megabytes (default: %u)"), DEFAULT_MAX_MEMPOOL_SIZE));
     strUsage += HelpMessageOpt("-mempoolexpiry=<n>", strprintf(_("Do not keep transactions in the mempool longer than <n> hours (default: %u)"), DEFAULT_MEMPOOL_EXPIRY));
     strUsage += HelpMessageOpt("-par=<n>", strprintf(_("Set the number of script verification threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"),
@@ -349,6 +354,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-discover", _("Discover own IP addresses (default: 1 when listening and no -externalip or -proxy)"));
     strUsage += HelpMessageOpt("-dns", _("Allow DNS lookups for -addnode, -seednode and -connect") + " " + strprintf(_("(default: %u)"), DEFAULT_NAME_LOOKUP));
     strUsage += HelpMessageOpt("-dnsseed", _("Query for peer addresses via DNS lookup, if low on addresses (default: 1 unless -connect)"));
+    strUsage += HelpMessageOpt("-cmpctearlyrelay", strprintf(_("Relay new blocks to high-bandwidth compact block peers once their header, proof of work and transaction list are checked, before connecting them (default: %u)"), DEFAULT_CMPCT_EARLY_RELAY));
     strUsage += HelpMessageOpt("-externalip=<ip>", _("Specify your own public address"));
     strUsage += HelpMessageOpt("-forcednsseed", strprintf(_("Always query for peer addresses via DNS lookup (default: %u)"), DEFAULT_FORCEDNSSEED));
     strUsage += HelpMessageOpt("-listen", _("Accept connections from outside (default: 1 if no -proxy or -connect)"));
@@ -357,6 +363,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-maxreceivebuffer=<n>", strprintf(_("Maximum per-connection receive buffer, <n>*1000 bytes (default: %u)"), DEFAULT_MAXRECEIVEBUFFER));
     strUsage += HelpMessageOpt("-maxsendbuffer=<n>", strprintf(_("Maximum per-connection send buffer, <n>*1000 bytes (default: %u)"), DEFAULT_MAXSENDBUFFER));
     strUsage += HelpMessageOpt("-maxtimeadjustment", strprintf(_("Maximum allowed median peer time offset adjustment. Local perspective of time may be influenced by peers forward or backward by this amount. (default: %u seconds)"), DEFAULT_MAX_TIME_ADJUSTMENT));
+    strUsage += HelpMessageOpt("-msghandlerthreads=<n>", strprintf(_("Number of threads processing peer messages; each peer is handled by one thread at a time (1 to %d, default: %d)"), MAX_MSG_HANDLER_THREADS, DEFAULT_MSG_HANDLER_THREADS));
     strUsage += HelpMessageOpt("-onion=<ip:port>", strprintf(_("Use separate SOCKS5 proxy to reach peers via Tor hidden services (default: %s)"), "-proxy"));
     strUsage += HelpMessageOpt("-onlynet=<net>", _("Only connect to nodes in network <net> (ipv4, ipv6 or onion)"));
     strUsage += HelpMessageOpt("-permitbaremultisig", strprintf(_("Relay non-P2SH multisig (default: %u)"), DEFAULT_PERMIT_BAREMULTISIG));
@@ -366,6 +373,9 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-proxyrandomize", strprintf(_("Randomize credentials for every proxy connection. This enables Tor stream isolation (default: %u)"), DEFAULT_PROXYRANDOMIZE));
     strUsage += HelpMessageOpt("-rpcserialversion", strprintf(_("Sets the serialization of raw transaction or block hex returned in non-verbose mode, non-segwit(0) or segwit(1) (default: %d)"), DEFAULT_RPC_SERIALIZE_VERSION));
     strUsage += HelpMessageOpt("-seednode=<ip>", _("Connect to a node to retrieve peer addresses, and disconnect"));
+#ifdef HAVE_SYS_EPOLL_H
+    strUsage += HelpMessageOpt("-socketepoll", strprintf(_("Wait on peer sockets with epoll instead of select(), lifting the FD_SETSIZE limit on -maxconnections (default: %u)"), DEFAULT_SOCKET_EPOLL));
+#endif
     strUsage += HelpMessageOpt("-timeout=<n>", strprintf(_("Specify connection timeout in milliseconds (minimum: 1, default: %d)"), DEFAULT_CONNECT_TIMEOUT));
     strUsage += HelpMessageOpt("-torcontrol=<ip>:<port>", strprintf(_("Tor control port to use if onion listening enabled (default: %s)"), DEFAULT_TOR_CONTROL));
     strUsage += HelpMessageOpt("-torpassword=<pass>", _("Tor control port password (default: empty)"));
@@ -459,6 +469,10 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-blockprioritysize=<n>", strprintf(_("Set maximum size of high-priority/low-fee transactions in bytes (default: %d)"), DEFAULT_BLOCK_PRIORITY_SIZE));
     if (showDebug)
         strUsage += HelpMessageOpt("-blockversion=<n>", "Override block version to test forking scenarios");
+    strUsage += HelpMessageOpt("-genthreads=<n>", strprintf(_("Set the number of nonce search threads used by generate and generatetoaddress (0 = one per core, <0 = leave that many cores free, default: %d)"), DEFAULT_GENERATE_THREADS));
+    strUsage += HelpMessageOpt("-precomputetemplates", strprintf(_("Build the next block templates in the background as soon as a new block is connected (default: %u)"), DEFAULT_PRECOMPUTE_TEMPLATES));
+    strUsage += HelpMessageOpt("-templatefastcheck", strprintf(_("Do not re-run scripts of mempool transactions when checking new block templates (default: %u)"), DEFAULT_TEMPLATE_FASTCHECK));
+    strUsage += HelpMessageOpt("-templatebgcheck", strprintf(_("Fully check fast-checked block templates in the background (default: %u)"), DEFAULT_TEMPLATE_BGCHECK));
 
     strUsage += HelpMessageGroup(_("RPC server options:"));
     strUsage += HelpMessageOpt("-server", _("Accept command line and JSON-RPC commands"));
@@ -471,9 +485,12 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-rpcport=<port>", strprintf(_("Listen for JSON-RPC connections on <port> (default: %u or testnet: %u)"), BaseParams(CBaseChainParams::MAIN).RPCPort(), BaseParams(CBaseChainParams::TESTNET).RPCPort()));
     strUsage += HelpMessageOpt("-rpcallowip=<ip>", _("Allow JSON-RPC connections from specified source. Valid for <ip> are a single IP (e.g. 1.2.3.4), a network/netmask (e.g. 1.2.3.4/255.255.255.0) or a network/CIDR (e.g. 1.2.3.4/24). This option can be specified multiple times"));
     strUsage += HelpMessageOpt("-rpcthreads=<n>", strprintf(_("Set the number of threads to service RPC calls (default: %d)"), DEFAULT_HTTP_THREADS));
+    strUsage += HelpMessageOpt("-rpcbinary", strprintf(_("Accept binary RPC requests for blocks, transactions, UTXOs and mempool entries at /bin (default: %u)"), DEFAULT_BINARY_RPC_ENABLE));
+    strUsage += HelpMessageOpt("-rpcbatchparallelism=<n>", strprintf(_("Execute up to <n> read-only calls of a JSON-RPC batch at the same time (default: %d)"), DEFAULT_RPC_BATCH_PARALLELISM));
     if (showDebug) {
         strUsage += HelpMessageOpt("-rpcworkqueue=<n>", strprintf("Set the depth of the work queue to service RPC calls (default: %d)", DEFAULT_HTTP_WORKQUEUE));
         strUsage += HelpMessageOpt("-rpcservertimeout=<n>", strprintf("Timeout during HTTP requests (default: %d)", DEFAULT_HTTP_SERVER_TIMEOUT));
+        strUsage += HelpMessageOpt("-rpceventloops=<n>", strprintf("Number of threads accepting and parsing HTTP connections, which share the RPC port through SO_REUSEPORT (default: %d)", DEFAULT_HTTP_EVENT_LOOPS));
     }
 
     return strUsage;
@@ -862,8 +879,15 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     int nUserMaxConnections = GetArg("-maxconnections", DEFAULT_MAX_PEER_CONNECTIONS);
     nMaxConnections = std::max(nUserMaxConnections, 0);
 
+    fSocketEpoll = GetBoolArg("-socketepoll", DEFAULT_SOCKET_EPOLL);
+#ifndef HAVE_SYS_EPOLL_H
+    if (fSocketEpoll)
+        return InitError(_("-socketepoll is not supported on this platform."));
+#endif
+
     // Trim requested connection counts, to fit into system limitations
-    nMaxConnections = std::max(std::min(nMaxConnections, (int)(FD_SETSIZE - nBind - MIN_CORE_FILEDESCRIPTORS)), 0);
+    if (!fSocketEpoll)
+        nMaxConnections = std::max(std::min(nMaxConnections, (int)(FD_SETSIZE - nBind - MIN_CORE_FILEDESCRIPTORS)), 0);
     int nFD = RaiseFileDescriptorLimit(nMaxConnections + MIN_CORE_FILEDESCRIPTORS);
     if (nFD < MIN_CORE_FILEDESCRIPTORS)
         return InitError(_("Not enough file descriptors available."));
@@ -906,6 +930,9 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     }
     fCheckBlockIndex = GetBoolArg("-checkblockindex", chainparams.DefaultConsistencyChecks());
     fCheckpointsEnabled = GetBoolArg("-checkpoints", DEFAULT_CHECKPOINTS_ENABLED);
+    fPrecomputeTemplates = GetBoolArg("-precomputetemplates", DEFAULT_PRECOMPUTE_TEMPLATES);
+    fTemplateFastCheck = GetBoolArg("-templatefastcheck", DEFAULT_TEMPLATE_FASTCHECK);
+    fTemplateBackgroundCheck = GetBoolArg("-templatebgcheck", DEFAULT_TEMPLATE_BGCHECK);
 
     // mempool limits
     int64_t nMempoolSizeMax = GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000;
@@ -922,6 +949,8 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     else if (nScriptCheckThreads > MAX_SCRIPTCHECK_THREADS)
         nScriptCheckThreads = MAX_SCRIPTCHECK_THREADS;
 
+    nMessageHandlerThreads = std::max(1, std::min((int)GetArg("-msghandlerthreads", DEFAULT_MSG_HANDLER_THREADS), MAX_MSG_HANDLER_THREADS));
+
     fServer = GetBoolArg("-server", false);
 
     // block pruning; get the amount of disk space (in MiB) to allot for block & undo files
@@ -992,6 +1021,8 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
 
     nMaxTipAge = GetArg("-maxtipage", DEFAULT_MAX_TIP_AGE);
 
+    fCmpctEarlyRelay = GetBoolArg("-cmpctearlyrelay", DEFAULT_CMPCT_EARLY_RELAY);
+
     fEnableReplacement = GetBoolArg("-mempoolreplacement", DEFAULT_ENABLE_REPLACEMENT);
     if ((!fEnableReplacement) && mapArgs.count("-mempoolreplacement")) {
         // Minimal effort at forwards compatibility
@@ -1076,6 +1107,9 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     LogPrintf("Using data directory %s\n", strDataDir);
     LogPrintf("Using config file %s\n", GetConfigFile().string());
     LogPrintf("Using at most %i connections (%i file descriptors available)\n", nMaxConnections, nFD);
+    LogPrintf("Using %d message handler threads\n", nMessageHandlerThreads);
+    // Account the time cs_main is held to the peers it is taken for
+    SetProfiledLock(&cs_main);
     std::ostringstream strErrors;
 
     LogPrintf("Using %u threads for script verification\n", nScriptCheckThreads);
@@ -1417,10 +1451,14 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     LogPrintf(" block index %15dms\n", GetTimeMillis() - nStart);
 
     boost::filesystem::path est_path = GetDataDir() / FEE_ESTIMATES_FILENAME;
-    CAutoFile est_filein(fopen(est_path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
-    // Allowed to fail as this file IS missing on first startup.
-    if (!est_filein.IsNull())
-        mempool.ReadFeeEstimates(est_filein);
+    {
+        CAutoFile est_filein(fopen(est_path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+        // Allowed to fail as this file IS missing on first startup.
+        if (!est_filein.IsNull())
+            mempool.ReadFeeEstimates(est_filein);
+    }
+    // Compact what was read (including any journaled blocks) into a fresh file and journal from there
+    mempool.StartFeeEstimatesJournal(est_path.string());
     fFeeEstimatesInitialized = true;
 
     // ********************************************************* Step 8: load wallet
@@ -1515,6 +1553,11 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
 
     StartNode(threadGroup, scheduler);
 
+    if (fPrecomputeTemplates)
+        threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "tmplprecomp", &ThreadPrecomputeTemplates));
+    if (fTemplateFastCheck && fTemplateBackgroundCheck)
+        threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "tmplcheck", &ThreadCheckTemplates));
+
     // ********************************************************* Step 12: finished
 
     SetRPCWarmupFinished();
@@ -14,10 +14,13 @@
 #include "consensus/consensus.h"
 #include "consensus/merkle.h"
 #include "consensus/validation.h"
+#include "crypto/common.h"
 #include "hash.h"
 #include "init.h"
 #include "merkleblock.h"
+#include "miner.h"
 #include "net.h"
+#include "orphanpool.h"
 #include "policy/fees.h"
 #include "policy/policy.h"
 #include "pow.h"
@@ -30,6 +33,7 @@
 #include "tinyformat.h"
 #include "txdb.h"
 #include "txmempool.h"
+#include "txrelay.h"
 #include "ui_interface.h"
 #include "undo.h"
 #include "util.h"
@@ -81,6 +85,7 @@ size_t nCoinCacheUsage = 5000 * 300;
 uint64_t nPruneTarget = 0;
 int64_t nMaxTipAge = DEFAULT_MAX_TIP_AGE;
 bool fEnableReplacement = DEFAULT_ENABLE_REPLACEMENT;
+bool fCmpctEarlyRelay = DEFAULT_CMPCT_EARLY_RELAY;
 
 
 CFeeRate minRelayTxFee = CFeeRate(DEFAULT_MIN_RELAY_TX_FEE);
@@ -89,23 +94,7 @@ CAmount maxTxFee = DEFAULT_TRANSACTION_MAXFEE;
 CTxMemPool mempool(::minRelayTxFee);
 FeeFilterRounder filterRounder(::minRelayTxFee);
 
-struct IteratorComparator
-{
-    template<typename I>
-    bool operator()(const I& a, const I& b)
-    {
-        return &(*a) < &(*b);
-    }
-};
-
-struct COrphanTx {
-    CTransaction tx;
-    NodeId fromPeer;
-    int64_t nTimeExpire;
-};
-map<uint256, COrphanTx> mapOrphanTransactions GUARDED_BY(cs_main);
-map<COutPoint, set<map<uint256, COrphanTx>::iterator, IteratorComparator>> mapOrphanTransactionsByPrev GUARDED_BY(cs_main);
-void EraseOrphansFor(NodeId peer) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+COrphanPool orphanPool GUARDED_BY(cs_main);
 
 /**
  * Returns true if there are nRequired or more blocks of minVersion or above
@@ -184,6 +173,9 @@ namespace {
      */
     map<uint256, std::pair<NodeId, bool>> mapBlockSource;
 
+    /** Time (in microseconds) the last block was handed to ProcessNewBlock. Protected by cs_main. */
+    int64_t nTimeLastBlockReceived = 0;
+
     /**
      * Filter for transactions that were recently rejected by
      * AcceptToMemoryPool. These are not rerequested until the chain tip
@@ -236,6 +228,16 @@ namespace {
     MapRelay mapRelay;
     /** Expiration-time ordered list of (expire time, relay map entry) pairs, protected by cs_main). */
     std::deque<std::pair<int64_t, MapRelay::iterator>> vRelayExpiration;
+
+    /** Transactions queued for announcement, shared by all peers. */
+    CTxRelay txRelay;
+
+    /** Orphan, replaced and evicted transactions kept for compact block
+     *  reconstruction, a ring overwritten in insertion order. Protected by cs_main. */
+    std::vector<CExtraTransaction> vExtraTxnForCompact;
+    size_t vExtraTxnForCompactIt = 0;
+    uint64_t nExtraTxnAdded[EXTRA_TXN_SOURCE_COUNT] = {};
+    uint64_t nExtraTxnHits[EXTRA_TXN_SOURCE_COUNT] = {};
 } // anon namespace
 
 //////////////////////////////////////////////////////////////////////////////
@@ -310,6 +312,14 @@ struct CNodeState {
      * otherwise: whether this peer sends non-witnesses in cmpctblocks/blocktxns.
      */
     bool fSupportsDesiredCmpctVersion;
+    //! Number of blocks we sent this peer as cmpctblocks before connecting them
+    int nEarlyRelayBlocks;
+    //! Total time in microseconds those blocks reached this peer ahead of a post-validation announcement
+    int64_t nEarlyRelayTimeSaved;
+    //! Number of blocks from this peer that we relayed before validation and turned out invalid
+    int nEarlyRelayInvalid;
+    //! How far through txRelay's batches we have announced transactions to this peer
+    CTxRelayCursor txRelayCursor;
 
     CNodeState() {
         fCurrentlyConnected = false;
@@ -332,6 +342,9 @@ struct CNodeState {
         fHaveWitness = false;
         fWantsCmpctWitness = false;
         fSupportsDesiredCmpctVersion = false;
+        nEarlyRelayBlocks = 0;
+        nEarlyRelayTimeSaved = 0;
+        nEarlyRelayInvalid = 0;
     }
 };
 
@@ -367,6 +380,7 @@ void InitializeNode(NodeId nodeid, const CNode *pnode) {
     CNodeState &state = mapNodeState.insert(std::make_pair(nodeid, CNodeState())).first->second;
     state.name = pnode->addrName;
     state.address = pnode->addr;
+    state.txRelayCursor = txRelay.GetEndCursor();
 }
 
 void FinalizeNode(NodeId nodeid) {
@@ -383,7 +397,8 @@ void FinalizeNode(NodeId nodeid) {
     BOOST_FOREACH(const QueuedBlock& entry, state->vBlocksInFlight) {
         mapBlocksInFlight.erase(entry.hash);
     }
-    EraseOrphansFor(nodeid);
+    int nErased = orphanPool.EraseForPeer(nodeid);
+    if (nErased > 0) LogPrint("mempool", "Erased %d orphan tx from peer %d\n", nErased, nodeid);
     nPreferredDownload -= state->fPreferredDownload;
     nPeersWithValidatedDownloads -= (state->nBlocksInFlightValidHeaders != 0);
     assert(nPeersWithValidatedDownloads >= 0);
@@ -657,6 +672,9 @@ bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats) {
         if (queue.pindex)
             stats.vHeightInFlight.push_back(queue.pindex->nHeight);
     }
+    stats.nEarlyRelayBlocks = state->nEarlyRelayBlocks;
+    stats.nEarlyRelayTimeSaved = state->nEarlyRelayTimeSaved;
+    stats.nEarlyRelayInvalid = state->nEarlyRelayInvalid;
     return true;
 }
 
@@ -701,108 +719,42 @@ CBlockTreeDB *pblocktree = NULL;
 
 //////////////////////////////////////////////////////////////////////////////
 //
-// mapOrphanTransactions
+// orphanPool
 //
 
-bool AddOrphanTx(const CTransaction& tx, NodeId peer) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+static void AddToCompactExtraTransactions(const std::shared_ptr<const CTransaction>& tx, ExtraTxnSource source) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
 {
-    uint256 hash = tx.GetHash();
-    if (mapOrphanTransactions.count(hash))
-        return false;
-
-    // Ignore big transactions, to avoid a
-    // send-big-orphans memory exhaustion attack. If a peer has a legitimate
-    // large transaction with a missing parent then we assume
-    // it will rebroadcast it later, after the parent transaction(s)
-    // have been mined or received.
-    // 100 orphans, each of which is at most 99,999 bytes big is
-    // at most 10 megabytes of orphans and somewhat more byprev index (in the worst case):
-    unsigned int sz = GetTransactionWeight(tx);
-    if (sz >= MAX_STANDARD_TX_WEIGHT)
-    {
-        LogPrint("mempool", "ignoring large orphan tx (size: %u, hash: %s)\n", sz, hash.ToString());
-        return false;
-    }
-
-    auto ret = mapOrphanTransactions.emplace(hash, COrphanTx{tx, peer, GetTime() + ORPHAN_TX_EXPIRE_TIME});
-    assert(ret.second);
-    BOOST_FOREACH(const CTxIn& txin, tx.vin) {
-        mapOrphanTransactionsByPrev[txin.prevout].insert(ret.first);
-    }
-
-    LogPrint("mempool", "stored orphan tx %s (mapsz %u outsz %u)\n", hash.ToString(),
-             mapOrphanTransactions.size(), mapOrphanTransactionsByPrev.size());
-    return true;
-}
-
-int static EraseOrphanTx(uint256 hash) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
-{
-    map<uint256, COrphanTx>::iterator it = mapOrphanTransactions.find(hash);
-    if (it == mapOrphanTransactions.end())
-        return 0;
-    BOOST_FOREACH(const CTxIn& txin, it->second.tx.vin)
-    {
-        auto itPrev = mapOrphanTransactionsByPrev.find(txin.prevout);
-        if (itPrev == mapOrphanTransactionsByPrev.end())
-            continue;
-        itPrev->second.erase(it);
-        if (itPrev->second.empty())
-            mapOrphanTransactionsByPrev.erase(itPrev);
+    int64_t nMaxExtraTxn = GetArg("-blockreconstructionextratxn", DEFAULT_BLOCK_RECONSTRUCTION_EXTRA_TXN);
+    if (nMaxExtraTxn <= 0)
+        return;
+    size_t max_extra_txn = nMaxExtraTxn;
+    if (vExtraTxnForCompact.size() > max_extra_txn) {
+        vExtraTxnForCompact.resize(max_extra_txn);
+        vExtraTxnForCompactIt = 0;
     }
-    mapOrphanTransactions.erase(it);
-    return 1;
+    if (vExtraTxnForCompact.size() < max_extra_txn)
+        vExtraTxnForCompact.push_back(CExtraTransaction(tx, source));
+    else
+        vExtraTxnForCompact[vExtraTxnForCompactIt] = CExtraTransaction(tx, source);
+    vExtraTxnForCompactIt = (vExtraTxnForCompactIt + 1) % max_extra_txn;
+    nExtraTxnAdded[source]++;
 }
 
-void EraseOrphansFor(NodeId peer)
+static void CountCompactExtraTransactionHits(const PartiallyDownloadedBlock& block) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
 {
-    int nErased = 0;
-    map<uint256, COrphanTx>::iterator iter = mapOrphanTransactions.begin();
-    while (iter != mapOrphanTransactions.end())
-    {
-        map<uint256, COrphanTx>::iterator maybeErase = iter++; // increment to avoid iterator becoming invalid
-        if (maybeErase->second.fromPeer == peer)
-        {
-            nErased += EraseOrphanTx(maybeErase->second.tx.GetHash());
-        }
-    }
-    if (nErased > 0) LogPrint("mempool", "Erased %d orphan tx from peer %d\n", nErased, peer);
+    for (int i = 0; i < EXTRA_TXN_SOURCE_COUNT; i++)
+        nExtraTxnHits[i] += block.GetExtraCount((ExtraTxnSource)i);
 }
 
-
-unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+void GetExtraTxnStats(CExtraTxnStats &stats)
 {
-    unsigned int nEvicted = 0;
-    static int64_t nNextSweep;
-    int64_t nNow = GetTime();
-    if (nNextSweep <= nNow) {
-        // Sweep out expired orphan pool entries:
-        int nErased = 0;
-        int64_t nMinExpTime = nNow + ORPHAN_TX_EXPIRE_TIME - ORPHAN_TX_EXPIRE_INTERVAL;
-        map<uint256, COrphanTx>::iterator iter = mapOrphanTransactions.begin();
-        while (iter != mapOrphanTransactions.end())
-        {
-            map<uint256, COrphanTx>::iterator maybeErase = iter++;
-            if (maybeErase->second.nTimeExpire <= nNow) {
-                nErased += EraseOrphanTx(maybeErase->second.tx.GetHash());
-            } else {
-                nMinExpTime = std::min(maybeErase->second.nTimeExpire, nMinExpTime);
-            }
-        }
-        // Sweep again 5 minutes after the next entry that expires in order to batch the linear scan.
-        nNextSweep = nMinExpTime + ORPHAN_TX_EXPIRE_INTERVAL;
-        if (nErased > 0) LogPrint("mempool", "Erased %d orphan tx due to expiration\n", nErased);
-    }
-    while (mapOrphanTransactions.size() > nMaxOrphans)
-    {
-        // Evict a random orphan:
-        uint256 randomhash = GetRandHash();
-        map<uint256, COrphanTx>::iterator it = mapOrphanTransactions.lower_bound(randomhash);
-        if (it == mapOrphanTransactions.end())
-            it = mapOrphanTransactions.begin();
-        EraseOrphanTx(it->first);
-        ++nEvicted;
+    LOCK(cs_main);
+    stats.nCount = vExtraTxnForCompact.size();
+    stats.nMax = std::max((int64_t)0, GetArg("-blockreconstructionextratxn", DEFAULT_BLOCK_RECONSTRUCTION_EXTRA_TXN));
+    for (int i = 0; i < EXTRA_TXN_SOURCE_COUNT; i++) {
+        stats.nAdded[i] = nExtraTxnAdded[i];
+        stats.nHits[i] = nExtraTxnHits[i];
     }
-    return nEvicted;
 }
 
 bool IsFinalTx(const CTransaction &tx, int nBlockHeight, int64_t nBlockTime)
@@ -1128,9 +1080,12 @@ void LimitMempoolSize(CTxMemPool& pool, size_t limit, unsigned long age) {
         LogPrint("mempool", "Expired %i transactions from the memory pool\n", expired);
 
     std::vector<uint256> vNoSpendsRemaining;
-    pool.TrimToSize(limit, &vNoSpendsRemaining);
+    std::vector<std::shared_ptr<const CTransaction> > vEvicted;
+    pool.TrimToSize(limit, &vNoSpendsRemaining, &vEvicted);
     BOOST_FOREACH(const uint256& removed, vNoSpendsRemaining)
         pcoinsTip->Uncache(removed);
+    BOOST_FOREACH(const std::shared_ptr<const CTransaction>& tx, vEvicted)
+        AddToCompactExtraTransactions(tx, EXTRA_TXN_EVICTED);
 }
 
 /** Convert CValidationState to a human-readable message for logging */
@@ -1553,6 +1508,18 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
                 __func__, hash.ToString(), FormatStateMessage(state));
         }
 
+        // With -templatefastcheck, also verify against the flags the next
+        // block will be checked with so CreateNewBlock can skip these scripts.
+        if (fTemplateFastCheck) {
+            CBlockHeader nextBlock;
+            nextBlock.nVersion = ComputeBlockVersion(chainActive.Tip(), Params().GetConsensus());
+            nextBlock.nTime = GetAdjustedTime();
+            unsigned int nBlockFlags = GetBlockScriptFlags(nextBlock, chainActive.Tip(), Params().GetConsensus());
+            CValidationState stateDummy;
+            if (CheckInputs(tx, stateDummy, view, true, nBlockFlags, true, txdata))
+                entry.SetScriptsVerified(nBlockFlags);
+        }
+
         // Remove conflicting transactions from the mempool
         BOOST_FOREACH(const CTxMemPool::txiter it, allConflicting)
         {
@@ -1561,6 +1528,7 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
                     hash.ToString(),
                     FormatMoney(nModifiedFees - nConflictingFees),
                     (int)nSize - (int)nConflictingSize);
+            AddToCompactExtraTransactions(it->GetSharedTx(), EXTRA_TXN_REPLACED);
         }
         pool.RemoveStaged(allConflicting, false);
 
@@ -1720,6 +1688,33 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus
     return true;
 }
 
+bool ReadRawBlockFromFile(std::vector<unsigned char>& vchBlock, FILE* file, const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart)
+{
+    // The block is preceded by the message start and its size
+    unsigned char header[8];
+    if (pos.nPos < sizeof(header) || fseek(file, pos.nPos - sizeof(header), SEEK_SET))
+        return error("%s: Invalid block position %s", __func__, pos.ToString());
+    if (fread(header, 1, sizeof(header), file) != sizeof(header))
+        return error("%s: I/O error at %s", __func__, pos.ToString());
+    if (memcmp(header, messageStart, MESSAGE_START_SIZE))
+        return error("%s: Block magic mismatch at %s", __func__, pos.ToString());
+    unsigned int nSize = ReadLE32(header + MESSAGE_START_SIZE);
+    if (nSize > MAX_BLOCK_SERIALIZED_SIZE)
+        return error("%s: Block too large (%u bytes) at %s", __func__, nSize, pos.ToString());
+    vchBlock.resize(nSize);
+    if (fread(vchBlock.data(), 1, nSize, file) != nSize)
+        return error("%s: I/O error at %s", __func__, pos.ToString());
+    return true;
+}
+
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& vchBlock, const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart)
+{
+    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return error("%s: OpenBlockFile failed for %s", __func__, pos.ToString());
+    return ReadRawBlockFromFile(vchBlock, filein.Get(), pos, messageStart);
+}
+
 CAmount GetBlockSubsidy(int nHeight, const Consensus::Params& consensusParams)
 {
     int halvings = nHeight / consensusParams.nSubsidyHalvingInterval;
@@ -2326,8 +2321,42 @@ static int64_t nTimeIndex = 0;
 static int64_t nTimeCallbacks = 0;
 static int64_t nTimeTotal = 0;
 
+unsigned int GetBlockScriptFlags(const CBlockHeader& block, const CBlockIndex* pindexPrev, const Consensus::Params& consensusparams)
+{
+    // BIP16 didn't become active until Apr 1 2012
+    int64_t nBIP16SwitchTime = 1333238400;
+    bool fStrictPayToScriptHash = (block.GetBlockTime() >= nBIP16SwitchTime);
+
+    unsigned int flags = fStrictPayToScriptHash ? SCRIPT_VERIFY_P2SH : SCRIPT_VERIFY_NONE;
+
+    // Start enforcing the DERSIG (BIP66) rules, for block.nVersion=3 blocks,
+    // when 75% of the network has upgraded:
+    if (block.nVersion >= 3 && IsSuperMajority(3, pindexPrev, consensusparams.nMajorityEnforceBlockUpgrade, consensusparams)) {
+        flags |= SCRIPT_VERIFY_DERSIG;
+    }
+
+    // Start enforcing CHECKLOCKTIMEVERIFY, (BIP65) for block.nVersion=4
+    // blocks, when 75% of the network has upgraded:
+    if (block.nVersion >= 4 && IsSuperMajority(4, pindexPrev, consensusparams.nMajorityEnforceBlockUpgrade, consensusparams)) {
+        flags |= SCRIPT_VERIFY_CHECKLOCKTIMEVERIFY;
+    }
+
+    // Start enforcing BIP112 (CHECKSEQUENCEVERIFY) using versionbits logic.
+    if (VersionBitsState(pindexPrev, consensusparams, Consensus::DEPLOYMENT_CSV, versionbitscache) == THRESHOLD_ACTIVE) {
+        flags |= SCRIPT_VERIFY_CHECKSEQUENCEVERIFY;
+    }
+
+    // Start enforcing WITNESS rules using versionbits logic.
+    if (IsWitnessEnabled(pindexPrev, consensusparams)) {
+        flags |= SCRIPT_VERIFY_WITNESS;
+        flags |= SCRIPT_VERIFY_NULLDUMMY;
+    }
+
+    return flags;
+}
+
 bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex,
-                  CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck)
+                  CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck, const CTxMemPool* pVerifiedPool)
 {
     AssertLockHeld(cs_main);
 
@@ -2430,37 +2459,14 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         }
     }
 
-    // BIP16 didn't become active until Apr 1 2012
-    int64_t nBIP16SwitchTime = 1333238400;
-    bool fStrictPayToScriptHash = (pindex->GetBlockTime() >= nBIP16SwitchTime);
-
-    unsigned int flags = fStrictPayToScriptHash ? SCRIPT_VERIFY_P2SH : SCRIPT_VERIFY_NONE;
+    unsigned int flags = GetBlockScriptFlags(block, pindex->pprev, chainparams.GetConsensus());
 
-    // Start enforcing the DERSIG (BIP66) rules, for block.nVersion=3 blocks,
-    // when 75% of the network has upgraded:
-    if (block.nVersion >= 3 && IsSuperMajority(3, pindex->pprev, chainparams.GetConsensus().nMajorityEnforceBlockUpgrade, chainparams.GetConsensus())) {
-        flags |= SCRIPT_VERIFY_DERSIG;
-    }
-
-    // Start enforcing CHECKLOCKTIMEVERIFY, (BIP65) for block.nVersion=4
-    // blocks, when 75% of the network has upgraded:
-    if (block.nVersion >= 4 && IsSuperMajority(4, pindex->pprev, chainparams.GetConsensus().nMajorityEnforceBlockUpgrade, chainparams.GetConsensus())) {
-        flags |= SCRIPT_VERIFY_CHECKLOCKTIMEVERIFY;
-    }
-
-    // Start enforcing BIP68 (sequence locks) and BIP112 (CHECKSEQUENCEVERIFY) using versionbits logic.
+    // Start enforcing BIP68 (sequence locks) together with BIP112 (CHECKSEQUENCEVERIFY).
     int nLockTimeFlags = 0;
-    if (VersionBitsState(pindex->pprev, chainparams.GetConsensus(), Consensus::DEPLOYMENT_CSV, versionbitscache) == THRESHOLD_ACTIVE) {
-        flags |= SCRIPT_VERIFY_CHECKSEQUENCEVERIFY;
+    if (flags & SCRIPT_VERIFY_CHECKSEQUENCEVERIFY) {
         nLockTimeFlags |= LOCKTIME_VERIFY_SEQUENCE;
     }
 
-    // Start enforcing WITNESS rules using versionbits logic.
-    if (IsWitnessEnabled(pindex->pprev, chainparams.GetConsensus())) {
-        flags |= SCRIPT_VERIFY_WITNESS;
-        flags |= SCRIPT_VERIFY_NULLDUMMY;
-    }
-
     int64_t nTime2 = GetTimeMicros(); nTimeForks += nTime2 - nTime1;
     LogPrint("bench", "    - Fork checks: %.2fms [%.2fs]\n", 0.001 * (nTime2 - nTime1), nTimeForks * 0.000001);
 
@@ -2472,6 +2478,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     std::vector<int> prevheights;
     CAmount nFees = 0;
     int nInputs = 0;
+    int nInputsVerified = 0;
     int64_t nSigOpsCost = 0;
     CDiskTxPos pos(pindex->GetBlockPos(), GetSizeOfCompactSize(block.vtx.size()));
     std::vector<std::pair<uint256, CDiskTxPos> > vPos;
@@ -2500,15 +2507,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             }
 
             // Which orphan pool entries must we evict?
-            for (size_t j = 0; j < tx.vin.size(); j++) {
-                auto itByPrev = mapOrphanTransactionsByPrev.find(tx.vin[j].prevout);
-                if (itByPrev == mapOrphanTransactionsByPrev.end()) continue;
-                for (auto mi = itByPrev->second.begin(); mi != itByPrev->second.end(); ++mi) {
-                    const CTransaction& orphanTx = (*mi)->second.tx;
-                    const uint256& orphanHash = orphanTx.GetHash();
-                    vOrphanErase.push_back(orphanHash);
-                }
-            }
+            orphanPool.AddConflicts(tx, vOrphanErase);
 
             if (!SequenceLocks(tx, nLockTimeFlags, &prevheights, *pindex)) {
                 return state.DoS(100, error("%s: contains a non-BIP68-final transaction", __func__),
@@ -2530,9 +2529,21 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         {
             nFees += view.GetValueIn(tx)-tx.GetValueOut();
 
+            bool fTxScriptChecks = fScriptChecks;
+            if (fTxScriptChecks && pVerifiedPool) {
+                // Inputs already verified against these exact flags when the
+                // transaction entered the pool need not be verified again
+                CTxMemPool::indexed_transaction_set::const_iterator it = pVerifiedPool->mapTx.find(tx.GetHash());
+                if (it != pVerifiedPool->mapTx.end() && it->HasScriptsVerified(flags) &&
+                        it->GetTx().GetWitnessHash() == tx.GetWitnessHash()) {
+                    fTxScriptChecks = false;
+                    nInputsVerified += tx.vin.size();
+                }
+            }
+
             std::vector<CScriptCheck> vChecks;
             bool fCacheResults = fJustCheck; /* Don't cache results if we're actually connecting blocks (still consult the cache, though) */
-            if (!CheckInputs(tx, state, view, fScriptChecks, flags, fCacheResults, txdata[i], nScriptCheckThreads ? &vChecks : NULL))
+            if (!CheckInputs(tx, state, view, fTxScriptChecks, flags, fCacheResults, txdata[i], nScriptCheckThreads ? &vChecks : NULL))
                 return error("ConnectBlock(): CheckInputs on %s failed with %s",
                     tx.GetHash().ToString(), FormatStateMessage(state));
             control.Add(vChecks);
@@ -2560,6 +2571,8 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     if (!control.Wait())
         return state.DoS(100, false);
     int64_t nTime4 = GetTimeMicros(); nTimeVerify += nTime4 - nTime2;
+    if (nInputsVerified > 0)
+        LogPrint("bench", "    - Skipped %u txins already verified in the mempool\n", nInputsVerified);
     LogPrint("bench", "    - Verify %u txins: %.2fms (%.3fms/txin) [%.2fs]\n", nInputs - 1, 0.001 * (nTime4 - nTime2), nInputs <= 1 ? 0 : 0.001 * (nTime4 - nTime2) / (nInputs-1), nTimeVerify * 0.000001);
 
     if (fJustCheck)
@@ -2603,7 +2616,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     if (vOrphanErase.size()) {
         int nErased = 0;
         BOOST_FOREACH(uint256 &orphanHash, vOrphanErase) {
-            nErased += EraseOrphanTx(orphanHash);
+            nErased += orphanPool.Erase(orphanHash);
         }
         LogPrint("mempool", "Erased %d orphan tx included or conflicted by block\n", nErased);
     }
@@ -2743,6 +2756,7 @@ void static UpdateTip(CBlockIndex *pindexNew, const CChainParams& chainParams) {
     nTimeBestReceived = GetTime();
     mempool.AddTransactionsUpdated(1);
 
+    PrecomputeBlockTemplates(pindexNew, nTimeLastBlockReceived);
     cvBlockChange.notify_all();
 
     static bool fWarned = false;
@@ -3832,15 +3846,83 @@ static bool IsSuperMajority(int minVersion, const CBlockIndex* pstart, unsigned
 }
 
 
+/**
+ * Send a block that passed AcceptBlock (header, proof of work, CheckBlock and
+ * ContextualCheckBlock) but is not connected yet as a cmpctblock to the
+ * high-bandwidth compact block peers which have its parent, when it would
+ * become our new tip. Returns the peers it was sent to.
+ */
+static std::vector<NodeId> RelayCompactBlockEarly(const CBlock& block, CBlockIndex* pindex, CNode* pfrom)
+{
+    AssertLockHeld(cs_main);
+    std::vector<NodeId> vRelayedTo;
+    if (IsInitialBlockDownload() || pindex->pprev != chainActive.Tip())
+        return vRelayedTo;
+    // Once a peer gave us an invalid block we relayed early, wait for its
+    // blocks to be connected before passing them on
+    if (pfrom && State(pfrom->GetId())->nEarlyRelayInvalid > 0)
+        return vRelayedTo;
+
+    LOCK(cs_vNodes);
+    BOOST_FOREACH(CNode* pnode, vNodes) {
+        if (pnode == pfrom || !pnode->fSuccessfullyConnected || pnode->fDisconnect)
+            continue;
+        CNodeState &state = *State(pnode->GetId());
+        if (!state.fPreferHeaderAndIDs || PeerHasHeader(&state, pindex) || !PeerHasHeader(&state, pindex->pprev))
+            continue;
+        {
+            LOCK(pnode->cs_inventory);
+            CBlockHeaderAndShortTxIDs cmpctblock(block, state.fWantsCmpctWitness, &pnode->filterInventoryKnown);
+            pnode->PushMessageWithFlag(state.fWantsCmpctWitness ? 0 : SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::CMPCTBLOCK, cmpctblock);
+        }
+        // Keeps SendMessages from announcing it again once it is connected
+        state.pindexBestHeaderSent = pindex;
+        vRelayedTo.push_back(pnode->GetId());
+    }
+    if (!vRelayedTo.empty())
+        LogPrint("cmpctblock", "Relayed block %s to %u peers before validation\n", pindex->GetBlockHash().ToString(), vRelayedTo.size());
+    return vRelayedTo;
+}
+
+/**
+ * Account for a block relayed by RelayCompactBlockEarly at nTimeRelayed once
+ * ActivateBestChain is done with it: credit the peers it was sent to with
+ * the time they got it ahead of the usual announcement, or count it
+ * against the peer it came from if it proved invalid.
+ */
+static void FinishCompactBlockEarlyRelay(const CBlockIndex* pindex, NodeId nodeFrom, const std::vector<NodeId>& vRelayedTo, int64_t nTimeRelayed)
+{
+    AssertLockHeld(cs_main);
+    if (pindex->nStatus & BLOCK_FAILED_MASK) {
+        LogPrintf("Block %s relayed to %u peers before validation is invalid\n", pindex->GetBlockHash().ToString(), vRelayedTo.size());
+        if (CNodeState *state = State(nodeFrom))
+            state->nEarlyRelayInvalid++;
+        return;
+    }
+    if (!chainActive.Contains(pindex))
+        return;
+    int64_t nTimeSaved = GetTimeMicros() - nTimeRelayed;
+    BOOST_FOREACH(NodeId nodeid, vRelayedTo) {
+        if (CNodeState *state = State(nodeid)) {
+            state->nEarlyRelayBlocks++;
+            state->nEarlyRelayTimeSaved += nTimeSaved;
+        }
+    }
+    LogPrint("cmpctblock", "Block %s relayed before validation, %.2fms ahead\n", pindex->GetBlockHash().ToString(), nTimeSaved * 0.001);
+}
+
 bool ProcessNewBlock(CValidationState& state, const CChainParams& chainparams, CNode* pfrom, const CBlock* pblock, bool fForceProcessing, const CDiskBlockPos* dbp, bool fMayBanPeerIfInvalid)
 {
+    CBlockIndex *pindex = NULL;
+    std::vector<NodeId> vEarlyRelayedTo;
+    int64_t nTimeEarlyRelay = 0;
     {
         LOCK(cs_main);
+        nTimeLastBlockReceived = GetTimeMicros();
         bool fRequested = MarkBlockAsReceived(pblock->GetHash());
         fRequested |= fForceProcessing;
 
         // Store to disk
-        CBlockIndex *pindex = NULL;
         bool fNewBlock = false;
         bool ret = AcceptBlock(*pblock, state, chainparams, &pindex, fRequested, dbp, &fNewBlock);
         if (pindex && pfrom) {
@@ -3850,17 +3932,29 @@ bool ProcessNewBlock(CValidationState& state, const CChainParams& chainparams, C
         CheckBlockIndex(chainparams.GetConsensus());
         if (!ret)
             return error("%s: AcceptBlock FAILED", __func__);
+
+        if (fCmpctEarlyRelay && fNewBlock && dbp == NULL) {
+            nTimeEarlyRelay = GetTimeMicros();
+            vEarlyRelayedTo = RelayCompactBlockEarly(*pblock, pindex, pfrom);
+        }
     }
 
     NotifyHeaderTip();
 
-    if (!ActivateBestChain(state, chainparams, pblock))
+    bool fActivated = ActivateBestChain(state, chainparams, pblock);
+
+    if (!vEarlyRelayedTo.empty()) {
+        LOCK(cs_main);
+        FinishCompactBlockEarlyRelay(pindex, pfrom ? pfrom->GetId() : -1, vEarlyRelayedTo, nTimeEarlyRelay);
+    }
+
+    if (!fActivated)
         return error("%s: ActivateBestChain failed", __func__);
 
     return true;
 }
 
-bool TestBlockValidity(CValidationState& state, const CChainParams& chainparams, const CBlock& block, CBlockIndex* pindexPrev, bool fCheckPOW, bool fCheckMerkleRoot)
+bool TestBlockValidity(CValidationState& state, const CChainParams& chainparams, const CBlock& block, CBlockIndex* pindexPrev, bool fCheckPOW, bool fCheckMerkleRoot, const CTxMemPool* pVerifiedPool)
 {
     AssertLockHeld(cs_main);
     assert(pindexPrev && pindexPrev == chainActive.Tip());
@@ -3879,7 +3973,7 @@ bool TestBlockValidity(CValidationState& state, const CChainParams& chainparams,
         return error("%s: Consensus::CheckBlock: %s", __func__, FormatStateMessage(state));
     if (!ContextualCheckBlock(block, state, pindexPrev))
         return error("%s: Consensus::ContextualCheckBlock: %s", __func__, FormatStateMessage(state));
-    if (!ConnectBlock(block, state, &indexDummy, viewNew, chainparams, true))
+    if (!ConnectBlock(block, state, &indexDummy, viewNew, chainparams, true, pVerifiedPool))
         return false;
     assert(state.IsValid());
 
@@ -4363,8 +4457,7 @@ void UnloadBlockIndex()
     pindexBestInvalid = NULL;
     pindexBestHeader = NULL;
     mempool.clear();
-    mapOrphanTransactions.clear();
-    mapOrphanTransactionsByPrev.clear();
+    orphanPool.Clear();
     nSyncStarted = 0;
     mapBlocksUnlinked.clear();
     vinfoBlockFile.clear();
@@ -4814,7 +4907,7 @@ bool static AlreadyHave(const CInv& inv) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
             // requesting or processing some txs which have already been included in a block
             return recentRejects->contains(inv.hash) ||
                    mempool.exists(inv.hash) ||
-                   mapOrphanTransactions.count(inv.hash) ||
+                   orphanPool.Have(inv.hash) ||
                    pcoinsTip->HaveCoinsInCache(inv.hash);
         }
     case MSG_BLOCK:
@@ -4825,153 +4918,226 @@ bool static AlreadyHave(const CInv& inv) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
     return true;
 }
 
+namespace {
+    /**
+     * The "block" messages last served in reply to getdata, without ([0]) and
+     * with ([1]) witness data. Peers fetching a new block mostly ask for the
+     * same one, so it is only read and serialized once for all of them.
+     */
+    CCriticalSection cs_recentBlockMessages;
+    uint256 hashRecentBlockMessages;
+    CSendBuffer recentBlockMessages[2];
+}
+
+static CSendBuffer GetRecentBlockMessage(const uint256& hash, bool fWitness)
+{
+    LOCK(cs_recentBlockMessages);
+    if (hash != hashRecentBlockMessages)
+        return CSendBuffer();
+    return recentBlockMessages[fWitness];
+}
+
+static void SetRecentBlockMessage(const uint256& hash, bool fWitness, const CSendBuffer& msg)
+{
+    LOCK(cs_recentBlockMessages);
+    if (hash != hashRecentBlockMessages) {
+        hashRecentBlockMessages = hash;
+        recentBlockMessages[0].reset();
+        recentBlockMessages[1].reset();
+    }
+    recentBlockMessages[fWitness] = msg;
+}
+
 void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParams)
 {
     std::deque<CInv>::iterator it = pfrom->vRecvGetData.begin();
 
     vector<CInv> vNotFound;
 
-    LOCK(cs_main);
+    // A requested block is only looked up under cs_main; reading it from disk
+    // and serializing it happens after cs_main is released, so peers fetching
+    // old blocks don't stall message processing for everyone else.
+    const CBlockIndex* pindexSend = NULL;
+    CDiskBlockPos posSend;
+    int nSendType = 0;
+    bool fSendCompact = false;
+    bool fPeerWantsWitness = false;
+    uint256 hashContinueTip;
 
-    while (it != pfrom->vRecvGetData.end()) {
-        // Don't bother if send buffer is too full to respond anyway
-        if (pfrom->nSendSize >= SendBufferSize())
-            break;
+    {
+        LOCK(cs_main);
 
-        const CInv &inv = *it;
-        {
-            boost::this_thread::interruption_point();
-            it++;
+        while (it != pfrom->vRecvGetData.end()) {
+            // Don't bother if send buffer is too full to respond anyway
+            if (pfrom->nSendSize >= SendBufferSize())
+                break;
 
-            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK || inv.type == MSG_CMPCT_BLOCK || inv.type == MSG_WITNESS_BLOCK)
+            const CInv &inv = *it;
             {
-                bool send = false;
-                BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
-                if (mi != mapBlockIndex.end())
+                boost::this_thread::interruption_point();
+                it++;
+
+                if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK || inv.type == MSG_CMPCT_BLOCK || inv.type == MSG_WITNESS_BLOCK)
                 {
-                    if (chainActive.Contains(mi->second)) {
-                        send = true;
-                    } else {
-                        static const int nOneMonth = 30 * 24 * 60 * 60;
-                        // To prevent fingerprinting attacks, only send blocks outside of the active
-                        // chain if they are valid, and no more than a month older (both in time, and in
-                        // best equivalent proof of work) than the best header chain we know about.
-                        send = mi->second->IsValid(BLOCK_VALID_SCRIPTS) && (pindexBestHeader != NULL) &&
-                            (pindexBestHeader->GetBlockTime() - mi->second->GetBlockTime() < nOneMonth) &&
-                            (GetBlockProofEquivalentTime(*pindexBestHeader, *mi->second, *pindexBestHeader, consensusParams) < nOneMonth);
-                        if (!send) {
-                            LogPrintf("%s: ignoring request from peer=%i for old block that isn't in the main chain\n", __func__, pfrom->GetId());
+                    bool send = false;
+                    BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
+                    if (mi != mapBlockIndex.end())
+                    {
+                        if (chainActive.Contains(mi->second)) {
+                            send = true;
+                        } else {
+                            static const int nOneMonth = 30 * 24 * 60 * 60;
+                            // To prevent fingerprinting attacks, only send blocks outside of the active
+                            // chain if they are valid, and no more than a month older (both in time, and in
+                            // best equivalent proof of work) than the best header chain we know about.
+                            send = mi->second->IsValid(BLOCK_VALID_SCRIPTS) && (pindexBestHeader != NULL) &&
+                                (pindexBestHeader->GetBlockTime() - mi->second->GetBlockTime() < nOneMonth) &&
+                                (GetBlockProofEquivalentTime(*pindexBestHeader, *mi->second, *pindexBestHeader, consensusParams) < nOneMonth);
+                            if (!send) {
+                                LogPrintf("%s: ignoring request from peer=%i for old block that isn't in the main chain\n", __func__, pfrom->GetId());
+                            }
                         }
                     }
-                }
-                // disconnect node in case we have reached the outbound limit for serving historical blocks
-                // never disconnect whitelisted nodes
-                static const int nOneWeek = 7 * 24 * 60 * 60; // assume > 1 week = historical
-                if (send && CNode::OutboundTargetReached(true) && ( ((pindexBestHeader != NULL) && (pindexBestHeader->GetBlockTime() - mi->second->GetBlockTime() > nOneWeek)) || inv.type == MSG_FILTERED_BLOCK) && !pfrom->fWhitelisted)
-                {
-                    LogPrint("net", "historical block serving limit reached, disconnect peer=%d\n", pfrom->GetId());
+                    // disconnect node in case we have reached the outbound limit for serving historical blocks
+                    // never disconnect whitelisted nodes
+                    static const int nOneWeek = 7 * 24 * 60 * 60; // assume > 1 week = historical
+                    if (send && CNode::OutboundTargetReached(true) && ( ((pindexBestHeader != NULL) && (pindexBestHeader->GetBlockTime() - mi->second->GetBlockTime() > nOneWeek)) || inv.type == MSG_FILTERED_BLOCK) && !pfrom->fWhitelisted)
+                    {
+                        LogPrint("net", "historical block serving limit reached, disconnect peer=%d\n", pfrom->GetId());
 
-                    //disconnect node
-                    pfrom->fDisconnect = true;
-                    send = false;
-                }
-                // Pruned nodes may have deleted the block, so check whether
-                // it's available before trying to send.
-                if (send && (mi->second->nStatus & BLOCK_HAVE_DATA))
-                {
-                    // Send block from disk
-                    CBlock block;
-                    if (!ReadBlockFromDisk(block, (*mi).second, consensusParams))
-                        assert(!"cannot load block from disk");
-                    if (inv.type == MSG_BLOCK)
-                        pfrom->PushMessageWithFlag(SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::BLOCK, block);
-                    else if (inv.type == MSG_WITNESS_BLOCK)
-                        pfrom->PushMessage(NetMsgType::BLOCK, block);
-                    else if (inv.type == MSG_FILTERED_BLOCK)
+                        //disconnect node
+                        pfrom->fDisconnect = true;
+                        send = false;
+                    }
+                    // Pruned nodes may have deleted the block, so check whether
+                    // it's available before trying to send.
+                    if (send && (mi->second->nStatus & BLOCK_HAVE_DATA))
                     {
-                        bool send = false;
-                        CMerkleBlock merkleBlock;
+                        pindexSend = mi->second;
+                        posSend = pindexSend->GetBlockPos();
+                        nSendType = inv.type;
+                        if (inv.type == MSG_CMPCT_BLOCK) {
+                            // If a peer is asking for old blocks, we're almost guaranteed
+                            // they wont have a useful mempool to match against a compact block,
+                            // and we don't feel like constructing the object for them, so
+                            // instead we respond with the full, non-compact block.
+                            fPeerWantsWitness = State(pfrom->GetId())->fWantsCmpctWitness;
+                            fSendCompact = CanDirectFetch(consensusParams) && mi->second->nHeight >= chainActive.Height() - MAX_CMPCTBLOCK_DEPTH;
+                        }
+
+                        // Trigger the peer node to send a getblocks request for the next batch of inventory
+                        if (inv.hash == pfrom->hashContinue)
                         {
-                            LOCK(pfrom->cs_filter);
-                            if (pfrom->pfilter) {
-                                send = true;
-                                merkleBlock = CMerkleBlock(block, *pfrom->pfilter);
-                            }
+                            hashContinueTip = chainActive.Tip()->GetBlockHash();
+                            pfrom->hashContinue.SetNull();
                         }
-                        if (send) {
-                            pfrom->PushMessage(NetMsgType::MERKLEBLOCK, merkleBlock);
-                            // CMerkleBlock just contains hashes, so also push any transactions in the block the client did not see
-                            // This avoids hurting performance by pointlessly requiring a round-trip
-                            // Note that there is currently no way for a node to request any single transactions we didn't send here -
-                            // they must either disconnect and retry or request the full block.
-                            // Thus, the protocol spec specified allows for us to provide duplicate txn here,
-                            // however we MUST always provide at least what the remote peer needs
-                            typedef std::pair<unsigned int, uint256> PairType;
-                            BOOST_FOREACH(PairType& pair, merkleBlock.vMatchedTxn)
-                                pfrom->PushMessageWithFlag(SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::TX, block.vtx[pair.first]);
+                    }
+                }
+                else if (inv.type == MSG_TX || inv.type == MSG_WITNESS_TX)
+                {
+                    // Send stream from relay memory
+                    bool push = false;
+                    auto mi = mapRelay.find(inv.hash);
+                    if (mi != mapRelay.end()) {
+                        pfrom->PushMessageWithFlag(inv.type == MSG_TX ? SERIALIZE_TRANSACTION_NO_WITNESS : 0, NetMsgType::TX, *mi->second);
+                        push = true;
+                    } else if (pfrom->timeLastMempoolReq) {
+                        auto txinfo = mempool.info(inv.hash);
+                        // To protect privacy, do not answer getdata using the mempool when
+                        // that TX couldn't have been INVed in reply to a MEMPOOL request.
+                        if (txinfo.tx && txinfo.nTime <= pfrom->timeLastMempoolReq) {
+                            pfrom->PushMessageWithFlag(inv.type == MSG_TX ? SERIALIZE_TRANSACTION_NO_WITNESS : 0, NetMsgType::TX, *txinfo.tx);
+                            push = true;
                         }
-                        // else
-                            // no response
                     }
-                    else if (inv.type == MSG_CMPCT_BLOCK)
-                    {
-                        // If a peer is asking for old blocks, we're almost guaranteed
-                        // they wont have a useful mempool to match against a compact block,
-                        // and we don't feel like constructing the object for them, so
-                        // instead we respond with the full, non-compact block.
-                        bool fPeerWantsWitness = State(pfrom->GetId())->fWantsCmpctWitness;
-                        if (CanDirectFetch(consensusParams) && mi->second->nHeight >= chainActive.Height() - MAX_CMPCTBLOCK_DEPTH) {
-                            CBlockHeaderAndShortTxIDs cmpctblock(block, fPeerWantsWitness);
-                            pfrom->PushMessageWithFlag(fPeerWantsWitness ? 0 : SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::CMPCTBLOCK, cmpctblock);
-                        } else
-                            pfrom->PushMessageWithFlag(fPeerWantsWitness ? 0 : SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::BLOCK, block);
+                    if (!push) {
+                        vNotFound.push_back(inv);
                     }
+                }
 
-                    // Trigger the peer node to send a getblocks request for the next batch of inventory
-                    if (inv.hash == pfrom->hashContinue)
-                    {
-                        // Bypass PushInventory, this must send even if redundant,
-                        // and we want it right after the last block so they don't
-                        // wait for other stuff first.
-                        vector<CInv> vInv;
-                        vInv.push_back(CInv(MSG_BLOCK, chainActive.Tip()->GetBlockHash()));
-                        pfrom->PushMessage(NetMsgType::INV, vInv);
-                        pfrom->hashContinue.SetNull();
-                    }
+                // Track requests for our stuff.
+                GetMainSignals().Inventory(inv.hash);
+
+                if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK || inv.type == MSG_CMPCT_BLOCK || inv.type == MSG_WITNESS_BLOCK)
+                    break;
+            }
+        }
+
+        pfrom->vRecvGetData.erase(pfrom->vRecvGetData.begin(), it);
+    }
+
+    if (pindexSend)
+    {
+        // Full blocks are sent as a shared message, so peers fetching the
+        // same block don't each read, serialize and checksum it again.
+        bool fFullBlock = nSendType == MSG_BLOCK || nSendType == MSG_WITNESS_BLOCK || (nSendType == MSG_CMPCT_BLOCK && !fSendCompact);
+        bool fWitness = nSendType == MSG_WITNESS_BLOCK || (nSendType == MSG_CMPCT_BLOCK && fPeerWantsWitness);
+        CSendBuffer msgBlock;
+        if (fFullBlock)
+            msgBlock = GetRecentBlockMessage(pindexSend->GetBlockHash(), fWitness);
+
+        // Send block from disk
+        CBlock block;
+        if (!msgBlock && (!ReadBlockFromDisk(block, posSend, consensusParams) || block.GetHash() != pindexSend->GetBlockHash())) {
+            // Pruning may have deleted the block since cs_main was released
+            LOCK(cs_main);
+            if (pindexSend->nStatus & BLOCK_HAVE_DATA)
+                assert(!"cannot load block from disk");
+        } else {
+            if (fFullBlock)
+            {
+                if (!msgBlock) {
+                    // Block serialization depends on the witness flag, not on the peer's protocol version
+                    msgBlock = CNode::MakeSharedMessage(PROTOCOL_VERSION, fWitness ? 0 : SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::BLOCK, block);
+                    SetRecentBlockMessage(pindexSend->GetBlockHash(), fWitness, msgBlock);
                 }
+                pfrom->PushSharedMessage(NetMsgType::BLOCK, msgBlock);
             }
-            else if (inv.type == MSG_TX || inv.type == MSG_WITNESS_TX)
+            else if (nSendType == MSG_FILTERED_BLOCK)
             {
-                // Send stream from relay memory
-                bool push = false;
-                auto mi = mapRelay.find(inv.hash);
-                if (mi != mapRelay.end()) {
-                    pfrom->PushMessageWithFlag(inv.type == MSG_TX ? SERIALIZE_TRANSACTION_NO_WITNESS : 0, NetMsgType::TX, *mi->second);
-                    push = true;
-                } else if (pfrom->timeLastMempoolReq) {
-                    auto txinfo = mempool.info(inv.hash);
-                    // To protect privacy, do not answer getdata using the mempool when
-                    // that TX couldn't have been INVed in reply to a MEMPOOL request.
-                    if (txinfo.tx && txinfo.nTime <= pfrom->timeLastMempoolReq) {
-                        pfrom->PushMessageWithFlag(inv.type == MSG_TX ? SERIALIZE_TRANSACTION_NO_WITNESS : 0, NetMsgType::TX, *txinfo.tx);
-                        push = true;
+                bool send = false;
+                CMerkleBlock merkleBlock;
+                {
+                    LOCK(pfrom->cs_filter);
+                    if (pfrom->pfilter) {
+                        send = true;
+                        merkleBlock = CMerkleBlock(block, *pfrom->pfilter);
                     }
                 }
-                if (!push) {
-                    vNotFound.push_back(inv);
+                if (send) {
+                    pfrom->PushMessage(NetMsgType::MERKLEBLOCK, merkleBlock);
+                    // CMerkleBlock just contains hashes, so also push any transactions in the block the client did not see
+                    // This avoids hurting performance by pointlessly requiring a round-trip
+                    // Note that there is currently no way for a node to request any single transactions we didn't send here -
+                    // they must either disconnect and retry or request the full block.
+                    // Thus, the protocol spec specified allows for us to provide duplicate txn here,
+                    // however we MUST always provide at least what the remote peer needs
+                    typedef std::pair<unsigned int, uint256> PairType;
+                    BOOST_FOREACH(PairType& pair, merkleBlock.vMatchedTxn)
+                        pfrom->PushMessageWithFlag(SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::TX, block.vtx[pair.first]);
                 }
+                // else
+                    // no response
+            }
+            else if (nSendType == MSG_CMPCT_BLOCK)
+            {
+                LOCK(pfrom->cs_inventory);
+                CBlockHeaderAndShortTxIDs cmpctblock(block, fPeerWantsWitness, &pfrom->filterInventoryKnown);
+                pfrom->PushMessageWithFlag(fPeerWantsWitness ? 0 : SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::CMPCTBLOCK, cmpctblock);
             }
 
-            // Track requests for our stuff.
-            GetMainSignals().Inventory(inv.hash);
-
-            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK || inv.type == MSG_CMPCT_BLOCK || inv.type == MSG_WITNESS_BLOCK)
-                break;
+            if (!hashContinueTip.IsNull())
+            {
+                // Bypass PushInventory, this must send even if redundant,
+                // and we want it right after the last block so they don't
+                // wait for other stuff first.
+                vector<CInv> vInv;
+                vInv.push_back(CInv(MSG_BLOCK, hashContinueTip));
+                pfrom->PushMessage(NetMsgType::INV, vInv);
+            }
         }
     }
 
-    pfrom->vRecvGetData.erase(pfrom->vRecvGetData.begin(), it);
-
     if (!vNotFound.empty()) {
         // Let the peer know that we didn't find what it asked for, so it doesn't
         // have to wait around forever. Currently only SPV clients actually care
@@ -5573,8 +5739,6 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             return true;
         }
 
-        deque<COutPoint> vWorkQueue;
-        vector<uint256> vEraseQueue;
         CTransaction tx;
         vRecv >> tx;
 
@@ -5592,9 +5756,6 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         if (!AlreadyHave(inv) && AcceptToMemoryPool(mempool, state, tx, true, &fMissingInputs)) {
             mempool.check(pcoinsTip);
             RelayTransaction(tx);
-            for (unsigned int i = 0; i < tx.vout.size(); i++) {
-                vWorkQueue.emplace_back(inv.hash, i);
-            }
 
             pfrom->nLastTXTime = GetTime();
 
@@ -5603,65 +5764,9 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                 tx.GetHash().ToString(),
                 mempool.size(), mempool.DynamicMemoryUsage() / 1000);
 
-            // Recursively process any orphan transactions that depended on this one
-            set<NodeId> setMisbehaving;
-            while (!vWorkQueue.empty()) {
-                auto itByPrev = mapOrphanTransactionsByPrev.find(vWorkQueue.front());
-                vWorkQueue.pop_front();
-                if (itByPrev == mapOrphanTransactionsByPrev.end())
-                    continue;
-                for (auto mi = itByPrev->second.begin();
-                     mi != itByPrev->second.end();
-                     ++mi)
-                {
-                    const CTransaction& orphanTx = (*mi)->second.tx;
-                    const uint256& orphanHash = orphanTx.GetHash();
-                    NodeId fromPeer = (*mi)->second.fromPeer;
-                    bool fMissingInputs2 = false;
-                    // Use a dummy CValidationState so someone can't setup nodes to counter-DoS based on orphan
-                    // resolution (that is, feeding people an invalid transaction based on LegitTxX in order to get
-                    // anyone relaying LegitTxX banned)
-                    CValidationState stateDummy;
-
-
-                    if (setMisbehaving.count(fromPeer))
-                        continue;
-                    if (AcceptToMemoryPool(mempool, stateDummy, orphanTx, true, &fMissingInputs2)) {
-                        LogPrint("mempool", "   accepted orphan tx %s\n", orphanHash.ToString());
-                        RelayTransaction(orphanTx);
-                        for (unsigned int i = 0; i < orphanTx.vout.size(); i++) {
-                            vWorkQueue.emplace_back(orphanHash, i);
-                        }
-                        vEraseQueue.push_back(orphanHash);
-                    }
-                    else if (!fMissingInputs2)
-                    {
-                        int nDos = 0;
-                        if (stateDummy.IsInvalid(nDos) && nDos > 0)
-                        {
-                            // Punish peer that gave us an invalid orphan tx
-                            Misbehaving(fromPeer, nDos);
-                            setMisbehaving.insert(fromPeer);
-                            LogPrint("mempool", "   invalid orphan tx %s\n", orphanHash.ToString());
-                        }
-                        // Has inputs but not accepted to mempool
-                        // Probably non-standard or insufficient fee/priority
-                        LogPrint("mempool", "   removed orphan tx %s\n", orphanHash.ToString());
-                        vEraseQueue.push_back(orphanHash);
-                        if (orphanTx.wit.IsNull() && !stateDummy.CorruptionPossible()) {
-                            // Do not use rejection cache for witness transactions or
-                            // witness-stripped transactions, as they can have been malleated.
-                            // See https://github.com/bitcoin/bitcoin/issues/8279 for details.
-                            assert(recentRejects);
-                            recentRejects->insert(orphanHash);
-                        }
-                    }
-                    mempool.check(pcoinsTip);
-                }
-            }
-
-            BOOST_FOREACH(uint256 hash, vEraseQueue)
-                EraseOrphanTx(hash);
+            // Orphans that depended on this one are retried one at a time
+            // before this peer's next message, see ProcessOrphanWork
+            orphanPool.AddChildrenToWorkSet(tx, pfrom->setOrphanWork);
         }
         else if (fMissingInputs)
         {
@@ -5679,13 +5784,22 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                     pfrom->AddInventoryKnown(_inv);
                     if (!AlreadyHave(_inv)) pfrom->AskFor(_inv);
                 }
-                AddOrphanTx(tx, pfrom->GetId());
+                std::shared_ptr<const CTransaction> ptx = std::make_shared<const CTransaction>(tx);
+                if (orphanPool.Add(ptx, pfrom->GetId(), GetTime() + ORPHAN_TX_EXPIRE_TIME)) {
+                    AddToCompactExtraTransactions(ptx, EXTRA_TXN_ORPHAN);
+                    LogPrint("mempool", "stored orphan tx %s (poolsz %u txn, %u kB)\n", tx.GetHash().ToString(),
+                             orphanPool.size(), orphanPool.DynamicMemoryUsage() / 1000);
+                }
 
-                // DoS prevention: do not allow mapOrphanTransactions to grow unbounded
-                unsigned int nMaxOrphanTx = (unsigned int)std::max((int64_t)0, GetArg("-maxorphantx", DEFAULT_MAX_ORPHAN_TRANSACTIONS));
-                unsigned int nEvicted = LimitOrphanTxSize(nMaxOrphanTx);
+                // DoS prevention: do not allow the orphan pool to grow unbounded
+                int nExpired = orphanPool.Expire(GetTime());
+                if (nExpired > 0)
+                    LogPrint("mempool", "Erased %d orphan tx due to expiration\n", nExpired);
+                size_t nMaxOrphanTx = (size_t)std::max((int64_t)0, GetArg("-maxorphantx", DEFAULT_MAX_ORPHAN_TRANSACTIONS));
+                size_t nMaxOrphanUsage = (size_t)std::max((int64_t)0, GetArg("-maxorphanpoolsize", DEFAULT_MAX_ORPHAN_POOL_SIZE)) * 1000000;
+                int nEvicted = orphanPool.LimitSize(nMaxOrphanTx, nMaxOrphanUsage);
                 if (nEvicted > 0)
-                    LogPrint("mempool", "mapOrphan overflow, removed %u tx\n", nEvicted);
+                    LogPrint("mempool", "orphan pool overflow, removed %d tx\n", nEvicted);
             } else {
                 LogPrint("mempool", "not keeping orphan with rejected parents %s\n",tx.GetHash().ToString());
             }
@@ -5815,7 +5929,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                 }
 
                 PartiallyDownloadedBlock& partialBlock = *(*queuedBlockIt)->partialBlock;
-                ReadStatus status = partialBlock.InitData(cmpctblock);
+                ReadStatus status = partialBlock.InitData(cmpctblock, vExtraTxnForCompact);
                 if (status == READ_STATUS_INVALID) {
                     MarkBlockAsReceived(pindex->GetBlockHash()); // Reset in-flight state in case of whitelist
                     Misbehaving(pfrom->GetId(), 100);
@@ -5828,6 +5942,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                     pfrom->PushMessage(NetMsgType::GETDATA, vInv);
                     return true;
                 }
+                CountCompactExtraTransactionHits(partialBlock);
 
                 if (!fAlreadyInFlight && mapBlocksInFlight.size() == 1 && pindex->pprev->IsValid(BLOCK_VALID_CHAIN)) {
                     // We seem to be rather well-synced, so it appears pfrom was the first to provide us
@@ -5858,7 +5973,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                 // Optimistically try to reconstruct anyway since we might be
                 // able to without any round trips.
                 PartiallyDownloadedBlock tempBlock(&mempool);
-                ReadStatus status = tempBlock.InitData(cmpctblock);
+                ReadStatus status = tempBlock.InitData(cmpctblock, vExtraTxnForCompact);
                 if (status != READ_STATUS_OK) {
                     // TODO: don't ignore failures
                     return true;
@@ -5867,6 +5982,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                 status = tempBlock.FillBlock(block, dummy);
                 if (status == READ_STATUS_OK) {
                     fBlockReconstructed = true;
+                    CountCompactExtraTransactionHits(tempBlock);
                 }
             }
         } else {
@@ -6174,7 +6290,10 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         }
         pfrom->fSentAddr = true;
 
-        pfrom->vAddrToSend.clear();
+        {
+            LOCK(pfrom->cs_vAddrToSend);
+            pfrom->vAddrToSend.clear();
+        }
         vector<CAddress> vAddr = addrman.GetAddr();
         BOOST_FOREACH(const CAddress &addr, vAddr)
             pfrom->PushAddress(addr);
@@ -6389,6 +6508,62 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
 }
 
 // requires LOCK(cs_vRecvMsg)
+/**
+ * Retry the orphans in pfrom's work set until one is accepted or rejected,
+ * queueing the children of an accepted one in turn. Stopping there keeps the
+ * work done per call bounded however long the chain of orphans is.
+ */
+static void ProcessOrphanWork(CNode* pfrom) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+{
+    while (!pfrom->setOrphanWork.empty()) {
+        const uint256 orphanHash = *pfrom->setOrphanWork.begin();
+        pfrom->setOrphanWork.erase(pfrom->setOrphanWork.begin());
+
+        NodeId fromPeer;
+        std::shared_ptr<const CTransaction> porphanTx = orphanPool.Get(orphanHash, &fromPeer);
+        if (!porphanTx)
+            continue;
+        const CTransaction& orphanTx = *porphanTx;
+        bool fMissingInputs2 = false;
+        // Use a dummy CValidationState so someone can't setup nodes to counter-DoS based on orphan
+        // resolution (that is, feeding people an invalid transaction based on LegitTxX in order to get
+        // anyone relaying LegitTxX banned)
+        CValidationState stateDummy;
+
+        if (AcceptToMemoryPool(mempool, stateDummy, orphanTx, true, &fMissingInputs2)) {
+            LogPrint("mempool", "   accepted orphan tx %s\n", orphanHash.ToString());
+            RelayTransaction(orphanTx);
+            orphanPool.AddChildrenToWorkSet(orphanTx, pfrom->setOrphanWork);
+            orphanPool.Erase(orphanHash);
+            mempool.check(pcoinsTip);
+            break;
+        }
+        else if (!fMissingInputs2)
+        {
+            int nDos = 0;
+            if (stateDummy.IsInvalid(nDos) && nDos > 0)
+            {
+                // Punish peer that gave us an invalid orphan tx
+                Misbehaving(fromPeer, nDos);
+                LogPrint("mempool", "   invalid orphan tx %s\n", orphanHash.ToString());
+            }
+            // Has inputs but not accepted to mempool
+            // Probably non-standard or insufficient fee/priority
+            LogPrint("mempool", "   removed orphan tx %s\n", orphanHash.ToString());
+            orphanPool.Erase(orphanHash);
+            if (orphanTx.wit.IsNull() && !stateDummy.CorruptionPossible()) {
+                // Do not use rejection cache for witness transactions or
+                // witness-stripped transactions, as they can have been malleated.
+                // See https://github.com/bitcoin/bitcoin/issues/8279 for details.
+                assert(recentRejects);
+                recentRejects->insert(orphanHash);
+            }
+            mempool.check(pcoinsTip);
+            break;
+        }
+    }
+}
+
 bool ProcessMessages(CNode* pfrom)
 {
     const CChainParams& chainparams = Params();
@@ -6405,12 +6580,31 @@ bool ProcessMessages(CNode* pfrom)
     //
     bool fOk = true;
 
-    if (!pfrom->vRecvGetData.empty())
+    if (!pfrom->vRecvGetData.empty()) {
+        // Serving the rest of an earlier getdata counts as another getdata
+        CLockHoldTimer mainHeld;
+        int64_t nStart = GetTimeMicros();
         ProcessGetData(pfrom, chainparams.GetConsensus());
+        pfrom->RecordProcessTime(NetMsgType::GETDATA, GetTimeMicros() - nStart, mainHeld.nHeldMicros);
+    }
+
+    if (!pfrom->setOrphanWork.empty()) {
+        // Retrying orphans is charged to the tx message that made them ready
+        CLockHoldTimer mainHeld;
+        int64_t nStart = GetTimeMicros();
+        {
+            LOCK(cs_main);
+            ProcessOrphanWork(pfrom);
+        }
+        pfrom->RecordProcessTime(NetMsgType::TX, GetTimeMicros() - nStart, mainHeld.nHeldMicros);
+    }
 
     // this maintains the order of responses
     if (!pfrom->vRecvGetData.empty()) return fOk;
 
+    // transactions from this peer may depend on the orphans still to be retried
+    if (!pfrom->setOrphanWork.empty()) return fOk;
+
     std::deque<CNetMessage>::iterator it = pfrom->vRecvMsg.begin();
     while (!pfrom->fDisconnect && it != pfrom->vRecvMsg.end()) {
         // Don't bother if send buffer is too full to respond anyway
@@ -6464,6 +6658,8 @@ bool ProcessMessages(CNode* pfrom)
 
         // Process message
         bool fRet = false;
+        CLockHoldTimer mainHeld;
+        int64_t nProcessStart = GetTimeMicros();
         try
         {
             fRet = ProcessMessage(pfrom, strCommand, vRecv, msg.nTime, chainparams);
@@ -6501,6 +6697,8 @@ bool ProcessMessages(CNode* pfrom)
             PrintExceptionContinue(NULL, "ProcessMessages()");
         }
 
+        pfrom->RecordProcessTime(strCommand, GetTimeMicros() - nProcessStart, mainHeld.nHeldMicros);
+
         if (!fRet)
             LogPrintf("%s(%s, %u bytes) FAILED peer=%d\n", __func__, SanitizeString(strCommand), nMessageSize, pfrom->id);
 
@@ -6509,27 +6707,15 @@ bool ProcessMessages(CNode* pfrom)
 
     // In case the connection got shut down, its receive buffer was wiped
     if (!pfrom->fDisconnect)
-        pfrom->vRecvMsg.erase(pfrom->vRecvMsg.begin(), it);
+        pfrom->ReleaseRecvMessages(it);
 
     return fOk;
 }
 
-class CompareInvMempoolOrder
+void RelayTransaction(const CTransaction& tx)
 {
-    CTxMemPool *mp;
-public:
-    CompareInvMempoolOrder(CTxMemPool *mempool)
-    {
-        mp = mempool;
-    }
-
-    bool operator()(std::set<uint256>::iterator a, std::set<uint256>::iterator b)
-    {
-        /* As std::make_heap produces a max-heap, we want the entries with the
-         * fewest ancestors/highest fee to sort later. */
-        return mp->CompareDepthAndScore(*b, *a);
-    }
-};
+    txRelay.Queue(tx.GetHash());
+}
 
 bool SendMessages(CNode* pto)
 {
@@ -6592,27 +6778,27 @@ bool SendMessages(CNode* pto)
         if (pto->nNextAddrSend < nNow) {
             pto->nNextAddrSend = PoissonNextSend(nNow, AVG_ADDRESS_BROADCAST_INTERVAL);
             vector<CAddress> vAddr;
-            vAddr.reserve(pto->vAddrToSend.size());
-            BOOST_FOREACH(const CAddress& addr, pto->vAddrToSend)
             {
-                if (!pto->addrKnown.contains(addr.GetKey()))
+                // Other peers' message handlers may be relaying addresses to pto
+                LOCK(pto->cs_vAddrToSend);
+                vAddr.reserve(pto->vAddrToSend.size());
+                BOOST_FOREACH(const CAddress& addr, pto->vAddrToSend)
                 {
-                    pto->addrKnown.insert(addr.GetKey());
-                    vAddr.push_back(addr);
-                    // receiver rejects addr messages larger than 1000
-                    if (vAddr.size() >= 1000)
+                    if (!pto->addrKnown.contains(addr.GetKey()))
                     {
-                        pto->PushMessage(NetMsgType::ADDR, vAddr);
-                        vAddr.clear();
+                        pto->addrKnown.insert(addr.GetKey());
+                        vAddr.push_back(addr);
                     }
                 }
+                pto->vAddrToSend.clear();
+                // we only send the big addr message once
+                if (pto->vAddrToSend.capacity() > 40)
+                    pto->vAddrToSend.shrink_to_fit();
             }
-            pto->vAddrToSend.clear();
+            // receiver rejects addr messages larger than 1000, which
+            // MAX_ADDR_TO_SEND already keeps vAddrToSend within
             if (!vAddr.empty())
                 pto->PushMessage(NetMsgType::ADDR, vAddr);
-            // we only send the big addr message once
-            if (pto->vAddrToSend.capacity() > 40)
-                pto->vAddrToSend.shrink_to_fit();
         }
 
         CNodeState &state = *State(pto->GetId());
@@ -6743,7 +6929,7 @@ bool SendMessages(CNode* pto)
                     //TODO: Shouldn't need to reload block from disk, but requires refactor
                     CBlock block;
                     assert(ReadBlockFromDisk(block, pBestIndex, consensusParams));
-                    CBlockHeaderAndShortTxIDs cmpctblock(block, state.fWantsCmpctWitness);
+                    CBlockHeaderAndShortTxIDs cmpctblock(block, state.fWantsCmpctWitness, &pto->filterInventoryKnown);
                     pto->PushMessageWithFlag(state.fWantsCmpctWitness ? 0 : SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::CMPCTBLOCK, cmpctblock);
                     state.pindexBestHeaderSent = pBestIndex;
                 } else if (state.fPreferHeaders) {
@@ -6819,7 +7005,7 @@ bool SendMessages(CNode* pto)
             // Time to send but the peer has requested we not relay transactions.
             if (fSendTrickle) {
                 LOCK(pto->cs_filter);
-                if (!pto->fRelayTxes) pto->setInventoryTxToSend.clear();
+                if (!pto->fRelayTxes) state.txRelayCursor = txRelay.GetEndCursor();
             }
 
             // Respond to BIP35 mempool requests
@@ -6837,7 +7023,6 @@ bool SendMessages(CNode* pto)
                 for (const auto& txinfo : vtxinfo) {
                     const uint256& hash = txinfo.tx->GetHash();
                     CInv inv(MSG_TX, hash);
-                    pto->setInventoryTxToSend.erase(hash);
                     if (filterrate) {
                         if (txinfo.feeRate.GetFeePerK() < filterrate)
                             continue;
@@ -6857,67 +7042,68 @@ bool SendMessages(CNode* pto)
 
             // Determine transactions to relay
             if (fSendTrickle) {
-                // Produce a vector with all candidates for sending
-                vector<std::set<uint256>::iterator> vInvTx;
-                vInvTx.reserve(pto->setInventoryTxToSend.size());
-                for (std::set<uint256>::iterator it = pto->setInventoryTxToSend.begin(); it != pto->setInventoryTxToSend.end(); it++) {
-                    vInvTx.push_back(it);
-                }
+                // The transactions queued since the last interval are sorted by
+                // depth and feerate once for all peers; each peer walks the
+                // batches from where it left off.
+                txRelay.Update(mempool, nNow);
+                std::vector<std::shared_ptr<const CTxRelayBatch> > vBatches = txRelay.GetBatches(state.txRelayCursor);
                 CAmount filterrate = 0;
                 {
                     LOCK(pto->cs_feeFilter);
                     filterrate = pto->minFeeFilter;
                 }
-                // Topologically and fee-rate sort the inventory we send for privacy and priority reasons.
-                // A heap is used so that not all items need sorting if only a few are being sent.
-                CompareInvMempoolOrder compareInvMempoolOrder(&mempool);
-                std::make_heap(vInvTx.begin(), vInvTx.end(), compareInvMempoolOrder);
                 // No reason to drain out at many times the network's capacity,
                 // especially since we have many peers and some will draw much shorter delays.
                 unsigned int nRelayedTransactions = 0;
-                LOCK(pto->cs_filter);
-                while (!vInvTx.empty() && nRelayedTransactions < INVENTORY_BROADCAST_MAX) {
-                    // Fetch the top element from the heap
-                    std::pop_heap(vInvTx.begin(), vInvTx.end(), compareInvMempoolOrder);
-                    std::set<uint256>::iterator it = vInvTx.back();
-                    vInvTx.pop_back();
-                    uint256 hash = *it;
-                    // Remove it from the to-be-sent set
-                    pto->setInventoryTxToSend.erase(it);
-                    // Check if not in the filter already
-                    if (pto->filterInventoryKnown.contains(hash)) {
-                        continue;
-                    }
-                    // Not in the mempool anymore? don't bother sending it.
-                    auto txinfo = mempool.info(hash);
-                    if (!txinfo.tx) {
-                        continue;
+                CTxRelayCursor& cursor = state.txRelayCursor;
+                LOCK2(pto->cs_filter, mempool.cs);
+                for (size_t i = 0; i < vBatches.size() && nRelayedTransactions < INVENTORY_BROADCAST_MAX; i++) {
+                    const CTxRelayBatch& batch = *vBatches[i];
+                    // Batches we fell too far behind on have expired
+                    if (batch.nSequence != cursor.nSequence) {
+                        cursor.nSequence = batch.nSequence;
+                        cursor.nPos = 0;
                     }
-                    if (filterrate && txinfo.feeRate.GetFeePerK() < filterrate) {
-                        continue;
-                    }
-                    if (pto->pfilter && !pto->pfilter->IsRelevantAndUpdate(*txinfo.tx)) continue;
-                    // Send
-                    vInv.push_back(CInv(MSG_TX, hash));
-                    nRelayedTransactions++;
-                    {
-                        // Expire old relay messages
-                        while (!vRelayExpiration.empty() && vRelayExpiration.front().first < nNow)
-                        {
-                            mapRelay.erase(vRelayExpiration.front().second);
-                            vRelayExpiration.pop_front();
+                    while (cursor.nPos < batch.vTx.size() && nRelayedTransactions < INVENTORY_BROADCAST_MAX) {
+                        const CTxRelayEntry& entry = batch.vTx[cursor.nPos++];
+                        // Check if not in the filter already
+                        if (pto->filterInventoryKnown.contains(entry.hash)) {
+                            continue;
                         }
+                        // Not in the mempool anymore? don't bother sending it.
+                        if (!mempool.exists(entry.hash)) {
+                            continue;
+                        }
+                        if (filterrate && entry.feeRate.GetFeePerK() < filterrate) {
+                            continue;
+                        }
+                        if (pto->pfilter && !pto->pfilter->IsRelevantAndUpdate(*entry.tx)) continue;
+                        // Send
+                        vInv.push_back(CInv(MSG_TX, entry.hash));
+                        nRelayedTransactions++;
+                        {
+                            // Expire old relay messages
+                            while (!vRelayExpiration.empty() && vRelayExpiration.front().first < nNow)
+                            {
+                                mapRelay.erase(vRelayExpiration.front().second);
+                                vRelayExpiration.pop_front();
+                            }
 
-                        auto ret = mapRelay.insert(std::make_pair(hash, std::move(txinfo.tx)));
-                        if (ret.second) {
-                            vRelayExpiration.push_back(std::make_pair(nNow + 15 * 60 * 1000000, ret.first));
+                            auto ret = mapRelay.insert(std::make_pair(entry.hash, entry.tx));
+                            if (ret.second) {
+                                vRelayExpiration.push_back(std::make_pair(nNow + 15 * 60 * 1000000, ret.first));
+                            }
+                        }
+                        if (vInv.size() == MAX_INV_SZ) {
+                            pto->PushMessage(NetMsgType::INV, vInv);
+                            vInv.clear();
                         }
+                        pto->filterInventoryKnown.insert(entry.hash);
                     }
-                    if (vInv.size() == MAX_INV_SZ) {
-                        pto->PushMessage(NetMsgType::INV, vInv);
-                        vInv.clear();
+                    if (cursor.nPos == batch.vTx.size()) {
+                        cursor.nSequence = batch.nSequence + 1;
+                        cursor.nPos = 0;
                     }
-                    pto->filterInventoryKnown.insert(hash);
                 }
             }
         }
@@ -7044,7 +7230,6 @@ public:
         mapBlockIndex.clear();
 
         // orphan transactions
-        mapOrphanTransactions.clear();
-        mapOrphanTransactionsByPrev.clear();
+        orphanPool.Clear();
     }
 } instance_of_cmaincleanup;
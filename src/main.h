@@ -39,6 +39,7 @@ class CTxMemPool;
 class CValidationInterface;
 class CValidationState;
 
+struct CExtraTxnStats;
 struct PrecomputedTransactionData;
 struct CNodeStateStats;
 struct LockPoints;
@@ -57,10 +58,12 @@ static const CAmount HIGH_TX_FEE_PER_KB = 0.01 * COIN;
 static const CAmount HIGH_MAX_TX_FEE = 100 * HIGH_TX_FEE_PER_KB;
 /** Default for -maxorphantx, maximum number of orphan transactions kept in memory */
 static const unsigned int DEFAULT_MAX_ORPHAN_TRANSACTIONS = 100;
+/** Default for -maxorphanpoolsize, maximum megabytes of orphan transactions kept in memory */
+static const unsigned int DEFAULT_MAX_ORPHAN_POOL_SIZE = 5;
+/** Default for -blockreconstructionextratxn, number of orphan, replaced and evicted transactions kept for compact block reconstruction */
+static const unsigned int DEFAULT_BLOCK_RECONSTRUCTION_EXTRA_TXN = 100;
 /** Expiration time for orphan transactions in seconds */
 static const int64_t ORPHAN_TX_EXPIRE_TIME = 20 * 60;
-/** Minimum time between orphan transactions expire time checks in seconds */
-static const int64_t ORPHAN_TX_EXPIRE_INTERVAL = 5 * 60;
 /** Default for -limitancestorcount, max number of in-mempool ancestors */
 static const unsigned int DEFAULT_ANCESTOR_LIMIT = 25;
 /** Default for -limitancestorsize, maximum kilobytes of tx + all in-mempool ancestors */
@@ -139,6 +142,8 @@ static const bool DEFAULT_TESTSAFEMODE = false;
 static const bool DEFAULT_ENABLE_REPLACEMENT = true;
 /** Default for using fee filter */
 static const bool DEFAULT_FEEFILTER = true;
+/** Default for -cmpctearlyrelay */
+static const bool DEFAULT_CMPCT_EARLY_RELAY = false;
 
 /** Maximum number of headers to announce when relaying blocks with headers message.*/
 static const unsigned int MAX_BLOCKS_TO_ANNOUNCE = 8;
@@ -180,6 +185,8 @@ extern CAmount maxTxFee;
 /** If the tip is older than this (in seconds), the node is considered to be in initial block download. */
 extern int64_t nMaxTipAge;
 extern bool fEnableReplacement;
+/** Whether to announce new blocks to high-bandwidth compact block peers before connecting them */
+extern bool fCmpctEarlyRelay;
 
 /** Best header we've seen so far (used for getheaders queries' starting points). */
 extern CBlockIndex *pindexBestHeader;
@@ -252,6 +259,8 @@ bool ProcessMessages(CNode* pfrom);
  * @param[in]   pto             The node which we are sending messages to.
  */
 bool SendMessages(CNode* pto);
+/** Queue a transaction for announcement to all peers */
+void RelayTransaction(const CTransaction& tx);
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
@@ -296,6 +305,8 @@ void UnlinkPrunedFiles(std::set<int>& setFilesToPrune);
 CBlockIndex * InsertBlockIndex(uint256 hash);
 /** Get statistics from node state */
 bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats);
+/** Get statistics on the transactions kept for compact block reconstruction */
+void GetExtraTxnStats(CExtraTxnStats &stats);
 /** Increase a node's misbehavior score. */
 void Misbehaving(NodeId nodeid, int howmuch);
 /** Flush all state, indexes and buffers to disk. */
@@ -318,6 +329,9 @@ struct CNodeStateStats {
     int nSyncHeight;
     int nCommonHeight;
     std::vector<int> vHeightInFlight;
+    int nEarlyRelayBlocks;
+    int64_t nEarlyRelayTimeSaved;
+    int nEarlyRelayInvalid;
 };
 
 
@@ -443,6 +457,10 @@ public:
 bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams);
+/** Read the serialized block at pos as stored, without decoding or checking it */
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& vchBlock, const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
+/** Like ReadRawBlockFromDisk, from an open block file that is left open */
+bool ReadRawBlockFromFile(std::vector<unsigned char>& vchBlock, FILE* file, const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
 
 /** Functions for validating blocks and updating the block tree */
 
@@ -458,9 +476,15 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIn
 
 /** Apply the effects of this block (with given index) on the UTXO set represented by coins.
  *  Validity checks that depend on the UTXO set are also done; ConnectBlock()
- *  can fail if those validity checks fail (among other reasons). */
+ *  can fail if those validity checks fail (among other reasons).
+ *  If pVerifiedPool is given (with its cs held), scripts of transactions that
+ *  were already verified against the block's flags on entry to that pool are
+ *  not run again. */
 bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins,
-                  const CChainParams& chainparams, bool fJustCheck = false);
+                  const CChainParams& chainparams, bool fJustCheck = false, const CTxMemPool* pVerifiedPool = NULL);
+
+/** Script verification flags for a block with the given header on top of pindexPrev */
+unsigned int GetBlockScriptFlags(const CBlockHeader& block, const CBlockIndex* pindexPrev, const Consensus::Params& consensusparams);
 
 /** Undo the effects of this block (with given index) on the UTXO set represented by coins.
  *  In case pfClean is provided, operation will try to be tolerant about errors, and *pfClean
@@ -468,8 +492,9 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
  *  of problems. Note that in any case, coins may be modified. */
 bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockIndex* pindex, CCoinsViewCache& coins, bool* pfClean = NULL);
 
-/** Check a block is completely valid from start to finish (only works on top of our current best block, with cs_main held) */
-bool TestBlockValidity(CValidationState& state, const CChainParams& chainparams, const CBlock& block, CBlockIndex* pindexPrev, bool fCheckPOW = true, bool fCheckMerkleRoot = true);
+/** Check a block is completely valid from start to finish (only works on top of our current best block, with cs_main held).
+ *  See ConnectBlock() for pVerifiedPool. */
+bool TestBlockValidity(CValidationState& state, const CChainParams& chainparams, const CBlock& block, CBlockIndex* pindexPrev, bool fCheckPOW = true, bool fCheckMerkleRoot = true, const CTxMemPool* pVerifiedPool = NULL);
 
 /** Check whether witness commitments are required for block. */
 bool IsWitnessEnabled(const CBlockIndex* pindexPrev, const Consensus::Params& params);
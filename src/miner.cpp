@@ -6,12 +6,15 @@
 #include "miner.h"
 
 #include "amount.h"
+#include "arith_uint256.h"
 #include "chain.h"
 #include "chainparams.h"
 #include "coins.h"
 #include "consensus/consensus.h"
 #include "consensus/merkle.h"
 #include "consensus/validation.h"
+#include "crypto/common.h"
+#include "crypto/sha256.h"
 #include "hash.h"
 #include "main.h"
 #include "net.h"
@@ -47,6 +50,24 @@ uint64_t nLastBlockTx = 0;
 uint64_t nLastBlockSize = 0;
 uint64_t nLastBlockWeight = 0;
 
+bool fPrecomputeTemplates = DEFAULT_PRECOMPUTE_TEMPLATES;
+bool fTemplateFastCheck = DEFAULT_TEMPLATE_FASTCHECK;
+bool fTemplateBackgroundCheck = DEFAULT_TEMPLATE_BGCHECK;
+
+// Templates precomputed on top of pindexPrecompute, protected by csPrecompute
+static boost::mutex csPrecompute;
+static boost::condition_variable cvPrecompute;
+static const CBlockIndex* pindexPrecompute = NULL;
+static int64_t nPrecomputeReceived = 0;
+static std::unique_ptr<CBlockTemplate> pPrecomputedEmpty;
+static std::unique_ptr<CBlockTemplate> pPrecomputedFull;
+
+// Latest fast-checked template waiting for a full check, protected by csTemplateCheck
+static boost::mutex csTemplateCheck;
+static boost::condition_variable cvTemplateCheck;
+static std::unique_ptr<CBlock> pTemplateToCheck;
+static CBlockIndex* pindexTemplateToCheck = NULL;
+
 class ScoreCompare
 {
 public:
@@ -227,7 +248,7 @@ void BlockAssembler::resetBlock()
     return pblocktemplate.release();
 }*/
 
-CBlockTemplate* BlockAssembler::CreateNewBlock(const CScript& scriptPubKeyIn)
+CBlockTemplate* BlockAssembler::CreateNewBlock(const CScript& scriptPubKeyIn, bool fMempoolTxs)
 {
     resetBlock();
 
@@ -285,12 +306,14 @@ CBlockTemplate* BlockAssembler::CreateNewBlock(const CScript& scriptPubKeyIn)
     // Decide whether to include witness transactions
     fIncludeWitness = IsWitnessEnabled(pindexPrev, chainparams.GetConsensus());
 
-    addPriorityTxs();
-    addPackageTxs();
+    if (fMempoolTxs) {
+        addPriorityTxs();
+        addPackageTxs();
 
-    nLastBlockTx = nBlockTx;
-    nLastBlockSize = nBlockSize;
-    nLastBlockWeight = nBlockWeight;
+        nLastBlockTx = nBlockTx;
+        nLastBlockSize = nBlockSize;
+        nLastBlockWeight = nBlockWeight;
+    }
 
     // Create coinbase transaction.
     CMutableTransaction coinbaseTx;
@@ -337,10 +360,20 @@ CBlockTemplate* BlockAssembler::CreateNewBlock(const CScript& scriptPubKeyIn)
     pblock->nNonce = 0;
     pblocktemplate->vTxSigOpsCost[0] = WITNESS_SCALE_FACTOR * GetLegacySigOpCount(pblock->vtx[0]);
 
+    // With -templatefastcheck, scripts already verified against the same flags
+    // on mempool entry are not run again; the full check is left to
+    // ThreadCheckTemplates.
+    const bool fFastCheck = fTemplateFastCheck && fMempoolTxs;
     CValidationState state;
-    if (!TestBlockValidity(state, chainparams, *pblock, pindexPrev, false, false)) {
+    if (!TestBlockValidity(state, chainparams, *pblock, pindexPrev, false, false, fFastCheck ? &mempool : NULL)) {
         throw std::runtime_error(strprintf("%s: TestBlockValidity failed: %s", __func__, FormatStateMessage(state)));
     }
+    if (fFastCheck && fTemplateBackgroundCheck) {
+        boost::unique_lock<boost::mutex> lock(csTemplateCheck);
+        pTemplateToCheck.reset(new CBlock(*pblock));
+        pindexTemplateToCheck = pindexPrev;
+        cvTemplateCheck.notify_one();
+    }
 
     return pblocktemplate.release();
 }
@@ -753,3 +786,155 @@ void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned
     pblock->vtx[0] = txCoinbase;
     pblock->hashMerkleRoot = BlockMerkleRoot(*pblock);
 }
+
+bool ScanHeaderNonce(CBlockHeader& header, uint32_t nNonceStart, uint32_t nCount, uint64_t& nTries, const std::atomic<bool>* pfAbort)
+{
+    nTries = 0;
+    bool fNegative, fOverflow;
+    arith_uint256 bnTarget;
+    bnTarget.SetCompact(header.nBits, &fNegative, &fOverflow);
+    if (fNegative || fOverflow || bnTarget == 0)
+        return false;
+
+    // Serialized header: nVersion, hashPrevBlock, hashMerkleRoot, nTime, nBits, nNonce
+    unsigned char data[80];
+    WriteLE32(data, header.nVersion);
+    memcpy(data + 4, header.hashPrevBlock.begin(), 32);
+    memcpy(data + 36, header.hashMerkleRoot.begin(), 32);
+    WriteLE32(data + 68, header.nTime);
+    WriteLE32(data + 72, header.nBits);
+
+    CSHA256 midstate;
+    midstate.Write(data, 64);
+    unsigned char* tail = data + 64;
+    unsigned char hash1[CSHA256::OUTPUT_SIZE];
+    uint256 hash;
+
+    for (uint32_t i = 0; i < nCount; i++) {
+        if ((i & 0xfff) == 0 && pfAbort && pfAbort->load(std::memory_order_relaxed))
+            return false;
+        uint32_t nNonce = nNonceStart + i;
+        WriteLE32(tail + 12, nNonce);
+        CSHA256(midstate).Write(tail, 16).Finalize(hash1);
+        CSHA256().Write(hash1, sizeof(hash1)).Finalize(hash.begin());
+        ++nTries;
+        if (UintToArith256(hash) <= bnTarget) {
+            header.nNonce = nNonce;
+            return true;
+        }
+    }
+    return false;
+}
+
+void PrecomputeBlockTemplates(const CBlockIndex* pindexNew, int64_t nTimeReceived)
+{
+    AssertLockHeld(cs_main);
+    if (!fPrecomputeTemplates || IsInitialBlockDownload())
+        return;
+
+    // The empty template does not look at the mempool, so it is built right
+    // here, before the mempool and wallets have caught up with the new tip.
+    CScript scriptDummy = CScript() << OP_TRUE;
+    std::unique_ptr<CBlockTemplate> pempty;
+    try {
+        pempty.reset(BlockAssembler(Params()).CreateNewBlock(scriptDummy, false));
+    } catch (const std::runtime_error& e) {
+        LogPrintf("%s: %s\n", __func__, e.what());
+    }
+    if (pempty && nTimeReceived > 0)
+        LogPrint("bench", "- Precompute empty template: %.2fms since block receipt\n", (GetTimeMicros() - nTimeReceived) * 0.001);
+
+    {
+        boost::unique_lock<boost::mutex> lock(csPrecompute);
+        pindexPrecompute = pindexNew;
+        nPrecomputeReceived = nTimeReceived;
+        pPrecomputedEmpty.swap(pempty);
+        pPrecomputedFull.reset();
+    }
+    cvPrecompute.notify_all();
+}
+
+CBlockTemplate* GetPrecomputedTemplate(const CBlockIndex* pindexPrev, bool& fEmpty)
+{
+    boost::unique_lock<boost::mutex> lock(csPrecompute);
+    if (pindexPrev == NULL || pindexPrev != pindexPrecompute)
+        return NULL;
+    if (pPrecomputedFull) {
+        fEmpty = false;
+        return new CBlockTemplate(*pPrecomputedFull);
+    }
+    if (pPrecomputedEmpty) {
+        fEmpty = true;
+        return new CBlockTemplate(*pPrecomputedEmpty);
+    }
+    return NULL;
+}
+
+void ThreadPrecomputeTemplates()
+{
+    const CBlockIndex* pindexDone = NULL;
+    while (true) {
+        const CBlockIndex* pindexTarget;
+        int64_t nTimeReceived;
+        {
+            boost::unique_lock<boost::mutex> lock(csPrecompute);
+            while (pindexPrecompute == pindexDone)
+                cvPrecompute.wait(lock);
+            pindexTarget = pindexPrecompute;
+            nTimeReceived = nPrecomputeReceived;
+        }
+        pindexDone = pindexTarget;
+
+        std::unique_ptr<CBlockTemplate> pfull;
+        {
+            LOCK(cs_main);
+            // Another block may have been connected while we waited for cs_main
+            if (chainActive.Tip() != pindexTarget)
+                continue;
+            CScript scriptDummy = CScript() << OP_TRUE;
+            try {
+                pfull.reset(BlockAssembler(Params()).CreateNewBlock(scriptDummy));
+            } catch (const std::runtime_error& e) {
+                LogPrintf("%s: %s\n", __func__, e.what());
+                continue;
+            }
+        }
+
+        {
+            boost::unique_lock<boost::mutex> lock(csPrecompute);
+            if (pindexPrecompute != pindexTarget)
+                continue;
+            pPrecomputedFull.swap(pfull);
+        }
+        if (nTimeReceived > 0)
+            LogPrint("bench", "- Precompute full template: %.2fms since block receipt\n", (GetTimeMicros() - nTimeReceived) * 0.001);
+    }
+}
+
+void ThreadCheckTemplates()
+{
+    while (true) {
+        std::unique_ptr<CBlock> pblock;
+        CBlockIndex* pindexPrev;
+        {
+            boost::unique_lock<boost::mutex> lock(csTemplateCheck);
+            while (!pTemplateToCheck)
+                cvTemplateCheck.wait(lock);
+            pblock.swap(pTemplateToCheck);
+            pindexPrev = pindexTemplateToCheck;
+        }
+
+        LOCK(cs_main);
+        // TestBlockValidity only supports blocks built on the current tip
+        if (chainActive.Tip() != pindexPrev)
+            continue;
+        CValidationState state;
+        if (!TestBlockValidity(state, Params(), *pblock, pindexPrev, false, false)) {
+            // The fast path accepted a template the full check rejects; stop
+            // trusting it and make the problem visible.
+            fTemplateFastCheck = false;
+            strMiscWarning = strprintf(_("Warning: a fast-checked block template failed full validation (%s); -templatefastcheck disabled"), FormatStateMessage(state));
+            LogPrintf("%s: %s\n", __func__, strMiscWarning);
+        }
+    }
+}
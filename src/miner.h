@@ -10,6 +10,7 @@
 #include "txmempool.h"
 
 #include <stdint.h>
+#include <atomic>
 #include <memory>
 #include "boost/multi_index_container.hpp"
 #include "boost/multi_index/ordered_index.hpp"
@@ -23,6 +24,18 @@ class CWallet;
 namespace Consensus { struct Params; };
 
 static const bool DEFAULT_PRINTPRIORITY = false;
+static const bool DEFAULT_PRECOMPUTE_TEMPLATES = false;
+static const bool DEFAULT_TEMPLATE_FASTCHECK = false;
+static const bool DEFAULT_TEMPLATE_BGCHECK = true;
+/** Default number of nonce search threads for generate/generatetoaddress (0 = one per core) */
+static const int DEFAULT_GENERATE_THREADS = 1;
+
+/** Build block templates for a new tip in the background (-precomputetemplates) */
+extern bool fPrecomputeTemplates;
+/** Skip scripts already verified in the mempool when checking new templates (-templatefastcheck) */
+extern bool fTemplateFastCheck;
+/** Fully re-check fast-checked templates in the background (-templatebgcheck) */
+extern bool fTemplateBackgroundCheck;
 
 struct CBlockTemplate
 {
@@ -73,7 +86,7 @@ struct modifiedentry_iter {
 // except operating on CTxMemPoolModifiedEntry.
 // TODO: refactor to avoid duplication of this logic.
 struct CompareModifiedEntry {
-    bool operator()(const CTxMemPoolModifiedEntry &a, const CTxMemPoolModifiedEntry &b)
+    bool operator()(const CTxMemPoolModifiedEntry &a, const CTxMemPoolModifiedEntry &b) const
     {
         double f1 = (double)a.nModFeesWithAncestors * b.nSizeWithAncestors;
         double f2 = (double)b.nModFeesWithAncestors * a.nSizeWithAncestors;
@@ -163,8 +176,9 @@ private:
 
 public:
     BlockAssembler(const CChainParams& chainparams);
-    /** Construct a new block template with coinbase to scriptPubKeyIn */
-    CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn);
+    /** Construct a new block template with coinbase to scriptPubKeyIn.
+     *  If fMempoolTxs is false only the coinbase is included. */
+    CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn, bool fMempoolTxs = true);
 
 private:
     // utility functions
@@ -208,5 +222,30 @@ private:
 /** Modify the extranonce in a block */
 void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce);
 int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev);
+/**
+ * Try nCount nonces starting at nNonceStart until the header hash meets its
+ * own nBits target. The first 64 bytes of the header are hashed once into a
+ * SHA256 midstate, so each attempt only hashes the last 16 bytes plus the
+ * second SHA256 round. On success header.nNonce holds the solution. nTries is
+ * set to the number of hashes computed. The search stops early once pfAbort
+ * is set.
+ */
+bool ScanHeaderNonce(CBlockHeader& header, uint32_t nNonceStart, uint32_t nCount, uint64_t& nTries, const std::atomic<bool>* pfAbort = NULL);
+
+/**
+ * Build the empty template on top of pindexNew and wake the precompute
+ * thread to assemble the full one. Called from UpdateTip with cs_main held;
+ * nTimeReceived is the time (in microseconds) the new block was received.
+ */
+void PrecomputeBlockTemplates(const CBlockIndex* pindexNew, int64_t nTimeReceived);
+/**
+ * Return a copy of the best template precomputed on top of pindexPrev, or
+ * NULL if there is none. fEmpty is set if only the empty template is ready.
+ */
+CBlockTemplate* GetPrecomputedTemplate(const CBlockIndex* pindexPrev, bool& fEmpty);
+/** Assemble full templates for every new tip handed to PrecomputeBlockTemplates */
+void ThreadPrecomputeTemplates();
+/** Run the full TestBlockValidity on templates that were only fast-checked */
+void ThreadCheckTemplates();
 
 #endif // BITCOIN_MINER_H
@@ -25,6 +25,11 @@
 #include <string.h>
 #else
 #include <fcntl.h>
+#include <sys/uio.h>
+#endif
+
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
 #endif
 
 #ifdef USE_UPNP
@@ -91,8 +96,56 @@ static bool vfLimited[NET_MAX] = {};
 static CNode* pnodeLocalHost = NULL;
 uint64_t nLocalHostNonce = 0;
 static std::vector<ListenSocket> vhListenSocket;
+
+#ifdef HAVE_SYS_EPOLL_H
+/** The epoll instance peer and listen sockets are registered with when fSocketEpoll */
+static int hEpoll = -1;
+
+enum {
+    EPOLL_READY_RECV = (1 << 0),
+    EPOLL_READY_SEND = (1 << 1),
+};
+
+/**
+ * Readiness reported by epoll that has not been consumed yet. Peer sockets are
+ * edge-triggered, so a bit stays set until recv()/send() reports that the
+ * kernel buffer is drained/full. Only accessed by ThreadSocketHandler.
+ */
+static std::map<CNode*, int> mapEpollReady;
+#endif
+
+/** Whether ThreadSocketHandler is able to wait on hSocket. */
+static bool IsServiceableSocket(SOCKET hSocket)
+{
+#ifdef HAVE_SYS_EPOLL_H
+    if (hEpoll != -1)
+        return true;
+#endif
+    return IsSelectableSocket(hSocket);
+}
+
+/** Register a new peer's socket with the epoll instance, if in use. */
+static void RegisterNodeSocket(CNode* pnode)
+{
+#ifdef HAVE_SYS_EPOLL_H
+    if (hEpoll == -1)
+        return;
+    // Both directions are watched for the lifetime of the socket; interest is
+    // tracked in mapEpollReady instead of re-arming the kernel on every change
+    // in the node's send/receive buffers.
+    struct epoll_event event = {};
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.ptr = pnode;
+    if (epoll_ctl(hEpoll, EPOLL_CTL_ADD, pnode->hSocket, &event) != 0) {
+        LogPrintf("epoll_ctl failed for peer=%d: %s\n", pnode->id, NetworkErrorString(errno));
+        pnode->fDisconnect = true;
+    }
+#endif
+}
 CAddrMan addrman;
 int nMaxConnections = DEFAULT_MAX_PEER_CONNECTIONS;
+bool fSocketEpoll = false;
+int nMessageHandlerThreads = DEFAULT_MSG_HANDLER_THREADS;
 bool fAddressesInitialized = false;
 std::string strSubVersion;
 
@@ -408,7 +461,7 @@ CNode* ConnectNode(CAddress addrConnect, const char *pszDest, bool fCountFailure
     if (pszDest ? ConnectSocketByName(addrConnect, hSocket, pszDest, Params().GetDefaultPort(), nConnectTimeout, &proxyConnectionFailed) :
                   ConnectSocket(addrConnect, hSocket, nConnectTimeout, &proxyConnectionFailed))
     {
-        if (!IsSelectableSocket(hSocket)) {
+        if (!IsServiceableSocket(hSocket)) {
             LogPrintf("Cannot create connection: non-selectable socket created (fd >= FD_SETSIZE ?)\n");
             CloseSocket(hSocket);
             return NULL;
@@ -440,6 +493,7 @@ CNode* ConnectNode(CAddress addrConnect, const char *pszDest, bool fCountFailure
         CNode* pnode = new CNode(hSocket, addrConnect, pszDest ? pszDest : "", false);
         pnode->AddRef();
 
+        RegisterNodeSocket(pnode);
         {
             LOCK(cs_vNodes);
             vNodes.push_back(pnode);
@@ -489,8 +543,12 @@ void CNode::CloseSocketDisconnect()
 
     // in case this fails, we'll empty the recv buffer when the CNode is deleted
     TRY_LOCK(cs_vRecvMsg, lockRecv);
-    if (lockRecv)
+    if (lockRecv) {
         vRecvMsg.clear();
+        vRecvBufferPool.clear();
+        nRecvQueueMsgs = 0;
+        nRecvQueueBytes = 0;
+    }
 }
 
 void CNode::PushVersion()
@@ -698,6 +756,15 @@ void CNode::copyStats(CNodeStats &stats)
     X(mapSendBytesPerMsgCmd);
     X(nRecvBytes);
     X(mapRecvBytesPerMsgCmd);
+    {
+        LOCK(cs_msgTime);
+        X(mapRecvTimePerMsgCmd);
+        X(sendMessagesTime);
+    }
+    X(nRecvQueueMsgs);
+    X(nRecvQueueBytes);
+    X(nSendQueueMsgs);
+    stats.nSendQueueBytes = nSendSize;
     X(fWhitelisted);
 
     // It is common for nodes with good ping times to suddenly become lagged,
@@ -748,6 +815,21 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes)
             return false;
         }
 
+        // Size the payload buffer as soon as the header is known, taking one
+        // left over from an earlier message if possible
+        if (msg.in_data && msg.vRecv.size() != msg.hdr.nMessageSize) {
+            std::vector<CSerializeData>::iterator itBuf = vRecvBufferPool.begin();
+            while (itBuf != vRecvBufferPool.end() && itBuf->capacity() < msg.hdr.nMessageSize)
+                ++itBuf;
+            if (itBuf == vRecvBufferPool.end() && !vRecvBufferPool.empty())
+                --itBuf;
+            if (itBuf != vRecvBufferPool.end()) {
+                msg.vRecv.swap(*itBuf);
+                vRecvBufferPool.erase(itBuf);
+            }
+            msg.vRecv.resize(msg.hdr.nMessageSize);
+        }
+
         pch += handled;
         nBytes -= handled;
 
@@ -761,6 +843,8 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes)
             assert(i != mapRecvBytesPerMsgCmd.end());
             i->second += msg.hdr.nMessageSize + CMessageHeader::HEADER_SIZE;
 
+            nRecvQueueMsgs++;
+            nRecvQueueBytes += msg.hdr.nMessageSize + CMessageHeader::HEADER_SIZE;
             msg.nTime = GetTimeMicros();
             messageHandlerCondition.notify_one();
         }
@@ -769,26 +853,96 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes)
     return true;
 }
 
-int CNetMessage::readHeader(const char *pch, unsigned int nBytes)
+char* CNode::GetRecvPayloadBuffer(unsigned int& nSpace)
 {
-    // copy data to temporary parsing buffer
-    unsigned int nRemaining = 24 - nHdrPos;
-    unsigned int nCopy = std::min(nRemaining, nBytes);
+    if (vRecvMsg.empty() || !vRecvMsg.back().in_data || vRecvMsg.back().complete())
+        return NULL;
+    CNetMessage& msg = vRecvMsg.back();
+    nSpace = msg.hdr.nMessageSize - msg.nDataPos;
+    return &msg.vRecv[msg.nDataPos];
+}
+
+void CMsgTimeStats::Add(int64_t nMicros, int64_t nMainMicrosIn)
+{
+    nCount++;
+    nTotalMicros += nMicros;
+    nMainMicros += nMainMicrosIn;
+    nMaxMicros = std::max(nMaxMicros, nMicros);
+    int nBucket = 0;
+    while (nBucket < MSG_TIME_BUCKETS - 1 && nMicros >= ((int64_t)1 << nBucket))
+        nBucket++;
+    vBuckets[nBucket]++;
+}
+
+CMsgTimeStats& CMsgTimeStats::operator+=(const CMsgTimeStats& other)
+{
+    nCount += other.nCount;
+    nTotalMicros += other.nTotalMicros;
+    nMainMicros += other.nMainMicros;
+    nMaxMicros = std::max(nMaxMicros, other.nMaxMicros);
+    for (int i = 0; i < MSG_TIME_BUCKETS; i++)
+        vBuckets[i] += other.vBuckets[i];
+    return *this;
+}
 
-    memcpy(&hdrbuf[nHdrPos], pch, nCopy);
-    nHdrPos += nCopy;
+void CNode::RecordProcessTime(const std::string& strCommand, int64_t nMicros, int64_t nMainMicros)
+{
+    // Like the byte counts, only known commands get their own entry
+    const std::string& strKey = mapRecvBytesPerMsgCmd.count(strCommand) ? strCommand : NET_MESSAGE_COMMAND_OTHER;
+    LOCK(cs_msgTime);
+    mapRecvTimePerMsgCmd[strKey].Add(nMicros, nMainMicros);
+}
 
-    // if header incomplete, exit
-    if (nHdrPos < 24)
-        return nCopy;
+void CNode::RecordSendMessagesTime(int64_t nMicros, int64_t nMainMicros)
+{
+    LOCK(cs_msgTime);
+    sendMessagesTime.Add(nMicros, nMainMicros);
+}
 
-    // deserialize to CMessageHeader
-    try {
-        hdrbuf >> hdr;
+void CNode::ReleaseRecvMessages(std::deque<CNetMessage>::iterator itEnd)
+{
+    for (std::deque<CNetMessage>::iterator it = vRecvMsg.begin(); it != itEnd; ++it) {
+        nRecvQueueMsgs--;
+        nRecvQueueBytes -= it->hdr.nMessageSize + CMessageHeader::HEADER_SIZE;
+        if (vRecvBufferPool.size() >= MAX_RECV_POOL_BUFFERS)
+            continue;
+        CSerializeData data;
+        it->vRecv.swap(data);
+        if (data.capacity() == 0 || data.capacity() > MAX_RECV_POOL_BUFFER_SIZE)
+            continue;
+        data.clear();
+        vRecvBufferPool.push_back(CSerializeData());
+        vRecvBufferPool.back().swap(data);
     }
-    catch (const std::exception&) {
-        return -1;
+    vRecvMsg.erase(vRecvMsg.begin(), itEnd);
+}
+
+static void ParseMessageHeader(const char *pch, CMessageHeader& hdr)
+{
+    memcpy(hdr.pchMessageStart, pch, MESSAGE_START_SIZE);
+    memcpy(hdr.pchCommand, pch + MESSAGE_START_SIZE, CMessageHeader::COMMAND_SIZE);
+    hdr.nMessageSize = ReadLE32((const unsigned char*)pch + CMessageHeader::MESSAGE_SIZE_OFFSET);
+    hdr.nChecksum = ReadLE32((const unsigned char*)pch + CMessageHeader::CHECKSUM_OFFSET);
+}
+
+int CNetMessage::readHeader(const char *pch, unsigned int nBytes)
+{
+    unsigned int nRemaining = CMessageHeader::HEADER_SIZE - nHdrPos;
+    unsigned int nCopy = std::min(nRemaining, nBytes);
+
+    if (nHdrPos == 0 && nCopy == CMessageHeader::HEADER_SIZE) {
+        // the whole header is at hand, parse it where it is
+        ParseMessageHeader(pch, hdr);
+    } else {
+        // copy data to temporary parsing buffer
+        memcpy(&hdrbuf[nHdrPos], pch, nCopy);
+        if (nHdrPos + nCopy < CMessageHeader::HEADER_SIZE) {
+            nHdrPos += nCopy;
+            return nCopy;
+        }
+        ParseMessageHeader(hdrbuf, hdr);
     }
+    nHdrPos = CMessageHeader::HEADER_SIZE;
 
     // reject messages larger than MAX_SIZE
     if (hdr.nMessageSize > MAX_SIZE)
@@ -805,12 +959,12 @@ int CNetMessage::readData(const char *pch, unsigned int nBytes)
     unsigned int nRemaining = hdr.nMessageSize - nDataPos;
     unsigned int nCopy = std::min(nRemaining, nBytes);
 
-    if (vRecv.size() < nDataPos + nCopy) {
-        // Allocate up to 256 KiB ahead, but never more than the total message size.
-        vRecv.resize(std::min(hdr.nMessageSize, nDataPos + nCopy + 256 * 1024));
-    }
+    if (vRecv.size() != hdr.nMessageSize)
+        vRecv.resize(hdr.nMessageSize);
 
-    memcpy(&vRecv[nDataPos], pch, nCopy);
+    // the socket may have been read straight into the payload buffer
+    if (pch != &vRecv[nDataPos])
+        memcpy(&vRecv[nDataPos], pch, nCopy);
     nDataPos += nCopy;
 
     return nCopy;
@@ -824,26 +978,65 @@ int CNetMessage::readData(const char *pch, unsigned int nBytes)
 
 
 
+/** Maximum number of queued messages handed to a single sendmsg() call */
+static const size_t MAX_SEND_IOVECS = 64;
+
+/**
+ * Send as much of the queued messages [begin, end) as the socket accepts,
+ * starting nOffset bytes into the first one. Returns what send() would, and
+ * sets nAttempted to the number of bytes handed to the kernel.
+ */
+static int SendQueuedData(SOCKET hSocket, std::deque<CSendBuffer>::const_iterator begin,
+                          std::deque<CSendBuffer>::const_iterator end, size_t nOffset, size_t& nAttempted)
+{
+#ifdef WIN32
+    const CSerializeData &data = **begin;
+    nAttempted = data.size() - nOffset;
+    return send(hSocket, &data[nOffset], data.size() - nOffset, MSG_NOSIGNAL | MSG_DONTWAIT);
+#else
+    // Gather several queued messages into one system call; the buffers
+    // are sent from where they are, possibly shared with other peers.
+    struct iovec iov[MAX_SEND_IOVECS];
+    size_t nIov = 0;
+    nAttempted = 0;
+    for (std::deque<CSendBuffer>::const_iterator it = begin; it != end && nIov < MAX_SEND_IOVECS; ++it, nOffset = 0) {
+        const CSerializeData &data = **it;
+        iov[nIov].iov_base = (void*)&data[nOffset];
+        iov[nIov].iov_len = data.size() - nOffset;
+        nAttempted += iov[nIov].iov_len;
+        nIov++;
+    }
+    struct msghdr msg = {};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = nIov;
+    return sendmsg(hSocket, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+#endif
+}
+
 // requires LOCK(cs_vSend)
 void SocketSendData(CNode *pnode)
 {
-    std::deque<CSerializeData>::iterator it = pnode->vSendMsg.begin();
+    std::deque<CSendBuffer>::iterator it = pnode->vSendMsg.begin();
 
     while (it != pnode->vSendMsg.end()) {
-        const CSerializeData &data = *it;
-        assert(data.size() > pnode->nSendOffset);
-        int nBytes = send(pnode->hSocket, &data[pnode->nSendOffset], data.size() - pnode->nSendOffset, MSG_NOSIGNAL | MSG_DONTWAIT);
+        assert((*it)->size() > pnode->nSendOffset);
+        size_t nAttempted = 0;
+        int nBytes = SendQueuedData(pnode->hSocket, it, pnode->vSendMsg.end(), pnode->nSendOffset, nAttempted);
         if (nBytes > 0) {
             pnode->nLastSend = GetTime();
             pnode->nSendBytes += nBytes;
-            pnode->nSendOffset += nBytes;
             pnode->RecordBytesSent(nBytes);
-            if (pnode->nSendOffset == data.size()) {
+            // Skip over the messages that went out completely
+            size_t nRemaining = nBytes;
+            while (it != pnode->vSendMsg.end() && nRemaining >= (*it)->size() - pnode->nSendOffset) {
+                nRemaining -= (*it)->size() - pnode->nSendOffset;
                 pnode->nSendOffset = 0;
-                pnode->nSendSize -= data.size();
+                pnode->nSendSize -= (*it)->size();
                 it++;
-            } else {
-                // could not send full message; stop sending more
+            }
+            pnode->nSendOffset += nRemaining;
+            if ((size_t)nBytes < nAttempted) {
+                // could not send everything; stop sending more
                 break;
             }
         } else {
@@ -866,6 +1059,86 @@ void SocketSendData(CNode *pnode)
         assert(pnode->nSendSize == 0);
     }
     pnode->vSendMsg.erase(pnode->vSendMsg.begin(), it);
+    pnode->nSendQueueMsgs = pnode->vSendMsg.size();
+}
+
+// requires LOCK(cs_vRecvMsg)
+// Returns true if the socket may still have data pending, false if it was
+// drained or the connection is gone.
+static bool SocketRecvData(CNode *pnode)
+{
+    // typical socket buffer is 8K-64K
+    char pchBuf[0x10000];
+    char *pchDest = pchBuf;
+    unsigned int nSize = sizeof(pchBuf);
+
+    // Read the rest of a large payload straight into its buffer
+    unsigned int nSpace;
+    char *pchPayload = pnode->GetRecvPayloadBuffer(nSpace);
+    if (pchPayload && nSpace >= sizeof(pchBuf)) {
+        pchDest = pchPayload;
+        nSize = nSpace;
+    }
+
+    int nBytes = recv(pnode->hSocket, pchDest, nSize, MSG_DONTWAIT);
+    if (nBytes > 0)
+    {
+        if (!pnode->ReceiveMsgBytes(pchDest, nBytes))
+            pnode->CloseSocketDisconnect();
+        pnode->nLastRecv = GetTime();
+        pnode->nRecvBytes += nBytes;
+        pnode->RecordBytesRecv(nBytes);
+        return (unsigned int)nBytes == nSize && pnode->hSocket != INVALID_SOCKET;
+    }
+    else if (nBytes == 0)
+    {
+        // socket closed gracefully
+        if (!pnode->fDisconnect)
+            LogPrint("net", "socket closed\n");
+        pnode->CloseSocketDisconnect();
+    }
+    else if (nBytes < 0)
+    {
+        // error
+        int nErr = WSAGetLastError();
+        if (nErr == WSAEINTR)
+            return true;
+        if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINPROGRESS)
+        {
+            if (!pnode->fDisconnect)
+                LogPrintf("socket recv error %s\n", NetworkErrorString(nErr));
+            pnode->CloseSocketDisconnect();
+        }
+    }
+    return false;
+}
+
+static void InactivityCheck(CNode *pnode)
+{
+    int64_t nTime = GetTime();
+    if (nTime - pnode->nTimeConnected > 60)
+    {
+        if (pnode->nLastRecv == 0 || pnode->nLastSend == 0)
+        {
+            LogPrint("net", "socket no message in first 60 seconds, %d %d from %d\n", pnode->nLastRecv != 0, pnode->nLastSend != 0, pnode->id);
+            pnode->fDisconnect = true;
+        }
+        else if (nTime - pnode->nLastSend > TIMEOUT_INTERVAL)
+        {
+            LogPrintf("socket sending timeout: %is\n", nTime - pnode->nLastSend);
+            pnode->fDisconnect = true;
+        }
+        else if (nTime - pnode->nLastRecv > (pnode->nVersion > BIP0031_VERSION ? TIMEOUT_INTERVAL : 90*60))
+        {
+            LogPrintf("socket receive timeout: %is\n", nTime - pnode->nLastRecv);
+            pnode->fDisconnect = true;
+        }
+        else if (pnode->nPingNonceSent && pnode->nPingUsecStart + TIMEOUT_INTERVAL * 1000000 < GetTimeMicros())
+        {
+            LogPrintf("ping timeout: %fs\n", 0.000001 * (GetTimeMicros() - pnode->nPingUsecStart));
+            pnode->fDisconnect = true;
+        }
+    }
 }
 
 static std::list<CNode*> vNodesDisconnected;
@@ -1043,7 +1316,7 @@ static void AcceptConnection(const ListenSocket& hListenSocket) {
         return;
     }
 
-    if (!IsSelectableSocket(hSocket))
+    if (!IsServiceableSocket(hSocket))
     {
         LogPrintf("connection from %s dropped: non-selectable socket\n", addr.ToString());
         CloseSocket(hSocket);
@@ -1082,12 +1355,145 @@ static void AcceptConnection(const ListenSocket& hListenSocket) {
 
     LogPrint("net", "connection from %s accepted\n", addr.ToString());
 
+    RegisterNodeSocket(pnode);
     {
         LOCK(cs_vNodes);
         vNodes.push_back(pnode);
     }
 }
 
+#ifdef HAVE_SYS_EPOLL_H
+/**
+ * One round of socket servicing using epoll. Unlike the select() path this
+ * only touches peers whose sockets reported readiness, so its cost does not
+ * grow with the number of idle connections.
+ */
+static void ServiceSocketsEpoll()
+{
+    static const int MAX_EPOLL_EVENTS = 256;
+    static bool fProgress = false;
+    static int64_t nLastInactivityCheck = 0;
+
+    struct epoll_event events[MAX_EPOLL_EVENTS];
+    // Keep going without sleeping while the previous round made progress on
+    // pending readiness; otherwise wait as long as the select() path would.
+    int nEvents = epoll_wait(hEpoll, events, MAX_EPOLL_EVENTS, fProgress ? 0 : 50);
+    boost::this_thread::interruption_point();
+    if (nEvents < 0) {
+        if (errno != EINTR)
+            LogPrintf("socket epoll_wait error %s\n", NetworkErrorString(errno));
+        nEvents = 0;
+    }
+
+    for (int i = 0; i < nEvents; i++) {
+        // Listen sockets are level-triggered; accept one connection per
+        // ready socket per round like the select() path does.
+        bool fListenSocket = false;
+        BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket) {
+            if (events[i].data.ptr == &hListenSocket) {
+                fListenSocket = true;
+                if (hListenSocket.socket != INVALID_SOCKET)
+                    AcceptConnection(hListenSocket);
+            }
+        }
+        if (fListenSocket)
+            continue;
+        int& nReady = mapEpollReady[(CNode*)events[i].data.ptr];
+        if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+            nReady |= EPOLL_READY_RECV;
+        if (events[i].events & (EPOLLOUT | EPOLLERR))
+            nReady |= EPOLL_READY_SEND;
+    }
+
+    std::vector<CNode*> vNodesCopy;
+    {
+        LOCK(cs_vNodes);
+        for (std::map<CNode*, int>::const_iterator it = mapEpollReady.begin(); it != mapEpollReady.end(); ++it) {
+            it->first->AddRef();
+            vNodesCopy.push_back(it->first);
+        }
+    }
+
+    fProgress = false;
+    BOOST_FOREACH(CNode* pnode, vNodesCopy)
+    {
+        boost::this_thread::interruption_point();
+
+        int& nReady = mapEpollReady[pnode];
+        if (pnode->hSocket == INVALID_SOCKET) {
+            nReady = 0;
+            continue;
+        }
+
+        //
+        // Send
+        //
+        bool fSendPending = true;
+        {
+            TRY_LOCK(pnode->cs_vSend, lockSend);
+            if (lockSend) {
+                if (!pnode->vSendMsg.empty() && (nReady & EPOLL_READY_SEND)) {
+                    SocketSendData(pnode);
+                    if (pnode->vSendMsg.empty())
+                        fProgress = true;
+                }
+                // Whatever is left over could not be written because the kernel
+                // buffer is full, and the next EPOLLOUT edge will report when it
+                // drains. Optimistic sends from other threads only ever leave
+                // data behind in that same situation.
+                nReady &= ~EPOLL_READY_SEND;
+                fSendPending = !pnode->vSendMsg.empty();
+            }
+        }
+
+        //
+        // Receive
+        //
+        // As with select(), drain the send buffer before receiving more, and
+        // leave the data in the kernel while the receive buffer is flooded.
+        if ((nReady & EPOLL_READY_RECV) && !fSendPending && pnode->hSocket != INVALID_SOCKET)
+        {
+            TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+            if (lockRecv && (
+                pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete() ||
+                pnode->GetTotalRecvSize() <= ReceiveFloodSize()))
+            {
+                if (SocketRecvData(pnode))
+                    fProgress = true;
+                else
+                    nReady &= ~EPOLL_READY_RECV;
+            }
+        }
+        if (pnode->hSocket == INVALID_SOCKET)
+            nReady = 0;
+    }
+
+    for (std::map<CNode*, int>::iterator it = mapEpollReady.begin(); it != mapEpollReady.end(); ) {
+        if (it->second == 0)
+            mapEpollReady.erase(it++);
+        else
+            ++it;
+    }
+
+    {
+        LOCK(cs_vNodes);
+        BOOST_FOREACH(CNode* pnode, vNodesCopy)
+            pnode->Release();
+    }
+
+    //
+    // Inactivity checking
+    //
+    int64_t nTime = GetTime();
+    if (nTime != nLastInactivityCheck) {
+        nLastInactivityCheck = nTime;
+        LOCK(cs_vNodes);
+        BOOST_FOREACH(CNode* pnode, vNodes)
+            InactivityCheck(pnode);
+    }
+}
+#endif
+
 void ThreadSocketHandler()
 {
     unsigned int nPrevNodeCount = 0;
@@ -1107,6 +1513,9 @@ void ThreadSocketHandler()
                 {
                     // remove from vNodes
                     vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
+#ifdef HAVE_SYS_EPOLL_H
+                    mapEpollReady.erase(pnode);
+#endif
 
                     // release outbound grant (if any)
                     pnode->grantOutbound.Release();
@@ -1156,6 +1565,13 @@ void ThreadSocketHandler()
             uiInterface.NotifyNumConnectionsChanged(nPrevNodeCount);
         }
 
+#ifdef HAVE_SYS_EPOLL_H
+        if (hEpoll != -1) {
+            ServiceSocketsEpoll();
+            continue;
+        }
+#endif
+
         //
         // Find which sockets have data to receive
         //
@@ -1272,39 +1688,7 @@ void ThreadSocketHandler()
             {
                 TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
                 if (lockRecv)
-                {
-                    {
-                        // typical socket buffer is 8K-64K
-                        char pchBuf[0x10000];
-                        int nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
-                        if (nBytes > 0)
-                        {
-                            if (!pnode->ReceiveMsgBytes(pchBuf, nBytes))
-                                pnode->CloseSocketDisconnect();
-                            pnode->nLastRecv = GetTime();
-                            pnode->nRecvBytes += nBytes;
-                            pnode->RecordBytesRecv(nBytes);
-                        }
-                        else if (nBytes == 0)
-                        {
-                            // socket closed gracefully
-                            if (!pnode->fDisconnect)
-                                LogPrint("net", "socket closed\n");
-                            pnode->CloseSocketDisconnect();
-                        }
-                        else if (nBytes < 0)
-                        {
-                            // error
-                            int nErr = WSAGetLastError();
-                            if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS)
-                            {
-                                if (!pnode->fDisconnect)
-                                    LogPrintf("socket recv error %s\n", NetworkErrorString(nErr));
-                                pnode->CloseSocketDisconnect();
-                            }
-                        }
-                    }
-                }
+                    SocketRecvData(pnode);
             }
 
             //
@@ -1322,30 +1706,7 @@ void ThreadSocketHandler()
             //
             // Inactivity checking
             //
-            int64_t nTime = GetTime();
-            if (nTime - pnode->nTimeConnected > 60)
-            {
-                if (pnode->nLastRecv == 0 || pnode->nLastSend == 0)
-                {
-                    LogPrint("net", "socket no message in first 60 seconds, %d %d from %d\n", pnode->nLastRecv != 0, pnode->nLastSend != 0, pnode->id);
-                    pnode->fDisconnect = true;
-                }
-                else if (nTime - pnode->nLastSend > TIMEOUT_INTERVAL)
-                {
-                    LogPrintf("socket sending timeout: %is\n", nTime - pnode->nLastSend);
-                    pnode->fDisconnect = true;
-                }
-                else if (nTime - pnode->nLastRecv > (pnode->nVersion > BIP0031_VERSION ? TIMEOUT_INTERVAL : 90*60))
-                {
-                    LogPrintf("socket receive timeout: %is\n", nTime - pnode->nLastRecv);
-                    pnode->fDisconnect = true;
-                }
-                else if (pnode->nPingNonceSent && pnode->nPingUsecStart + TIMEOUT_INTERVAL * 1000000 < GetTimeMicros())
-                {
-                    LogPrintf("ping timeout: %fs\n", 0.000001 * (GetTimeMicros() - pnode->nPingUsecStart));
-                    pnode->fDisconnect = true;
-                }
-            }
+            InactivityCheck(pnode);
         }
         {
             LOCK(cs_vNodes);
@@ -1849,6 +2210,40 @@ bool OpenNetworkConnection(const CAddress& addrConnect, bool fCountFailure, CSem
 }
 
 
+/** Whether the next message queued for pnode is part of block propagation. */
+static bool HasPriorityMessage(CNode* pnode)
+{
+    TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+    if (!lockRecv || pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete())
+        return false;
+    const std::string strCommand = pnode->vRecvMsg.front().hdr.GetCommand();
+    return strCommand == NetMsgType::CMPCTBLOCK || strCommand == NetMsgType::BLOCKTXN ||
+           strCommand == NetMsgType::GETBLOCKTXN || strCommand == NetMsgType::HEADERS ||
+           strCommand == NetMsgType::BLOCK;
+}
+
+/** Claims a node for the calling message handler thread, if no other thread has. */
+class CMessageHandlerClaim
+{
+private:
+    CNode* pnode;
+    bool fClaimed;
+
+public:
+    CMessageHandlerClaim(CNode* pnodeIn) : pnode(pnodeIn)
+    {
+        fClaimed = !pnode->fInMessageHandler.exchange(true);
+    }
+
+    ~CMessageHandlerClaim()
+    {
+        if (fClaimed)
+            pnode->fInMessageHandler = false;
+    }
+
+    operator bool() const { return fClaimed; }
+};
+
 void ThreadMessageHandler()
 {
     boost::mutex condition_mutex;
@@ -1865,6 +2260,11 @@ void ThreadMessageHandler()
             }
         }
 
+        // Serve peers that have a block-related message waiting first, so
+        // block propagation does not queue up behind other peers' getdata
+        // and transaction traffic.
+        std::stable_partition(vNodesCopy.begin(), vNodesCopy.end(), HasPriorityMessage);
+
         bool fSleep = true;
 
         BOOST_FOREACH(CNode* pnode, vNodesCopy)
@@ -1872,6 +2272,12 @@ void ThreadMessageHandler()
             if (pnode->fDisconnect)
                 continue;
 
+            // With several handler threads, a peer is only ever served by one
+            // of them at a time, which keeps its messages and responses in order.
+            CMessageHandlerClaim claim(pnode);
+            if (!claim)
+                continue;
+
             // Receive messages
             {
                 TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
@@ -1882,7 +2288,7 @@ void ThreadMessageHandler()
 
                     if (pnode->nSendSize < SendBufferSize())
                     {
-                        if (!pnode->vRecvGetData.empty() || (!pnode->vRecvMsg.empty() && pnode->vRecvMsg[0].complete()))
+                        if (!pnode->vRecvGetData.empty() || !pnode->setOrphanWork.empty() || (!pnode->vRecvMsg.empty() && pnode->vRecvMsg[0].complete()))
                         {
                             fSleep = false;
                         }
@@ -1894,8 +2300,12 @@ void ThreadMessageHandler()
             // Send messages
             {
                 TRY_LOCK(pnode->cs_vSend, lockSend);
-                if (lockSend)
+                if (lockSend) {
+                    CLockHoldTimer mainHeld;
+                    int64_t nStart = GetTimeMicros();
                     GetNodeSignals().SendMessages(pnode);
+                    pnode->RecordSendMessagesTime(GetTimeMicros() - nStart, mainHeld.nHeldMicros);
+                }
             }
             boost::this_thread::interruption_point();
         }
@@ -2112,6 +2522,25 @@ void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler)
     if (pnodeLocalHost == NULL)
         pnodeLocalHost = new CNode(INVALID_SOCKET, CAddress(CService("127.0.0.1", 0), nLocalServices));
 
+#ifdef HAVE_SYS_EPOLL_H
+    if (fSocketEpoll && hEpoll == -1) {
+        hEpoll = epoll_create1(EPOLL_CLOEXEC);
+        if (hEpoll == -1) {
+            LogPrintf("epoll_create1 failed (%s), falling back to select()\n", NetworkErrorString(errno));
+        } else {
+            // vhListenSocket does not change after this point, so its elements
+            // can be used to identify listen socket events.
+            BOOST_FOREACH(ListenSocket& hListenSocket, vhListenSocket) {
+                struct epoll_event event = {};
+                event.events = EPOLLIN;
+                event.data.ptr = &hListenSocket;
+                if (epoll_ctl(hEpoll, EPOLL_CTL_ADD, hListenSocket.socket, &event) != 0)
+                    LogPrintf("epoll_ctl failed for listen socket: %s\n", NetworkErrorString(errno));
+            }
+        }
+    }
+#endif
+
     Discover(threadGroup);
 
     //
@@ -2136,7 +2565,8 @@ void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler)
     threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "opencon", &ThreadOpenConnections));
 
     // Process messages
-    threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "msghand", &ThreadMessageHandler));
+    for (int i = 0; i < nMessageHandlerThreads; i++)
+        threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "msghand", &ThreadMessageHandler));
 
     // Dump network addresses
     scheduler.scheduleEvery(&DumpData, DUMP_ADDRESSES_INTERVAL);
@@ -2183,6 +2613,13 @@ public:
         vNodes.clear();
         vNodesDisconnected.clear();
         vhListenSocket.clear();
+#ifdef HAVE_SYS_EPOLL_H
+        mapEpollReady.clear();
+        if (hEpoll != -1) {
+            close(hEpoll);
+            hEpoll = -1;
+        }
+#endif
         delete semOutbound;
         semOutbound = NULL;
         delete pnodeLocalHost;
@@ -2197,16 +2634,6 @@ public:
 instance_of_cnetcleanup;
 
 
-void RelayTransaction(const CTransaction& tx)
-{
-    CInv inv(MSG_TX, tx.GetHash());
-    LOCK(cs_vNodes);
-    BOOST_FOREACH(CNode* pnode, vNodes)
-    {
-        pnode->PushInventory(inv);
-    }
-}
-
 void CNode::RecordBytesRecv(uint64_t bytes)
 {
     LOCK(cs_totalBytesRecv);
@@ -2490,6 +2917,10 @@ CNode::CNode(SOCKET hSocketIn, const CAddress& addrIn, const std::string& addrNa
     fSuccessfullyConnected = false;
     fDisconnect = false;
     nRefCount = 0;
+    fInMessageHandler = false;
+    nRecvQueueMsgs = 0;
+    nRecvQueueBytes = 0;
+    nSendQueueMsgs = 0;
     nSendSize = 0;
     nSendOffset = 0;
     hashContinue = uint256();
@@ -2580,6 +3011,26 @@ void CNode::AskFor(const CInv& inv)
     mapAskFor.insert(std::make_pair(nRequestTime, inv));
 }
 
+/**
+ * Fill in the size and checksum of the message header at the start of ss,
+ * followed by the serialized payload. Returns the payload size.
+ */
+static unsigned int FinalizeMessageHeader(CDataStream& ss)
+{
+    // Set the size
+    unsigned int nSize = ss.size() - CMessageHeader::HEADER_SIZE;
+    WriteLE32((uint8_t*)&ss[CMessageHeader::MESSAGE_SIZE_OFFSET], nSize);
+
+    // Set the checksum
+    uint256 hash = Hash(ss.begin() + CMessageHeader::HEADER_SIZE, ss.end());
+    unsigned int nChecksum = 0;
+    memcpy(&nChecksum, &hash, sizeof(nChecksum));
+    assert(ss.size () >= CMessageHeader::CHECKSUM_OFFSET + sizeof(nChecksum));
+    memcpy((char*)&ss[CMessageHeader::CHECKSUM_OFFSET], &nChecksum, sizeof(nChecksum));
+
+    return nSize;
+}
+
 void CNode::BeginMessage(const char* pszCommand) EXCLUSIVE_LOCK_FUNCTION(cs_vSend)
 {
     ENTER_CRITICAL_SECTION(cs_vSend);
@@ -2616,31 +3067,60 @@ void CNode::EndMessage(const char* pszCommand) UNLOCK_FUNCTION(cs_vSend)
         LEAVE_CRITICAL_SECTION(cs_vSend);
         return;
     }
-    // Set the size
-    unsigned int nSize = ssSend.size() - CMessageHeader::HEADER_SIZE;
-    WriteLE32((uint8_t*)&ssSend[CMessageHeader::MESSAGE_SIZE_OFFSET], nSize);
+    unsigned int nSize = FinalizeMessageHeader(ssSend);
 
     //log total amount of bytes per command
     mapSendBytesPerMsgCmd[std::string(pszCommand)] += nSize + CMessageHeader::HEADER_SIZE;
 
-    // Set the checksum
-    uint256 hash = Hash(ssSend.begin() + CMessageHeader::HEADER_SIZE, ssSend.end());
-    unsigned int nChecksum = 0;
-    memcpy(&nChecksum, &hash, sizeof(nChecksum));
-    assert(ssSend.size () >= CMessageHeader::CHECKSUM_OFFSET + sizeof(nChecksum));
-    memcpy((char*)&ssSend[CMessageHeader::CHECKSUM_OFFSET], &nChecksum, sizeof(nChecksum));
-
     LogPrint("net", "(%d bytes) peer=%d\n", nSize, id);
 
-    std::deque<CSerializeData>::iterator it = vSendMsg.insert(vSendMsg.end(), CSerializeData());
-    ssSend.GetAndClear(*it);
-    nSendSize += (*it).size();
+    std::shared_ptr<CSerializeData> msg = std::make_shared<CSerializeData>();
+    ssSend.GetAndClear(*msg);
+    QueueSendBuffer(msg);
+
+    LEAVE_CRITICAL_SECTION(cs_vSend);
+}
+
+void CNode::BeginSharedMessage(CDataStream& ss, const char* pszCommand)
+{
+    assert(ss.size() == 0);
+    ss << CMessageHeader(Params().MessageStart(), pszCommand, 0);
+}
+
+CSendBuffer CNode::EndSharedMessage(CDataStream& ss)
+{
+    FinalizeMessageHeader(ss);
+    std::shared_ptr<CSerializeData> msg = std::make_shared<CSerializeData>();
+    ss.GetAndClear(*msg);
+    return msg;
+}
+
+void CNode::PushSharedMessage(const char* pszCommand, const CSendBuffer& msg)
+{
+    LOCK(cs_vSend);
+    if (mapArgs.count("-dropmessagestest") && GetRand(GetArg("-dropmessagestest", 2)) == 0)
+    {
+        LogPrint("net", "dropmessages DROPPING SEND MESSAGE\n");
+        return;
+    }
+
+    mapSendBytesPerMsgCmd[std::string(pszCommand)] += msg->size();
+
+    LogPrint("net", "sending: %s (%d bytes, shared) peer=%d\n", SanitizeString(pszCommand), msg->size() - CMessageHeader::HEADER_SIZE, id);
+
+    QueueSendBuffer(msg);
+}
+
+// requires LOCK(cs_vSend)
+void CNode::QueueSendBuffer(const CSendBuffer& msg)
+{
+    vSendMsg.push_back(msg);
+    nSendSize += msg->size();
+    nSendQueueMsgs = vSendMsg.size();
 
     // If write queue empty, attempt "optimistic write"
-    if (it == vSendMsg.begin())
+    if (vSendMsg.size() == 1)
         SocketSendData(this);
-
-    LEAVE_CRITICAL_SECTION(cs_vSend);
 }
 
 //
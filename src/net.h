@@ -19,6 +19,7 @@
 
 #include <atomic>
 #include <deque>
+#include <memory>
 #include <stdint.h>
 
 #ifndef WIN32
@@ -49,6 +50,10 @@ static const unsigned int MAX_INV_SZ = 50000;
 static const unsigned int MAX_ADDR_TO_SEND = 1000;
 /** Maximum length of incoming protocol messages (no message over 4 MB is currently acceptable). */
 static const unsigned int MAX_PROTOCOL_MESSAGE_LENGTH = 4 * 1000 * 1000;
+/** Maximum number of received payload buffers each peer keeps for reuse */
+static const unsigned int MAX_RECV_POOL_BUFFERS = 4;
+/** Larger payload buffers are freed rather than kept for reuse */
+static const unsigned int MAX_RECV_POOL_BUFFER_SIZE = 256 * 1024;
 /** Maximum length of strSubVer in `version` message */
 static const unsigned int MAX_SUBVERSION_LENGTH = 256;
 /** -listen default */
@@ -71,6 +76,12 @@ static const uint64_t DEFAULT_MAX_UPLOAD_TARGET = 0;
 static const bool DEFAULT_BLOCKSONLY = false;
 
 static const bool DEFAULT_FORCEDNSSEED = false;
+/** Default for -socketepoll, waiting on peer sockets with epoll instead of select() */
+static const bool DEFAULT_SOCKET_EPOLL = false;
+/** Default number of message handler threads (-msghandlerthreads) */
+static const int DEFAULT_MSG_HANDLER_THREADS = 1;
+/** Maximum number of message handler threads */
+static const int MAX_MSG_HANDLER_THREADS = 16;
 static const size_t DEFAULT_MAXRECEIVEBUFFER = 5 * 1000;
 static const size_t DEFAULT_MAXSENDBUFFER    = 1 * 1000;
 
@@ -84,6 +95,12 @@ unsigned int SendBufferSize();
 
 typedef int NodeId;
 
+/**
+ * A complete serialized message, header included. Queued messages are never
+ * modified, so one buffer can be queued to any number of peers without copying.
+ */
+typedef std::shared_ptr<const CSerializeData> CSendBuffer;
+
 void AddOneShot(const std::string& strDest);
 void AddressCurrentlyConnected(const CService& addr);
 CNode* FindNode(const CNetAddr& ip);
@@ -165,6 +182,10 @@ extern CAddrMan addrman;
 
 /** Maximum number of connections to simultaneously allow (aka connection slots) */
 extern int nMaxConnections;
+/** Whether ThreadSocketHandler uses epoll, which is not limited to FD_SETSIZE sockets */
+extern bool fSocketEpoll;
+/** Number of ThreadMessageHandler threads; each peer is served by at most one of them at a time */
+extern int nMessageHandlerThreads;
 
 extern std::vector<CNode*> vNodes;
 extern CCriticalSection cs_vNodes;
@@ -188,6 +209,33 @@ extern CCriticalSection cs_mapLocalHost;
 extern std::map<CNetAddr, LocalServiceInfo> mapLocalHost;
 typedef std::map<std::string, uint64_t> mapMsgCmdSize; //command, total bytes
 
+/** Number of histogram buckets in CMsgTimeStats; bucket i counts times below 2^i microseconds, the last one everything longer */
+static const int MSG_TIME_BUCKETS = 24;
+
+/** Time spent handling one kind of message */
+class CMsgTimeStats
+{
+public:
+    uint64_t nCount;
+    int64_t nTotalMicros;
+    int64_t nMainMicros;  //!< part of nTotalMicros cs_main was held
+    int64_t nMaxMicros;
+    uint64_t vBuckets[MSG_TIME_BUCKETS];
+
+    CMsgTimeStats()
+    {
+        nCount = 0;
+        nTotalMicros = 0;
+        nMainMicros = 0;
+        nMaxMicros = 0;
+        memset(vBuckets, 0, sizeof(vBuckets));
+    }
+
+    void Add(int64_t nMicros, int64_t nMainMicrosIn);
+    CMsgTimeStats& operator+=(const CMsgTimeStats& other);
+};
+typedef std::map<std::string, CMsgTimeStats> mapMsgCmdTime; //command, processing time
+
 class CNodeStats
 {
 public:
@@ -207,6 +255,12 @@ public:
     mapMsgCmdSize mapSendBytesPerMsgCmd;
     uint64_t nRecvBytes;
     mapMsgCmdSize mapRecvBytesPerMsgCmd;
+    mapMsgCmdTime mapRecvTimePerMsgCmd;
+    CMsgTimeStats sendMessagesTime;
+    size_t nRecvQueueMsgs;
+    size_t nRecvQueueBytes;
+    size_t nSendQueueMsgs;
+    size_t nSendQueueBytes;
     bool fWhitelisted;
     double dPingTime;
     double dPingWait;
@@ -221,17 +275,16 @@ class CNetMessage {
 public:
     bool in_data;                   // parsing header (false) or data (true)
 
-    CDataStream hdrbuf;             // partially received header
+    char hdrbuf[CMessageHeader::HEADER_SIZE]; // partially received header
     CMessageHeader hdr;             // complete header
     unsigned int nHdrPos;
 
-    CDataStream vRecv;              // received message data
+    CDataStream vRecv;              // received message data, sized to hdr.nMessageSize once the header is known
     unsigned int nDataPos;
 
     int64_t nTime;                  // time (in microseconds) of message receipt.
 
-    CNetMessage(const CMessageHeader::MessageStartChars& pchMessageStartIn, int nTypeIn, int nVersionIn) : hdrbuf(nTypeIn, nVersionIn), hdr(pchMessageStartIn), vRecv(nTypeIn, nVersionIn) {
-        hdrbuf.resize(24);
+    CNetMessage(const CMessageHeader::MessageStartChars& pchMessageStartIn, int nTypeIn, int nVersionIn) : hdr(pchMessageStartIn), vRecv(nTypeIn, nVersionIn) {
         in_data = false;
         nHdrPos = 0;
         nDataPos = 0;
@@ -247,7 +300,6 @@ public:
 
     void SetVersion(int nVersionIn)
     {
-        hdrbuf.SetVersion(nVersionIn);
         vRecv.SetVersion(nVersionIn);
     }
 
@@ -329,12 +381,23 @@ public:
     size_t nSendSize; // total size of all vSendMsg entries
     size_t nSendOffset; // offset inside the first vSendMsg already sent
     uint64_t nSendBytes;
-    std::deque<CSerializeData> vSendMsg;
+    std::deque<CSendBuffer> vSendMsg;
     CCriticalSection cs_vSend;
 
     std::deque<CInv> vRecvGetData;
+    // Orphans to retry now that a parent was accepted, protected by cs_main
+    std::set<uint256> setOrphanWork;
     std::deque<CNetMessage> vRecvMsg;
+    // Payload buffers of processed messages, reused for the next ones received
+    std::vector<CSerializeData> vRecvBufferPool;
     CCriticalSection cs_vRecvMsg;
+    // Set while a message handler thread is processing this node's messages
+    std::atomic<bool> fInMessageHandler;
+    // Complete messages in vRecvMsg waiting to be processed, and messages in
+    // vSendMsg, kept for stats which can't take the queues' locks
+    std::atomic<size_t> nRecvQueueMsgs;
+    std::atomic<size_t> nRecvQueueBytes;
+    std::atomic<size_t> nSendQueueMsgs;
     uint64_t nRecvBytes;
     int nRecvVersion;
 
@@ -388,6 +451,11 @@ protected:
     mapMsgCmdSize mapSendBytesPerMsgCmd;
     mapMsgCmdSize mapRecvBytesPerMsgCmd;
 
+    // Time spent in ProcessMessage per command, and in SendMessages
+    mapMsgCmdTime mapRecvTimePerMsgCmd;
+    CMsgTimeStats sendMessagesTime;
+    CCriticalSection cs_msgTime;
+
     // Basic fuzz-testing
     void Fuzz(int nChance); // modifies ssSend
 
@@ -396,6 +464,7 @@ public:
     int nStartingHeight;
 
     // flood relay
+    CCriticalSection cs_vAddrToSend; // protects vAddrToSend and addrKnown
     std::vector<CAddress> vAddrToSend;
     CRollingBloomFilter addrKnown;
     bool fGetAddr;
@@ -405,9 +474,7 @@ public:
 
     // inventory based relay
     CRollingBloomFilter filterInventoryKnown;
-    // Set of transaction ids we still have to announce.
-    // They are sorted by the mempool before relay, so the order is not important.
-    std::set<uint256> setInventoryTxToSend;
+    // Transactions to announce are queued for all peers at once, see txrelay.h.
     // List of block ids we still have announce.
     // There is no final sorting before sending, as they are always sent immediately
     // and in the order requested.
@@ -491,6 +558,20 @@ public:
     // requires LOCK(cs_vRecvMsg)
     bool ReceiveMsgBytes(const char *pch, unsigned int nBytes);
 
+    // requires LOCK(cs_vRecvMsg)
+    // Where the payload of the message being received continues, so that the
+    // socket can be read straight into it. Returns NULL while no header is
+    // pending; nSpace is set to the number of payload bytes still missing.
+    char* GetRecvPayloadBuffer(unsigned int& nSpace);
+
+    // requires LOCK(cs_vRecvMsg)
+    // Drop the processed messages in front of itEnd, keeping their payload
+    // buffers for reuse
+    void ReleaseRecvMessages(std::deque<CNetMessage>::iterator itEnd);
+
+    void RecordProcessTime(const std::string& strCommand, int64_t nMicros, int64_t nMainMicros);
+    void RecordSendMessagesTime(int64_t nMicros, int64_t nMainMicros);
+
     // requires LOCK(cs_vRecvMsg)
     void SetRecvVersion(int nVersionIn)
     {
@@ -514,6 +595,7 @@ public:
 
     void AddAddressKnown(const CAddress& addr)
     {
+        LOCK(cs_vAddrToSend);
         addrKnown.insert(addr.GetKey());
     }
 
@@ -522,6 +604,7 @@ public:
         // Known checking here is only to save space from duplicates.
         // SendMessages will filter it again for knowns that were added
         // after addresses were pushed.
+        LOCK(cs_vAddrToSend);
         if (addr.IsValid() && !addrKnown.contains(addr.GetKey())) {
             if (vAddrToSend.size() >= MAX_ADDR_TO_SEND) {
                 vAddrToSend[insecure_rand() % vAddrToSend.size()] = addr;
@@ -540,14 +623,11 @@ public:
         }
     }
 
+    // Transactions are announced through RelayTransaction instead
     void PushInventory(const CInv& inv)
     {
         LOCK(cs_inventory);
-        if (inv.type == MSG_TX) {
-            if (!filterInventoryKnown.contains(inv.hash)) {
-                setInventoryTxToSend.insert(inv.hash);
-            }
-        } else if (inv.type == MSG_BLOCK) {
+        if (inv.type == MSG_BLOCK) {
             vInventoryBlockToSend.push_back(inv.hash);
         }
     }
@@ -569,8 +649,31 @@ public:
     // TODO: Document the precondition of this function.  Is cs_vSend locked?
     void EndMessage(const char* pszCommand) UNLOCK_FUNCTION(cs_vSend);
 
+    // requires LOCK(cs_vSend)
+    void QueueSendBuffer(const CSendBuffer& msg);
+
     void PushVersion();
 
+    /**
+     * Serialize a message once so it can be queued to several peers with
+     * PushSharedMessage. nVersion and flag are the serialization version and
+     * flags the receiving peers expect.
+     */
+    template<typename T1>
+    static CSendBuffer MakeSharedMessage(int nVersion, int flag, const char* pszCommand, const T1& a1)
+    {
+        CDataStream ss(SER_NETWORK, nVersion);
+        BeginSharedMessage(ss, pszCommand);
+        WithOrVersion(&ss, flag) << a1;
+        return EndSharedMessage(ss);
+    }
+
+    static void BeginSharedMessage(CDataStream& ss, const char* pszCommand);
+    static CSendBuffer EndSharedMessage(CDataStream& ss);
+
+    /** Queue a message built by MakeSharedMessage, sharing its buffer with other peers. */
+    void PushSharedMessage(const char* pszCommand, const CSendBuffer& msg);
+
 
     void PushMessage(const char* pszCommand)
     {
@@ -816,9 +919,6 @@ public:
 
 
 
-class CTransaction;
-void RelayTransaction(const CTransaction& tx);
-
 /** Access to the (IP) address database (peers.dat) */
 class CAddrDB
 {
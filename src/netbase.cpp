@@ -25,6 +25,7 @@
 #include <arpa/inet.h>
 #endif
 #include <fcntl.h>
+#include <poll.h>
 #endif
 
 #include <boost/algorithm/string/case_conv.hpp> // for to_lower()
@@ -190,6 +191,29 @@ struct timeval MillisToTimeval(int64_t nTimeout)
     return timeout;
 }
 
+/**
+ * Wait for at most nTimeout milliseconds for hSocket to become readable, or
+ * writable if fWrite. Returns a positive number if it did, 0 on timeout and
+ * SOCKET_ERROR on error. Unlike select(), poll() is not limited to sockets
+ * below FD_SETSIZE, which matters once a node serves thousands of peers.
+ */
+static int WaitForSocket(SOCKET hSocket, bool fWrite, int64_t nTimeout)
+{
+#ifdef WIN32
+    struct timeval tval = MillisToTimeval(nTimeout);
+    fd_set fdset;
+    FD_ZERO(&fdset);
+    FD_SET(hSocket, &fdset);
+    return select(hSocket + 1, fWrite ? NULL : &fdset, fWrite ? &fdset : NULL, NULL, &tval);
+#else
+    struct pollfd pfd;
+    pfd.fd = hSocket;
+    pfd.events = fWrite ? POLLOUT : POLLIN;
+    pfd.revents = 0;
+    return poll(&pfd, 1, nTimeout);
+#endif
+}
+
 /**
  * Read bytes from socket. This will either read the full number of bytes requested
  * or return False on error or timeout.
@@ -218,14 +242,7 @@ bool static InterruptibleRecv(char* data, size_t len, int timeout, SOCKET& hSock
         } else { // Other error or blocking
             int nErr = WSAGetLastError();
             if (nErr == WSAEINPROGRESS || nErr == WSAEWOULDBLOCK || nErr == WSAEINVAL) {
-                if (!IsSelectableSocket(hSocket)) {
-                    return false;
-                }
-                struct timeval tval = MillisToTimeval(std::min(endTime - curTime, maxWait));
-                fd_set fdset;
-                FD_ZERO(&fdset);
-                FD_SET(hSocket, &fdset);
-                int nRet = select(hSocket + 1, &fdset, NULL, NULL, &tval);
+                int nRet = WaitForSocket(hSocket, false, std::min(endTime - curTime, maxWait));
                 if (nRet == SOCKET_ERROR) {
                     return false;
                 }
@@ -426,11 +443,7 @@ bool static ConnectSocketDirectly(const CService &addrConnect, SOCKET& hSocketRe
         // WSAEINVAL is here because some legacy version of winsock uses it
         if (nErr == WSAEINPROGRESS || nErr == WSAEWOULDBLOCK || nErr == WSAEINVAL)
         {
-            struct timeval timeout = MillisToTimeval(nTimeout);
-            fd_set fdset;
-            FD_ZERO(&fdset);
-            FD_SET(hSocket, &fdset);
-            int nRet = select(hSocket + 1, NULL, &fdset, NULL, &timeout);
+            int nRet = WaitForSocket(hSocket, true, nTimeout);
             if (nRet == 0)
             {
                 LogPrint("net", "connection to %s timeout\n", addrConnect.ToString());
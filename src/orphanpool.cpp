@@ -0,0 +1,165 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "orphanpool.h"
+
+#include "core_memusage.h"
+#include "memusage.h"
+#include "policy/policy.h"
+#include "random.h"
+#include "util.h"
+
+#include <boost/foreach.hpp>
+
+COrphanPool::COrphanPool() : nTotalUsage(0)
+{
+}
+
+bool COrphanPool::Add(const std::shared_ptr<const CTransaction>& tx, NodeId peer, int64_t nTimeExpire)
+{
+    const uint256& hash = tx->GetHash();
+    if (mapOrphans.count(hash))
+        return false;
+
+    // Ignore big transactions, to avoid a
+    // send-big-orphans memory exhaustion attack. If a peer has a legitimate
+    // large transaction with a missing parent then we assume
+    // it will rebroadcast it later, after the parent transaction(s)
+    // have been mined or received.
+    unsigned int sz = GetTransactionWeight(*tx);
+    if (sz >= MAX_STANDARD_TX_WEIGHT)
+    {
+        LogPrint("mempool", "ignoring large orphan tx (size: %u, hash: %s)\n", sz, hash.ToString());
+        return false;
+    }
+
+    // Estimate the multi_index node as 9 pointers + an allocation, and charge
+    // every input a full byprev entry, which overestimates shared outpoints.
+    size_t nUsage = RecursiveDynamicUsage(*tx) + memusage::MallocUsage(sizeof(CTransaction)) +
+                    memusage::MallocUsage(sizeof(COrphanTx) + 9 * sizeof(void*)) +
+                    tx->vin.size() * (memusage::MallocUsage(sizeof(memusage::stl_tree_node<std::pair<const COutPoint, std::set<orphaniter, CompareIteratorByHash> > >)) +
+                                      memusage::MallocUsage(sizeof(memusage::stl_tree_node<orphaniter>)));
+
+    COrphanTx orphan;
+    orphan.hash = hash;
+    orphan.tx = tx;
+    orphan.fromPeer = peer;
+    orphan.nTimeExpire = nTimeExpire;
+    orphan.nUsage = nUsage;
+    std::pair<orphaniter, bool> ret = mapOrphans.insert(orphan);
+    assert(ret.second);
+    for (size_t i = 0; i < tx->vin.size(); i++)
+        mapOrphansByPrev[tx->vin[i].prevout].insert(ret.first);
+    nTotalUsage += nUsage;
+    return true;
+}
+
+bool COrphanPool::Have(const uint256& hash) const
+{
+    return mapOrphans.count(hash) != 0;
+}
+
+std::shared_ptr<const CTransaction> COrphanPool::Get(const uint256& hash, NodeId* pfromPeer) const
+{
+    orphaniter it = mapOrphans.find(hash);
+    if (it == mapOrphans.end())
+        return std::shared_ptr<const CTransaction>();
+    if (pfromPeer)
+        *pfromPeer = it->fromPeer;
+    return it->tx;
+}
+
+void COrphanPool::EraseEntry(orphaniter it)
+{
+    const CTransaction& tx = *it->tx;
+    for (size_t i = 0; i < tx.vin.size(); i++)
+    {
+        std::map<COutPoint, std::set<orphaniter, CompareIteratorByHash> >::iterator itPrev = mapOrphansByPrev.find(tx.vin[i].prevout);
+        if (itPrev == mapOrphansByPrev.end())
+            continue;
+        itPrev->second.erase(it);
+        if (itPrev->second.empty())
+            mapOrphansByPrev.erase(itPrev);
+    }
+    nTotalUsage -= it->nUsage;
+    mapOrphans.erase(it);
+}
+
+int COrphanPool::Erase(const uint256& hash)
+{
+    orphaniter it = mapOrphans.find(hash);
+    if (it == mapOrphans.end())
+        return 0;
+    EraseEntry(it);
+    return 1;
+}
+
+int COrphanPool::EraseForPeer(NodeId peer)
+{
+    typedef indexed_orphan_set::index<orphan_peer>::type orphans_by_peer;
+    orphans_by_peer& byPeer = mapOrphans.get<orphan_peer>();
+    int nErased = 0;
+    orphans_by_peer::iterator it = byPeer.lower_bound(peer);
+    while (it != byPeer.end() && it->fromPeer == peer) {
+        EraseEntry(mapOrphans.project<0>(it++));
+        nErased++;
+    }
+    return nErased;
+}
+
+int COrphanPool::Expire(int64_t nNow)
+{
+    typedef indexed_orphan_set::index<orphan_expiry>::type orphans_by_expiry;
+    orphans_by_expiry& byExpiry = mapOrphans.get<orphan_expiry>();
+    int nErased = 0;
+    while (!byExpiry.empty() && byExpiry.begin()->nTimeExpire <= nNow) {
+        EraseEntry(mapOrphans.project<0>(byExpiry.begin()));
+        nErased++;
+    }
+    return nErased;
+}
+
+int COrphanPool::LimitSize(size_t nMaxCount, size_t nMaxUsage)
+{
+    int nEvicted = 0;
+    while (!mapOrphans.empty() && (mapOrphans.size() > nMaxCount || nTotalUsage > nMaxUsage))
+    {
+        // Evict a random orphan:
+        orphaniter it = mapOrphans.lower_bound(GetRandHash());
+        if (it == mapOrphans.end())
+            it = mapOrphans.begin();
+        EraseEntry(it);
+        ++nEvicted;
+    }
+    return nEvicted;
+}
+
+void COrphanPool::AddChildrenToWorkSet(const CTransaction& tx, std::set<uint256>& setWork) const
+{
+    const uint256& hash = tx.GetHash();
+    // Children are found by outpoint, so start at the first output of tx
+    std::map<COutPoint, std::set<orphaniter, CompareIteratorByHash> >::const_iterator itPrev = mapOrphansByPrev.lower_bound(COutPoint(hash, 0));
+    for (; itPrev != mapOrphansByPrev.end() && itPrev->first.hash == hash; ++itPrev) {
+        BOOST_FOREACH(const orphaniter& mi, itPrev->second)
+            setWork.insert(mi->hash);
+    }
+}
+
+void COrphanPool::AddConflicts(const CTransaction& tx, std::vector<uint256>& vConflicts) const
+{
+    for (size_t i = 0; i < tx.vin.size(); i++) {
+        std::map<COutPoint, std::set<orphaniter, CompareIteratorByHash> >::const_iterator itPrev = mapOrphansByPrev.find(tx.vin[i].prevout);
+        if (itPrev == mapOrphansByPrev.end())
+            continue;
+        BOOST_FOREACH(const orphaniter& mi, itPrev->second)
+            vConflicts.push_back(mi->hash);
+    }
+}
+
+void COrphanPool::Clear()
+{
+    mapOrphansByPrev.clear();
+    mapOrphans.clear();
+    nTotalUsage = 0;
+}
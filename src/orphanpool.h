@@ -0,0 +1,125 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_ORPHANPOOL_H
+#define BITCOIN_ORPHANPOOL_H
+
+#include "net.h"
+#include "primitives/transaction.h"
+#include "uint256.h"
+
+#include <map>
+#include <memory>
+#include <set>
+#include <stdint.h>
+#include <vector>
+
+#include "boost/multi_index_container.hpp"
+#include "boost/multi_index/member.hpp"
+#include "boost/multi_index/ordered_index.hpp"
+
+/** A transaction whose inputs could not be found yet, kept until its parents show up */
+struct COrphanTx
+{
+    uint256 hash;
+    std::shared_ptr<const CTransaction> tx;
+    NodeId fromPeer;
+    int64_t nTimeExpire;
+    //! Memory accounted to this entry, including its share of the indexes
+    size_t nUsage;
+};
+
+// multi_index tag names
+struct orphan_peer {};
+struct orphan_expiry {};
+
+/**
+ * Transactions received with missing inputs, indexed by txid, by the peer
+ * that sent them and by expiry time, and bounded both in count and in
+ * memory. The pool does no locking of its own; main.cpp keeps it under
+ * cs_main.
+ */
+class COrphanPool
+{
+private:
+    typedef boost::multi_index_container<
+        COrphanTx,
+        boost::multi_index::indexed_by<
+            // sorted by txid, so a random hash picks a random entry to evict
+            boost::multi_index::ordered_unique<
+                boost::multi_index::member<COrphanTx, uint256, &COrphanTx::hash>
+            >,
+            // grouped by the peer that sent it
+            boost::multi_index::ordered_non_unique<
+                boost::multi_index::tag<orphan_peer>,
+                boost::multi_index::member<COrphanTx, NodeId, &COrphanTx::fromPeer>
+            >,
+            // sorted by expiry time
+            boost::multi_index::ordered_non_unique<
+                boost::multi_index::tag<orphan_expiry>,
+                boost::multi_index::member<COrphanTx, int64_t, &COrphanTx::nTimeExpire>
+            >
+        >
+    > indexed_orphan_set;
+
+    typedef indexed_orphan_set::iterator orphaniter;
+
+    struct CompareIteratorByHash {
+        bool operator()(const orphaniter& a, const orphaniter& b) const {
+            return a->hash < b->hash;
+        }
+    };
+
+    indexed_orphan_set mapOrphans;
+    //! The orphans spending each outpoint
+    std::map<COutPoint, std::set<orphaniter, CompareIteratorByHash> > mapOrphansByPrev;
+    size_t nTotalUsage;
+
+    void EraseEntry(orphaniter it);
+
+public:
+    COrphanPool();
+
+    /**
+     * Add an orphan received from peer, to be dropped at nTimeExpire.
+     * Returns false if it is already in the pool or too large to keep.
+     */
+    bool Add(const std::shared_ptr<const CTransaction>& tx, NodeId peer, int64_t nTimeExpire);
+
+    bool Have(const uint256& hash) const;
+
+    /** The orphan with this txid and the peer that sent it, or NULL if there is none */
+    std::shared_ptr<const CTransaction> Get(const uint256& hash, NodeId* pfromPeer = NULL) const;
+
+    /** Remove one orphan. Returns the number removed (0 or 1). */
+    int Erase(const uint256& hash);
+
+    /** Remove every orphan received from peer */
+    int EraseForPeer(NodeId peer);
+
+    /** Remove every orphan that expired at or before nNow */
+    int Expire(int64_t nNow);
+
+    /**
+     * Evict random orphans until at most nMaxCount are left and they use at
+     * most nMaxUsage bytes. Returns the number evicted.
+     */
+    int LimitSize(size_t nMaxCount, size_t nMaxUsage);
+
+    /**
+     * Add the txids of the orphans spending an output of tx to setWork, so
+     * they can be retried now that tx is known. Only direct children are
+     * added; their own children follow once they are accepted in turn.
+     */
+    void AddChildrenToWorkSet(const CTransaction& tx, std::set<uint256>& setWork) const;
+
+    /** Append the txids of the orphans spending any of tx's inputs to vConflicts */
+    void AddConflicts(const CTransaction& tx, std::vector<uint256>& vConflicts) const;
+
+    size_t size() const { return mapOrphans.size(); }
+    size_t DynamicMemoryUsage() const { return nTotalUsage; }
+    void Clear();
+};
+
+#endif // BITCOIN_ORPHANPOOL_H
@@ -7,72 +7,113 @@
 #include "policy/policy.h"
 
 #include "amount.h"
+#include "clientversion.h"
 #include "primitives/transaction.h"
 #include "random.h"
 #include "streams.h"
 #include "txmempool.h"
 #include "util.h"
 
+#include <algorithm>
+
+/** Rescale the moving averages once the decay scale drops below this */
+static const double MIN_DECAY_SCALE = 1e-20;
+
 void TxConfirmStats::Initialize(std::vector<double>& defaultBuckets,
                                 unsigned int maxConfirms, double _decay, std::string _dataTypeString)
 {
     decay = _decay;
+    scale = 1;
     dataTypeString = _dataTypeString;
-    for (unsigned int i = 0; i < defaultBuckets.size(); i++) {
-        buckets.push_back(defaultBuckets[i]);
-        bucketMap[defaultBuckets[i]] = i;
-    }
+    buckets = defaultBuckets;
     confAvg.resize(maxConfirms);
-    curBlockConf.resize(maxConfirms);
-    unconfTxs.resize(maxConfirms);
     for (unsigned int i = 0; i < maxConfirms; i++) {
         confAvg[i].resize(buckets.size());
-        curBlockConf[i].resize(buckets.size());
-        unconfTxs[i].resize(buckets.size());
     }
-
-    oldUnconfTxs.resize(buckets.size());
-    curBlockTxCt.resize(buckets.size());
     txCtAvg.resize(buckets.size());
-    curBlockVal.resize(buckets.size());
     avg.resize(buckets.size());
+    ResizeCurrent(maxConfirms);
 }
 
-// Zero out the data for the current block
+void TxConfirmStats::ResizeCurrent(unsigned int maxConfirms)
+{
+    curBlockConf.assign(maxConfirms * buckets.size(), 0);
+    curBlockConfCells.clear();
+    curBlockTxCt.assign(buckets.size(), 0);
+    curBlockVal.assign(buckets.size(), 0);
+    curBlockBuckets.clear();
+
+    unconfTxs.resize(maxConfirms);
+    for (unsigned int i = 0; i < maxConfirms; i++) {
+        unconfTxs[i].resize(buckets.size());
+    }
+    oldUnconfTxs.resize(buckets.size());
+}
+
+unsigned int TxConfirmStats::FindBucketIndex(double val) const
+{
+    std::vector<double>::const_iterator it = std::lower_bound(buckets.begin(), buckets.end(), val);
+    if (it == buckets.end())
+        return buckets.size() - 1;
+    return it - buckets.begin();
+}
+
+// Decay the moving averages and zero out the data for the current block
 void TxConfirmStats::ClearCurrent(unsigned int nBlockHeight)
 {
+    std::vector<int>& unconfBlock = unconfTxs[nBlockHeight%unconfTxs.size()];
     for (unsigned int j = 0; j < buckets.size(); j++) {
-        oldUnconfTxs[j] += unconfTxs[nBlockHeight%unconfTxs.size()][j];
-        unconfTxs[nBlockHeight%unconfTxs.size()][j] = 0;
-        for (unsigned int i = 0; i < curBlockConf.size(); i++)
-            curBlockConf[i][j] = 0;
-        curBlockTxCt[j] = 0;
-        curBlockVal[j] = 0;
-    }
+        oldUnconfTxs[j] += unconfBlock[j];
+        unconfBlock[j] = 0;
+    }
+    for (unsigned int i = 0; i < curBlockConfCells.size(); i++)
+        curBlockConf[curBlockConfCells[i]] = 0;
+    curBlockConfCells.clear();
+    for (unsigned int i = 0; i < curBlockBuckets.size(); i++) {
+        curBlockTxCt[curBlockBuckets[i]] = 0;
+        curBlockVal[curBlockBuckets[i]] = 0;
+    }
+    curBlockBuckets.clear();
+    scale *= decay;
 }
 
+void TxConfirmStats::AddToCurrent(int blocksToConfirm, unsigned int bucketindex, int count, double val)
+{
+    double weight = 1 / scale;
+    if ((unsigned int)blocksToConfirm <= confAvg.size()) {
+        unsigned int cell = (blocksToConfirm - 1) * buckets.size() + bucketindex;
+        if (curBlockConf[cell] == 0)
+            curBlockConfCells.push_back(cell);
+        curBlockConf[cell] += count;
+        confAvg[blocksToConfirm - 1][bucketindex] += count * weight;
+    }
+    if (curBlockTxCt[bucketindex] == 0)
+        curBlockBuckets.push_back(bucketindex);
+    curBlockTxCt[bucketindex] += count;
+    curBlockVal[bucketindex] += val;
+    txCtAvg[bucketindex] += count * weight;
+    avg[bucketindex] += val * weight;
+}
 
 void TxConfirmStats::Record(int blocksToConfirm, double val)
 {
     // blocksToConfirm is 1-based
     if (blocksToConfirm < 1)
         return;
-    unsigned int bucketindex = bucketMap.lower_bound(val)->second;
-    for (size_t i = blocksToConfirm; i <= curBlockConf.size(); i++) {
-        curBlockConf[i - 1][bucketindex]++;
-    }
-    curBlockTxCt[bucketindex]++;
-    curBlockVal[bucketindex] += val;
+    AddToCurrent(blocksToConfirm, FindBucketIndex(val), 1, val);
 }
 
 void TxConfirmStats::UpdateMovingAverages()
 {
+    if (scale >= MIN_DECAY_SCALE)
+        return;
     for (unsigned int j = 0; j < buckets.size(); j++) {
         for (unsigned int i = 0; i < confAvg.size(); i++)
-            confAvg[i][j] = confAvg[i][j] * decay + curBlockConf[i][j];
-        avg[j] = avg[j] * decay + curBlockVal[j];
-        txCtAvg[j] = txCtAvg[j] * decay + curBlockTxCt[j];
+            confAvg[i][j] *= scale;
+        avg[j] *= scale;
+        txCtAvg[j] *= scale;
     }
+    scale = 1;
 }
 
 // returns -1 on error conditions
@@ -110,8 +151,9 @@ double TxConfirmStats::EstimateMedianVal(int confTarget, double sufficientTxVal,
     // Start counting from highest(default) or lowest fee/pri transactions
     for (int bucket = startbucket; bucket >= 0 && bucket <= maxbucketindex; bucket += step) {
         curFarBucket = bucket;
-        nConf += confAvg[confTarget - 1][bucket];
-        totalNum += txCtAvg[bucket];
+        for (int confct = 0; confct < confTarget; confct++)
+            nConf += confAvg[confct][bucket] * scale;
+        totalNum += txCtAvg[bucket] * scale;
         for (unsigned int confct = confTarget; confct < GetMaxConfirms(); confct++)
             extraNum += unconfTxs[(nBlockHeight - confct)%bins][bucket];
         extraNum += oldUnconfTxs[bucket];
@@ -176,11 +218,25 @@ double TxConfirmStats::EstimateMedianVal(int confTarget, double sufficientTxVal,
 
 void TxConfirmStats::Write(CAutoFile& fileout)
 {
+    // The file holds the actual moving averages, with confirmations counted
+    // cumulatively (confirmed within Y blocks)
+    std::vector<double> fileAvg(avg.size());
+    std::vector<double> fileTxCtAvg(txCtAvg.size());
+    std::vector<std::vector<double> > fileConfAvg(confAvg.size(), std::vector<double>(buckets.size()));
+    for (unsigned int j = 0; j < buckets.size(); j++) {
+        fileAvg[j] = avg[j] * scale;
+        fileTxCtAvg[j] = txCtAvg[j] * scale;
+        double confSum = 0;
+        for (unsigned int i = 0; i < confAvg.size(); i++) {
+            confSum += confAvg[i][j];
+            fileConfAvg[i][j] = confSum * scale;
+        }
+    }
     fileout << decay;
     fileout << buckets;
-    fileout << avg;
-    fileout << txCtAvg;
-    fileout << confAvg;
+    fileout << fileAvg;
+    fileout << fileTxCtAvg;
+    fileout << fileConfAvg;
 }
 
 void TxConfirmStats::Read(CAutoFile& filein)
@@ -218,37 +274,77 @@ void TxConfirmStats::Read(CAutoFile& filein)
     // Now that we've processed the entire fee estimate data file and not
     // thrown any errors, we can copy it to our data structures
     decay = fileDecay;
+    scale = 1;
     buckets = fileBuckets;
     avg = fileAvg;
-    confAvg = fileConfAvg;
     txCtAvg = fileTxCtAvg;
-    bucketMap.clear();
-
-    // Resize the current block variables which aren't stored in the data file
-    // to match the number of confirms and buckets
-    curBlockConf.resize(maxConfirms);
-    for (unsigned int i = 0; i < maxConfirms; i++) {
-        curBlockConf[i].resize(buckets.size());
-    }
-    curBlockTxCt.resize(buckets.size());
-    curBlockVal.resize(buckets.size());
 
-    unconfTxs.resize(maxConfirms);
-    for (unsigned int i = 0; i < maxConfirms; i++) {
-        unconfTxs[i].resize(buckets.size());
+    // Turn the cumulative confirmation counts into counts per exact number of blocks
+    confAvg = fileConfAvg;
+    for (unsigned int i = maxConfirms - 1; i > 0; i--) {
+        for (unsigned int j = 0; j < numBuckets; j++)
+            confAvg[i][j] = std::max(0.0, fileConfAvg[i][j] - fileConfAvg[i - 1][j]);
     }
-    oldUnconfTxs.resize(buckets.size());
 
-    for (unsigned int i = 0; i < buckets.size(); i++)
-        bucketMap[buckets[i]] = i;
+    // Resize the current block variables which aren't stored in the data file
+    // to match the number of confirms and buckets
+    ResizeCurrent(maxConfirms);
 
     LogPrint("estimatefee", "Reading estimates: %u %s buckets counting confirms up to %u blocks\n",
              numBuckets, dataTypeString, maxConfirms);
 }
 
+void TxConfirmStats::WriteCurrent(CDataStream& stream)
+{
+    std::vector<int> confCounts(curBlockConfCells.size());
+    for (unsigned int i = 0; i < curBlockConfCells.size(); i++)
+        confCounts[i] = curBlockConf[curBlockConfCells[i]];
+    std::vector<int> txCounts(curBlockBuckets.size());
+    std::vector<double> vals(curBlockBuckets.size());
+    for (unsigned int i = 0; i < curBlockBuckets.size(); i++) {
+        txCounts[i] = curBlockTxCt[curBlockBuckets[i]];
+        vals[i] = curBlockVal[curBlockBuckets[i]];
+    }
+    stream << curBlockConfCells << confCounts << curBlockBuckets << txCounts << vals;
+}
+
+void TxConfirmStats::ReadCurrent(CDataStream& stream)
+{
+    std::vector<unsigned int> confCells, bucketIndexes;
+    std::vector<int> confCounts, txCounts;
+    std::vector<double> vals;
+    stream >> confCells >> confCounts >> bucketIndexes >> txCounts >> vals;
+    if (confCells.size() != confCounts.size() || bucketIndexes.size() != txCounts.size() || bucketIndexes.size() != vals.size())
+        throw std::runtime_error("Corrupt estimates journal. Mismatch in block data sizes");
+    for (unsigned int i = 0; i < confCells.size(); i++) {
+        if (confCells[i] >= curBlockConf.size() || confCounts[i] < 0)
+            throw std::runtime_error("Corrupt estimates journal. Confirm count out of range");
+    }
+    for (unsigned int i = 0; i < bucketIndexes.size(); i++) {
+        if (bucketIndexes[i] >= buckets.size() || txCounts[i] < 0)
+            throw std::runtime_error("Corrupt estimates journal. Bucket out of range");
+    }
+
+    // Confirmed txs first, then the txs confirmed beyond the tracked confirms
+    // (the remainder of each bucket's count) along with the bucket's value
+    std::vector<int> remaining(buckets.size(), 0);
+    for (unsigned int i = 0; i < bucketIndexes.size(); i++)
+        remaining[bucketIndexes[i]] += txCounts[i];
+    for (unsigned int i = 0; i < confCells.size(); i++) {
+        unsigned int bucketindex = confCells[i] % buckets.size();
+        AddToCurrent(confCells[i] / buckets.size() + 1, bucketindex, confCounts[i], 0);
+        remaining[bucketindex] -= confCounts[i];
+    }
+    for (unsigned int i = 0; i < bucketIndexes.size(); i++) {
+        unsigned int bucketindex = bucketIndexes[i];
+        AddToCurrent(confAvg.size() + 1, bucketindex, std::max(0, remaining[bucketindex]), vals[i]);
+        remaining[bucketindex] = 0;
+    }
+}
+
 unsigned int TxConfirmStats::NewTx(unsigned int nBlockHeight, double val)
 {
-    unsigned int bucketindex = bucketMap.lower_bound(val)->second;
+    unsigned int bucketindex = FindBucketIndex(val);
     unsigned int blockIndex = nBlockHeight % unconfTxs.size();
     unconfTxs[blockIndex][bucketindex]++;
     LogPrint("estimatefee", "adding to %s", dataTypeString);
@@ -285,7 +381,7 @@ void TxConfirmStats::removeTx(unsigned int entryHeight, unsigned int nBestSeenHe
 
 void CBlockPolicyEstimator::removeTx(uint256 hash)
 {
-    std::map<uint256, TxStatsInfo>::iterator pos = mapMemPoolTxs.find(hash);
+    boost::unordered_map<uint256, TxStatsInfo, SaltedTxidHasher>::iterator pos = mapMemPoolTxs.find(hash);
     if (pos == mapMemPoolTxs.end()) {
         LogPrint("estimatefee", "Blockpolicy error mempool tx %s not found for removeTx\n",
                  hash.ToString().c_str());
@@ -297,11 +393,11 @@ void CBlockPolicyEstimator::removeTx(uint256 hash)
 
     if (stats != NULL)
         stats->removeTx(entryHeight, nBestSeenHeight, bucketIndex);
-    mapMemPoolTxs.erase(hash);
+    mapMemPoolTxs.erase(pos);
 }
 
 CBlockPolicyEstimator::CBlockPolicyEstimator(const CFeeRate& _minRelayFee)
-    : nBestSeenHeight(0)
+    : nBestSeenHeight(0), journal(NULL), nJournalBlocks(0)
 {
     minTrackedFee = _minRelayFee < CFeeRate(MIN_FEERATE) ? CFeeRate(MIN_FEERATE) : _minRelayFee;
     std::vector<double> vfeelist;
@@ -323,6 +419,13 @@ CBlockPolicyEstimator::CBlockPolicyEstimator(const CFeeRate& _minRelayFee)
     feeLikely = CFeeRate(INF_FEERATE);
     priUnlikely = 0;
     priLikely = INF_PRIORITY;
+
+    UpdateAnswerTable();
+}
+
+CBlockPolicyEstimator::~CBlockPolicyEstimator()
+{
+    SetJournal(NULL);
 }
 
 bool CBlockPolicyEstimator::isFeeDataPoint(const CFeeRate &fee, double pri)
@@ -347,7 +450,8 @@ void CBlockPolicyEstimator::processTransaction(const CTxMemPoolEntry& entry, boo
 {
     unsigned int txHeight = entry.GetHeight();
     uint256 hash = entry.GetTx().GetHash();
-    if (mapMemPoolTxs[hash].stats != NULL) {
+    TxStatsInfo& info = mapMemPoolTxs[hash];
+    if (info.stats != NULL) {
         LogPrint("estimatefee", "Blockpolicy error mempool tx %s already being tracked\n",
                  hash.ToString().c_str());
 	return;
@@ -378,18 +482,20 @@ void CBlockPolicyEstimator::processTransaction(const CTxMemPoolEntry& entry, boo
     // what that will be and its too hard to continue updating it
     // so use starting priority as a proxy
     double curPri = entry.GetPriority(txHeight);
-    mapMemPoolTxs[hash].blockHeight = txHeight;
+    info.blockHeight = txHeight;
 
-    LogPrint("estimatefee", "Blockpolicy mempool tx %s ", hash.ToString().substr(0,10));
+    // Checked first so the txid is not formatted for every transaction when not logging
+    if (LogAcceptCategory("estimatefee"))
+        LogPrint("estimatefee", "Blockpolicy mempool tx %s ", hash.ToString().substr(0,10));
     // Record this as a priority estimate
     if (entry.GetFee() == 0 || isPriDataPoint(feeRate, curPri)) {
-        mapMemPoolTxs[hash].stats = &priStats;
-        mapMemPoolTxs[hash].bucketIndex =  priStats.NewTx(txHeight, curPri);
+        info.stats = &priStats;
+        info.bucketIndex =  priStats.NewTx(txHeight, curPri);
     }
     // Record this as a fee estimate
     else if (isFeeDataPoint(feeRate, curPri)) {
-        mapMemPoolTxs[hash].stats = &feeStats;
-        mapMemPoolTxs[hash].bucketIndex = feeStats.NewTx(txHeight, (double)feeRate.GetFeePerK());
+        info.stats = &feeStats;
+        info.bucketIndex = feeStats.NewTx(txHeight, (double)feeRate.GetFeePerK());
     }
     else {
         LogPrint("estimatefee", "not adding");
@@ -490,16 +596,51 @@ void CBlockPolicyEstimator::processBlock(unsigned int nBlockHeight,
 
     LogPrint("estimatefee", "Blockpolicy after updating estimates for %u confirmed entries, new mempool map size %u\n",
              entries.size(), mapMemPoolTxs.size());
+
+    UpdateAnswerTable();
+
+    if (journal) {
+        CDataStream ssBlock(SER_DISK, CLIENT_VERSION);
+        ssBlock << nBlockHeight;
+        feeStats.WriteCurrent(ssBlock);
+        priStats.WriteCurrent(ssBlock);
+        CAutoFile fileout(journal, SER_DISK, CLIENT_VERSION);
+        try {
+            // Written as a single vector, so a block that was only partly
+            // written before a crash fails to read as a whole
+            fileout << std::vector<char>(ssBlock.begin(), ssBlock.end());
+            if (fflush(fileout.Get()) != 0)
+                throw std::ios_base::failure("fflush failed");
+            journal = fileout.release();
+            nJournalBlocks++;
+        }
+        catch (const std::exception& e) {
+            LogPrintf("CBlockPolicyEstimator::processBlock(): unable to journal block %u (%s), closing journal\n", nBlockHeight, e.what());
+            journal = NULL; // fileout closes it
+        }
+    }
+}
+
+void CBlockPolicyEstimator::UpdateAnswerTable()
+{
+    answers.nBlockHeight = nBestSeenHeight;
+    // It's not possible to get reasonable fee estimates for confTarget of 1
+    answers.feeMedians.assign(feeStats.GetMaxConfirms(), -1);
+    for (unsigned int i = 2; i <= feeStats.GetMaxConfirms(); i++)
+        answers.feeMedians[i - 1] = feeStats.EstimateMedianVal(i, SUFFICIENT_FEETXS, MIN_SUCCESS_PCT, true, nBestSeenHeight);
+    answers.priMedians.assign(priStats.GetMaxConfirms(), -1);
+    for (unsigned int i = 1; i <= priStats.GetMaxConfirms(); i++)
+        answers.priMedians[i - 1] = priStats.EstimateMedianVal(i, SUFFICIENT_PRITXS, MIN_SUCCESS_PCT, true, nBestSeenHeight);
 }
 
 CFeeRate CBlockPolicyEstimator::estimateFee(int confTarget)
 {
     // Return failure if trying to analyze a target we're not tracking
     // It's not possible to get reasonable estimates for confTarget of 1
-    if (confTarget <= 1 || (unsigned int)confTarget > feeStats.GetMaxConfirms())
+    if (confTarget <= 1 || (unsigned int)confTarget > answers.feeMedians.size())
         return CFeeRate(0);
 
-    double median = feeStats.EstimateMedianVal(confTarget, SUFFICIENT_FEETXS, MIN_SUCCESS_PCT, true, nBestSeenHeight);
+    double median = answers.feeMedians[confTarget - 1];
 
     if (median < 0)
         return CFeeRate(0);
@@ -508,11 +649,34 @@ CFeeRate CBlockPolicyEstimator::estimateFee(int confTarget)
 }
 
 CFeeRate CBlockPolicyEstimator::estimateSmartFee(int confTarget, int *answerFoundAtTarget, const CTxMemPool& pool)
+{
+    // If mempool is limiting txs , return at least the min fee from the mempool
+    CAmount minPoolFee = pool.GetMinFee(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000).GetFeePerK();
+    return answers.estimateSmartFee(confTarget, answerFoundAtTarget, minPoolFee);
+}
+
+double CBlockPolicyEstimator::estimatePriority(int confTarget)
+{
+    // Return failure if trying to analyze a target we're not tracking
+    if (confTarget <= 0 || (unsigned int)confTarget > answers.priMedians.size())
+        return -1;
+
+    return answers.priMedians[confTarget - 1];
+}
+
+double CBlockPolicyEstimator::estimateSmartPriority(int confTarget, int *answerFoundAtTarget, const CTxMemPool& pool)
+{
+    // If mempool is limiting txs, no priority txs are allowed
+    CAmount minPoolFee = pool.GetMinFee(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000).GetFeePerK();
+    return answers.estimateSmartPriority(confTarget, answerFoundAtTarget, minPoolFee);
+}
+
+CFeeRate FeeEstimateTable::estimateSmartFee(int confTarget, int *answerFoundAtTarget, CAmount minPoolFee) const
 {
     if (answerFoundAtTarget)
         *answerFoundAtTarget = confTarget;
     // Return failure if trying to analyze a target we're not tracking
-    if (confTarget <= 0 || (unsigned int)confTarget > feeStats.GetMaxConfirms())
+    if (confTarget <= 0 || (unsigned int)confTarget > feeMedians.size())
         return CFeeRate(0);
 
     // It's not possible to get reasonable estimates for confTarget of 1
@@ -520,15 +684,14 @@ CFeeRate CBlockPolicyEstimator::estimateSmartFee(int confTarget, int *answerFoun
         confTarget = 2;
 
     double median = -1;
-    while (median < 0 && (unsigned int)confTarget <= feeStats.GetMaxConfirms()) {
-        median = feeStats.EstimateMedianVal(confTarget++, SUFFICIENT_FEETXS, MIN_SUCCESS_PCT, true, nBestSeenHeight);
+    while (median < 0 && (unsigned int)confTarget <= feeMedians.size()) {
+        median = feeMedians[confTarget++ - 1];
     }
 
     if (answerFoundAtTarget)
         *answerFoundAtTarget = confTarget - 1;
 
     // If mempool is limiting txs , return at least the min fee from the mempool
-    CAmount minPoolFee = pool.GetMinFee(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000).GetFeePerK();
     if (minPoolFee > 0 && minPoolFee > median)
         return CFeeRate(minPoolFee);
 
@@ -538,31 +701,21 @@ CFeeRate CBlockPolicyEstimator::estimateSmartFee(int confTarget, int *answerFoun
     return CFeeRate(median);
 }
 
-double CBlockPolicyEstimator::estimatePriority(int confTarget)
-{
-    // Return failure if trying to analyze a target we're not tracking
-    if (confTarget <= 0 || (unsigned int)confTarget > priStats.GetMaxConfirms())
-        return -1;
-
-    return priStats.EstimateMedianVal(confTarget, SUFFICIENT_PRITXS, MIN_SUCCESS_PCT, true, nBestSeenHeight);
-}
-
-double CBlockPolicyEstimator::estimateSmartPriority(int confTarget, int *answerFoundAtTarget, const CTxMemPool& pool)
+double FeeEstimateTable::estimateSmartPriority(int confTarget, int *answerFoundAtTarget, CAmount minPoolFee) const
 {
     if (answerFoundAtTarget)
         *answerFoundAtTarget = confTarget;
     // Return failure if trying to analyze a target we're not tracking
-    if (confTarget <= 0 || (unsigned int)confTarget > priStats.GetMaxConfirms())
+    if (confTarget <= 0 || (unsigned int)confTarget > priMedians.size())
         return -1;
 
     // If mempool is limiting txs, no priority txs are allowed
-    CAmount minPoolFee = pool.GetMinFee(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000).GetFeePerK();
     if (minPoolFee > 0)
         return INF_PRIORITY;
 
     double median = -1;
-    while (median < 0 && (unsigned int)confTarget <= priStats.GetMaxConfirms()) {
-        median = priStats.EstimateMedianVal(confTarget++, SUFFICIENT_PRITXS, MIN_SUCCESS_PCT, true, nBestSeenHeight);
+    while (median < 0 && (unsigned int)confTarget <= priMedians.size()) {
+        median = priMedians[confTarget++ - 1];
     }
 
     if (answerFoundAtTarget)
@@ -585,6 +738,46 @@ void CBlockPolicyEstimator::Read(CAutoFile& filein)
     feeStats.Read(filein);
     priStats.Read(filein);
     nBestSeenHeight = nFileBestSeenHeight;
+
+    // Replay the blocks journaled after the snapshot
+    unsigned int nReplayed = 0;
+    while (true) {
+        std::vector<char> vBlock;
+        try {
+            filein >> vBlock;
+        }
+        catch (const std::exception&) {
+            // End of the journal, or a block cut short by a crash
+            break;
+        }
+        try {
+            CDataStream ssBlock(vBlock, SER_DISK, CLIENT_VERSION);
+            unsigned int nBlockHeight;
+            ssBlock >> nBlockHeight;
+            feeStats.ClearCurrent(nBlockHeight);
+            priStats.ClearCurrent(nBlockHeight);
+            feeStats.ReadCurrent(ssBlock);
+            priStats.ReadCurrent(ssBlock);
+            feeStats.UpdateMovingAverages();
+            priStats.UpdateMovingAverages();
+            nBestSeenHeight = nBlockHeight;
+            nReplayed++;
+        }
+        catch (const std::exception& e) {
+            LogPrintf("CBlockPolicyEstimator::Read(): stopped replaying the fee estimates journal: %s\n", e.what());
+            break;
+        }
+    }
+    LogPrint("estimatefee", "Replayed %u journaled blocks, best seen height %u\n", nReplayed, nBestSeenHeight);
+    UpdateAnswerTable();
+}
+
+void CBlockPolicyEstimator::SetJournal(FILE* file)
+{
+    if (journal)
+        fclose(journal);
+    journal = file;
+    nJournalBlocks = 0;
 }
 
 FeeFilterRounder::FeeFilterRounder(const CFeeRate& minIncrementalFee)
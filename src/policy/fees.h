@@ -6,13 +6,18 @@
 #define BITCOIN_POLICYESTIMATOR_H
 
 #include "amount.h"
+#include "coins.h"
 #include "uint256.h"
 
 #include <map>
+#include <stdio.h>
 #include <string>
 #include <vector>
 
+#include <boost/unordered_map.hpp>
+
 class CAutoFile;
+class CDataStream;
 class CFeeRate;
 class CTxMemPoolEntry;
 class CTxMemPool;
@@ -58,8 +63,11 @@ class CTxMemPool;
  * want to save a history of this information, so at any time we have a
  * counter of the total number of transactions that happened in a given fee
  * bucket and the total number that were confirmed in each number 1-25 blocks
- * or less for any bucket.   We save this history by keeping an exponentially
- * decaying moving average of each one of these stats.  Furthermore we also
+ * or less for any bucket.  (Internally only the counter for exactly Y is
+ * incremented and the counters up to Z are summed when estimating, so
+ * recording a transaction touches a single counter.)  We save this history
+ * by keeping an exponentially decaying moving average of each one of these
+ * stats.  Furthermore we also
  * keep track of the number unmined (in mempool) transactions in each bucket
  * and for how many blocks they have been outstanding and use that to increase
  * the number of transactions we've seen in that fee bucket when calculating
@@ -81,30 +89,37 @@ class TxConfirmStats
 private:
     //Define the buckets we will group transactions into (both fee buckets and priority buckets)
     std::vector<double> buckets;              // The upper-bound of the range for the bucket (inclusive)
-    std::map<double, unsigned int> bucketMap; // Map of bucket upper-bound to index into all vectors by bucket
+
+    // The historical moving averages below are stored divided by scale, the
+    // product of all the per-block decays applied so far.  Decaying every
+    // average for a new block then only means updating scale, and a data
+    // point of the current block is added in as 1/scale.
+    double scale;
 
     // For each bucket X:
     // Count the total # of txs in each bucket
     // Track the historical moving average of this total over blocks
     std::vector<double> txCtAvg;
-    // and calculate the total for the current block to update the moving average
-    std::vector<int> curBlockTxCt;
 
-    // Count the total # of txs confirmed within Y blocks in each bucket
-    // Track the historical moving average of theses totals over blocks
+    // Count the # of txs confirmed in exactly Y+1 blocks in each bucket
+    // (the # confirmed within Y blocks is the sum of the first Y counts)
+    // Track the historical moving average of theses counts over blocks
     std::vector<std::vector<double> > confAvg; // confAvg[Y][X]
-    // and calculate the totals for the current block to update the moving averages
-    std::vector<std::vector<int> > curBlockConf; // curBlockConf[Y][X]
 
     // Sum the total priority/fee of all tx's in each bucket
     // Track the historical moving average of this total over blocks
     std::vector<double> avg;
-    // and calculate the total for the current block to update the moving average
-    std::vector<double> curBlockVal;
 
     // Combine the conf counts with tx counts to calculate the confirmation % for each Y,X
     // Combine the total value with the tx counts to calculate the avg fee/priority per bucket
 
+    // Data points of the current block, kept so the block can be journaled
+    std::vector<int> curBlockConf;              // curBlockConf[Y * buckets.size() + X]
+    std::vector<unsigned int> curBlockConfCells; // nonzero entries of curBlockConf
+    std::vector<int> curBlockTxCt;
+    std::vector<double> curBlockVal;
+    std::vector<unsigned int> curBlockBuckets;   // nonzero entries of curBlockTxCt
+
     std::string dataTypeString;
     double decay;
 
@@ -115,6 +130,15 @@ private:
     // transactions still unconfirmed after MAX_CONFIRMS for each bucket
     std::vector<int> oldUnconfTxs;
 
+    /** Binary search for the bucket val falls into */
+    unsigned int FindBucketIndex(double val) const;
+
+    /** Add count txs of bucketIndex confirmed in blocksToConfirm blocks with total value val to the current block */
+    void AddToCurrent(int blocksToConfirm, unsigned int bucketIndex, int count, double val);
+
+    /** Resize the current block and mempool tracking to the bucket and confirm counts */
+    void ResizeCurrent(unsigned int maxConfirms);
+
 public:
     /**
      * Initialize the data structures.  This is called by BlockPolicyEstimator's
@@ -126,7 +150,7 @@ public:
      */
     void Initialize(std::vector<double>& defaultBuckets, unsigned int maxConfirms, double decay, std::string dataTypeString);
 
-    /** Clear the state of the curBlock variables to start counting for the new block */
+    /** Decay the historical moving averages and clear the curBlock variables to start counting for the new block */
     void ClearCurrent(unsigned int nBlockHeight);
 
     /**
@@ -144,8 +168,8 @@ public:
     void removeTx(unsigned int entryHeight, unsigned int nBestSeenHeight,
                   unsigned int bucketIndex);
 
-    /** Update our estimates by decaying our historical moving average and updating
-        with the data gathered from the current block */
+    /** Finish the current block.  The moving averages were already updated as
+        data points were recorded; this only rescales them once scale gets too small. */
     void UpdateMovingAverages();
 
     /**
@@ -173,6 +197,12 @@ public:
      * variables with this state.
      */
     void Read(CAutoFile& filein);
+
+    /** Write the data points recorded for the current block */
+    void WriteCurrent(CDataStream& stream);
+
+    /** Record data points written by WriteCurrent in the current block */
+    void ReadCurrent(CDataStream& stream);
 };
 
 
@@ -210,6 +240,29 @@ static const double FEE_SPACING = 1.1;
 /** Spacing of Priority buckets */
 static const double PRI_SPACING = 2;
 
+/** Rewrite the whole fee estimates file after journaling this many blocks to it */
+static const unsigned int MAX_JOURNAL_BLOCKS = 144;
+
+/**
+ * The fee and priority estimates for every confirmation target as of one
+ * block.  CBlockPolicyEstimator computes the table once per block and answers
+ * all estimate queries from it.
+ */
+struct FeeEstimateTable
+{
+    unsigned int nBlockHeight;
+    std::vector<double> feeMedians; //!< feeMedians[Y-1] is the fee estimate for Y blocks, or -1
+    std::vector<double> priMedians; //!< priMedians[Y-1] is the priority estimate for Y blocks, or -1
+
+    FeeEstimateTable() : nBlockHeight(0) {}
+
+    /** See CBlockPolicyEstimator::estimateSmartFee; minPoolFee is the mempool min fee per kB */
+    CFeeRate estimateSmartFee(int confTarget, int *answerFoundAtTarget, CAmount minPoolFee) const;
+
+    /** See CBlockPolicyEstimator::estimateSmartPriority; minPoolFee is the mempool min fee per kB */
+    double estimateSmartPriority(int confTarget, int *answerFoundAtTarget, CAmount minPoolFee) const;
+};
+
 /**
  *  We want to be able to estimate fees or priorities that are needed on tx's to be included in
  * a certain number of blocks.  Every time a block is added to the best chain, this class records
@@ -220,6 +273,7 @@ class CBlockPolicyEstimator
 public:
     /** Create new BlockPolicyEstimator and initialize stats tracking classes with default values */
     CBlockPolicyEstimator(const CFeeRate& minRelayFee);
+    ~CBlockPolicyEstimator();
 
     /** Process all the transactions that have been included in a block */
     void processBlock(unsigned int nBlockHeight,
@@ -261,9 +315,25 @@ public:
     /** Write estimation data to a file */
     void Write(CAutoFile& fileout);
 
-    /** Read estimation data from a file */
+    /** Read estimation data from a file, replaying any blocks journaled after it */
     void Read(CAutoFile& filein);
 
+    /**
+     * Append the data points of every following block to file, which must
+     * already hold the output of Write.  Takes ownership of file; NULL
+     * closes the current journal.
+     */
+    void SetJournal(FILE* file);
+
+    /** Is a journal open? */
+    bool HasJournal() const { return journal != NULL; }
+
+    /** Return the estimates for every target, as of the last block processed */
+    const FeeEstimateTable& GetAnswerTable() const { return answers; }
+
+    /** Return the number of blocks journaled since SetJournal */
+    unsigned int GetJournalBlocks() const { return nJournalBlocks; }
+
 private:
     CFeeRate minTrackedFee;    //!< Passed to constructor to avoid dependency on main
     double minTrackedPriority; //!< Set to AllowFreeThreshold
@@ -277,7 +347,10 @@ private:
     };
 
     // map of txids to information about that transaction
-    std::map<uint256, TxStatsInfo> mapMemPoolTxs;
+    boost::unordered_map<uint256, TxStatsInfo, SaltedTxidHasher> mapMemPoolTxs;
+
+    FILE* journal;
+    unsigned int nJournalBlocks;
 
     /** Classes to track historical data on transaction confirmations */
     TxConfirmStats feeStats, priStats;
@@ -285,6 +358,12 @@ private:
     /** Breakpoints to help determine whether a transaction was confirmed by priority or Fee */
     CFeeRate feeLikely, feeUnlikely;
     double priLikely, priUnlikely;
+
+    /** Estimates for every target, recomputed by UpdateAnswerTable */
+    FeeEstimateTable answers;
+
+    /** Recompute the estimates for every target from the current stats */
+    void UpdateAnswerTable();
 };
 
 class FeeFilterRounder
@@ -9,10 +9,12 @@
 #include "primitives/transaction.h"
 #include "main.h"
 #include "httpserver.h"
+#include "rpc/jsonwriter.h"
 #include "rpc/server.h"
 #include "streams.h"
 #include "sync.h"
 #include "txmempool.h"
+#include "util.h"
 #include "utilstrencodings.h"
 #include "version.h"
 
@@ -24,6 +26,14 @@
 using namespace std;
 
 static const size_t MAX_GETUTXOS_OUTPOINTS = 15; //allow a max of 15 outpoints to be queried at once
+//! Blocks or headers of a range request looked up under one cs_main lock
+static const int REST_RANGE_BATCH = 1000;
+//! Size of the chunks a range reply is sent in
+static const size_t REST_RANGE_CHUNK_SIZE = 4096;
+//! Bytes of a range reply that may be on their way to the client before more are read
+static const size_t REST_RANGE_MAX_PENDING = 16384;
+//! How far ahead of the block being sent the block file is read
+static const unsigned int REST_BLOCK_READ_AHEAD = 16 << 20;
 
 enum RetFormat {
     RF_UNDEF,
@@ -59,9 +69,9 @@ struct CCoin {
 };
 
 extern void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry);
-extern UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false);
+extern void blockToJSON(CJSONStreamWriter& writer, const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false);
 extern UniValue mempoolInfoToJSON();
-extern UniValue mempoolToJSON(bool fVerbose = false);
+extern void mempoolToJSON(CJSONStreamWriter& writer, bool fVerbose = false);
 extern void ScriptPubKeyToJSON(const CScript& scriptPubKey, UniValue& out, bool fIncludeHex);
 extern UniValue blockheaderToJSON(const CBlockIndex* blockindex);
 
@@ -72,6 +82,13 @@ static bool RESTERR(HTTPRequest* req, enum HTTPStatusCode status, string message
     return false;
 }
 
+static void RESTWriteJSONChunk(HTTPRequest* req, const std::string& strChunk)
+{
+    if (!req->ReplyStarted())
+        req->WriteHeader("Content-Type", "application/json");
+    req->WriteReplyChunk(strChunk);
+}
+
 static enum RetFormat ParseDataFormat(std::string& param, const std::string& strReq)
 {
     const std::string::size_type pos = strReq.rfind('.');
@@ -200,6 +217,192 @@ static bool rest_headers(HTTPRequest* req,
     return true; // continue to process further HTTP reqs on this cxn
 }
 
+/** Parse the <start>/<count> of a range request, or reply with an error */
+static bool ParseRange(HTTPRequest* req, const std::string& param, const std::string& strEndpoint, int& nStart, int& nCount)
+{
+    vector<string> path;
+    boost::split(path, param, boost::is_any_of("/"));
+    if (path.size() != 2)
+        return RESTERR(req, HTTP_BAD_REQUEST, "Use /rest/" + strEndpoint + "/<start>/<count>.bin.");
+    if (!ParseInt32(path[0], &nStart) || nStart < 0)
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid start height: " + path[0]);
+    if (!ParseInt32(path[1], &nCount) || nCount < 1)
+        return RESTERR(req, HTTP_BAD_REQUEST, "Count out of range: " + path[1]);
+    return true;
+}
+
+/**
+ * Look up at most nMax blocks of the active chain from height nHeight on,
+ * provided the one at nHeight follows hashPrev, if that is not null. A range
+ * sent in several batches thus stops at a reorganization instead of
+ * continuing on the new chain.
+ */
+static void GetChainRange(int nHeight, int nMax, const uint256& hashPrev, std::vector<CBlockIndex*>& vIndex)
+{
+    AssertLockHeld(cs_main);
+    vIndex.clear();
+    CBlockIndex* pindex = chainActive[nHeight];
+    if (!pindex || (!hashPrev.IsNull() && (!pindex->pprev || pindex->pprev->GetBlockHash() != hashPrev)))
+        return;
+    while (pindex && (int)vIndex.size() < nMax) {
+        vIndex.push_back(pindex);
+        pindex = chainActive.Next(pindex);
+    }
+}
+
+/** Send a chunk of a range reply and wait for the client to catch up; false if it went away */
+static bool RESTWriteRangeChunk(HTTPRequest* req, const std::string& strChunk)
+{
+    if (!req->ReplyStarted())
+        req->WriteHeader("Content-Type", "application/octet-stream");
+    req->WriteReplyChunk(strChunk);
+    return req->WaitReplyPending(REST_RANGE_MAX_PENDING);
+}
+
+/** Finish a range reply, or reply with an error if nothing of the range was found */
+static bool RESTEndRange(HTTPRequest* req, const std::string& strChunk)
+{
+    if (!req->ReplyStarted() && strChunk.empty())
+        return RESTERR(req, HTTP_NOT_FOUND, "Start height out of range or block not available (pruned data)");
+    if (!strChunk.empty())
+        RESTWriteRangeChunk(req, strChunk);
+    req->EndReply();
+    return true;
+}
+
+static bool rest_headerrange(HTTPRequest* req, const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    std::string param;
+    if (ParseDataFormat(param, strURIPart) != RF_BINARY)
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: .bin)");
+    int nHeight, nCount;
+    if (!ParseRange(req, param, "headerrange", nHeight, nCount))
+        return false;
+
+    CDataStream ssHeaders(SER_NETWORK, PROTOCOL_VERSION);
+    std::vector<CBlockIndex*> vIndex;
+    uint256 hashLast;
+    while (nCount > 0) {
+        int nBatch = std::min(nCount, REST_RANGE_BATCH);
+        {
+            LOCK(cs_main);
+            GetChainRange(nHeight, nBatch, hashLast, vIndex);
+        }
+        BOOST_FOREACH(const CBlockIndex* pindex, vIndex)
+            ssHeaders << pindex->GetBlockHeader();
+        if (!vIndex.empty())
+            hashLast = vIndex.back()->GetBlockHash();
+        if (ssHeaders.size() >= REST_RANGE_CHUNK_SIZE) {
+            bool fReading = RESTWriteRangeChunk(req, ssHeaders.str());
+            ssHeaders.clear();
+            if (!fReading)
+                break;
+        }
+        if ((int)vIndex.size() < nBatch)
+            break; // tip or reorganization
+        nHeight += nBatch;
+        nCount -= nBatch;
+    }
+    return RESTEndRange(req, ssHeaders.str());
+}
+
+/** Reads blocks one after another, keeping the current block file open and
+ * letting the OS read ahead of the position.
+ */
+class CBlockRangeReader
+{
+private:
+    FILE* file;
+    int nFile;
+    //! End of the part of the file that was asked to be read ahead
+    unsigned int nReadAheadEnd;
+
+public:
+    CBlockRangeReader() : file(NULL), nFile(-1), nReadAheadEnd(0) {}
+    ~CBlockRangeReader()
+    {
+        if (file)
+            fclose(file);
+    }
+
+    bool Read(std::vector<unsigned char>& vchBlock, const CDiskBlockPos& pos)
+    {
+        if (!file || pos.nFile != nFile) {
+            if (file)
+                fclose(file);
+            file = OpenBlockFile(pos, true);
+            nFile = pos.nFile;
+            nReadAheadEnd = 0;
+            if (!file)
+                return false;
+        }
+        // Renew the read ahead halfway through, or when blocks were stored out of order
+        if (pos.nPos + REST_BLOCK_READ_AHEAD / 2 > nReadAheadEnd || pos.nPos + REST_BLOCK_READ_AHEAD < nReadAheadEnd) {
+            FileReadAhead(file, pos.nPos, REST_BLOCK_READ_AHEAD);
+            nReadAheadEnd = pos.nPos + REST_BLOCK_READ_AHEAD;
+        }
+        return ReadRawBlockFromFile(vchBlock, file, pos, Params().MessageStart());
+    }
+};
+
+static bool rest_blockrange(HTTPRequest* req, const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    std::string param;
+    if (ParseDataFormat(param, strURIPart) != RF_BINARY)
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: .bin)");
+    int nHeight, nCount;
+    if (!ParseRange(req, param, "blockrange", nHeight, nCount))
+        return false;
+
+    // Positions are looked up in batches, the blocks read without cs_main;
+    // one pruned in the meantime fails the magic check or its file is gone
+    CBlockRangeReader reader;
+    std::vector<CBlockIndex*> vIndex;
+    std::vector<CDiskBlockPos> vPos;
+    std::vector<unsigned char> vchBlock;
+    std::string strChunk;
+    uint256 hashLast;
+    bool fComplete = false;
+    while (nCount > 0 && !fComplete) {
+        int nBatch = std::min(nCount, REST_RANGE_BATCH);
+        vPos.clear();
+        {
+            LOCK(cs_main);
+            GetChainRange(nHeight, nBatch, hashLast, vIndex);
+            BOOST_FOREACH(const CBlockIndex* pindex, vIndex) {
+                if (!(pindex->nStatus & BLOCK_HAVE_DATA))
+                    break;
+                vPos.push_back(pindex->GetBlockPos());
+                hashLast = pindex->GetBlockHash();
+            }
+        }
+        // Stop after this batch at the tip, a reorganization or pruned blocks
+        fComplete = (int)vPos.size() < nBatch;
+        BOOST_FOREACH(const CDiskBlockPos& pos, vPos) {
+            if (!reader.Read(vchBlock, pos)) {
+                fComplete = true;
+                break;
+            }
+            strChunk.append((const char*)vchBlock.data(), vchBlock.size());
+            if (strChunk.size() >= REST_RANGE_CHUNK_SIZE) {
+                bool fReading = RESTWriteRangeChunk(req, strChunk);
+                strChunk.clear();
+                if (!fReading) {
+                    fComplete = true;
+                    break;
+                }
+            }
+        }
+        nHeight += nBatch;
+        nCount -= nBatch;
+    }
+    return RESTEndRange(req, strChunk);
+}
+
 static bool rest_block(HTTPRequest* req,
                        const std::string& strURIPart,
                        bool showTxDetails)
@@ -247,10 +450,11 @@ static bool rest_block(HTTPRequest* req,
     }
 
     case RF_JSON: {
-        UniValue objBlock = blockToJSON(block, pblockindex, showTxDetails);
-        string strJSON = objBlock.write() + "\n";
-        req->WriteHeader("Content-Type", "application/json");
-        req->WriteReply(HTTP_OK, strJSON);
+        CJSONStreamWriter writer(boost::bind(RESTWriteJSONChunk, req, _1));
+        blockToJSON(writer, block, pblockindex, showTxDetails);
+        writer.Raw("\n");
+        writer.Flush();
+        req->EndReply();
         return true;
     }
 
@@ -335,11 +539,11 @@ static bool rest_mempool_contents(HTTPRequest* req, const std::string& strURIPar
 
     switch (rf) {
     case RF_JSON: {
-        UniValue mempoolObject = mempoolToJSON(true);
-
-        string strJSON = mempoolObject.write() + "\n";
-        req->WriteHeader("Content-Type", "application/json");
-        req->WriteReply(HTTP_OK, strJSON);
+        CJSONStreamWriter writer(boost::bind(RESTWriteJSONChunk, req, _1));
+        mempoolToJSON(writer, true);
+        writer.Raw("\n");
+        writer.Flush();
+        req->EndReply();
         return true;
     }
     default: {
@@ -610,6 +814,8 @@ static const struct {
       {"/rest/mempool/info", rest_mempool_info},
       {"/rest/mempool/contents", rest_mempool_contents},
       {"/rest/headers/", rest_headers},
+      {"/rest/headerrange/", rest_headerrange},
+      {"/rest/blockrange/", rest_blockrange},
       {"/rest/getutxos", rest_getutxos},
 };
 
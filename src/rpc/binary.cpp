@@ -0,0 +1,119 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "rpc/binary.h"
+
+#include "chain.h"
+#include "chainparams.h"
+#include "coins.h"
+#include "crypto/common.h"
+#include "main.h"
+#include "primitives/transaction.h"
+#include "sync.h"
+#include "txmempool.h"
+#include "uint256.h"
+#include "version.h"
+
+bool ParseBinaryRPCRequests(const std::string& strBody, std::vector<std::string>& vRequests)
+{
+    vRequests.clear();
+    size_t nPos = 0;
+    while (nPos < strBody.size()) {
+        if (strBody.size() - nPos < 4)
+            return false;
+        uint32_t nLen = ReadLE32((const unsigned char*)&strBody[nPos]);
+        nPos += 4;
+        if (strBody.size() - nPos < nLen)
+            return false;
+        vRequests.push_back(strBody.substr(nPos, nLen));
+        nPos += nLen;
+    }
+    return true;
+}
+
+/** Append the result of a request to reply, or return why there is none */
+static BinaryRPCStatus ExecRequest(const std::string& strRequest, CDataStream& reply)
+{
+    CDataStream ssRequest(strRequest.data(), strRequest.data() + strRequest.size(), SER_NETWORK, PROTOCOL_VERSION);
+    uint8_t nType;
+    uint256 hash;
+    COutPoint outpoint;
+    try {
+        ssRequest >> nType;
+        if (nType == BINRPC_UTXO)
+            ssRequest >> outpoint;
+        else
+            ssRequest >> hash;
+    } catch (const std::exception&) {
+        return BINRPC_INVALID;
+    }
+    if (!ssRequest.empty())
+        return BINRPC_INVALID;
+
+    switch (nType) {
+    case BINRPC_BLOCK: {
+        CDiskBlockPos pos;
+        {
+            LOCK(cs_main);
+            BlockMap::iterator mi = mapBlockIndex.find(hash);
+            if (mi == mapBlockIndex.end() || !(mi->second->nStatus & BLOCK_HAVE_DATA))
+                return BINRPC_NOT_FOUND;
+            pos = mi->second->GetBlockPos();
+        }
+        // Read outside cs_main; a block pruned in the meantime fails the
+        // magic check of ReadRawBlockFromDisk, or its file is gone
+        std::vector<unsigned char> vchBlock;
+        if (!ReadRawBlockFromDisk(vchBlock, pos, Params().MessageStart()))
+            return BINRPC_NOT_FOUND;
+        reply.write((const char*)vchBlock.data(), vchBlock.size());
+        return BINRPC_OK;
+    }
+    case BINRPC_TX: {
+        CTransaction tx;
+        uint256 hashBlock;
+        if (!GetTransaction(hash, tx, Params().GetConsensus(), hashBlock, true))
+            return BINRPC_NOT_FOUND;
+        reply << tx << hashBlock;
+        return BINRPC_OK;
+    }
+    case BINRPC_UTXO: {
+        LOCK2(cs_main, mempool.cs);
+        CCoinsViewMemPool viewMempool(pcoinsTip, mempool);
+        CCoins coins;
+        if (!viewMempool.GetCoins(outpoint.hash, coins))
+            return BINRPC_NOT_FOUND;
+        mempool.pruneSpent(outpoint.hash, coins);
+        if (!coins.IsAvailable(outpoint.n))
+            return BINRPC_NOT_FOUND;
+        reply << (uint32_t)coins.nVersion << (uint32_t)coins.nHeight << coins.vout[outpoint.n];
+        return BINRPC_OK;
+    }
+    case BINRPC_MEMPOOL_ENTRY: {
+        LOCK(mempool.cs);
+        CTxMemPool::txiter it = mempool.mapTx.find(hash);
+        if (it == mempool.mapTx.end())
+            return BINRPC_NOT_FOUND;
+        reply << it->GetTx() << it->GetFee() << it->GetModifiedFee() << it->GetTime() << (uint32_t)it->GetHeight();
+        reply << it->GetCountWithDescendants() << it->GetSizeWithDescendants() << it->GetModFeesWithDescendants();
+        reply << it->GetCountWithAncestors() << it->GetSizeWithAncestors() << it->GetModFeesWithAncestors();
+        return BINRPC_OK;
+    }
+    default:
+        return BINRPC_INVALID;
+    }
+}
+
+void ExecBinaryRPCRequest(const std::string& strRequest, CDataStream& reply)
+{
+    // The length is filled in once the payload is complete
+    size_t nStart = reply.size();
+    reply << (uint32_t)0 << (uint8_t)BINRPC_OK;
+
+    BinaryRPCStatus status = ExecRequest(strRequest, reply);
+    if (status != BINRPC_OK) {
+        reply.resize(nStart + 5);
+        reply[nStart + 4] = status;
+    }
+    WriteLE32((unsigned char*)&reply[nStart], reply.size() - nStart - 4);
+}
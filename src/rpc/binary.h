@@ -0,0 +1,59 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_RPC_BINARY_H
+#define BITCOIN_RPC_BINARY_H
+
+#include "streams.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/**
+ * Binary RPC, for clients that pull large amounts of chain data and want
+ * neither hex nor JSON in the way. A request body is a batch of frames, each
+ * a 4-byte little-endian payload length followed by the payload: a one-byte
+ * request type and its argument. The reply has one frame per request, in
+ * order, whose payload is a one-byte status followed, if it is BINRPC_OK, by
+ * the result in the usual network serialization:
+ *
+ * - BINRPC_BLOCK, block hash: the block, as stored on disk
+ * - BINRPC_TX, txid: the transaction and the hash of the block that contains
+ *   it, null for mempool transactions
+ * - BINRPC_UTXO, COutPoint: tx version, height and CTxOut of the unspent
+ *   output, as in the BIP64 getutxos reply; spends and outputs of mempool
+ *   transactions are taken into account
+ * - BINRPC_MEMPOOL_ENTRY, txid: the transaction, its fee, modified fee,
+ *   entry time and entry height, then descendant count, size and fees and
+ *   ancestor count, size and fees
+ */
+enum BinaryRPCRequestType {
+    BINRPC_BLOCK = 1,
+    BINRPC_TX = 2,
+    BINRPC_UTXO = 3,
+    BINRPC_MEMPOOL_ENTRY = 4,
+};
+
+enum BinaryRPCStatus {
+    BINRPC_OK = 0,
+    //! Not known, or no longer available (e.g. pruned)
+    BINRPC_NOT_FOUND = 1,
+    //! Unknown request type or malformed argument
+    BINRPC_INVALID = 2,
+};
+
+/** Size of the pieces the reply is sent in */
+static const size_t BINRPC_CHUNK_SIZE = 64 * 1024;
+
+/**
+ * Split a request body into its frames' payloads. Returns false if the body
+ * does not consist of complete frames.
+ */
+bool ParseBinaryRPCRequests(const std::string& strBody, std::vector<std::string>& vRequests);
+
+/** Execute one request payload and append its reply frame to reply */
+void ExecBinaryRPCRequest(const std::string& strRequest, CDataStream& reply);
+
+#endif // BITCOIN_RPC_BINARY_H
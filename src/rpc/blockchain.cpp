@@ -12,6 +12,7 @@
 #include "main.h"
 #include "policy/policy.h"
 #include "primitives/transaction.h"
+#include "rpc/jsonwriter.h"
 #include "rpc/server.h"
 #include "streams.h"
 #include "sync.h"
@@ -90,7 +91,8 @@ UniValue blockheaderToJSON(const CBlockIndex* blockindex)
     return result;
 }
 
-UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false)
+/** The JSON description of a block, with txs as its "tx" member */
+static UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, UniValue txs)
 {
     UniValue result(UniValue::VOBJ);
     result.push_back(Pair("hash", blockindex->GetBlockHash().GetHex()));
@@ -106,19 +108,7 @@ UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool tx
     result.push_back(Pair("version", block.nVersion));
     result.push_back(Pair("versionHex", strprintf("%08x", block.nVersion)));
     result.push_back(Pair("merkleroot", block.hashMerkleRoot.GetHex()));
-    UniValue txs(UniValue::VARR);
-    BOOST_FOREACH(const CTransaction&tx, block.vtx)
-    {
-        if(txDetails)
-        {
-            UniValue objTx(UniValue::VOBJ);
-            TxToJSON(tx, uint256(), objTx);
-            txs.push_back(objTx);
-        }
-        else
-            txs.push_back(tx.GetHash().GetHex());
-    }
-    result.push_back(Pair("tx", txs));
+    result.push_back(Pair("tx", std::move(txs)));
     result.push_back(Pair("time", block.GetBlockTime()));
     result.push_back(Pair("mediantime", (int64_t)blockindex->GetMedianTimePast()));
     result.push_back(Pair("nonce", (uint64_t)block.nNonce));
@@ -134,6 +124,56 @@ UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool tx
     return result;
 }
 
+UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false)
+{
+    UniValue txs(UniValue::VARR);
+    BOOST_FOREACH(const CTransaction&tx, block.vtx)
+    {
+        if(txDetails)
+        {
+            UniValue objTx(UniValue::VOBJ);
+            TxToJSON(tx, uint256(), objTx);
+            txs.push_back(std::move(objTx));
+        }
+        else
+            txs.push_back(tx.GetHash().GetHex());
+    }
+    return blockToJSON(block, blockindex, std::move(txs));
+}
+
+void blockToJSON(CJSONStreamWriter& writer, const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false)
+{
+    // The fields besides the transactions are few, so they are built as
+    // usual; the transactions are converted and written one at a time.
+    UniValue result = blockToJSON(block, blockindex, UniValue(UniValue::VARR));
+    const std::vector<std::string>& keys = result.getKeys();
+    const std::vector<UniValue>& values = result.getValues();
+    writer.BeginObject();
+    for (size_t i = 0; i < keys.size(); i++)
+    {
+        writer.Key(keys[i]);
+        if (keys[i] != "tx")
+        {
+            writer.Value(values[i]);
+            continue;
+        }
+        writer.BeginArray();
+        BOOST_FOREACH(const CTransaction&tx, block.vtx)
+        {
+            if(txDetails)
+            {
+                UniValue objTx(UniValue::VOBJ);
+                TxToJSON(tx, uint256(), objTx);
+                writer.Value(objTx);
+            }
+            else
+                writer.String(tx.GetHash().GetHex());
+        }
+        writer.EndArray();
+    }
+    writer.EndObject();
+}
+
 UniValue getblockcount(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() != 0)
@@ -267,6 +307,33 @@ UniValue mempoolToJSON(bool fVerbose = false)
     }
 }
 
+void mempoolToJSON(CJSONStreamWriter& writer, bool fVerbose = false)
+{
+    if (fVerbose)
+    {
+        LOCK(mempool.cs);
+        writer.BeginObject();
+        BOOST_FOREACH(const CTxMemPoolEntry& e, mempool.mapTx)
+        {
+            UniValue info(UniValue::VOBJ);
+            entryToJSON(info, e);
+            writer.Key(e.GetTx().GetHash().ToString());
+            writer.Value(info);
+        }
+        writer.EndObject();
+    }
+    else
+    {
+        vector<uint256> vtxid;
+        mempool.queryHashes(vtxid);
+
+        writer.BeginArray();
+        BOOST_FOREACH(const uint256& hash, vtxid)
+            writer.String(hash.ToString());
+        writer.EndArray();
+    }
+}
+
 UniValue getrawmempool(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() > 1)
@@ -298,6 +365,19 @@ UniValue getrawmempool(const UniValue& params, bool fHelp)
     return mempoolToJSON(fVerbose);
 }
 
+static bool getrawmempoolStream(const UniValue& params, CJSONStreamWriter& writer)
+{
+    if (params.size() > 1)
+        return false;
+
+    bool fVerbose = false;
+    if (params.size() > 0)
+        fVerbose = params[0].get_bool();
+
+    mempoolToJSON(writer, fVerbose);
+    return true;
+}
+
 UniValue getmempoolancestors(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() < 1 || params.size() > 2) {
@@ -543,6 +623,33 @@ UniValue getblockheader(const UniValue& params, bool fHelp)
     return blockheaderToJSON(pblockindex);
 }
 
+/** Look up the block with hash strHash and read it from disk, for getblock */
+static CBlockIndex* ReadBlockForRPC(const std::string& strHash, CBlock& block)
+{
+    uint256 hash(uint256S(strHash));
+
+    CBlockIndex* pblockindex;
+    {
+        LOCK(cs_main);
+        if (mapBlockIndex.count(hash) == 0)
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+
+        pblockindex = mapBlockIndex[hash];
+
+        if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "Block not available (pruned data)");
+    }
+
+    // Read and encode the block without cs_main, so concurrent calls (such as
+    // those of a batch) don't queue up behind each other's disk reads. Block
+    // index entries are never deleted; if the block is pruned meanwhile, the
+    // read fails.
+    if(!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
+
+    return pblockindex;
+}
+
 UniValue getblock(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() < 1 || params.size() > 2)
@@ -584,26 +691,12 @@ UniValue getblock(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getblock", "\"00000000c937983704a73af28acdec37b049d214adbda81d7e2a3dd146f6ed09\"")
         );
 
-    LOCK(cs_main);
-
-    std::string strHash = params[0].get_str();
-    uint256 hash(uint256S(strHash));
-
     bool fVerbose = true;
     if (params.size() > 1)
         fVerbose = params[1].get_bool();
 
-    if (mapBlockIndex.count(hash) == 0)
-        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
-
     CBlock block;
-    CBlockIndex* pblockindex = mapBlockIndex[hash];
-
-    if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
-        throw JSONRPCError(RPC_INTERNAL_ERROR, "Block not available (pruned data)");
-
-    if(!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
-        throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
+    CBlockIndex* pblockindex = ReadBlockForRPC(params[0].get_str(), block);
 
     if (!fVerbose)
     {
@@ -613,9 +706,29 @@ UniValue getblock(const UniValue& params, bool fHelp)
         return strHex;
     }
 
+    LOCK(cs_main);
     return blockToJSON(block, pblockindex);
 }
 
+static bool getblockStream(const UniValue& params, CJSONStreamWriter& writer)
+{
+    if (params.size() < 1 || params.size() > 2)
+        return false;
+
+    bool fVerbose = true;
+    if (params.size() > 1)
+        fVerbose = params[1].get_bool();
+    if (!fVerbose)
+        return false;
+
+    CBlock block;
+    CBlockIndex* pblockindex = ReadBlockForRPC(params[0].get_str(), block);
+
+    LOCK(cs_main);
+    blockToJSON(writer, block, pblockindex);
+    return true;
+}
+
 struct CCoinsStats
 {
     int nHeight;
@@ -1215,4 +1328,6 @@ void RegisterBlockchainRPCCommands(CRPCTable &tableRPC)
 {
     for (unsigned int vcidx = 0; vcidx < ARRAYLEN(commands); vcidx++)
         tableRPC.appendCommand(commands[vcidx].name, &commands[vcidx]);
+    tableRPC.appendStreamCommand("getblock", &getblockStream);
+    tableRPC.appendStreamCommand("getrawmempool", &getrawmempoolStream);
 }
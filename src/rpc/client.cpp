@@ -98,6 +98,7 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "estimatepriority", 0 },
     { "estimatesmartfee", 0 },
     { "estimatesmartpriority", 0 },
+    { "estimatesmartfees", 0 },
     { "prioritisetransaction", 1 },
     { "prioritisetransaction", 2 },
     { "setban", 2 },
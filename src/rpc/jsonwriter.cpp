@@ -0,0 +1,98 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "rpc/jsonwriter.h"
+
+#include <assert.h>
+
+CJSONStreamWriter::CJSONStreamWriter(const SinkFn& sinkIn, size_t nChunkSizeIn) :
+    sink(sinkIn), nChunkSize(nChunkSizeIn), fAfterKey(false), nBytesWritten(0)
+{
+    strBuffer.reserve(nChunkSize);
+}
+
+void CJSONStreamWriter::Append(const std::string& str)
+{
+    strBuffer += str;
+    nBytesWritten += str.size();
+    if (strBuffer.size() >= nChunkSize)
+        Flush();
+}
+
+void CJSONStreamWriter::BeginValue()
+{
+    if (fAfterKey) {
+        fAfterKey = false;
+        return;
+    }
+    if (vEmpty.empty())
+        return;
+    if (!vEmpty.back()) {
+        strBuffer += ',';
+        nBytesWritten++;
+    }
+    vEmpty.back() = false;
+}
+
+void CJSONStreamWriter::BeginObject()
+{
+    BeginValue();
+    vEmpty.push_back(true);
+    Append("{");
+}
+
+void CJSONStreamWriter::EndObject()
+{
+    assert(!vEmpty.empty() && !fAfterKey);
+    vEmpty.pop_back();
+    Append("}");
+}
+
+void CJSONStreamWriter::BeginArray()
+{
+    BeginValue();
+    vEmpty.push_back(true);
+    Append("[");
+}
+
+void CJSONStreamWriter::EndArray()
+{
+    assert(!vEmpty.empty() && !fAfterKey);
+    vEmpty.pop_back();
+    Append("]");
+}
+
+void CJSONStreamWriter::Key(const std::string& key)
+{
+    assert(!vEmpty.empty() && !fAfterKey);
+    BeginValue();
+    // Escape like UniValue does
+    Append(UniValue(key).write() + ":");
+    fAfterKey = true;
+}
+
+void CJSONStreamWriter::Value(const UniValue& val)
+{
+    BeginValue();
+    Append(val.write());
+}
+
+void CJSONStreamWriter::String(const std::string& str)
+{
+    BeginValue();
+    Append(UniValue(str).write());
+}
+
+void CJSONStreamWriter::Raw(const std::string& str)
+{
+    Append(str);
+}
+
+void CJSONStreamWriter::Flush()
+{
+    if (strBuffer.empty())
+        return;
+    sink(strBuffer);
+    strBuffer.clear();
+}
@@ -0,0 +1,71 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_RPC_JSONWRITER_H
+#define BITCOIN_RPC_JSONWRITER_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <boost/function.hpp>
+
+#include <univalue.h>
+
+/** Size of the pieces a CJSONStreamWriter hands to its sink */
+static const size_t JSON_STREAM_CHUNK_SIZE = 64 * 1024;
+
+/**
+ * Writes compact JSON text piece by piece, passing it on to a sink whenever
+ * nChunkSize bytes have collected, so a large result never exists in memory
+ * as a whole. Containers are opened and closed explicitly; the values inside
+ * them are usually small and are written from a UniValue. The output is the
+ * same as UniValue::write() of the equivalent tree.
+ *
+ * Nothing reaches the sink before nChunkSize bytes were written or Flush()
+ * is called, and output still buffered when the writer is destroyed is
+ * dropped.
+ */
+class CJSONStreamWriter
+{
+public:
+    typedef boost::function<void(const std::string&)> SinkFn;
+
+private:
+    SinkFn sink;
+    size_t nChunkSize;
+    std::string strBuffer;
+    //! For each open container, whether nothing was written into it yet
+    std::vector<bool> vEmpty;
+    bool fAfterKey;
+    uint64_t nBytesWritten;
+
+    void BeginValue();
+    void Append(const std::string& str);
+
+public:
+    CJSONStreamWriter(const SinkFn& sink, size_t nChunkSize = JSON_STREAM_CHUNK_SIZE);
+
+    void BeginObject();
+    void EndObject();
+    void BeginArray();
+    void EndArray();
+
+    /** Write the key of the next member of the current object */
+    void Key(const std::string& key);
+    void Value(const UniValue& val);
+    void String(const std::string& str);
+    /** Append text as is, e.g. a trailing newline */
+    void Raw(const std::string& str);
+
+    /** Pass everything written so far on to the sink */
+    void Flush();
+
+    /** Number of bytes written, whether passed on or still buffered */
+    uint64_t GetBytesWritten() const { return nBytesWritten; }
+    /** Number of containers that are open */
+    size_t GetDepth() const { return vEmpty.size(); }
+};
+
+#endif // BITCOIN_RPC_JSONWRITER_H
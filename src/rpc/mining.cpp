@@ -15,6 +15,7 @@
 #include "main.h"
 #include "miner.h"
 #include "net.h"
+#include "policy/fees.h"
 #include "pow.h"
 #include "rpc/server.h"
 #include "txmempool.h"
@@ -24,8 +25,11 @@
 
 #include <stdint.h>
 
+#include <atomic>
+
 #include <boost/assign/list_of.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
 
 #include <univalue.h>
 
@@ -95,6 +99,13 @@ UniValue getnetworkhashps(const UniValue& params, bool fHelp)
     return GetNetworkHashPS(params.size() > 0 ? params[0].get_int() : 120, params.size() > 1 ? params[1].get_int() : -1);
 }
 
+static void ScanBlockNonceThread(CBlockHeader* pheader, uint32_t nCount, uint64_t* pnTries, bool* pfFound, std::atomic<bool>* pfAbort)
+{
+    *pfFound = ScanHeaderNonce(*pheader, 0, nCount, *pnTries, pfAbort);
+    if (*pfFound)
+        *pfAbort = true;
+}
+
 UniValue generateBlocks(boost::shared_ptr<CReserveScript> coinbaseScript, int nGenerate, uint64_t nMaxTries, bool keepScript)
 {
     static const int nInnerLoopCount = 0x10000;
@@ -102,6 +113,12 @@ UniValue generateBlocks(boost::shared_ptr<CReserveScript> coinbaseScript, int nG
     int nHeightEnd = 0;
     int nHeight = 0;
 
+    int nThreads = GetArg("-genthreads", DEFAULT_GENERATE_THREADS);
+    if (nThreads <= 0)
+        nThreads += GetNumCores();
+    if (nThreads < 1)
+        nThreads = 1;
+
     {   // Don't keep cs_main locked
         LOCK(cs_main);
         nHeightStart = chainActive.Height();
@@ -110,26 +127,43 @@ UniValue generateBlocks(boost::shared_ptr<CReserveScript> coinbaseScript, int nG
     }
     unsigned int nExtraNonce = 0;
     UniValue blockHashes(UniValue::VARR);
-    while (nHeight < nHeightEnd)
+    while (nHeight < nHeightEnd && nMaxTries > 0)
     {
         std::unique_ptr<CBlockTemplate> pblocktemplate(BlockAssembler(Params()).CreateNewBlock(coinbaseScript->reserveScript));
         if (!pblocktemplate.get())
             throw JSONRPCError(RPC_INTERNAL_ERROR, "Couldn't create new block");
-        CBlock *pblock = &pblocktemplate->block;
+
+        // Every thread searches the full nonce range of its own candidate;
+        // the candidates differ by extranonce, so no two threads ever hash
+        // the same header.
+        std::vector<CBlock> vCandidates(nThreads, pblocktemplate->block);
         {
             LOCK(cs_main);
-            IncrementExtraNonce(pblock, chainActive.Tip(), nExtraNonce);
+            for (int i = 0; i < nThreads; i++)
+                IncrementExtraNonce(&vCandidates[i], chainActive.Tip(), nExtraNonce);
         }
-        while (nMaxTries > 0 && pblock->nNonce < nInnerLoopCount && !CheckProofOfWork(pblock->GetHash(), pblock->nBits, Params().GetConsensus())) {
-            ++pblock->nNonce;
-            --nMaxTries;
+        uint32_t nCount = std::min<uint64_t>(nInnerLoopCount, (nMaxTries + nThreads - 1) / nThreads);
+        std::vector<uint64_t> vTries(nThreads, 0);
+        std::unique_ptr<bool[]> vFound(new bool[nThreads]());
+        std::atomic<bool> fAbort(false);
+        if (nThreads == 1) {
+            ScanBlockNonceThread(&vCandidates[0], nCount, &vTries[0], &vFound[0], &fAbort);
+        } else {
+            boost::thread_group searchThreads;
+            for (int i = 0; i < nThreads; i++)
+                searchThreads.create_thread(boost::bind(&ScanBlockNonceThread, &vCandidates[i], nCount, &vTries[i], &vFound[i], &fAbort));
+            searchThreads.join_all();
         }
-        if (nMaxTries == 0) {
-            break;
+
+        CBlock *pblock = NULL;
+        for (int i = 0; i < nThreads; i++) {
+            nMaxTries -= std::min(nMaxTries, vTries[i]);
+            if (vFound[i] && !pblock)
+                pblock = &vCandidates[i];
         }
-        if (pblock->nNonce == nInnerLoopCount) {
+        if (!pblock)
             continue;
-        }
+
         CValidationState state;
         if (!ProcessNewBlock(state, Params(), NULL, pblock, true, NULL, false))
             throw JSONRPCError(RPC_INTERNAL_ERROR, "ProcessNewBlock, block not accepted");
@@ -525,12 +559,16 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
     static int64_t nStart;
     static unsigned int nBits;
     static CBlockTemplate* pblocktemplate;
+    static bool fTemplateEmpty;
 
     // Always regenerate block template to ensure difficulty is current
     // This is necessary because emergency difficulty rules depend on timestamps
     CBlockIndex* pindexTip = chainActive.Tip();
+    const bool fNewTip = (pindexPrev != pindexTip);
 
-    if (pindexPrev != pindexTip ||
+    // An empty precomputed template is served right after a new tip and is
+    // swapped for the full one as soon as -precomputetemplates has built it.
+    if (fNewTip || fTemplateEmpty ||
         (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && GetTime() - nStart > 5))
     {
         // Clear pindexPrev so future calls make a new block, despite any failures from here on
@@ -539,7 +577,11 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
         // Store the pindexBest used before CreateNewBlock, to avoid races
         nTransactionsUpdatedLast = mempool.GetTransactionsUpdated();
         CBlockIndex* pindexPrevNew = chainActive.Tip();
-        nStart = GetTime();
+        // Give the precompute thread a few seconds to finish the full
+        // template, after that we assemble one ourselves
+        bool fTryPrecomputed = fPrecomputeTemplates && (fNewTip || GetTime() - nStart <= 5);
+        if (fNewTip || !fTemplateEmpty)
+            nStart = GetTime();
 
         // Create new block
         if(pblocktemplate)
@@ -547,10 +589,15 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
             delete pblocktemplate;
             pblocktemplate = NULL;
         }
-        CScript scriptDummy = CScript() << OP_TRUE;
-        pblocktemplate = BlockAssembler(Params()).CreateNewBlock(scriptDummy);
-        if (!pblocktemplate)
-            throw JSONRPCError(RPC_OUT_OF_MEMORY, "Out of memory");
+        fTemplateEmpty = false;
+        if (fTryPrecomputed)
+            pblocktemplate = GetPrecomputedTemplate(pindexPrevNew, fTemplateEmpty);
+        if (!pblocktemplate) {
+            CScript scriptDummy = CScript() << OP_TRUE;
+            pblocktemplate = BlockAssembler(Params()).CreateNewBlock(scriptDummy);
+            if (!pblocktemplate)
+                throw JSONRPCError(RPC_OUT_OF_MEMORY, "Out of memory");
+        }
 
         // Need to update only after we know CreateNewBlock succeeded
         pindexPrev = pindexPrevNew;
@@ -932,6 +979,64 @@ UniValue estimatesmartpriority(const UniValue& params, bool fHelp)
     return result;
 }
 
+UniValue estimatesmartfees(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() > 1)
+        throw runtime_error(
+            "estimatesmartfees ( maxblocks )\n"
+            "\nWARNING: This interface is unstable and may disappear or change!\n"
+            "\nReturns estimatesmartfee and estimatesmartpriority for every nblocks from 1 to\n"
+            "maxblocks in one call. The estimates are computed once per block and are read\n"
+            "without locking the mempool, so the mempool reject fee they account for is the\n"
+            "one as of the last block or mempool limiting.\n"
+            "\nArguments:\n"
+            "1. maxblocks   (numeric, optional) Highest nblocks to return (default: all tracked)\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"height\" : n,        (numeric) block height the estimates were computed at\n"
+            "  \"estimates\" : [     (array) one entry per nblocks\n"
+            "    {\n"
+            "      \"nblocks\" : n,          (numeric) requested number of blocks\n"
+            "      \"feerate\" : x.x,        (numeric) as estimatesmartfee feerate\n"
+            "      \"blocks\" : n,           (numeric) as estimatesmartfee blocks\n"
+            "      \"priority\" : x.x,       (numeric) as estimatesmartpriority priority\n"
+            "      \"priorityblocks\" : n    (numeric) as estimatesmartpriority blocks\n"
+            "    }, ...\n"
+            "  ]\n"
+            "}\n"
+            "\nExample:\n"
+            + HelpExampleCli("estimatesmartfees", "")
+            + HelpExampleCli("estimatesmartfees", "12")
+            );
+
+    RPCTypeCheck(params, boost::assign::list_of(UniValue::VNUM));
+
+    CAmount minPoolFee;
+    std::shared_ptr<const FeeEstimateTable> table = mempool.GetFeeEstimates(minPoolFee);
+    int nMaxBlocks = std::max(table->feeMedians.size(), table->priMedians.size());
+    if (params.size() > 0)
+        nMaxBlocks = std::min(nMaxBlocks, params[0].get_int());
+
+    UniValue estimates(UniValue::VARR);
+    for (int nBlocks = 1; nBlocks <= nMaxBlocks; nBlocks++) {
+        UniValue entry(UniValue::VOBJ);
+        int answerFound;
+        CFeeRate feeRate = table->estimateSmartFee(nBlocks, &answerFound, minPoolFee);
+        entry.push_back(Pair("nblocks", nBlocks));
+        entry.push_back(Pair("feerate", feeRate == CFeeRate(0) ? -1.0 : ValueFromAmount(feeRate.GetFeePerK())));
+        entry.push_back(Pair("blocks", answerFound));
+        double priority = table->estimateSmartPriority(nBlocks, &answerFound, minPoolFee);
+        entry.push_back(Pair("priority", priority));
+        entry.push_back(Pair("priorityblocks", answerFound));
+        estimates.push_back(entry);
+    }
+
+    UniValue result(UniValue::VOBJ);
+    result.push_back(Pair("height", (int)table->nBlockHeight));
+    result.push_back(Pair("estimates", estimates));
+    return result;
+}
+
 static const CRPCCommand commands[] =
 { //  category              name                      actor (function)         okSafeMode
   //  --------------------- ------------------------  -----------------------  ----------
@@ -948,6 +1053,7 @@ static const CRPCCommand commands[] =
     { "util",               "estimatepriority",       &estimatepriority,       true  },
     { "util",               "estimatesmartfee",       &estimatesmartfee,       true  },
     { "util",               "estimatesmartpriority",  &estimatesmartpriority,  true  },
+    { "util",               "estimatesmartfees",      &estimatesmartfees,      true  },
 };
 
 void RegisterMiningRPCCommands(CRPCTable &tableRPC)
@@ -4,6 +4,7 @@
 
 #include "rpc/server.h"
 
+#include "blockencodings.h"
 #include "chainparams.h"
 #include "clientversion.h"
 #include "main.h"
@@ -77,6 +78,32 @@ static void CopyNodeStats(std::vector<CNodeStats>& vstats)
     }
 }
 
+static UniValue MsgTimeStatsToJSON(const CMsgTimeStats& stats)
+{
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("count", stats.nCount));
+    obj.push_back(Pair("time", stats.nTotalMicros * 0.000001));
+    obj.push_back(Pair("cs_main", stats.nMainMicros * 0.000001));
+    obj.push_back(Pair("max", stats.nMaxMicros * 0.000001));
+    int nBuckets = MSG_TIME_BUCKETS;
+    while (nBuckets > 0 && stats.vBuckets[nBuckets - 1] == 0)
+        nBuckets--;
+    UniValue histogram(UniValue::VARR);
+    for (int i = 0; i < nBuckets; i++)
+        histogram.push_back(stats.vBuckets[i]);
+    obj.push_back(Pair("histogram", histogram));
+    return obj;
+}
+
+static const char* strMsgTimeStatsHelp =
+    "{\n"
+    "         \"count\": n,          (numeric) Number of times handled\n"
+    "         \"time\": n,           (numeric) Total time in seconds spent handling them\n"
+    "         \"cs_main\": n,        (numeric) Part of that time in seconds cs_main was held\n"
+    "         \"max\": n,            (numeric) Longest single handling time in seconds\n"
+    "         \"histogram\": [n,...] (array) Counts by handling time, entry i counting times below 2^i microseconds\n"
+    "       }";
+
 UniValue getpeerinfo(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() != 0)
@@ -111,6 +138,9 @@ UniValue getpeerinfo(const UniValue& params, bool fHelp)
             "       n,                        (numeric) The heights of blocks we're currently asking from this peer\n"
             "       ...\n"
             "    ]\n"
+            "    \"earlyrelay_blocks\": n,    (numeric) Blocks sent to this peer before we finished validating them (-cmpctearlyrelay)\n"
+            "    \"earlyrelay_saved\": n,     (numeric) Total time in seconds those blocks reached this peer ahead of announcing them after validation\n"
+            "    \"earlyrelay_invalid\": n,   (numeric) Blocks from this peer which we relayed before validation and turned out invalid\n"
             "    \"bytessent_per_msg\": {\n"
             "       \"addr\": n,             (numeric) The total bytes sent aggregated by message type\n"
             "       ...\n"
@@ -119,6 +149,17 @@ UniValue getpeerinfo(const UniValue& params, bool fHelp)
             "       \"addr\": n,             (numeric) The total bytes received aggregated by message type\n"
             "       ...\n"
             "    }\n"
+            "    \"recvqueue_msgs\": n,       (numeric) Received messages waiting to be processed\n"
+            "    \"recvqueue_bytes\": n,      (numeric) Size in bytes of those messages\n"
+            "    \"sendqueue_msgs\": n,       (numeric) Messages waiting to be sent\n"
+            "    \"sendqueue_bytes\": n,      (numeric) Bytes waiting to be sent\n"
+            "    \"processtime_per_msg\": {\n"
+            "       \"addr\": "
+            + std::string(strMsgTimeStatsHelp) + "  Time spent processing received messages by message type\n"
+            "       ...\n"
+            "    }\n"
+            "    \"sendmessages_time\": "
+            + std::string(strMsgTimeStatsHelp) + "  Time spent preparing messages for this peer\n"
             "  }\n"
             "  ,...\n"
             "]\n"
@@ -172,6 +213,9 @@ UniValue getpeerinfo(const UniValue& params, bool fHelp)
                 heights.push_back(height);
             }
             obj.push_back(Pair("inflight", heights));
+            obj.push_back(Pair("earlyrelay_blocks", statestats.nEarlyRelayBlocks));
+            obj.push_back(Pair("earlyrelay_saved", statestats.nEarlyRelayTimeSaved * 0.000001));
+            obj.push_back(Pair("earlyrelay_invalid", statestats.nEarlyRelayInvalid));
         }
         obj.push_back(Pair("whitelisted", stats.fWhitelisted));
 
@@ -189,6 +233,17 @@ UniValue getpeerinfo(const UniValue& params, bool fHelp)
         }
         obj.push_back(Pair("bytesrecv_per_msg", recvPerMsgCmd));
 
+        obj.push_back(Pair("recvqueue_msgs", (uint64_t)stats.nRecvQueueMsgs));
+        obj.push_back(Pair("recvqueue_bytes", (uint64_t)stats.nRecvQueueBytes));
+        obj.push_back(Pair("sendqueue_msgs", (uint64_t)stats.nSendQueueMsgs));
+        obj.push_back(Pair("sendqueue_bytes", (uint64_t)stats.nSendQueueBytes));
+
+        UniValue timePerMsgCmd(UniValue::VOBJ);
+        BOOST_FOREACH(const mapMsgCmdTime::value_type &i, stats.mapRecvTimePerMsgCmd)
+            timePerMsgCmd.push_back(Pair(i.first, MsgTimeStatsToJSON(i.second)));
+        obj.push_back(Pair("processtime_per_msg", timePerMsgCmd));
+        obj.push_back(Pair("sendmessages_time", MsgTimeStatsToJSON(stats.sendMessagesTime)));
+
         ret.push_back(obj);
     }
 
@@ -376,6 +431,82 @@ UniValue getnettotals(const UniValue& params, bool fHelp)
     return obj;
 }
 
+UniValue getnetprofile(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() > 0)
+        throw runtime_error(
+            "getnetprofile\n"
+            "\nReturns the time the message handler spent on the connected peers, summed up\n"
+            "by message type, and the peers ordered by the time spent on them.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"processtime_per_msg\": {\n"
+            "     \"addr\": "
+            + std::string(strMsgTimeStatsHelp) + "  Time spent processing received messages by message type\n"
+            "     ...\n"
+            "  },\n"
+            "  \"sendmessages_time\": "
+            + std::string(strMsgTimeStatsHelp) + "  Time spent preparing messages for peers\n"
+            "  \"peers\": [\n"
+            "    {\n"
+            "      \"id\": n,                (numeric) Peer index\n"
+            "      \"addr\":\"host:port\",   (string) The ip address and port of the peer\n"
+            "      \"time\": n,              (numeric) Seconds spent processing its messages and preparing messages for it\n"
+            "      \"cs_main\": n,           (numeric) Part of that time in seconds cs_main was held\n"
+            "      \"recvqueue_msgs\": n,    (numeric) Received messages waiting to be processed\n"
+            "      \"sendqueue_bytes\": n    (numeric) Bytes waiting to be sent\n"
+            "    }\n"
+            "    ,...\n"
+            "  ]\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getnetprofile", "")
+            + HelpExampleRpc("getnetprofile", "")
+       );
+
+    vector<CNodeStats> vstats;
+    CopyNodeStats(vstats);
+
+    mapMsgCmdTime mapTotalPerMsgCmd;
+    CMsgTimeStats sendTotal;
+    std::vector<std::pair<int64_t, const CNodeStats*> > vPeerTime;
+    BOOST_FOREACH(const CNodeStats& stats, vstats) {
+        CMsgTimeStats peerTotal = stats.sendMessagesTime;
+        BOOST_FOREACH(const mapMsgCmdTime::value_type &i, stats.mapRecvTimePerMsgCmd) {
+            mapTotalPerMsgCmd[i.first] += i.second;
+            peerTotal += i.second;
+        }
+        sendTotal += stats.sendMessagesTime;
+        vPeerTime.push_back(std::make_pair(peerTotal.nTotalMicros, &stats));
+    }
+    std::sort(vPeerTime.rbegin(), vPeerTime.rend());
+
+    UniValue obj(UniValue::VOBJ);
+    UniValue timePerMsgCmd(UniValue::VOBJ);
+    BOOST_FOREACH(const mapMsgCmdTime::value_type &i, mapTotalPerMsgCmd)
+        timePerMsgCmd.push_back(Pair(i.first, MsgTimeStatsToJSON(i.second)));
+    obj.push_back(Pair("processtime_per_msg", timePerMsgCmd));
+    obj.push_back(Pair("sendmessages_time", MsgTimeStatsToJSON(sendTotal)));
+
+    UniValue peers(UniValue::VARR);
+    for (size_t i = 0; i < vPeerTime.size(); i++) {
+        const CNodeStats& stats = *vPeerTime[i].second;
+        int64_t nMainMicros = stats.sendMessagesTime.nMainMicros;
+        BOOST_FOREACH(const mapMsgCmdTime::value_type &j, stats.mapRecvTimePerMsgCmd)
+            nMainMicros += j.second.nMainMicros;
+        UniValue peer(UniValue::VOBJ);
+        peer.push_back(Pair("id", stats.nodeid));
+        peer.push_back(Pair("addr", stats.addrName));
+        peer.push_back(Pair("time", vPeerTime[i].first * 0.000001));
+        peer.push_back(Pair("cs_main", nMainMicros * 0.000001));
+        peer.push_back(Pair("recvqueue_msgs", (uint64_t)stats.nRecvQueueMsgs));
+        peer.push_back(Pair("sendqueue_bytes", (uint64_t)stats.nSendQueueBytes));
+        peers.push_back(peer);
+    }
+    obj.push_back(Pair("peers", peers));
+    return obj;
+}
+
 static UniValue GetNetworksInfo()
 {
     UniValue networks(UniValue::VARR);
@@ -430,6 +561,16 @@ UniValue getnetworkinfo(const UniValue& params, bool fHelp)
             "  }\n"
             "  ,...\n"
             "  ]\n"
+            "  \"compactextratxn\": {                   (json object) transactions kept outside the mempool for compact block reconstruction\n"
+            "    \"size\": xxx,                         (numeric) number of transactions currently kept\n"
+            "    \"maxsize\": xxx,                      (numeric) maximum number kept (-blockreconstructionextratxn)\n"
+            "    \"sources\": {                         (json object) counters per source (orphan, replaced or evicted)\n"
+            "      \"orphan\": {\n"
+            "        \"added\": xxx,                    (numeric) transactions added from this source\n"
+            "        \"hits\": xxx                      (numeric) block transactions taken from this source instead of being requested\n"
+            "      }, ...\n"
+            "    }\n"
+            "  }\n"
             "  \"warnings\": \"...\"                    (string) any network warnings (such as alert messages) \n"
             "}\n"
             "\nExamples:\n"
@@ -462,6 +603,20 @@ UniValue getnetworkinfo(const UniValue& params, bool fHelp)
         }
     }
     obj.push_back(Pair("localaddresses", localAddresses));
+    CExtraTxnStats extraStats;
+    GetExtraTxnStats(extraStats);
+    UniValue extraTxn(UniValue::VOBJ);
+    extraTxn.push_back(Pair("size", (uint64_t)extraStats.nCount));
+    extraTxn.push_back(Pair("maxsize", (uint64_t)extraStats.nMax));
+    UniValue extraSources(UniValue::VOBJ);
+    for (int i = 0; i < EXTRA_TXN_SOURCE_COUNT; i++) {
+        UniValue source(UniValue::VOBJ);
+        source.push_back(Pair("added", extraStats.nAdded[i]));
+        source.push_back(Pair("hits", extraStats.nHits[i]));
+        extraSources.push_back(Pair(GetExtraTxnSourceName((ExtraTxnSource)i), source));
+    }
+    extraTxn.push_back(Pair("sources", extraSources));
+    obj.push_back(Pair("compactextratxn", extraTxn));
     obj.push_back(Pair("warnings",       GetWarnings("statusbar")));
     return obj;
 }
@@ -581,6 +736,7 @@ static const CRPCCommand commands[] =
     { "network",            "disconnectnode",         &disconnectnode,         true  },
     { "network",            "getaddednodeinfo",       &getaddednodeinfo,       true  },
     { "network",            "getnettotals",           &getnettotals,           true  },
+    { "network",            "getnetprofile",          &getnetprofile,          true  },
     { "network",            "getnetworkinfo",         &getnetworkinfo,         true  },
     { "network",            "setban",                 &setban,                 true  },
     { "network",            "listbanned",             &listbanned,             true  },
@@ -94,9 +94,9 @@ void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry)
 
         }
         in.push_back(Pair("sequence", (int64_t)txin.nSequence));
-        vin.push_back(in);
+        vin.push_back(std::move(in));
     }
-    entry.push_back(Pair("vin", vin));
+    entry.push_back(Pair("vin", std::move(vin)));
     UniValue vout(UniValue::VARR);
     for (unsigned int i = 0; i < tx.vout.size(); i++) {
         const CTxOut& txout = tx.vout[i];
@@ -106,9 +106,9 @@ void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry)
         UniValue o(UniValue::VOBJ);
         ScriptPubKeyToJSON(txout.scriptPubKey, o, true);
         out.push_back(Pair("scriptPubKey", o));
-        vout.push_back(out);
+        vout.push_back(std::move(out));
     }
-    entry.push_back(Pair("vout", vout));
+    entry.push_back(Pair("vout", std::move(vout)));
 
     if (!hashBlock.IsNull()) {
         entry.push_back(Pair("blockhash", hashBlock.GetHex()));
@@ -196,14 +196,13 @@ UniValue getrawtransaction(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getrawtransaction", "\"mytxid\", 1")
         );
 
-    LOCK(cs_main);
-
     uint256 hash = ParseHashV(params[0], "parameter 1");
 
     bool fVerbose = false;
     if (params.size() > 1)
         fVerbose = (params[1].get_int() != 0);
 
+    // GetTransaction takes cs_main itself; encoding the result doesn't need it
     CTransaction tx;
     uint256 hashBlock;
     if (!GetTransaction(hash, tx, Params().GetConsensus(), hashBlock, true))
@@ -216,6 +215,7 @@ UniValue getrawtransaction(const UniValue& params, bool fHelp)
 
     UniValue result(UniValue::VOBJ);
     result.push_back(Pair("hex", strHex));
+    LOCK(cs_main);
     TxToJSON(tx, hashBlock, result);
     return result;
 }
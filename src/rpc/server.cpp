@@ -15,6 +15,8 @@
 
 #include <univalue.h>
 
+#include <atomic>
+
 #include <boost/bind.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/foreach.hpp>
@@ -37,6 +39,8 @@ static RPCTimerInterface* timerInterface = NULL;
 /* Map of name to timer.
  * @note Can be changed to std::unique_ptr when C++11 */
 static std::map<std::string, boost::shared_ptr<RPCTimerBase> > deadlineTimers;
+/* Queues the helpers executing batch calls; batches run serially while unset */
+static RPCQueueWorkFn pfnQueueBatchWork = NULL;
 
 static struct CRPCSignals
 {
@@ -307,6 +311,18 @@ bool CRPCTable::appendCommand(const std::string& name, const CRPCCommand* pcmd)
     return true;
 }
 
+bool CRPCTable::appendStreamCommand(const std::string& name, rpcstreamfn_type fn)
+{
+    if (IsRPCRunning())
+        return false;
+
+    if (!mapCommands.count(name) || mapStreamCommands.count(name))
+        return false;
+
+    mapStreamCommands[name] = fn;
+    return true;
+}
+
 bool StartRPC()
 {
     LogPrint("rpc", "Starting RPC\n");
@@ -409,13 +425,146 @@ static UniValue JSONRPCExecOne(const UniValue& req)
     return rpc_result;
 }
 
+/** Methods that only read state, so that consecutive calls to them in a batch can run at the same time */
+static const char* const pszReadOnlyBatchMethods[] = {
+    "decoderawtransaction",
+    "decodescript",
+    "getbestblockhash",
+    "getblock",
+    "getblockchaininfo",
+    "getblockcount",
+    "getblockhash",
+    "getblockheader",
+    "getchaintips",
+    "getdifficulty",
+    "getmempoolancestors",
+    "getmempooldescendants",
+    "getmempoolentry",
+    "getmempoolinfo",
+    "getrawmempool",
+    "getrawtransaction",
+    "gettxout",
+    "gettxoutproof",
+    "verifytxoutproof",
+};
+
+static bool IsReadOnlyBatchRequest(const UniValue& req)
+{
+    const UniValue& valMethod = find_value(req, "method");
+    if (!valMethod.isStr())
+        return false;
+    for (unsigned int i = 0; i < ARRAYLEN(pszReadOnlyBatchMethods); i++)
+        if (valMethod.get_str() == pszReadOnlyBatchMethods[i])
+            return true;
+    return false;
+}
+
+/**
+ * A run of read-only batch calls shared between the thread serving the batch
+ * and the helpers it queued. Each call is claimed by whichever thread gets to
+ * it first; a helper that starts after all calls were claimed does nothing,
+ * so it never touches the batch after JSONRPCExecBatch returned.
+ */
+class CRPCBatchRun
+{
+private:
+    const UniValue& vReq;
+    const unsigned int nEnd;
+    std::atomic<unsigned int> nNext;
+    CWaitableCriticalSection cs;
+    CConditionVariable cond;
+    unsigned int nRemaining;
+
+public:
+    std::vector<UniValue> vResults;
+
+    CRPCBatchRun(const UniValue& vReqIn, unsigned int nBegin, unsigned int nEndIn) :
+        vReq(vReqIn), nEnd(nEndIn), nNext(nBegin), nRemaining(nEndIn - nBegin), vResults(nEndIn - nBegin)
+    {
+    }
+
+    /** Execute calls until none are left to claim */
+    void Work()
+    {
+        const unsigned int nBegin = nEnd - vResults.size();
+        unsigned int nIdx;
+        while ((nIdx = nNext++) < nEnd) {
+            try {
+                vResults[nIdx - nBegin] = JSONRPCExecOne(vReq[nIdx]);
+            } catch (...) {
+                Finished();
+                throw;
+            }
+            Finished();
+        }
+    }
+
+    void Finished()
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        if (--nRemaining == 0)
+            cond.notify_all();
+    }
+
+    /** Wait until every call was executed */
+    void Wait()
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        while (nRemaining > 0)
+            cond.wait(lock);
+    }
+};
+
+static void RPCBatchHelper(boost::shared_ptr<CRPCBatchRun> run)
+{
+    run->Work();
+}
+
 std::string JSONRPCExecBatch(const UniValue& vReq)
 {
-    UniValue ret(UniValue::VARR);
-    for (unsigned int reqIdx = 0; reqIdx < vReq.size(); reqIdx++)
-        ret.push_back(JSONRPCExecOne(vReq[reqIdx]));
+    int nParallelism = std::max((int)GetArg("-rpcbatchparallelism", DEFAULT_RPC_BATCH_PARALLELISM), 1);
+    std::string strReply = "[";
+    unsigned int reqIdx = 0;
+    while (reqIdx < vReq.size()) {
+        // Calls that may change state run alone and in order; a run of
+        // read-only calls between them is spread over the HTTP worker threads.
+        unsigned int reqEnd = reqIdx + 1;
+        if (nParallelism > 1 && IsReadOnlyBatchRequest(vReq[reqIdx])) {
+            while (reqEnd < vReq.size() && IsReadOnlyBatchRequest(vReq[reqEnd]))
+                reqEnd++;
+        }
 
-    return ret.write() + "\n";
+        if (reqEnd - reqIdx == 1) {
+            if (reqIdx > 0)
+                strReply += ",";
+            strReply += JSONRPCExecOne(vReq[reqIdx]).write();
+        } else {
+            boost::shared_ptr<CRPCBatchRun> run(new CRPCBatchRun(vReq, reqIdx, reqEnd));
+            unsigned int nHelpers = std::min((unsigned int)nParallelism, reqEnd - reqIdx) - 1;
+            for (unsigned int i = 0; i < nHelpers; i++) {
+                if (!pfnQueueBatchWork || !pfnQueueBatchWork(boost::bind(&RPCBatchHelper, run)))
+                    break;
+            }
+            // This thread works on the run as well, so it completes even if
+            // no helper could be queued or they are slow to start.
+            try {
+                run->Work();
+            } catch (...) {
+                // Helpers may still be executing calls they claimed
+                run->Wait();
+                throw;
+            }
+            run->Wait();
+            for (unsigned int i = 0; i < run->vResults.size(); i++) {
+                if (reqIdx + i > 0)
+                    strReply += ",";
+                strReply += run->vResults[i].write();
+            }
+        }
+        reqIdx = reqEnd;
+    }
+    strReply += "]\n";
+    return strReply;
 }
 
 UniValue CRPCTable::execute(const std::string &strMethod, const UniValue &params) const
@@ -447,6 +596,36 @@ UniValue CRPCTable::execute(const std::string &strMethod, const UniValue &params
     g_rpcSignals.PostCommand(*pcmd);
 }
 
+bool CRPCTable::executeStream(const std::string &strMethod, const UniValue &params, CJSONStreamWriter& writer) const
+{
+    std::map<std::string, rpcstreamfn_type>::const_iterator it = mapStreamCommands.find(strMethod);
+    if (it == mapStreamCommands.end())
+        return false;
+
+    // execute() reports the warmup
+    {
+        LOCK(cs_rpcWarmup);
+        if (fRPCInWarmup)
+            return false;
+    }
+
+    const CRPCCommand *pcmd = tableRPC[strMethod];
+    g_rpcSignals.PreCommand(*pcmd);
+
+    bool fStreamed;
+    try
+    {
+        fStreamed = it->second(params, writer);
+    }
+    catch (const std::exception& e)
+    {
+        throw JSONRPCError(RPC_MISC_ERROR, e.what());
+    }
+
+    g_rpcSignals.PostCommand(*pcmd);
+    return fStreamed;
+}
+
 std::vector<std::string> CRPCTable::listCommands() const
 {
     std::vector<std::string> commandList;
@@ -486,6 +665,11 @@ void RPCUnsetTimerInterface(RPCTimerInterface *iface)
         timerInterface = NULL;
 }
 
+void RPCSetBatchWorkQueue(RPCQueueWorkFn fn)
+{
+    pfnQueueBatchWork = fn;
+}
+
 void RPCRunLater(const std::string& name, boost::function<void(void)> func, int64_t nSeconds)
 {
     if (!timerInterface)
@@ -20,7 +20,10 @@
 #include <univalue.h>
 
 static const unsigned int DEFAULT_RPC_SERIALIZE_VERSION = 1;
+/** Default for -rpcbatchparallelism, maximum number of calls of one JSON-RPC batch executed at the same time */
+static const int DEFAULT_RPC_BATCH_PARALLELISM = 4;
 
+class CJSONStreamWriter;
 class CRPCCommand;
 
 namespace RPCServer
@@ -118,6 +121,12 @@ void RPCSetTimerInterfaceIfUnset(RPCTimerInterface *iface);
 /** Unset factory function for timers */
 void RPCUnsetTimerInterface(RPCTimerInterface *iface);
 
+/** Function queueing work for another thread; returns false if it could not be queued */
+typedef bool (*RPCQueueWorkFn)(const boost::function<void()>& func);
+
+/** Set the function used to spread the calls of a JSON-RPC batch over other threads */
+void RPCSetBatchWorkQueue(RPCQueueWorkFn fn);
+
 /**
  * Run func nSeconds from now.
  * Overrides previous timer <name> (if any).
@@ -138,10 +147,18 @@ public:
 /**
  * Bitcoin RPC command dispatcher.
  */
+/**
+ * Streaming version of a method: writes the result to writer and returns
+ * true, or returns false without writing anything if params ask for a result
+ * that is not streamed. Errors must be thrown before the first write.
+ */
+typedef bool(*rpcstreamfn_type)(const UniValue& params, CJSONStreamWriter& writer);
+
 class CRPCTable
 {
 private:
     std::map<std::string, const CRPCCommand*> mapCommands;
+    std::map<std::string, rpcstreamfn_type> mapStreamCommands;
 public:
     CRPCTable();
     const CRPCCommand* operator[](const std::string& name) const;
@@ -169,6 +186,20 @@ public:
      * Commands cannot be overwritten (returns false).
      */
     bool appendCommand(const std::string& name, const CRPCCommand* pcmd);
+
+    /**
+     * Execute a method that has a streaming version, writing its result to
+     * writer. Returns false, having written nothing, if the call has to go
+     * through execute() instead.
+     * @throws an exception (UniValue) when an error happens.
+     */
+    bool executeStream(const std::string& method, const UniValue& params, CJSONStreamWriter& writer) const;
+
+    /**
+     * Registers a streaming version for a command of the dispatch table.
+     * Same restrictions as appendCommand.
+     */
+    bool appendStreamCommand(const std::string& name, rpcstreamfn_type fn);
 };
 
 extern CRPCTable tableRPC;
@@ -195,6 +226,7 @@ extern void EnsureWalletIsUnlocked();
 bool StartRPC();
 void InterruptRPC();
 void StopRPC();
+/** Execute a JSON-RPC batch; runs of read-only calls in it are executed concurrently */
 std::string JSONRPCExecBatch(const UniValue& vReq);
 
 // Retrieves any serialization flags requested in command line argument
@@ -332,6 +332,12 @@ public:
         clear();
     }
 
+    /** Exchange the underlying buffer with data and rewind the read position */
+    void swap(CSerializeData &data) {
+        vch.swap(data);
+        nReadPos = 0;
+    }
+
     /**
      * XOR the contents of this stream with a certain key.
      *
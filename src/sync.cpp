@@ -20,6 +20,69 @@ void PrintLockContention(const char* pszName, const char* pszFile, int nLine)
 }
 #endif /* DEBUG_LOCKCONTENTION */
 
+void* pProfiledLock = NULL;
+
+struct LockHoldState {
+    int nDepth;
+    int64_t nStart;
+    CLockHoldTimer* ptimer;
+    LockHoldState() : nDepth(0), nStart(0), ptimer(NULL) {}
+};
+
+static boost::thread_specific_ptr<LockHoldState> lockholdstate;
+
+static LockHoldState& GetLockHoldState()
+{
+    if (lockholdstate.get() == NULL)
+        lockholdstate.reset(new LockHoldState());
+    return *lockholdstate;
+}
+
+// Charge the time since the last checkpoint to the active timer, if the lock is held
+static void ChargeLockHold(LockHoldState& state, int64_t nNow)
+{
+    if (state.ptimer && state.nDepth > 0)
+        state.ptimer->nHeldMicros += nNow - state.nStart;
+    state.nStart = nNow;
+}
+
+void SetProfiledLock(void* cs)
+{
+    pProfiledLock = cs;
+}
+
+void ProfiledLockEntered()
+{
+    LockHoldState& state = GetLockHoldState();
+    if (state.nDepth++ == 0 && state.ptimer)
+        state.nStart = GetTimeMicros();
+}
+
+void ProfiledLockLeft()
+{
+    LockHoldState& state = GetLockHoldState();
+    if (state.nDepth == 1 && state.ptimer)
+        ChargeLockHold(state, GetTimeMicros());
+    state.nDepth--;
+}
+
+CLockHoldTimer::CLockHoldTimer() : nHeldMicros(0)
+{
+    LockHoldState& state = GetLockHoldState();
+    if (state.nDepth > 0)
+        ChargeLockHold(state, GetTimeMicros());
+    pprev = state.ptimer;
+    state.ptimer = this;
+}
+
+CLockHoldTimer::~CLockHoldTimer()
+{
+    LockHoldState& state = GetLockHoldState();
+    if (state.nDepth > 0)
+        ChargeLockHold(state, GetTimeMicros());
+    state.ptimer = pprev;
+}
+
 #ifdef DEBUG_LOCKORDER
 //
 // Early deadlock detection.
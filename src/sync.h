@@ -8,6 +8,8 @@
 
 #include "threadsafety.h"
 
+#include <stdint.h>
+
 #include <boost/thread/condition_variable.hpp>
 #include <boost/thread/locks.hpp>
 #include <boost/thread/mutex.hpp>
@@ -108,6 +110,29 @@ typedef boost::condition_variable CConditionVariable;
 void PrintLockContention(const char* pszName, const char* pszFile, int nLine);
 #endif
 
+/**
+ * Hold time accounting for a single mutex, set with SetProfiledLock (cs_main).
+ * While a CLockHoldTimer is in scope, the time its thread holds that mutex is
+ * added to it. Recursive locking counts once; nested timers charge only the
+ * innermost one.
+ */
+class CLockHoldTimer
+{
+public:
+    int64_t nHeldMicros;
+
+    CLockHoldTimer();
+    ~CLockHoldTimer();
+
+private:
+    CLockHoldTimer* pprev;
+};
+
+extern void* pProfiledLock;
+void SetProfiledLock(void* cs);
+void ProfiledLockEntered();
+void ProfiledLockLeft();
+
 /** Wrapper around boost::unique_lock<Mutex> */
 template <typename Mutex>
 class SCOPED_LOCKABLE CMutexLock
@@ -126,6 +151,8 @@ private:
 #ifdef DEBUG_LOCKCONTENTION
         }
 #endif
+        if ((void*)(lock.mutex()) == pProfiledLock)
+            ProfiledLockEntered();
     }
 
     bool TryEnter(const char* pszName, const char* pszFile, int nLine)
@@ -134,6 +161,8 @@ private:
         lock.try_lock();
         if (!lock.owns_lock())
             LeaveCritical();
+        else if ((void*)(lock.mutex()) == pProfiledLock)
+            ProfiledLockEntered();
         return lock.owns_lock();
     }
 
@@ -159,8 +188,11 @@ public:
 
     ~CMutexLock() UNLOCK_FUNCTION()
     {
-        if (lock.owns_lock())
+        if (lock.owns_lock()) {
+            if ((void*)(lock.mutex()) == pProfiledLock)
+                ProfiledLockLeft();
             LeaveCritical();
+        }
     }
 
     operator bool()
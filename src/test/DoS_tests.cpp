@@ -8,6 +8,7 @@
 #include "keystore.h"
 #include "main.h"
 #include "net.h"
+#include "orphanpool.h"
 #include "pow.h"
 #include "script/sign.h"
 #include "serialize.h"
@@ -15,6 +16,7 @@
 
 #include "test/test_bitcoin.h"
 
+#include <limits>
 #include <stdint.h>
 
 #include <boost/assign/list_of.hpp> // for 'map_list_of()'
@@ -22,17 +24,6 @@
 #include <boost/foreach.hpp>
 #include <boost/test/unit_test.hpp>
 
-// Tests this internal-to-main.cpp method:
-extern bool AddOrphanTx(const CTransaction& tx, NodeId peer);
-extern void EraseOrphansFor(NodeId peer);
-extern unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans);
-struct COrphanTx {
-    CTransaction tx;
-    NodeId fromPeer;
-};
-extern std::map<uint256, COrphanTx> mapOrphanTransactions;
-extern std::map<uint256, std::set<uint256> > mapOrphanTransactionsByPrev;
-
 CService ip(uint32_t i)
 {
     struct in_addr s;
@@ -105,13 +96,12 @@ BOOST_AUTO_TEST_CASE(DoS_bantime)
     BOOST_CHECK(!CNode::IsBanned(addr));
 }
 
-CTransaction RandomOrphan()
+CTransaction RandomOrphan(const std::vector<uint256>& vOrphans, const COrphanPool& pool)
 {
-    std::map<uint256, COrphanTx>::iterator it;
-    it = mapOrphanTransactions.lower_bound(GetRandHash());
-    if (it == mapOrphanTransactions.end())
-        it = mapOrphanTransactions.begin();
-    return it->second.tx;
+    std::shared_ptr<const CTransaction> tx;
+    while (!tx)
+        tx = pool.Get(vOrphans[GetRand(vOrphans.size())]);
+    return *tx;
 }
 
 BOOST_AUTO_TEST_CASE(DoS_mapOrphans)
@@ -120,6 +110,9 @@ BOOST_AUTO_TEST_CASE(DoS_mapOrphans)
     key.MakeNewKey(true);
     CBasicKeyStore keystore;
     keystore.AddKey(key);
+    COrphanPool orphanPool;
+    std::vector<uint256> vOrphans;
+    int64_t nExpire = GetTime() + ORPHAN_TX_EXPIRE_TIME;
 
     // 50 orphan transactions:
     for (int i = 0; i < 50; i++)
@@ -133,13 +126,14 @@ BOOST_AUTO_TEST_CASE(DoS_mapOrphans)
         tx.vout[0].nValue = 1*CENT;
         tx.vout[0].scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
 
-        AddOrphanTx(tx, i);
+        orphanPool.Add(std::make_shared<const CTransaction>(tx), i, nExpire);
+        vOrphans.push_back(tx.GetHash());
     }
 
     // ... and 50 that depend on other orphans:
     for (int i = 0; i < 50; i++)
     {
-        CTransaction txPrev = RandomOrphan();
+        CTransaction txPrev = RandomOrphan(vOrphans, orphanPool);
 
         CMutableTransaction tx;
         tx.vin.resize(1);
@@ -150,13 +144,14 @@ BOOST_AUTO_TEST_CASE(DoS_mapOrphans)
         tx.vout[0].scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
         SignSignature(keystore, txPrev, tx, 0, SIGHASH_ALL);
 
-        AddOrphanTx(tx, i);
+        orphanPool.Add(std::make_shared<const CTransaction>(tx), i, nExpire);
+        vOrphans.push_back(tx.GetHash());
     }
 
     // This really-big orphan should be ignored:
     for (int i = 0; i < 10; i++)
     {
-        CTransaction txPrev = RandomOrphan();
+        CTransaction txPrev = RandomOrphan(vOrphans, orphanPool);
 
         CMutableTransaction tx;
         tx.vout.resize(1);
@@ -174,25 +169,25 @@ BOOST_AUTO_TEST_CASE(DoS_mapOrphans)
         for (unsigned int j = 1; j < tx.vin.size(); j++)
             tx.vin[j].scriptSig = tx.vin[0].scriptSig;
 
-        BOOST_CHECK(!AddOrphanTx(tx, i));
+        BOOST_CHECK(!orphanPool.Add(std::make_shared<const CTransaction>(tx), i, nExpire));
     }
 
-    // Test EraseOrphansFor:
+    // Test EraseForPeer:
     for (NodeId i = 0; i < 3; i++)
     {
-        size_t sizeBefore = mapOrphanTransactions.size();
-        EraseOrphansFor(i);
-        BOOST_CHECK(mapOrphanTransactions.size() < sizeBefore);
+        size_t sizeBefore = orphanPool.size();
+        orphanPool.EraseForPeer(i);
+        BOOST_CHECK(orphanPool.size() < sizeBefore);
     }
 
-    // Test LimitOrphanTxSize() function:
-    LimitOrphanTxSize(40);
-    BOOST_CHECK(mapOrphanTransactions.size() <= 40);
-    LimitOrphanTxSize(10);
-    BOOST_CHECK(mapOrphanTransactions.size() <= 10);
-    LimitOrphanTxSize(0);
-    BOOST_CHECK(mapOrphanTransactions.empty());
-    BOOST_CHECK(mapOrphanTransactionsByPrev.empty());
+    // Test LimitSize() function:
+    orphanPool.LimitSize(40, std::numeric_limits<size_t>::max());
+    BOOST_CHECK(orphanPool.size() <= 40);
+    orphanPool.LimitSize(10, std::numeric_limits<size_t>::max());
+    BOOST_CHECK(orphanPool.size() <= 10);
+    orphanPool.LimitSize(0, std::numeric_limits<size_t>::max());
+    BOOST_CHECK(orphanPool.size() == 0);
+    BOOST_CHECK_EQUAL(orphanPool.DynamicMemoryUsage(), 0U);
 }
 
 BOOST_AUTO_TEST_SUITE_END()
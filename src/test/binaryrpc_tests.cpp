@@ -0,0 +1,169 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "rpc/binary.h"
+
+#include "chain.h"
+#include "crypto/common.h"
+#include "main.h"
+#include "primitives/block.h"
+#include "random.h"
+#include "txmempool.h"
+#include "version.h"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(binaryrpc_tests, TestChain100Setup)
+
+static std::string MakeRequest(uint8_t nType, const uint256& hash)
+{
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << nType << hash;
+    return ss.str();
+}
+
+static std::string MakeRequest(const COutPoint& outpoint)
+{
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << (uint8_t)BINRPC_UTXO << outpoint;
+    return ss.str();
+}
+
+/** Execute a request, check its reply frame and return the status; leaves the result in ssResult */
+static uint8_t Exec(const std::string& strRequest, CDataStream& ssResult)
+{
+    CDataStream reply(SER_NETWORK, PROTOCOL_VERSION);
+    ExecBinaryRPCRequest(strRequest, reply);
+    BOOST_REQUIRE(reply.size() >= 5);
+    BOOST_CHECK_EQUAL(ReadLE32((const unsigned char*)&reply[0]), reply.size() - 4);
+    uint8_t nStatus = reply[4];
+    ssResult = CDataStream(reply.begin() + 5, reply.end(), SER_NETWORK, PROTOCOL_VERSION);
+    if (nStatus != BINRPC_OK)
+        BOOST_CHECK(ssResult.empty());
+    return nStatus;
+}
+
+BOOST_AUTO_TEST_CASE(binaryrpc_framing)
+{
+    std::string strBody;
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << (uint32_t)3 << (uint8_t)1 << (uint8_t)2 << (uint8_t)3 << (uint32_t)0 << (uint32_t)1 << (uint8_t)4;
+    strBody = ss.str();
+
+    std::vector<std::string> vRequests;
+    BOOST_CHECK(ParseBinaryRPCRequests(strBody, vRequests));
+    BOOST_REQUIRE_EQUAL(vRequests.size(), 3U);
+    BOOST_CHECK(vRequests[0] == std::string("\x01\x02\x03"));
+    BOOST_CHECK(vRequests[1].empty());
+    BOOST_CHECK(vRequests[2] == std::string("\x04"));
+
+    BOOST_CHECK(ParseBinaryRPCRequests("", vRequests));
+    BOOST_CHECK(vRequests.empty());
+    // Truncated payload, truncated length
+    BOOST_CHECK(!ParseBinaryRPCRequests(strBody.substr(0, strBody.size() - 1), vRequests));
+    BOOST_CHECK(!ParseBinaryRPCRequests(strBody.substr(0, 2), vRequests));
+}
+
+BOOST_AUTO_TEST_CASE(binaryrpc_chain)
+{
+    CDataStream ssResult(SER_NETWORK, PROTOCOL_VERSION);
+
+    // Blocks come back as stored
+    uint256 hashTip = chainActive.Tip()->GetBlockHash();
+    BOOST_CHECK_EQUAL(Exec(MakeRequest(BINRPC_BLOCK, hashTip), ssResult), BINRPC_OK);
+    CBlock block;
+    ssResult >> block;
+    BOOST_CHECK(ssResult.empty());
+    BOOST_CHECK(block.GetHash() == hashTip);
+    BOOST_CHECK_EQUAL(Exec(MakeRequest(BINRPC_BLOCK, GetRandHash()), ssResult), BINRPC_NOT_FOUND);
+
+    // Confirmed transactions with the hash of their block
+    const CTransaction& coinbase = coinbaseTxns[0];
+    BOOST_CHECK_EQUAL(Exec(MakeRequest(BINRPC_TX, coinbase.GetHash()), ssResult), BINRPC_OK);
+    CTransaction tx;
+    uint256 hashBlock;
+    ssResult >> tx >> hashBlock;
+    BOOST_CHECK(tx == coinbase);
+    BOOST_CHECK(hashBlock == chainActive[1]->GetBlockHash());
+    BOOST_CHECK_EQUAL(Exec(MakeRequest(BINRPC_TX, GetRandHash()), ssResult), BINRPC_NOT_FOUND);
+
+    // Unspent outputs
+    BOOST_CHECK_EQUAL(Exec(MakeRequest(COutPoint(coinbase.GetHash(), 0)), ssResult), BINRPC_OK);
+    uint32_t nTxVer, nHeight;
+    CTxOut out;
+    ssResult >> nTxVer >> nHeight >> out;
+    BOOST_CHECK_EQUAL(nTxVer, (uint32_t)coinbase.nVersion);
+    BOOST_CHECK_EQUAL(nHeight, 1U);
+    BOOST_CHECK(out == coinbase.vout[0]);
+    BOOST_CHECK_EQUAL(Exec(MakeRequest(COutPoint(coinbase.GetHash(), 1)), ssResult), BINRPC_NOT_FOUND);
+
+    // Malformed requests
+    BOOST_CHECK_EQUAL(Exec("", ssResult), BINRPC_INVALID);
+    BOOST_CHECK_EQUAL(Exec(MakeRequest(BINRPC_BLOCK, hashTip).substr(0, 20), ssResult), BINRPC_INVALID);
+    BOOST_CHECK_EQUAL(Exec(MakeRequest(BINRPC_BLOCK, hashTip) + "x", ssResult), BINRPC_INVALID);
+    BOOST_CHECK_EQUAL(Exec(MakeRequest(99, hashTip), ssResult), BINRPC_INVALID);
+}
+
+BOOST_AUTO_TEST_CASE(binaryrpc_mempool)
+{
+    CDataStream ssResult(SER_NETWORK, PROTOCOL_VERSION);
+    const CTransaction& coinbase = coinbaseTxns[0];
+
+    CMutableTransaction spend;
+    spend.vin.resize(1);
+    spend.vin[0].prevout = COutPoint(coinbase.GetHash(), 0);
+    spend.vout.resize(1);
+    spend.vout[0].nValue = coinbase.vout[0].nValue - 1000;
+    spend.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    CTransaction tx(spend);
+
+    TestMemPoolEntryHelper entry;
+    {
+        LOCK(mempool.cs);
+        mempool.addUnchecked(tx.GetHash(), entry.Fee(1000).Time(1234).Height(100).FromTx(tx));
+    }
+
+    BOOST_CHECK_EQUAL(Exec(MakeRequest(BINRPC_MEMPOOL_ENTRY, tx.GetHash()), ssResult), BINRPC_OK);
+    CTransaction txEntry;
+    CAmount nFee, nModifiedFee;
+    int64_t nTime;
+    uint32_t nHeight;
+    ssResult >> txEntry >> nFee >> nModifiedFee >> nTime >> nHeight;
+    BOOST_CHECK(txEntry == tx);
+    BOOST_CHECK_EQUAL(nFee, 1000);
+    BOOST_CHECK_EQUAL(nModifiedFee, 1000);
+    BOOST_CHECK_EQUAL(nTime, 1234);
+    BOOST_CHECK_EQUAL(nHeight, 100U);
+    uint64_t nCount, nSize;
+    CAmount nFees;
+    ssResult >> nCount >> nSize >> nFees;
+    BOOST_CHECK_EQUAL(nCount, 1U);
+    ssResult >> nCount >> nSize >> nFees;
+    BOOST_CHECK_EQUAL(nCount, 1U);
+    BOOST_CHECK_EQUAL(nFees, 1000);
+    BOOST_CHECK(ssResult.empty());
+    BOOST_CHECK_EQUAL(Exec(MakeRequest(BINRPC_MEMPOOL_ENTRY, coinbase.GetHash()), ssResult), BINRPC_NOT_FOUND);
+
+    // Mempool transactions are found, with a null block hash
+    BOOST_CHECK_EQUAL(Exec(MakeRequest(BINRPC_TX, tx.GetHash()), ssResult), BINRPC_OK);
+    uint256 hashBlock;
+    ssResult >> txEntry >> hashBlock;
+    BOOST_CHECK(txEntry == tx);
+    BOOST_CHECK(hashBlock.IsNull());
+
+    // The mempool spends the coinbase output and creates a new one
+    BOOST_CHECK_EQUAL(Exec(MakeRequest(COutPoint(coinbase.GetHash(), 0)), ssResult), BINRPC_NOT_FOUND);
+    BOOST_CHECK_EQUAL(Exec(MakeRequest(COutPoint(tx.GetHash(), 0)), ssResult), BINRPC_OK);
+    uint32_t nTxVer;
+    CTxOut out;
+    ssResult >> nTxVer >> nHeight >> out;
+    BOOST_CHECK_EQUAL(nHeight, MEMPOOL_HEIGHT);
+    BOOST_CHECK(out == tx.vout[0]);
+
+    mempool.clear();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
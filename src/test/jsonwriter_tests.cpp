@@ -0,0 +1,122 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "rpc/jsonwriter.h"
+
+#include "chain.h"
+#include "primitives/block.h"
+#include "script/script.h"
+#include "test/test_bitcoin.h"
+
+#include <boost/bind.hpp>
+#include <boost/test/unit_test.hpp>
+
+#include <univalue.h>
+
+extern UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false);
+extern void blockToJSON(CJSONStreamWriter& writer, const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false);
+
+BOOST_FIXTURE_TEST_SUITE(jsonwriter_tests, BasicTestingSetup)
+
+struct ChunkSink
+{
+    std::vector<std::string> vChunks;
+
+    void Write(const std::string& strChunk) { vChunks.push_back(strChunk); }
+
+    std::string Joined() const
+    {
+        std::string str;
+        for (size_t i = 0; i < vChunks.size(); i++)
+            str += vChunks[i];
+        return str;
+    }
+};
+
+// Write val the way a streaming producer would, one container at a time
+static void WriteStreamed(CJSONStreamWriter& writer, const UniValue& val)
+{
+    if (val.isObject()) {
+        writer.BeginObject();
+        for (size_t i = 0; i < val.size(); i++) {
+            writer.Key(val.getKeys()[i]);
+            WriteStreamed(writer, val.getValues()[i]);
+        }
+        writer.EndObject();
+    } else if (val.isArray()) {
+        writer.BeginArray();
+        for (size_t i = 0; i < val.size(); i++)
+            WriteStreamed(writer, val[i]);
+        writer.EndArray();
+    } else if (val.isStr()) {
+        writer.String(val.get_str());
+    } else {
+        writer.Value(val);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(jsonwriter_matches_univalue)
+{
+    UniValue val;
+    BOOST_CHECK(val.read("{\"a\":[],\"b\":{},\"c\":[1,\"two\",{\"x\\n\\\"y\":null,\"z\":[true,false]},[[]]],\"d\":-1.5,\"\":\"\\u0001\"}"));
+
+    // Any chunk size gives the same text, and only whole chunks before the flush
+    for (size_t nChunkSize = 1; nChunkSize < 40; nChunkSize += 3) {
+        ChunkSink sink;
+        CJSONStreamWriter writer(boost::bind(&ChunkSink::Write, &sink, _1), nChunkSize);
+        WriteStreamed(writer, val);
+        BOOST_CHECK_EQUAL(writer.GetDepth(), 0U);
+        for (size_t i = 0; i < sink.vChunks.size(); i++)
+            BOOST_CHECK(sink.vChunks[i].size() >= nChunkSize);
+        writer.Flush();
+        BOOST_CHECK_EQUAL(sink.Joined(), val.write());
+        BOOST_CHECK_EQUAL(writer.GetBytesWritten(), val.write().size());
+    }
+
+    // Whole values written at once
+    ChunkSink sink;
+    CJSONStreamWriter writer(boost::bind(&ChunkSink::Write, &sink, _1));
+    writer.BeginArray();
+    writer.Value(val);
+    writer.Value(val["c"]);
+    writer.EndArray();
+    writer.Raw("\n");
+    BOOST_CHECK(sink.vChunks.empty());
+    writer.Flush();
+    writer.Flush();
+    BOOST_CHECK_EQUAL(sink.vChunks.size(), 1U);
+    BOOST_CHECK_EQUAL(sink.Joined(), "[" + val.write() + "," + val["c"].write() + "]\n");
+}
+
+BOOST_AUTO_TEST_CASE(jsonwriter_block)
+{
+    CBlock block;
+    block.nVersion = 4;
+    block.nTime = 1234567890;
+    block.nBits = 0x207fffff;
+    for (int i = 0; i < 50; i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout.n = i;
+        tx.vin[0].scriptSig = CScript() << OP_1;
+        tx.vout.resize(1);
+        tx.vout[0].nValue = i;
+        tx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+        block.vtx.push_back(tx);
+    }
+    CBlockIndex index(block);
+    uint256 hash = block.GetHash();
+    index.phashBlock = &hash;
+
+    for (int fTxDetails = 0; fTxDetails < 2; fTxDetails++) {
+        ChunkSink sink;
+        CJSONStreamWriter writer(boost::bind(&ChunkSink::Write, &sink, _1), 1000);
+        blockToJSON(writer, block, &index, fTxDetails);
+        writer.Flush();
+        BOOST_CHECK(sink.vChunks.size() > 1);
+        BOOST_CHECK_EQUAL(sink.Joined(), blockToJSON(block, &index, fTxDetails).write());
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
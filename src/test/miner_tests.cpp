@@ -2,6 +2,7 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "arith_uint256.h"
 #include "chainparams.h"
 #include "coins.h"
 #include "consensus/consensus.h"
@@ -9,7 +10,9 @@
 #include "consensus/validation.h"
 #include "main.h"
 #include "miner.h"
+#include "pow.h"
 #include "pubkey.h"
+#include "random.h"
 #include "script/standard.h"
 #include "txmempool.h"
 #include "uint256.h"
@@ -502,4 +505,34 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     fCheckpointsEnabled = true;
 }
 
+BOOST_AUTO_TEST_CASE(ScanHeaderNonce_midstate)
+{
+    CBlockHeader header;
+    header.nVersion = 4;
+    header.hashPrevBlock = GetRandHash();
+    header.hashMerkleRoot = GetRandHash();
+    header.nTime = 1469000000;
+    header.nBits = 0x1f00ffff; // roughly one in 2^16 hashes succeeds
+    uint64_t nTries = 0;
+
+    // Whatever the midstate search finds must also pass on the full header hash
+    bool fFound = ScanHeaderNonce(header, 0, 0x1000000, nTries);
+    BOOST_CHECK(fFound);
+    BOOST_CHECK(CheckProofOfWork(header.GetHash(), header.nBits, Params(CBaseChainParams::REGTEST).GetConsensus()));
+    BOOST_CHECK_EQUAL(nTries, (uint64_t)header.nNonce + 1);
+    for (uint32_t nNonce = 0; nNonce < header.nNonce; nNonce++) {
+        CBlockHeader other = header;
+        other.nNonce = nNonce;
+        BOOST_CHECK(UintToArith256(other.GetHash()) > arith_uint256().SetCompact(header.nBits));
+    }
+
+    // An unreachable target exhausts the range, and an abort stops the search early
+    header.nBits = 0x03000001;
+    BOOST_CHECK(!ScanHeaderNonce(header, 0, 1000, nTries));
+    BOOST_CHECK_EQUAL(nTries, 1000U);
+    std::atomic<bool> fAbort(true);
+    BOOST_CHECK(!ScanHeaderNonce(header, 0, 1000, nTries, &fAbort));
+    BOOST_CHECK_EQUAL(nTries, 0U);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -164,4 +164,86 @@ BOOST_AUTO_TEST_CASE(cnode_simple_test)
     BOOST_CHECK(pnode2->fFeeler == false);
 }
 
+static CDataStream FrameMessage(const char* pszCommand, const std::vector<unsigned char>& payload)
+{
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    CMessageHeader hdr(Params().MessageStart(), pszCommand, payload.size());
+    uint256 hash = Hash(payload.begin(), payload.end());
+    memcpy(&hdr.nChecksum, hash.begin(), sizeof(hdr.nChecksum));
+    ss << hdr;
+    ss.write((const char*)payload.data(), payload.size());
+    return ss;
+}
+
+BOOST_AUTO_TEST_CASE(cnode_receive_msg_bytes)
+{
+    in_addr ipv4Addr;
+    ipv4Addr.s_addr = 0xa0b0c001;
+    CNode node(INVALID_SOCKET, CAddress(CService(ipv4Addr, 7777), NODE_NETWORK), "", true);
+    LOCK(node.cs_vRecvMsg);
+
+    std::vector<unsigned char> small(100, 0x11), large(300000, 0x22);
+    CDataStream stream = FrameMessage("ping", small);
+    CDataStream streamLarge = FrameMessage("block", large);
+    stream.write(&streamLarge[0], streamLarge.size());
+    CDataStream streamSmall = FrameMessage("pong", small);
+    stream.write(&streamSmall[0], streamSmall.size());
+
+    // Feed the messages in pieces that split both headers and payloads
+    for (size_t nPos = 0; nPos < stream.size(); nPos += 7)
+        BOOST_CHECK(node.ReceiveMsgBytes(&stream[nPos], std::min<size_t>(7, stream.size() - nPos)));
+    BOOST_CHECK_EQUAL(node.vRecvMsg.size(), 3U);
+    BOOST_CHECK(node.vRecvMsg[0].complete() && node.vRecvMsg[0].hdr.GetCommand() == "ping");
+    BOOST_CHECK(node.vRecvMsg[1].complete() && node.vRecvMsg[1].hdr.GetCommand() == "block");
+    BOOST_CHECK(node.vRecvMsg[2].complete() && node.vRecvMsg[2].hdr.GetCommand() == "pong");
+    BOOST_CHECK(std::equal(large.begin(), large.end(), node.vRecvMsg[1].vRecv.begin()));
+    BOOST_CHECK(std::equal(small.begin(), small.end(), node.vRecvMsg[2].vRecv.begin()));
+
+    // Small payload buffers are kept for the next messages, oversized ones aren't
+    node.ReleaseRecvMessages(node.vRecvMsg.end());
+    BOOST_CHECK(node.vRecvMsg.empty());
+    BOOST_CHECK_EQUAL(node.vRecvBufferPool.size(), 2U);
+
+    // A payload whose header is known can be received in place
+    BOOST_CHECK(node.ReceiveMsgBytes(&streamLarge[0], CMessageHeader::HEADER_SIZE));
+    BOOST_CHECK_EQUAL(node.vRecvBufferPool.size(), 1U);
+    unsigned int nSpace = 0;
+    char* pchPayload = node.GetRecvPayloadBuffer(nSpace);
+    BOOST_CHECK(pchPayload != NULL);
+    BOOST_CHECK_EQUAL(nSpace, large.size());
+    memcpy(pchPayload, &streamLarge[CMessageHeader::HEADER_SIZE], nSpace);
+    BOOST_CHECK(node.ReceiveMsgBytes(pchPayload, nSpace));
+    BOOST_CHECK(node.vRecvMsg.back().complete());
+    BOOST_CHECK(std::equal(large.begin(), large.end(), node.vRecvMsg.back().vRecv.begin()));
+    BOOST_CHECK(node.GetRecvPayloadBuffer(nSpace) == NULL);
+
+    // Oversized messages are refused as soon as their header arrives
+    CDataStream streamHuge = FrameMessage("block", std::vector<unsigned char>(MAX_PROTOCOL_MESSAGE_LENGTH + 1));
+    BOOST_CHECK(!node.ReceiveMsgBytes(&streamHuge[0], CMessageHeader::HEADER_SIZE));
+}
+
+BOOST_AUTO_TEST_CASE(msg_time_stats)
+{
+    CMsgTimeStats stats;
+    stats.Add(0, 0);
+    stats.Add(1, 0);
+    stats.Add(1000, 400);
+    stats.Add(3000000000LL, 0);
+    BOOST_CHECK_EQUAL(stats.nCount, 4U);
+    BOOST_CHECK_EQUAL(stats.nTotalMicros, 3000001001LL);
+    BOOST_CHECK_EQUAL(stats.nMainMicros, 400);
+    BOOST_CHECK_EQUAL(stats.nMaxMicros, 3000000000LL);
+    BOOST_CHECK_EQUAL(stats.vBuckets[0], 1U);  // below 1us
+    BOOST_CHECK_EQUAL(stats.vBuckets[1], 1U);  // below 2us
+    BOOST_CHECK_EQUAL(stats.vBuckets[10], 1U); // below 1024us
+    BOOST_CHECK_EQUAL(stats.vBuckets[MSG_TIME_BUCKETS - 1], 1U);
+
+    CMsgTimeStats total;
+    total += stats;
+    total += stats;
+    BOOST_CHECK_EQUAL(total.nCount, 8U);
+    BOOST_CHECK_EQUAL(total.nMaxMicros, 3000000000LL);
+    BOOST_CHECK_EQUAL(total.vBuckets[10], 2U);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,143 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "orphanpool.h"
+#include "policy/policy.h"
+#include "random.h"
+
+#include "test/test_bitcoin.h"
+
+#include <limits>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(orphanpool_tests, BasicTestingSetup)
+
+static std::shared_ptr<const CTransaction> MakeOrphan(const uint256& hashPrev, uint32_t nPrev, unsigned int nOutputs = 1)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(hashPrev, nPrev);
+    tx.vin[0].scriptSig = CScript() << OP_1;
+    tx.vout.resize(nOutputs);
+    for (unsigned int i = 0; i < nOutputs; i++) {
+        tx.vout[i].scriptPubKey = CScript() << OP_1;
+        tx.vout[i].nValue = 1 * CENT;
+    }
+    return std::make_shared<const CTransaction>(tx);
+}
+
+static const size_t NO_USAGE_LIMIT = std::numeric_limits<size_t>::max();
+
+BOOST_AUTO_TEST_CASE(orphanpool_peer_and_expiry)
+{
+    COrphanPool pool;
+    std::vector<std::shared_ptr<const CTransaction> > vTx;
+    // Peers 0..2 each send 10 orphans, expiring at 100..109
+    for (int i = 0; i < 30; i++) {
+        vTx.push_back(MakeOrphan(GetRandHash(), 0));
+        BOOST_CHECK(pool.Add(vTx.back(), i / 10, 100 + i % 10));
+    }
+    BOOST_CHECK(!pool.Add(vTx[0], 2, 200));
+    BOOST_CHECK_EQUAL(pool.size(), 30U);
+
+    NodeId fromPeer = -1;
+    BOOST_CHECK(pool.Get(vTx[15]->GetHash(), &fromPeer) == vTx[15]);
+    BOOST_CHECK_EQUAL(fromPeer, 1);
+    BOOST_CHECK(!pool.Get(GetRandHash()));
+
+    // Only peer 1's orphans go
+    BOOST_CHECK_EQUAL(pool.EraseForPeer(1), 10);
+    BOOST_CHECK_EQUAL(pool.EraseForPeer(1), 0);
+    BOOST_CHECK_EQUAL(pool.size(), 20U);
+    for (int i = 0; i < 30; i++)
+        BOOST_CHECK_EQUAL(pool.Have(vTx[i]->GetHash()), i / 10 != 1);
+
+    // Only orphans expired at or before the given time go
+    BOOST_CHECK_EQUAL(pool.Expire(99), 0);
+    BOOST_CHECK_EQUAL(pool.Expire(104), 10);
+    for (int i = 0; i < 30; i++)
+        BOOST_CHECK_EQUAL(pool.Have(vTx[i]->GetHash()), i / 10 != 1 && i % 10 > 4);
+    BOOST_CHECK_EQUAL(pool.Expire(1000), 10);
+    BOOST_CHECK_EQUAL(pool.size(), 0U);
+    BOOST_CHECK_EQUAL(pool.DynamicMemoryUsage(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(orphanpool_limits)
+{
+    COrphanPool pool;
+    size_t nLastUsage = 0;
+    for (int i = 0; i < 100; i++) {
+        BOOST_CHECK(pool.Add(MakeOrphan(GetRandHash(), 0, 1 + i % 5), i, 100));
+        BOOST_CHECK(pool.DynamicMemoryUsage() > nLastUsage);
+        nLastUsage = pool.DynamicMemoryUsage();
+    }
+
+    // Bounded by count
+    BOOST_CHECK_EQUAL(pool.LimitSize(100, NO_USAGE_LIMIT), 0);
+    BOOST_CHECK_EQUAL(pool.LimitSize(80, NO_USAGE_LIMIT), 20);
+    BOOST_CHECK_EQUAL(pool.size(), 80U);
+
+    // Bounded by memory
+    size_t nMaxUsage = pool.DynamicMemoryUsage() / 2;
+    BOOST_CHECK(pool.LimitSize(80, nMaxUsage) > 0);
+    BOOST_CHECK(pool.DynamicMemoryUsage() <= nMaxUsage);
+    BOOST_CHECK(pool.size() < 80U);
+
+    // Too large orphans are never kept
+    CMutableTransaction txLarge(*MakeOrphan(GetRandHash(), 0));
+    txLarge.vout[0].scriptPubKey = CScript() << std::vector<unsigned char>(MAX_STANDARD_TX_WEIGHT / 4, 0) << OP_DROP;
+    BOOST_CHECK(!pool.Add(std::make_shared<const CTransaction>(txLarge), 0, 100));
+
+    pool.Clear();
+    BOOST_CHECK_EQUAL(pool.size(), 0U);
+    BOOST_CHECK_EQUAL(pool.DynamicMemoryUsage(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(orphanpool_children)
+{
+    COrphanPool pool;
+    CMutableTransaction parent;
+    parent.vout.resize(3);
+    uint256 hashParent = parent.GetHash();
+
+    // Two children spending outputs 0 and 2 of parent, a grandchild, and an unrelated orphan
+    std::shared_ptr<const CTransaction> child0 = MakeOrphan(hashParent, 0);
+    std::shared_ptr<const CTransaction> child2 = MakeOrphan(hashParent, 2);
+    std::shared_ptr<const CTransaction> grandchild = MakeOrphan(child0->GetHash(), 0);
+    std::shared_ptr<const CTransaction> other = MakeOrphan(GetRandHash(), 0);
+    BOOST_CHECK(pool.Add(child0, 0, 100));
+    BOOST_CHECK(pool.Add(child2, 1, 100));
+    BOOST_CHECK(pool.Add(grandchild, 0, 100));
+    BOOST_CHECK(pool.Add(other, 0, 100));
+
+    // Only direct children are retried when the parent arrives
+    std::set<uint256> setWork;
+    pool.AddChildrenToWorkSet(parent, setWork);
+    BOOST_CHECK_EQUAL(setWork.size(), 2U);
+    BOOST_CHECK(setWork.count(child0->GetHash()));
+    BOOST_CHECK(setWork.count(child2->GetHash()));
+
+    setWork.clear();
+    pool.AddChildrenToWorkSet(*child0, setWork);
+    BOOST_CHECK_EQUAL(setWork.size(), 1U);
+    BOOST_CHECK(setWork.count(grandchild->GetHash()));
+
+    // A transaction double spending output 2 of parent conflicts with child2 only
+    CMutableTransaction txConflict(*MakeOrphan(hashParent, 2));
+    txConflict.vout[0].nValue = 2 * CENT;
+    std::vector<uint256> vConflicts;
+    pool.AddConflicts(txConflict, vConflicts);
+    BOOST_CHECK_EQUAL(vConflicts.size(), 1U);
+    BOOST_CHECK(vConflicts[0] == child2->GetHash());
+
+    // Once erased, an orphan is no longer found through its parent
+    BOOST_CHECK_EQUAL(pool.Erase(child2->GetHash()), 1);
+    BOOST_CHECK_EQUAL(pool.Erase(child2->GetHash()), 0);
+    setWork.clear();
+    pool.AddChildrenToWorkSet(parent, setWork);
+    BOOST_CHECK_EQUAL(setWork.size(), 1U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
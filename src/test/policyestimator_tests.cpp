@@ -2,14 +2,17 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "clientversion.h"
 #include "policy/policy.h"
 #include "policy/fees.h"
+#include "streams.h"
 #include "txmempool.h"
 #include "uint256.h"
 #include "util.h"
 
 #include "test/test_bitcoin.h"
 
+#include <boost/filesystem.hpp>
 #include <boost/test/unit_test.hpp>
 
 BOOST_FIXTURE_TEST_SUITE(policyestimator_tests, BasicTestingSetup)
@@ -168,7 +171,14 @@ BOOST_AUTO_TEST_CASE(BlockPolicyEstimates)
     }
 
     // Mine all those transactions
-    // Estimates should still not be below original
+    // Estimates are only updated once per block, so reprocessing the
+    // height we've already seen leaves them unchanged
+    std::vector<CAmount> lastFeeEst;
+    std::vector<double> lastPriEst;
+    for (int i = 1; i < 10; i++) {
+        lastFeeEst.push_back(mpool.estimateFee(i).GetFeePerK());
+        lastPriEst.push_back(mpool.estimatePriority(i));
+    }
     for (int j = 0; j < 10; j++) {
         while(txHashes[j].size()) {
             std::shared_ptr<const CTransaction> ptx = mpool.get(txHashes[j].back());
@@ -181,9 +191,8 @@ BOOST_AUTO_TEST_CASE(BlockPolicyEstimates)
     block.clear();
     BOOST_CHECK(mpool.estimateFee(1) == CFeeRate(0));
     for (int i = 1; i < 10;i++) {
-        if (i > 1)
-            BOOST_CHECK(mpool.estimateFee(i).GetFeePerK() > origFeeEst[i-1] - deltaFee);
-        BOOST_CHECK(mpool.estimatePriority(i) > origPriEst[i-1] - deltaPri);
+        BOOST_CHECK_EQUAL(mpool.estimateFee(i).GetFeePerK(), lastFeeEst[i-1]);
+        BOOST_CHECK_EQUAL(mpool.estimatePriority(i), lastPriEst[i-1]);
     }
 
     // Mine 200 more blocks where everything is mined every block
@@ -220,6 +229,69 @@ BOOST_AUTO_TEST_CASE(BlockPolicyEstimates)
         BOOST_CHECK(mpool.estimateSmartFee(i).GetFeePerK() >= mpool.GetMinFee(1).GetFeePerK());
         BOOST_CHECK(mpool.estimateSmartPriority(i) == INF_PRIORITY);
     }
+
+    // The published table gives the same answers without locking the mempool
+    CAmount minPoolFee;
+    std::shared_ptr<const FeeEstimateTable> table = mpool.GetFeeEstimates(minPoolFee);
+    BOOST_CHECK_EQUAL(table->nBlockHeight, (unsigned int)blocknum);
+    BOOST_CHECK(minPoolFee > feeV[0][5]);
+    for (int i = 1; i < 10; i++) {
+        int answerFound, tableAnswerFound;
+        BOOST_CHECK(table->estimateSmartFee(i, &tableAnswerFound, minPoolFee) == mpool.estimateSmartFee(i, &answerFound));
+        BOOST_CHECK_EQUAL(tableAnswerFound, answerFound);
+        BOOST_CHECK(table->estimateSmartPriority(i, &tableAnswerFound, minPoolFee) == mpool.estimateSmartPriority(i, &answerFound));
+        BOOST_CHECK_EQUAL(tableAnswerFound, answerFound);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(BlockPolicyJournal)
+{
+    boost::filesystem::path path = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+    CTxMemPool mpool(CFeeRate(1000));
+    TestMemPoolEntryHelper entry;
+    std::list<CTransaction> dummyConflicted;
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 0LL;
+    std::vector<CTransaction> block;
+
+    BOOST_CHECK(mpool.StartFeeEstimatesJournal(path.string()));
+
+    // Run past MAX_JOURNAL_BLOCKS so the file gets rewritten once along the way.
+    // Every block, the j-th fee level gets confirmed after j+1 blocks.
+    std::vector<CTransaction> pending[10];
+    for (int blocknum = 0; blocknum < 200; blocknum++) {
+        for (int j = 0; j < 10; j++) {
+            for (int k = 0; k < 4; k++) {
+                tx.vin[0].prevout.n = 10000*blocknum+100*j+k;
+                mpool.addUnchecked(tx.GetHash(), entry.Fee(2000 * (10 - j)).Time(GetTime()).Height(blocknum).FromTx(tx, &mpool));
+                pending[j].push_back(tx);
+            }
+        }
+        for (int j = 0; j < 10; j++) {
+            if (blocknum % (j + 1) == 0) {
+                block.insert(block.end(), pending[j].begin(), pending[j].end());
+                pending[j].clear();
+            }
+        }
+        mpool.removeForBlock(block, blocknum + 1, dummyConflicted);
+        block.clear();
+    }
+    BOOST_CHECK(mpool.StopFeeEstimatesJournal());
+    BOOST_CHECK(!mpool.StopFeeEstimatesJournal());
+
+    // The snapshot plus the journaled blocks give the same estimates
+    CTxMemPool mpoolRead(CFeeRate(1000));
+    {
+        CAutoFile filein(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+        BOOST_CHECK(mpoolRead.ReadFeeEstimates(filein));
+    }
+    for (int i = 2; i < 10; i++) {
+        BOOST_CHECK(mpool.estimateFee(i) > CFeeRate(0));
+        BOOST_CHECK(abs(mpoolRead.estimateFee(i).GetFeePerK() - mpool.estimateFee(i).GetFeePerK()) <= 1);
+    }
+    boost::filesystem::remove(path);
 }
 
 BOOST_AUTO_TEST_SUITE_END()
@@ -23,6 +23,7 @@
 #include <map>
 #include <string>
 
+#include <boost/algorithm/string/case_conv.hpp>
 #include <boost/algorithm/string/classification.hpp>
 #include <boost/algorithm/string/split.hpp>
 #include <boost/assign/list_of.hpp>
@@ -771,4 +772,50 @@ BOOST_AUTO_TEST_CASE(test_IsStandard)
     BOOST_CHECK(!IsStandardTx(t, reason));
 }
 
+BOOST_AUTO_TEST_CASE(test_DecodeHexTx)
+{
+    CMutableTransaction mtx;
+    mtx.vin.resize(1);
+    mtx.vin[0].prevout.hash = uint256S("0123456789abcdef");
+    mtx.vin[0].scriptSig = CScript() << OP_1;
+    mtx.vout.resize(1);
+    mtx.vout[0].nValue = 1234;
+    mtx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    CTransaction tx(mtx);
+    mtx.wit.vtxinwit.resize(1);
+    mtx.wit.vtxinwit[0].scriptWitness.stack.push_back(std::vector<unsigned char>(100, 0xab));
+    CTransaction txWitness(mtx);
+
+    CTransaction txOut;
+    BOOST_CHECK(DecodeHexTx(txOut, EncodeHexTx(tx)));
+    BOOST_CHECK(txOut.GetHash() == tx.GetHash());
+    BOOST_CHECK(DecodeHexTx(txOut, EncodeHexTx(tx), true));
+    BOOST_CHECK(txOut.GetHash() == tx.GetHash());
+    // Witness serialization, with and without trying the old format first
+    std::string strHex = EncodeHexTx(txWitness);
+    BOOST_CHECK(DecodeHexTx(txOut, strHex));
+    BOOST_CHECK(txOut.GetWitnessHash() == txWitness.GetWitnessHash());
+    BOOST_CHECK(DecodeHexTx(txOut, strHex, true));
+    BOOST_CHECK(txOut.GetWitnessHash() == txWitness.GetWitnessHash());
+    // Upper case digits are hex too
+    BOOST_CHECK(DecodeHexTx(txOut, boost::to_upper_copy(strHex)));
+    BOOST_CHECK(txOut.GetWitnessHash() == txWitness.GetWitnessHash());
+
+    // Not hex, odd length, empty, truncated
+    BOOST_CHECK(!DecodeHexTx(txOut, ""));
+    BOOST_CHECK(!DecodeHexTx(txOut, strHex + "0"));
+    BOOST_CHECK(!DecodeHexTx(txOut, strHex.substr(0, 20) + "zz" + strHex.substr(22), true));
+    BOOST_CHECK(!DecodeHexTx(txOut, strHex.substr(0, strHex.size() - 2), true));
+
+    CBlock block;
+    block.vtx.push_back(tx);
+    CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
+    ssBlock << block;
+    CBlock blockOut;
+    BOOST_CHECK(DecodeHexBlk(blockOut, HexStr(ssBlock.begin(), ssBlock.end())));
+    BOOST_CHECK(blockOut.GetHash() == block.GetHash());
+    BOOST_CHECK(blockOut.vtx.size() == 1 && blockOut.vtx[0].GetHash() == tx.GetHash());
+    BOOST_CHECK(!DecodeHexBlk(blockOut, HexStr(ssBlock.begin(), ssBlock.end()) + "x"));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,83 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "random.h"
+#include "txmempool.h"
+#include "txrelay.h"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(txrelay_tests, BasicTestingSetup)
+
+static CMutableTransaction MakeTx(const uint256& hashPrev, CAmount nValue)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout.hash = hashPrev;
+    tx.vin[0].prevout.n = 0;
+    tx.vin[0].scriptSig = CScript() << OP_11;
+    tx.vout.resize(1);
+    tx.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx.vout[0].nValue = nValue;
+    return tx;
+}
+
+BOOST_AUTO_TEST_CASE(txrelay_batches)
+{
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+    CTxRelay relay;
+    int64_t nNow = 1000000000;
+
+    // A low and a high feerate transaction, and a high feerate child of the low one
+    CMutableTransaction txLow = MakeTx(GetRandHash(), 10000);
+    CMutableTransaction txHigh = MakeTx(GetRandHash(), 10000);
+    CMutableTransaction txChild = MakeTx(txLow.GetHash(), 9000);
+    pool.addUnchecked(txLow.GetHash(), entry.Fee(100).FromTx(txLow));
+    pool.addUnchecked(txHigh.GetHash(), entry.Fee(10000).FromTx(txHigh));
+    pool.addUnchecked(txChild.GetHash(), entry.Fee(50000).FromTx(txChild));
+
+    CTxRelayCursor cursor = relay.GetEndCursor();
+    relay.Queue(txChild.GetHash());
+    relay.Queue(txLow.GetHash());
+    relay.Queue(txHigh.GetHash());
+    relay.Queue(txHigh.GetHash());
+    relay.Queue(GetRandHash()); // not in the pool
+    BOOST_CHECK(relay.GetBatches(cursor).empty());
+
+    // Sorted once: parents before children, then by feerate; duplicates and
+    // transactions no longer in the pool left out
+    relay.Update(pool, nNow);
+    BOOST_CHECK_EQUAL(relay.GetPendingCount(), 0U);
+    std::vector<std::shared_ptr<const CTxRelayBatch> > vBatches = relay.GetBatches(cursor);
+    BOOST_CHECK_EQUAL(vBatches.size(), 1U);
+    BOOST_CHECK_EQUAL(vBatches[0]->nSequence, cursor.nSequence);
+    BOOST_CHECK_EQUAL(vBatches[0]->vTx.size(), 3U);
+    BOOST_CHECK(vBatches[0]->vTx[0].hash == txHigh.GetHash());
+    BOOST_CHECK(vBatches[0]->vTx[1].hash == txLow.GetHash());
+    BOOST_CHECK(vBatches[0]->vTx[2].hash == txChild.GetHash());
+
+    // A peer connecting now doesn't get the earlier announcements
+    CTxRelayCursor cursorNew = relay.GetEndCursor();
+    BOOST_CHECK(relay.GetBatches(cursorNew).empty());
+
+    // The next batch isn't formed before the interval is over
+    relay.Queue(txLow.GetHash());
+    relay.Update(pool, nNow + TX_RELAY_BATCH_INTERVAL - 1);
+    BOOST_CHECK_EQUAL(relay.GetPendingCount(), 1U);
+    relay.Update(pool, nNow + TX_RELAY_BATCH_INTERVAL);
+    BOOST_CHECK_EQUAL(relay.GetPendingCount(), 0U);
+    BOOST_CHECK_EQUAL(relay.GetBatches(cursor).size(), 2U);
+    BOOST_CHECK_EQUAL(relay.GetBatches(cursorNew).size(), 1U);
+
+    // Old batches expire
+    relay.Update(pool, nNow + TX_RELAY_BATCH_EXPIRY + 1);
+    vBatches = relay.GetBatches(cursor);
+    BOOST_CHECK_EQUAL(vBatches.size(), 1U);
+    BOOST_CHECK_EQUAL(vBatches[0]->nSequence, cursorNew.nSequence);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -26,7 +26,8 @@ CTxMemPoolEntry::CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee,
                                  bool _spendsCoinbase, int64_t _sigOpsCost, LockPoints lp):
     tx(std::make_shared<CTransaction>(_tx)), nFee(_nFee), nTime(_nTime), entryPriority(_entryPriority), entryHeight(_entryHeight),
     hadNoDependencies(poolHasNoInputsOf), inChainInputValue(_inChainInputValue),
-    spendsCoinbase(_spendsCoinbase), sigOpCost(_sigOpsCost), lockPoints(lp)
+    spendsCoinbase(_spendsCoinbase), sigOpCost(_sigOpsCost), lockPoints(lp),
+    fScriptsVerified(false), nScriptVerifyFlags(0)
 {
     nTxWeight = GetTransactionWeight(_tx);
     nModSize = _tx.CalculateModifiedSize(GetTxSize());
@@ -349,7 +350,7 @@ void CTxMemPoolEntry::UpdateAncestorState(int64_t modifySize, CAmount modifyFee,
 }
 
 CTxMemPool::CTxMemPool(const CFeeRate& _minReasonableRelayFee) :
-    nTransactionsUpdated(0)
+    nTransactionsUpdated(0), nTxHashesLogSize(0), nTxHashesLogStale(0), nTxHashesLogEpoch(0)
 {
     _clear(); //lock free clear
 
@@ -360,6 +361,8 @@ CTxMemPool::CTxMemPool(const CFeeRate& _minReasonableRelayFee) :
 
     minerPolicyEstimator = new CBlockPolicyEstimator(_minReasonableRelayFee);
     minReasonableRelayFee = _minReasonableRelayFee;
+    feeEstimates = std::make_shared<const FeeEstimateTable>(minerPolicyEstimator->GetAnswerTable());
+    feeEstimatesMinFee = 0;
 }
 
 CTxMemPool::~CTxMemPool()
@@ -446,6 +449,7 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry,
 
     vTxHashes.emplace_back(tx.GetWitnessHash(), newit);
     newit->vTxHashesIdx = vTxHashes.size() - 1;
+    AppendTxHashesLog(vTxHashes.back().first, newit->GetSharedTx());
 
     return true;
 }
@@ -464,6 +468,8 @@ void CTxMemPool::removeUnchecked(txiter it)
             vTxHashes.shrink_to_fit();
     } else
         vTxHashes.clear();
+    if (++nTxHashesLogStale > TxHashesLogChunk::SIZE && nTxHashesLogStale * 2 > nTxHashesLogSize)
+        RebuildTxHashesLog();
 
     totalTxSize -= it->GetTxSize();
     cachedInnerUsage -= it->DynamicMemoryUsage();
@@ -620,15 +626,64 @@ void CTxMemPool::removeForBlock(const std::vector<CTransaction>& vtx, unsigned i
     }
     // After the txs in the new block have been removed from the mempool, update policy estimates
     minerPolicyEstimator->processBlock(nBlockHeight, entries, fCurrentEstimate);
+    if (minerPolicyEstimator->GetJournalBlocks() >= MAX_JOURNAL_BLOCKS)
+        StartFeeEstimatesJournal(feeEstimatesPath);
+    PublishFeeEstimates(true);
     lastRollingFeeUpdate = GetTime();
     blockSinceLastRollingFeeBump = true;
 }
 
+void CTxMemPool::AppendTxHashesLog(const uint256& wtxid, const std::shared_ptr<const CTransaction>& tx)
+{
+    LOCK(cs_txHashesLog);
+    size_t nOffset = nTxHashesLogSize % TxHashesLogChunk::SIZE;
+    if (nOffset == 0)
+        vTxHashesLog.push_back(std::make_shared<TxHashesLogChunk>());
+    TxHashesLogEntry& entry = vTxHashesLog.back()->entries[nOffset];
+    entry.wtxid = wtxid;
+    entry.tx = tx;
+    nTxHashesLogSize++;
+}
+
+void CTxMemPool::RebuildTxHashesLog()
+{
+    std::vector<std::shared_ptr<TxHashesLogChunk> > vLog;
+    for (size_t i = 0; i < vTxHashes.size(); i++) {
+        if (i % TxHashesLogChunk::SIZE == 0)
+            vLog.push_back(std::make_shared<TxHashesLogChunk>());
+        TxHashesLogEntry& entry = vLog.back()->entries[i % TxHashesLogChunk::SIZE];
+        entry.wtxid = vTxHashes[i].first;
+        entry.tx = vTxHashes[i].second->GetSharedTx();
+    }
+
+    LOCK(cs_txHashesLog);
+    vTxHashesLog.swap(vLog);
+    nTxHashesLogSize = vTxHashes.size();
+    nTxHashesLogStale = 0;
+    nTxHashesLogEpoch++;
+    txHashesSnapshot.reset();
+}
+
+std::shared_ptr<const TxHashesSnapshot> CTxMemPool::GetTxHashesSnapshot() const
+{
+    LOCK(cs_txHashesLog);
+    if (!txHashesSnapshot || txHashesSnapshot->nEpoch != nTxHashesLogEpoch || txHashesSnapshot->nSize != nTxHashesLogSize) {
+        std::shared_ptr<TxHashesSnapshot> snapshot = std::make_shared<TxHashesSnapshot>();
+        snapshot->nEpoch = nTxHashesLogEpoch;
+        snapshot->nSize = nTxHashesLogSize;
+        snapshot->vChunks.assign(vTxHashesLog.begin(), vTxHashesLog.end());
+        txHashesSnapshot = snapshot;
+    }
+    return txHashesSnapshot;
+}
+
 void CTxMemPool::_clear()
 {
     mapLinks.clear();
     mapTx.clear();
     mapNextTx.clear();
+    vTxHashes.clear();
+    RebuildTxHashesLog();
     totalTxSize = 0;
     cachedInnerUsage = 0;
     lastRollingFeeUpdate = GetTime();
@@ -842,6 +897,28 @@ std::vector<TxMempoolInfo> CTxMemPool::infoAll() const
     return ret;
 }
 
+std::vector<TxMempoolInfo> CTxMemPool::infoSorted(const std::vector<uint256>& vHashes) const
+{
+    LOCK(cs);
+    std::vector<indexed_transaction_set::const_iterator> iters;
+    iters.reserve(vHashes.size());
+    for (const uint256& hash : vHashes) {
+        indexed_transaction_set::const_iterator i = mapTx.find(hash);
+        if (i != mapTx.end())
+            iters.push_back(i);
+    }
+    std::sort(iters.begin(), iters.end(), DepthAndScoreComparator());
+    // Duplicates compare equal, so they ended up next to each other
+    iters.erase(std::unique(iters.begin(), iters.end()), iters.end());
+
+    std::vector<TxMempoolInfo> ret;
+    ret.reserve(iters.size());
+    for (auto it : iters) {
+        ret.push_back(TxMempoolInfo{it->GetSharedTx(), it->GetTime(), CFeeRate(it->GetFee(), it->GetTxSize())});
+    }
+    return ret;
+}
+
 std::shared_ptr<const CTransaction> CTxMemPool::get(const uint256& hash) const
 {
     LOCK(cs);
@@ -908,6 +985,7 @@ CTxMemPool::ReadFeeEstimates(CAutoFile& filein)
 
         LOCK(cs);
         minerPolicyEstimator->Read(filein);
+        PublishFeeEstimates(true);
     }
     catch (const std::exception&) {
         LogPrintf("CTxMemPool::ReadFeeEstimates(): unable to read policy estimator data (non-fatal)\n");
@@ -916,6 +994,49 @@ CTxMemPool::ReadFeeEstimates(CAutoFile& filein)
     return true;
 }
 
+bool CTxMemPool::StartFeeEstimatesJournal(const std::string& path)
+{
+    LOCK(cs);
+    minerPolicyEstimator->SetJournal(NULL);
+    CAutoFile fileout(fopen(path.c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+    if (fileout.IsNull() || !WriteFeeEstimates(fileout) || fflush(fileout.Get()) != 0) {
+        LogPrintf("CTxMemPool::StartFeeEstimatesJournal(): unable to write %s\n", path);
+        return false;
+    }
+    feeEstimatesPath = path;
+    minerPolicyEstimator->SetJournal(fileout.release());
+    return true;
+}
+
+bool CTxMemPool::StopFeeEstimatesJournal()
+{
+    LOCK(cs);
+    bool fJournal = minerPolicyEstimator->HasJournal();
+    minerPolicyEstimator->SetJournal(NULL);
+    return fJournal;
+}
+
+void CTxMemPool::PublishFeeEstimates(bool fNewTable)
+{
+    AssertLockHeld(cs);
+    std::shared_ptr<const FeeEstimateTable> table;
+    if (fNewTable)
+        table = std::make_shared<const FeeEstimateTable>(minerPolicyEstimator->GetAnswerTable());
+    CAmount minPoolFee = GetMinFee(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000).GetFeePerK();
+
+    LOCK(cs_feeEstimates);
+    if (table)
+        feeEstimates = table;
+    feeEstimatesMinFee = minPoolFee;
+}
+
+std::shared_ptr<const FeeEstimateTable> CTxMemPool::GetFeeEstimates(CAmount& minPoolFee) const
+{
+    LOCK(cs_feeEstimates);
+    minPoolFee = feeEstimatesMinFee;
+    return feeEstimates;
+}
+
 void CTxMemPool::PrioritiseTransaction(const uint256 hash, const string strHash, double dPriorityDelta, const CAmount& nFeeDelta)
 {
     {
@@ -1090,7 +1211,7 @@ void CTxMemPool::trackPackageRemoved(const CFeeRate& rate) {
     }
 }
 
-void CTxMemPool::TrimToSize(size_t sizelimit, std::vector<uint256>* pvNoSpendsRemaining) {
+void CTxMemPool::TrimToSize(size_t sizelimit, std::vector<uint256>* pvNoSpendsRemaining, std::vector<std::shared_ptr<const CTransaction> >* pvEvicted) {
     LOCK(cs);
 
     unsigned nTxnRemoved = 0;
@@ -1117,6 +1238,10 @@ void CTxMemPool::TrimToSize(size_t sizelimit, std::vector<uint256>* pvNoSpendsRe
             BOOST_FOREACH(txiter it, stage)
                 txn.push_back(it->GetTx());
         }
+        if (pvEvicted) {
+            BOOST_FOREACH(txiter it, stage)
+                pvEvicted->push_back(it->GetSharedTx());
+        }
         RemoveStaged(stage, false);
         if (pvNoSpendsRemaining) {
             BOOST_FOREACH(const CTransaction& tx, txn) {
@@ -1131,8 +1256,10 @@ void CTxMemPool::TrimToSize(size_t sizelimit, std::vector<uint256>* pvNoSpendsRe
         }
     }
 
-    if (maxFeeRateRemoved > CFeeRate(0))
+    if (maxFeeRateRemoved > CFeeRate(0)) {
         LogPrint("mempool", "Removed %u txn, rolling minimum fee bumped to %s\n", nTxnRemoved, maxFeeRateRemoved.ToString());
+        PublishFeeEstimates(false);
+    }
 }
 
 bool CTxMemPool::TransactionWithinChainLimit(const uint256& txid, size_t chainLimit) const {
@@ -90,6 +90,8 @@ private:
     int64_t sigOpCost;         //!< Total sigop cost
     int64_t feeDelta;          //!< Used for determining the priority of the transaction for mining in a block
     LockPoints lockPoints;     //!< Track the height and time at which tx was final
+    bool fScriptsVerified;     //!< Inputs were verified against nScriptVerifyFlags
+    unsigned int nScriptVerifyFlags; //!< Block script flags the inputs were verified against
 
     // Information about descendants of this transaction that are in the
     // mempool; if we remove this transaction we must remove all of these
@@ -130,6 +132,8 @@ public:
     int64_t GetModifiedFee() const { return nFee + feeDelta; }
     size_t DynamicMemoryUsage() const { return nUsageSize; }
     const LockPoints& GetLockPoints() const { return lockPoints; }
+    // Whether the inputs passed script verification with exactly these block flags
+    bool HasScriptsVerified(unsigned int flags) const { return fScriptsVerified && nScriptVerifyFlags == flags; }
 
     // Adjusts the descendant state, if this entry is not dirty.
     void UpdateDescendantState(int64_t modifySize, CAmount modifyFee, int64_t modifyCount);
@@ -140,6 +144,8 @@ public:
     void UpdateFeeDelta(int64_t feeDelta);
     // Update the LockPoints after a reorg
     void UpdateLockPoints(const LockPoints& lp);
+    // Record the block script flags the inputs were verified against
+    void SetScriptsVerified(unsigned int flags) { fScriptsVerified = true; nScriptVerifyFlags = flags; }
 
     uint64_t GetCountWithDescendants() const { return nCountWithDescendants; }
     uint64_t GetSizeWithDescendants() const { return nSizeWithDescendants; }
@@ -224,7 +230,7 @@ struct mempoolentry_txid
 class CompareTxMemPoolEntryByDescendantScore
 {
 public:
-    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b)
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
     {
         bool fUseADescendants = UseDescendantScore(a);
         bool fUseBDescendants = UseDescendantScore(b);
@@ -246,7 +252,7 @@ public:
     }
 
     // Calculate which score to use for an entry (avoiding division).
-    bool UseDescendantScore(const CTxMemPoolEntry &a)
+    bool UseDescendantScore(const CTxMemPoolEntry &a) const
     {
         double f1 = (double)a.GetModifiedFee() * a.GetSizeWithDescendants();
         double f2 = (double)a.GetModFeesWithDescendants() * a.GetTxSize();
@@ -261,7 +267,7 @@ public:
 class CompareTxMemPoolEntryByScore
 {
 public:
-    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b)
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
     {
         double f1 = (double)a.GetModifiedFee() * b.GetTxSize();
         double f2 = (double)b.GetModifiedFee() * a.GetTxSize();
@@ -275,7 +281,7 @@ public:
 class CompareTxMemPoolEntryByEntryTime
 {
 public:
-    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b)
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
     {
         return a.GetTime() < b.GetTime();
     }
@@ -284,7 +290,7 @@ public:
 class CompareTxMemPoolEntryByAncestorFee
 {
 public:
-    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b)
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
     {
         double aFees = a.GetModFeesWithAncestors();
         double aSize = a.GetSizeWithAncestors();
@@ -311,6 +317,7 @@ struct mining_score {};
 struct ancestor_score {};
 
 class CBlockPolicyEstimator;
+struct FeeEstimateTable;
 
 /**
  * Information about a mempool transaction.
@@ -327,6 +334,36 @@ struct TxMempoolInfo
     CFeeRate feeRate;
 };
 
+/** An entry of the mempool's transaction hash log */
+struct TxHashesLogEntry
+{
+    uint256 wtxid;
+    std::shared_ptr<const CTransaction> tx;
+};
+
+/** A fixed-size block of log entries; the log only ever appends to its last chunk */
+struct TxHashesLogChunk
+{
+    static const size_t SIZE = 1024;
+    TxHashesLogEntry entries[SIZE];
+};
+
+/**
+ * A prefix of the mempool's transaction hash log which can be read without
+ * holding any lock: entries below nSize are never written again.
+ */
+struct TxHashesSnapshot
+{
+    uint64_t nEpoch; //!< Changes whenever the log is rebuilt and entries move
+    size_t nSize;
+    std::vector<std::shared_ptr<const TxHashesLogChunk> > vChunks;
+
+    const TxHashesLogEntry& operator[](size_t i) const
+    {
+        return vChunks[i / TxHashesLogChunk::SIZE]->entries[i % TxHashesLogChunk::SIZE];
+    }
+};
+
 /**
  * CTxMemPool stores valid-according-to-the-current-best-chain
  * transactions that may be included in the next block.
@@ -410,6 +447,25 @@ private:
     uint32_t nCheckFrequency; //!< Value n means that n times in 2^32 we check.
     unsigned int nTransactionsUpdated;
     CBlockPolicyEstimator* minerPolicyEstimator;
+    std::string feeEstimatesPath; //!< File the fee estimates are journaled to
+
+    mutable CCriticalSection cs_feeEstimates;
+    std::shared_ptr<const FeeEstimateTable> feeEstimates; //!< Guarded by cs_feeEstimates
+    CAmount feeEstimatesMinFee;                            //!< Guarded by cs_feeEstimates
+
+    /**
+     * Append-only log of the (wtxid, tx) of every transaction added, for
+     * compact block reconstruction to match against without holding cs.
+     * Entries are left behind when their transaction is removed, as matching
+     * one is harmless, until more than half the log is stale and it is
+     * rebuilt from vTxHashes. Written under cs and cs_txHashesLog.
+     */
+    mutable CCriticalSection cs_txHashesLog;
+    std::vector<std::shared_ptr<TxHashesLogChunk> > vTxHashesLog;
+    size_t nTxHashesLogSize;
+    size_t nTxHashesLogStale;
+    uint64_t nTxHashesLogEpoch;
+    mutable std::shared_ptr<const TxHashesSnapshot> txHashesSnapshot; //!< Last snapshot handed out
 
     uint64_t totalTxSize;      //!< sum of all mempool tx' byte sizes
     uint64_t cachedInnerUsage; //!< sum of dynamic memory usage of all the map elements (NOT the maps themselves)
@@ -589,8 +645,9 @@ public:
     /** Remove transactions from the mempool until its dynamic size is <= sizelimit.
       *  pvNoSpendsRemaining, if set, will be populated with the list of transactions
       *  which are not in mempool which no longer have any spends in this mempool.
+      *  pvEvicted, if set, will be populated with the transactions removed.
       */
-    void TrimToSize(size_t sizelimit, std::vector<uint256>* pvNoSpendsRemaining=NULL);
+    void TrimToSize(size_t sizelimit, std::vector<uint256>* pvNoSpendsRemaining=NULL, std::vector<std::shared_ptr<const CTransaction> >* pvEvicted=NULL);
 
     /** Expire all transaction (and their dependencies) in the mempool older than time. Return the number of removed transactions. */
     int Expire(int64_t time);
@@ -619,6 +676,8 @@ public:
     std::shared_ptr<const CTransaction> get(const uint256& hash) const;
     TxMempoolInfo info(const uint256& hash) const;
     std::vector<TxMempoolInfo> infoAll() const;
+    /** Info on those of the given transactions that are in the pool, once each, in the order of infoAll() */
+    std::vector<TxMempoolInfo> infoSorted(const std::vector<uint256>& vHashes) const;
 
     /** Estimate fee rate needed to get into the next nBlocks
      *  If no answer can be given at nBlocks, return an estimate
@@ -642,9 +701,40 @@ public:
     bool WriteFeeEstimates(CAutoFile& fileout) const;
     bool ReadFeeEstimates(CAutoFile& filein);
 
+    /**
+     * Write the fee estimates to path, then append the estimator data of every
+     * following block to it instead of rewriting the whole file. The file is
+     * rewritten after MAX_JOURNAL_BLOCKS blocks to keep it from growing.
+     */
+    bool StartFeeEstimatesJournal(const std::string& path);
+    /** Close the fee estimates journal. Returns false if none was open. */
+    bool StopFeeEstimatesJournal();
+
+    /**
+     * Return the estimates for every target as of the last block, and set
+     * minPoolFee to the mempool min fee (per kB) as of the last block or
+     * mempool trim. Does not lock the mempool.
+     */
+    std::shared_ptr<const FeeEstimateTable> GetFeeEstimates(CAmount& minPoolFee) const;
+
     size_t DynamicMemoryUsage() const;
 
+    /**
+     * Return the current transaction hash log, which includes every
+     * transaction in the mempool and possibly some that have since left it.
+     * Only locks the log, not the mempool.
+     */
+    std::shared_ptr<const TxHashesSnapshot> GetTxHashesSnapshot() const;
+
 private:
+    /** Append a transaction to the hash log */
+    void AppendTxHashesLog(const uint256& wtxid, const std::shared_ptr<const CTransaction>& tx);
+    /** Replace the hash log by one holding only the transactions in vTxHashes */
+    void RebuildTxHashesLog();
+
+    /** Publish the current min fee, and the estimator's new answers if fNewTable, for GetFeeEstimates */
+    void PublishFeeEstimates(bool fNewTable);
+
     /** UpdateForDescendants is used by UpdateTransactionsFromBlock to update
      *  the descendants for a single transaction that has been added to the
      *  mempool but may have child transactions in the mempool, eg during a
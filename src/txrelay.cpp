@@ -0,0 +1,88 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "txrelay.h"
+
+#include "txmempool.h"
+
+CTxRelay::CTxRelay() : nLastBatchTime(0), nNextSequence(1)
+{
+}
+
+void CTxRelay::Queue(const uint256& hash)
+{
+    LOCK(cs);
+    vPending.push_back(hash);
+}
+
+void CTxRelay::Update(const CTxMemPool& pool, int64_t nNow)
+{
+    // One thread forms batches at a time; the others carry on with what is there
+    TRY_LOCK(cs_update, lockUpdate);
+    if (!lockUpdate)
+        return;
+
+    std::vector<uint256> vHashes;
+    uint64_t nSequence;
+    {
+        LOCK(cs);
+        while (!vBatches.empty() && vBatches.front()->nTime < nNow - TX_RELAY_BATCH_EXPIRY)
+            vBatches.pop_front();
+        if (vPending.empty() || nNow < nLastBatchTime + TX_RELAY_BATCH_INTERVAL)
+            return;
+        vHashes.swap(vPending);
+        nSequence = nNextSequence++;
+        nLastBatchTime = nNow;
+    }
+
+    // Look up and sort outside our lock, so queueing never waits for the mempool
+    std::shared_ptr<CTxRelayBatch> batch = std::make_shared<CTxRelayBatch>();
+    batch->nSequence = nSequence;
+    batch->nTime = nNow;
+    std::vector<TxMempoolInfo> vInfo = pool.infoSorted(vHashes);
+    batch->vTx.reserve(vInfo.size());
+    for (size_t i = 0; i < vInfo.size(); i++) {
+        CTxRelayEntry entry;
+        entry.hash = vInfo[i].tx->GetHash();
+        entry.tx = vInfo[i].tx;
+        entry.feeRate = vInfo[i].feeRate;
+        batch->vTx.push_back(entry);
+    }
+
+    LOCK(cs);
+    vBatches.push_back(batch);
+}
+
+CTxRelayCursor CTxRelay::GetEndCursor() const
+{
+    LOCK(cs);
+    CTxRelayCursor cursor;
+    cursor.nSequence = nNextSequence;
+    return cursor;
+}
+
+std::vector<std::shared_ptr<const CTxRelayBatch> > CTxRelay::GetBatches(const CTxRelayCursor& cursor) const
+{
+    LOCK(cs);
+    std::vector<std::shared_ptr<const CTxRelayBatch> > vRet;
+    std::deque<std::shared_ptr<const CTxRelayBatch> >::const_iterator it = vBatches.end();
+    while (it != vBatches.begin() && (*(it - 1))->nSequence >= cursor.nSequence)
+        --it;
+    vRet.assign(it, vBatches.end());
+    return vRet;
+}
+
+size_t CTxRelay::GetPendingCount() const
+{
+    LOCK(cs);
+    return vPending.size();
+}
+
+void CTxRelay::Clear()
+{
+    LOCK(cs);
+    vPending.clear();
+    vBatches.clear();
+    nLastBatchTime = 0;
+}
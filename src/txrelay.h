@@ -0,0 +1,91 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_TXRELAY_H
+#define BITCOIN_TXRELAY_H
+
+#include "amount.h"
+#include "sync.h"
+#include "uint256.h"
+
+#include <deque>
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+class CTransaction;
+class CTxMemPool;
+
+/** Transactions queued for relay are sorted into a new batch at most this often (in microseconds) */
+static const int64_t TX_RELAY_BATCH_INTERVAL = 1000000;
+/** Batches are dropped this long (in microseconds) after being formed, whether or not every peer got through them */
+static const int64_t TX_RELAY_BATCH_EXPIRY = 15 * 60 * 1000000LL;
+
+/** A transaction to be announced, as it was in the mempool when its batch was formed */
+struct CTxRelayEntry
+{
+    uint256 hash;
+    std::shared_ptr<const CTransaction> tx;
+    CFeeRate feeRate;
+};
+
+/** The transactions queued for relay during one interval, sorted by depth and feerate once for all peers */
+struct CTxRelayBatch
+{
+    uint64_t nSequence;
+    int64_t nTime;
+    std::vector<CTxRelayEntry> vTx;
+};
+
+/** How far a peer got through the announcement queue: the next entry is vTx[nPos] of batch nSequence */
+struct CTxRelayCursor
+{
+    uint64_t nSequence;
+    size_t nPos;
+
+    CTxRelayCursor() : nSequence(0), nPos(0) {}
+};
+
+/**
+ * Transaction relay engine. Instead of every peer keeping its own set of
+ * transactions to announce and sorting it against the mempool on each
+ * trickle, transactions are queued once, sorted into shared batches once per
+ * interval, and each peer only keeps a cursor into the batches.
+ */
+class CTxRelay
+{
+private:
+    mutable CCriticalSection cs;
+    CCriticalSection cs_update;
+    std::vector<uint256> vPending;
+    int64_t nLastBatchTime;
+    uint64_t nNextSequence;
+    std::deque<std::shared_ptr<const CTxRelayBatch> > vBatches;
+
+public:
+    CTxRelay();
+
+    /** Queue a transaction for announcement to all peers */
+    void Queue(const uint256& hash);
+
+    /**
+     * Sort the transactions queued since the last batch into a new one if
+     * TX_RELAY_BATCH_INTERVAL has passed, and expire old batches. Transactions
+     * no longer in the pool are left out.
+     */
+    void Update(const CTxMemPool& pool, int64_t nNow);
+
+    /** A cursor past everything announced so far, for a new peer */
+    CTxRelayCursor GetEndCursor() const;
+
+    /** The batches at or after cursor, oldest first */
+    std::vector<std::shared_ptr<const CTxRelayBatch> > GetBatches(const CTxRelayCursor& cursor) const;
+
+    /** Number of transactions queued but not sorted into a batch yet */
+    size_t GetPendingCount() const;
+
+    void Clear();
+};
+
+#endif // BITCOIN_TXRELAY_H
@@ -11,6 +11,8 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <memory>
+#include <unordered_map>
 #include <cassert>
 
 #include <sstream>        // .get_int64()
@@ -43,11 +45,12 @@ public:
     UniValue(const std::string& val_) {
         setStr(val_);
     }
+    UniValue(std::string&& val_) {
+        setStr(std::move(val_));
+    }
     UniValue(const char *val_) {
-        std::string s(val_);
-        setStr(s);
+        setStr(std::string(val_));
     }
-    ~UniValue() {}
 
     void clear();
 
@@ -59,6 +62,7 @@ public:
     bool setInt(int val) { return setInt((int64_t)val); }
     bool setFloat(double val);
     bool setStr(const std::string& val);
+    bool setStr(std::string&& val);
     bool setArray();
     bool setObject();
 
@@ -83,41 +87,35 @@ public:
     bool isArray() const { return (typ == VARR); }
     bool isObject() const { return (typ == VOBJ); }
 
-    bool push_back(const UniValue& val);
+    // Values and keys are taken by value, so passing a temporary or a
+    // std::move()d value moves it into place instead of copying it
+    bool push_back(UniValue val);
     bool push_back(const std::string& val_) {
-        UniValue tmpVal(VSTR, val_);
-        return push_back(tmpVal);
+        return push_back(UniValue(val_));
     }
     bool push_back(const char *val_) {
-        std::string s(val_);
-        return push_back(s);
+        return push_back(UniValue(val_));
     }
     bool push_backV(const std::vector<UniValue>& vec);
 
-    bool pushKV(const std::string& key, const UniValue& val);
-    bool pushKV(const std::string& key, const std::string& val) {
-        UniValue tmpVal(VSTR, val);
-        return pushKV(key, tmpVal);
+    bool pushKV(std::string key, UniValue val);
+    bool pushKV(std::string key, const std::string& val) {
+        return pushKV(std::move(key), UniValue(val));
     }
-    bool pushKV(const std::string& key, const char *val_) {
-        std::string val(val_);
-        return pushKV(key, val);
+    bool pushKV(std::string key, const char *val_) {
+        return pushKV(std::move(key), UniValue(val_));
     }
-    bool pushKV(const std::string& key, int64_t val) {
-        UniValue tmpVal(val);
-        return pushKV(key, tmpVal);
+    bool pushKV(std::string key, int64_t val) {
+        return pushKV(std::move(key), UniValue(val));
     }
-    bool pushKV(const std::string& key, uint64_t val) {
-        UniValue tmpVal(val);
-        return pushKV(key, tmpVal);
+    bool pushKV(std::string key, uint64_t val) {
+        return pushKV(std::move(key), UniValue(val));
     }
-    bool pushKV(const std::string& key, int val) {
-        UniValue tmpVal((int64_t)val);
-        return pushKV(key, tmpVal);
+    bool pushKV(std::string key, int val) {
+        return pushKV(std::move(key), UniValue((int64_t)val));
     }
-    bool pushKV(const std::string& key, double val) {
-        UniValue tmpVal(val);
-        return pushKV(key, tmpVal);
+    bool pushKV(std::string key, double val) {
+        return pushKV(std::move(key), UniValue(val));
     }
     bool pushKVs(const UniValue& obj);
 
@@ -129,23 +127,33 @@ public:
         return read(rawStr.c_str());
     }
 
+    // Objects with at least this many keys get a hash index for lookups
+    static const size_t KEY_INDEX_MIN = 32;
+
 private:
+    typedef std::unordered_map<std::string, size_t> KeyIndex;
+
     UniValue::VType typ;
     std::string val;                       // numbers are stored as C++ strings
     std::vector<std::string> keys;
     std::vector<UniValue> values;
+    // Position of the first occurrence of each key, kept once an object
+    // reaches KEY_INDEX_MIN keys. Copies share it until one of them adds a key.
+    std::shared_ptr<KeyIndex> keyIndex;
 
     int findKey(const std::string& key) const;
+    void indexKey(size_t pos);
+    void write(unsigned int prettyIndent, unsigned int indentLevel, std::string& s) const;
     void writeArray(unsigned int prettyIndent, unsigned int indentLevel, std::string& s) const;
     void writeObject(unsigned int prettyIndent, unsigned int indentLevel, std::string& s) const;
 
 public:
     // Strict type-specific getters, these throw std::runtime_error if the
     // value is of unexpected type
-    std::vector<std::string> getKeys() const;
-    std::vector<UniValue> getValues() const;
+    const std::vector<std::string>& getKeys() const;
+    const std::vector<UniValue>& getValues() const;
     bool get_bool() const;
-    std::string get_str() const;
+    const std::string& get_str() const;
     int get_int() const;
     int64_t get_int64() const;
     double get_real() const;
@@ -154,7 +162,7 @@ public:
 
     enum VType type() const { return getType(); }
     bool push_back(std::pair<std::string,UniValue> pear) {
-        return pushKV(pear.first, pear.second);
+        return pushKV(std::move(pear.first), std::move(pear.second));
     }
     friend const UniValue& find_value( const UniValue& obj, const std::string& name);
 };
@@ -167,60 +175,60 @@ static inline std::pair<std::string,UniValue> Pair(const char *cKey, const char
 {
     std::string key(cKey);
     UniValue uVal(cVal);
-    return std::make_pair(key, uVal);
+    return std::make_pair(std::move(key), std::move(uVal));
 }
 
 static inline std::pair<std::string,UniValue> Pair(const char *cKey, std::string strVal)
 {
     std::string key(cKey);
-    UniValue uVal(strVal);
-    return std::make_pair(key, uVal);
+    UniValue uVal(std::move(strVal));
+    return std::make_pair(std::move(key), std::move(uVal));
 }
 
 static inline std::pair<std::string,UniValue> Pair(const char *cKey, uint64_t u64Val)
 {
     std::string key(cKey);
     UniValue uVal(u64Val);
-    return std::make_pair(key, uVal);
+    return std::make_pair(std::move(key), std::move(uVal));
 }
 
 static inline std::pair<std::string,UniValue> Pair(const char *cKey, int64_t i64Val)
 {
     std::string key(cKey);
     UniValue uVal(i64Val);
-    return std::make_pair(key, uVal);
+    return std::make_pair(std::move(key), std::move(uVal));
 }
 
 static inline std::pair<std::string,UniValue> Pair(const char *cKey, bool iVal)
 {
     std::string key(cKey);
     UniValue uVal(iVal);
-    return std::make_pair(key, uVal);
+    return std::make_pair(std::move(key), std::move(uVal));
 }
 
 static inline std::pair<std::string,UniValue> Pair(const char *cKey, int iVal)
 {
     std::string key(cKey);
     UniValue uVal(iVal);
-    return std::make_pair(key, uVal);
+    return std::make_pair(std::move(key), std::move(uVal));
 }
 
 static inline std::pair<std::string,UniValue> Pair(const char *cKey, double dVal)
 {
     std::string key(cKey);
     UniValue uVal(dVal);
-    return std::make_pair(key, uVal);
+    return std::make_pair(std::move(key), std::move(uVal));
 }
 
-static inline std::pair<std::string,UniValue> Pair(const char *cKey, const UniValue& uVal)
+static inline std::pair<std::string,UniValue> Pair(const char *cKey, UniValue uVal)
 {
     std::string key(cKey);
-    return std::make_pair(key, uVal);
+    return std::make_pair(std::move(key), std::move(uVal));
 }
 
-static inline std::pair<std::string,UniValue> Pair(std::string key, const UniValue& uVal)
+static inline std::pair<std::string,UniValue> Pair(std::string key, UniValue uVal)
 {
-    return std::make_pair(key, uVal);
+    return std::make_pair(std::move(key), std::move(uVal));
 }
 
 enum jtokentype {
@@ -243,6 +251,32 @@ extern enum jtokentype getJsonToken(std::string& tokenVal,
                                     unsigned int& consumed, const char *raw);
 extern const char *uvTypeName(UniValue::VType t);
 
+/**
+ * Receives the parts of a JSON text from parseJson() as they are read,
+ * without building a tree of UniValues. Numbers and strings are passed by
+ * non-const reference so they can be moved from. Returning false from any
+ * callback stops the parse.
+ */
+class UniValueHandler {
+public:
+    virtual ~UniValueHandler() {}
+
+    virtual bool onNull() = 0;
+    virtual bool onBool(bool val) = 0;
+    virtual bool onNumber(std::string& numStr) = 0;
+    virtual bool onString(std::string& str) = 0;
+    virtual bool onKey(std::string& key) = 0;
+    virtual bool onBeginObject() = 0;
+    virtual bool onEndObject() = 0;
+    virtual bool onBeginArray() = 0;
+    virtual bool onEndArray() = 0;
+};
+
+// Parse the object or array in raw, followed by nothing but whitespace, as
+// UniValue::read() does. Returns false if raw is not valid JSON or if the
+// handler stopped the parse.
+extern bool parseJson(const char *raw, UniValueHandler& handler);
+
 static inline bool jsonTokenIsValue(enum jtokentype jtt)
 {
     switch (jtt) {
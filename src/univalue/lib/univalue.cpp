@@ -5,6 +5,7 @@
 
 #include <stdint.h>
 #include <errno.h>
+#include <inttypes.h>
 #include <iomanip>
 #include <limits>
 #include <sstream>
@@ -76,6 +77,7 @@ bool ParseDouble(const std::string& str, double *out)
 using namespace std;
 
 const UniValue NullUniValue;
+const size_t UniValue::KEY_INDEX_MIN;
 
 void UniValue::clear()
 {
@@ -83,6 +85,7 @@ void UniValue::clear()
     val.clear();
     keys.clear();
     values.clear();
+    keyIndex.reset();
 }
 
 bool UniValue::setNull()
@@ -121,22 +124,25 @@ bool UniValue::setNumStr(const string& val_)
 
 bool UniValue::setInt(uint64_t val)
 {
-    string s;
-    ostringstream oss;
+    // Always a valid number, so skip setNumStr's check
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%" PRIu64, val);
 
-    oss << val;
-
-    return setNumStr(oss.str());
+    clear();
+    typ = VNUM;
+    this->val = buf;
+    return true;
 }
 
 bool UniValue::setInt(int64_t val)
 {
-    string s;
-    ostringstream oss;
-
-    oss << val;
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%" PRId64, val);
 
-    return setNumStr(oss.str());
+    clear();
+    typ = VNUM;
+    this->val = buf;
+    return true;
 }
 
 bool UniValue::setFloat(double val)
@@ -159,6 +165,14 @@ bool UniValue::setStr(const string& val_)
     return true;
 }
 
+bool UniValue::setStr(string&& val_)
+{
+    clear();
+    typ = VSTR;
+    val = std::move(val_);
+    return true;
+}
+
 bool UniValue::setArray()
 {
     clear();
@@ -173,12 +187,12 @@ bool UniValue::setObject()
     return true;
 }
 
-bool UniValue::push_back(const UniValue& val)
+bool UniValue::push_back(UniValue val)
 {
     if (typ != VARR)
         return false;
 
-    values.push_back(val);
+    values.push_back(std::move(val));
     return true;
 }
 
@@ -192,13 +206,14 @@ bool UniValue::push_backV(const std::vector<UniValue>& vec)
     return true;
 }
 
-bool UniValue::pushKV(const std::string& key, const UniValue& val)
+bool UniValue::pushKV(std::string key, UniValue val)
 {
     if (typ != VOBJ)
         return false;
 
-    keys.push_back(key);
-    values.push_back(val);
+    keys.push_back(std::move(key));
+    values.push_back(std::move(val));
+    indexKey(keys.size() - 1);
     return true;
 }
 
@@ -210,13 +225,38 @@ bool UniValue::pushKVs(const UniValue& obj)
     for (unsigned int i = 0; i < obj.keys.size(); i++) {
         keys.push_back(obj.keys[i]);
         values.push_back(obj.values.at(i));
+        indexKey(keys.size() - 1);
     }
 
     return true;
 }
 
+void UniValue::indexKey(size_t pos)
+{
+    if (!keyIndex) {
+        if (keys.size() < KEY_INDEX_MIN)
+            return;
+        keyIndex = std::make_shared<KeyIndex>();
+        keyIndex->reserve(keys.size() * 2);
+        for (size_t i = 0; i < keys.size(); i++)
+            keyIndex->emplace(keys[i], i);
+        return;
+    }
+
+    // Shared with a copy of this object, which must not see the new key
+    if (keyIndex.use_count() > 1)
+        keyIndex = std::make_shared<KeyIndex>(*keyIndex);
+    // emplace keeps an existing entry, so the first of duplicate keys wins
+    keyIndex->emplace(keys[pos], pos);
+}
+
 int UniValue::findKey(const std::string& key) const
 {
+    if (keyIndex) {
+        KeyIndex::const_iterator it = keyIndex->find(key);
+        return it == keyIndex->end() ? -1 : (int) it->second;
+    }
+
     for (unsigned int i = 0; i < keys.size(); i++) {
         if (keys[i] == key)
             return (int) i;
@@ -279,21 +319,21 @@ const char *uvTypeName(UniValue::VType t)
 
 const UniValue& find_value(const UniValue& obj, const std::string& name)
 {
-    for (unsigned int i = 0; i < obj.keys.size(); i++)
-        if (obj.keys[i] == name)
-            return obj.values.at(i);
+    int index = obj.findKey(name);
+    if (index < 0)
+        return NullUniValue;
 
-    return NullUniValue;
+    return obj.values.at(index);
 }
 
-std::vector<std::string> UniValue::getKeys() const
+const std::vector<std::string>& UniValue::getKeys() const
 {
     if (typ != VOBJ)
         throw std::runtime_error("JSON value is not an object as expected");
     return keys;
 }
 
-std::vector<UniValue> UniValue::getValues() const
+const std::vector<UniValue>& UniValue::getValues() const
 {
     if (typ != VOBJ && typ != VARR)
         throw std::runtime_error("JSON value is not an object or array as expected");
@@ -307,7 +347,7 @@ bool UniValue::get_bool() const
     return getBool();
 }
 
-std::string UniValue::get_str() const
+const std::string& UniValue::get_str() const
 {
     if (typ != VSTR)
         throw std::runtime_error("JSON value is not a string as expected");
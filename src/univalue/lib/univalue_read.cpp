@@ -114,7 +114,7 @@ enum jtokentype getJsonToken(string& tokenVal, unsigned int& consumed,
     case '8':
     case '9': {
         // part 1: int
-        string numStr;
+        string& numStr = tokenVal;
 
         const char *first = raw;
 
@@ -166,7 +166,6 @@ enum jtokentype getJsonToken(string& tokenVal, unsigned int& consumed,
             }
         }
 
-        tokenVal = numStr;
         consumed = (raw - rawStart);
         return JTOK_NUMBER;
         }
@@ -174,10 +173,30 @@ enum jtokentype getJsonToken(string& tokenVal, unsigned int& consumed,
     case '"': {
         raw++;                                // skip "
 
-        string valStr;
-        JSONUTF8StringFilter writer(valStr);
+        // An escape only ever shortens its text, so the distance to the
+        // closing quote is enough room for the whole string
+        const char *end = raw;
+        while (*end && *end != '"') {
+            if (*end == '\\' && end[1])
+                end++;
+            end++;
+        }
+        tokenVal.reserve(end - raw);
+
+        JSONUTF8StringFilter writer(tokenVal);
 
         while (*raw) {
+            // Copy runs of printable 7-bit ASCII in one go
+            const char *run = raw;
+            while ((unsigned char)*run >= 0x20 && (unsigned char)*run < 0x80 &&
+                   *run != '"' && *run != '\\')
+                run++;
+            if (run != raw) {
+                writer.append_ascii(raw, run - raw);
+                raw = run;
+                continue;
+            }
+
             if ((unsigned char)*raw < 0x20)
                 return JTOK_ERR;
 
@@ -224,7 +243,6 @@ enum jtokentype getJsonToken(string& tokenVal, unsigned int& consumed,
 
         if (!writer.finalize())
             return JTOK_ERR;
-        tokenVal = valStr;
         consumed = (raw - rawStart);
         return JTOK_STRING;
         }
@@ -246,12 +264,10 @@ enum expect_bits {
 #define setExpect(bit) (expectMask |= EXP_##bit)
 #define clearExpect(bit) (expectMask &= ~EXP_##bit)
 
-bool UniValue::read(const char *raw)
+bool parseJson(const char *raw, UniValueHandler& handler)
 {
-    clear();
-
     uint32_t expectMask = 0;
-    vector<UniValue*> stack;
+    vector<UniValue::VType> stack;
 
     string tokenVal;
     unsigned int consumed;
@@ -304,23 +320,12 @@ bool UniValue::read(const char *raw)
 
         case JTOK_OBJ_OPEN:
         case JTOK_ARR_OPEN: {
-            VType utyp = (tok == JTOK_OBJ_OPEN ? VOBJ : VARR);
-            if (!stack.size()) {
-                if (utyp == VOBJ)
-                    setObject();
-                else
-                    setArray();
-                stack.push_back(this);
-            } else {
-                UniValue tmpVal(utyp);
-                UniValue *top = stack.back();
-                top->values.push_back(tmpVal);
-
-                UniValue *newTop = &(top->values.back());
-                stack.push_back(newTop);
-            }
+            UniValue::VType utyp = (tok == JTOK_OBJ_OPEN ? UniValue::VOBJ : UniValue::VARR);
+            if (!(utyp == UniValue::VOBJ ? handler.onBeginObject() : handler.onBeginArray()))
+                return false;
+            stack.push_back(utyp);
 
-            if (utyp == VOBJ)
+            if (utyp == UniValue::VOBJ)
                 setExpect(OBJ_NAME);
             else
                 setExpect(ARR_VALUE);
@@ -332,12 +337,13 @@ bool UniValue::read(const char *raw)
             if (!stack.size() || (last_tok == JTOK_COMMA))
                 return false;
 
-            VType utyp = (tok == JTOK_OBJ_CLOSE ? VOBJ : VARR);
-            UniValue *top = stack.back();
-            if (utyp != top->getType())
+            UniValue::VType utyp = (tok == JTOK_OBJ_CLOSE ? UniValue::VOBJ : UniValue::VARR);
+            if (utyp != stack.back())
                 return false;
 
             stack.pop_back();
+            if (!(utyp == UniValue::VOBJ ? handler.onEndObject() : handler.onEndArray()))
+                return false;
             clearExpect(OBJ_NAME);
             setExpect(NOT_VALUE);
             break;
@@ -347,8 +353,7 @@ bool UniValue::read(const char *raw)
             if (!stack.size())
                 return false;
 
-            UniValue *top = stack.back();
-            if (top->getType() != VOBJ)
+            if (stack.back() != UniValue::VOBJ)
                 return false;
 
             setExpect(VALUE);
@@ -360,8 +365,7 @@ bool UniValue::read(const char *raw)
                 (last_tok == JTOK_COMMA) || (last_tok == JTOK_ARR_OPEN))
                 return false;
 
-            UniValue *top = stack.back();
-            if (top->getType() == VOBJ)
+            if (stack.back() == UniValue::VOBJ)
                 setExpect(OBJ_NAME);
             else
                 setExpect(ARR_VALUE);
@@ -374,22 +378,9 @@ bool UniValue::read(const char *raw)
             if (!stack.size())
                 return false;
 
-            UniValue tmpVal;
-            switch (tok) {
-            case JTOK_KW_NULL:
-                // do nothing more
-                break;
-            case JTOK_KW_TRUE:
-                tmpVal.setBool(true);
-                break;
-            case JTOK_KW_FALSE:
-                tmpVal.setBool(false);
-                break;
-            default: /* impossible */ break;
-            }
-
-            UniValue *top = stack.back();
-            top->values.push_back(tmpVal);
+            bool ok = (tok == JTOK_KW_NULL ? handler.onNull() : handler.onBool(tok == JTOK_KW_TRUE));
+            if (!ok)
+                return false;
 
             setExpect(NOT_VALUE);
             break;
@@ -399,9 +390,8 @@ bool UniValue::read(const char *raw)
             if (!stack.size())
                 return false;
 
-            UniValue tmpVal(VNUM, tokenVal);
-            UniValue *top = stack.back();
-            top->values.push_back(tmpVal);
+            if (!handler.onNumber(tokenVal))
+                return false;
 
             setExpect(NOT_VALUE);
             break;
@@ -411,15 +401,14 @@ bool UniValue::read(const char *raw)
             if (!stack.size())
                 return false;
 
-            UniValue *top = stack.back();
-
             if (expect(OBJ_NAME)) {
-                top->keys.push_back(tokenVal);
+                if (!handler.onKey(tokenVal))
+                    return false;
                 clearExpect(OBJ_NAME);
                 setExpect(COLON);
             } else {
-                UniValue tmpVal(VSTR, tokenVal);
-                top->values.push_back(tmpVal);
+                if (!handler.onString(tokenVal))
+                    return false;
             }
 
             setExpect(NOT_VALUE);
@@ -439,3 +428,61 @@ bool UniValue::read(const char *raw)
     return true;
 }
 
+bool UniValue::read(const char *raw)
+{
+    // Builds the tree in place: each value is moved into its parent, and
+    // open containers are tracked by pointer. A parent's values vector only
+    // grows once the child it points to is closed.
+    class TreeBuilder : public UniValueHandler {
+    public:
+        UniValue& root;
+        vector<UniValue*> stack;
+        string key;
+
+        TreeBuilder(UniValue& rootIn) : root(rootIn) {}
+
+        UniValue *add(UniValue&& val) {
+            UniValue *top = stack.back();
+            if (top->typ == VOBJ) {
+                top->keys.push_back(std::move(key));
+                top->values.push_back(std::move(val));
+                top->indexKey(top->keys.size() - 1);
+            } else {
+                top->values.push_back(std::move(val));
+            }
+            return &top->values.back();
+        }
+        bool begin(VType utyp) {
+            if (stack.empty()) {
+                if (utyp == VOBJ)
+                    root.setObject();
+                else
+                    root.setArray();
+                stack.push_back(&root);
+            } else {
+                stack.push_back(add(UniValue(utyp)));
+            }
+            return true;
+        }
+
+        bool onNull() { add(UniValue()); return true; }
+        bool onBool(bool val) { add(UniValue(val)); return true; }
+        bool onNumber(string& numStr) {
+            UniValue tmpVal(VNUM);
+            tmpVal.val = std::move(numStr);
+            add(std::move(tmpVal));
+            return true;
+        }
+        bool onString(string& str) { add(UniValue(std::move(str))); return true; }
+        bool onKey(string& keyIn) { key = std::move(keyIn); return true; }
+        bool onBeginObject() { return begin(VOBJ); }
+        bool onEndObject() { stack.pop_back(); return true; }
+        bool onBeginArray() { return begin(VARR); }
+        bool onEndArray() { stack.pop_back(); return true; }
+    };
+
+    clear();
+
+    TreeBuilder builder(*this);
+    return parseJson(raw, builder);
+}
@@ -45,7 +45,14 @@ public:
                 push_back_u(codepoint);
         }
     }
-    // Write codepoint directly, possibly collating surrogate pairs
+    // Write a run of 7-bit ASCII chars, as push_back() would one by one
+    void append_ascii(const char *s, size_t n)
+    {
+        if (state) // Not a continuation, invalid
+            is_valid = false;
+        str.append(s, n);
+    }
+        // Write codepoint directly, possibly collating surrogate pairs
     void push_back_u(unsigned int codepoint)
     {
         if (state) // Only accept full codepoints in open state
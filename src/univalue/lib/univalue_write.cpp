@@ -10,11 +10,10 @@
 
 using namespace std;
 
-static string json_escape(const string& inS)
+// Append inS to outS as a quoted JSON string
+static void json_escape(const string& inS, string& outS)
 {
-    string outS;
-    outS.reserve(inS.size() * 2);
-
+    outS += '"';
     for (unsigned int i = 0; i < inS.size(); i++) {
         unsigned char ch = inS[i];
         const char *escStr = escapes[ch];
@@ -24,8 +23,7 @@ static string json_escape(const string& inS)
         else
             outS += ch;
     }
-
-    return outS;
+    outS += '"';
 }
 
 string UniValue::write(unsigned int prettyIndent,
@@ -33,7 +31,15 @@ string UniValue::write(unsigned int prettyIndent,
 {
     string s;
     s.reserve(1024);
+    write(prettyIndent, indentLevel, s);
+    return s;
+}
 
+// Nested values are appended to the caller's string rather than written to
+// strings of their own, so a document is built in a single buffer
+void UniValue::write(unsigned int prettyIndent,
+                     unsigned int indentLevel, string& s) const
+{
     unsigned int modIndent = indentLevel;
     if (modIndent == 0)
         modIndent = 1;
@@ -49,7 +55,7 @@ string UniValue::write(unsigned int prettyIndent,
         writeArray(prettyIndent, modIndent, s);
         break;
     case VSTR:
-        s += "\"" + json_escape(val) + "\"";
+        json_escape(val, s);
         break;
     case VNUM:
         s += val;
@@ -58,8 +64,6 @@ string UniValue::write(unsigned int prettyIndent,
         s += (val == "1" ? "true" : "false");
         break;
     }
-
-    return s;
 }
 
 static void indentStr(unsigned int prettyIndent, unsigned int indentLevel, string& s)
@@ -76,7 +80,7 @@ void UniValue::writeArray(unsigned int prettyIndent, unsigned int indentLevel, s
     for (unsigned int i = 0; i < values.size(); i++) {
         if (prettyIndent)
             indentStr(prettyIndent, indentLevel, s);
-        s += values[i].write(prettyIndent, indentLevel + 1);
+        values[i].write(prettyIndent, indentLevel + 1, s);
         if (i != (values.size() - 1)) {
             s += ",";
             if (prettyIndent)
@@ -100,10 +104,11 @@ void UniValue::writeObject(unsigned int prettyIndent, unsigned int indentLevel,
     for (unsigned int i = 0; i < keys.size(); i++) {
         if (prettyIndent)
             indentStr(prettyIndent, indentLevel, s);
-        s += "\"" + json_escape(keys[i]) + "\":";
+        json_escape(keys[i], s);
+        s += ":";
         if (prettyIndent)
             s += " ";
-        s += values.at(i).write(prettyIndent, indentLevel + 1);
+        values.at(i).write(prettyIndent, indentLevel + 1, s);
         if (i != (values.size() - 1))
             s += ",";
         if (prettyIndent)
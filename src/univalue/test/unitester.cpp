@@ -150,6 +150,124 @@ void unescape_unicode_test()
     f_assert(val[0].get_str() == "\xf0\x9d\x85\xa1");
 }
 
+// Test plain ASCII runs mixed with UTF-8 and escapes
+void mixed_string_test()
+{
+    UniValue val;
+    f_assert(val.read("[\"ab\xc6\x91" "cd\\n\\u0191ef\"]"));
+    f_assert(val[0].get_str() == "ab\xc6\x91" "cd\n\xc6\x91" "ef");
+    // Truncated UTF-8 sequence followed by ASCII
+    f_assert(!val.read("[\"ab\xc6" "cd\"]"));
+    // Unpaired surrogate followed by ASCII
+    f_assert(!val.read("[\"\\ud834abc\"]"));
+}
+
+// Test lookups in objects large enough to be indexed
+void key_index_test()
+{
+    const size_t nKeys = UniValue::KEY_INDEX_MIN * 4;
+    UniValue obj(UniValue::VOBJ);
+    for (size_t i = 0; i < nKeys; i++) {
+        char key[16];
+        snprintf(key, sizeof(key), "k%u", (unsigned int)i);
+        obj.pushKV(key, (int64_t)i);
+    }
+    // The first of duplicate keys is the one found
+    obj.pushKV("k7", 1000);
+    f_assert(obj.size() == nKeys + 1);
+    f_assert(find_value(obj, "k0").get_int() == 0);
+    f_assert(find_value(obj, "k7").get_int() == 7);
+    f_assert(obj["k100"].get_int() == 100);
+    f_assert(obj.exists("k127"));
+    f_assert(!obj.exists("k128"));
+    f_assert(find_value(obj, "missing").isNull());
+
+    // A copy does not see keys added to the original, and vice versa
+    UniValue copy(obj);
+    obj.pushKV("new", "original");
+    copy.pushKV("new", "copy");
+    copy.pushKV("other", UniValue(true));
+    f_assert(obj["new"].get_str() == "original");
+    f_assert(copy["new"].get_str() == "copy");
+    f_assert(!obj.exists("other"));
+    f_assert(copy.exists("other"));
+
+    // Parsed objects are indexed too
+    UniValue parsed;
+    f_assert(parsed.read(copy.write()));
+    f_assert(parsed["k100"].get_int() == 100);
+    f_assert(parsed["k7"].get_int() == 7);
+    f_assert(parsed["other"].isTrue());
+
+    obj.clear();
+    f_assert(!obj.exists("k0"));
+    obj.setObject();
+    obj.pushKV("k0", 5);
+    f_assert(obj["k0"].get_int() == 5);
+}
+
+// Test that moving values leaves the sources empty
+void move_test()
+{
+    std::string str(1000, 'x');
+    UniValue val(std::move(str));
+    f_assert(val.get_str().size() == 1000);
+
+    UniValue arr(UniValue::VARR);
+    arr.push_back(std::move(val));
+    f_assert(val.getValStr().empty());
+    f_assert(arr[0].get_str().size() == 1000);
+
+    UniValue obj(UniValue::VOBJ);
+    obj.pushKV("arr", std::move(arr));
+    f_assert(arr.empty());
+    obj.push_back(Pair("str", UniValue("s")));
+    f_assert(obj["arr"][0].get_str().size() == 1000);
+    f_assert(obj["str"].get_str() == "s");
+}
+
+// Records the events of a parse
+class EventLog : public UniValueHandler {
+public:
+    string log;
+    size_t stopAfter;
+
+    EventLog() : stopAfter(-1) {}
+
+    bool add(const string& ev) { log += ev + " "; return --stopAfter != 0; }
+    bool onNull() { return add("null"); }
+    bool onBool(bool val) { return add(val ? "true" : "false"); }
+    bool onNumber(string& numStr) { return add("num:" + numStr); }
+    bool onString(string& str) { return add("str:" + str); }
+    bool onKey(string& key) { return add("key:" + key); }
+    bool onBeginObject() { return add("{"); }
+    bool onEndObject() { return add("}"); }
+    bool onBeginArray() { return add("["); }
+    bool onEndArray() { return add("]"); }
+};
+
+// Test the events passed to a parse handler
+void parse_handler_test()
+{
+    const char *json = "{\"a\": [1, -2.5e3, \"x\", true, false, null], \"b\": {}}";
+    EventLog all;
+    f_assert(parseJson(json, all));
+    f_assert(all.log == "{ key:a [ num:1 num:-2.5e3 str:x true false null ] key:b { } } ");
+
+    // A handler can stop the parse
+    EventLog stopped;
+    stopped.stopAfter = 3;
+    f_assert(!parseJson(json, stopped));
+    f_assert(stopped.log == "{ key:a [ ");
+
+    // Invalid JSON fails after the events before the error
+    EventLog invalid;
+    f_assert(!parseJson("[1, 2,]", invalid));
+    f_assert(invalid.log == "[ num:1 num:2 ");
+    EventLog trailing;
+    f_assert(!parseJson("[] x", trailing));
+}
+
 int main (int argc, char *argv[])
 {
     for (unsigned int fidx = 0; fidx < ARRAY_SIZE(filenames); fidx++) {
@@ -157,6 +275,10 @@ int main (int argc, char *argv[])
     }
 
     unescape_unicode_test();
+    mixed_string_test();
+    key_index_test();
+    move_test();
+    parse_handler_test();
 
     return test_failed ? 1 : 0;
 }
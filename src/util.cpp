@@ -24,7 +24,7 @@
 #endif
 
 #ifndef WIN32
-// for posix_fallocate
+// for posix_fallocate and posix_fadvise
 #ifdef __linux__
 
 #ifdef _POSIX_C_SOURCE
@@ -695,6 +695,21 @@ void AllocateFileRange(FILE *file, unsigned int offset, unsigned int length) {
 #endif
 }
 
+/**
+ * this function asks the OS to start reading a range of a file that will be read soon
+ * it is advisory, and returns before the data is read
+ */
+void FileReadAhead(FILE *file, unsigned int offset, unsigned int length) {
+#if defined(MAC_OSX)
+    struct radvisory ra;
+    ra.ra_offset = offset;
+    ra.ra_count = length;
+    fcntl(fileno(file), F_RDADVISE, &ra);
+#elif defined(__linux__)
+    posix_fadvise(fileno(file), offset, length, POSIX_FADV_WILLNEED);
+#endif
+}
+
 void ShrinkDebugFile()
 {
     // Scroll debug.log if it's getting too big